@@ -41,6 +41,7 @@ extern "C" {
 #define FUSE_CAP_EXPORT_SUPPORT         (1 << 4)
 #define FUSE_CAP_BIG_WRITES             (1 << 5)
 #define FUSE_CAP_DONT_MASK              (1 << 6)
+#define FSP_FUSE_CAP_READDIR_PLUS       (1 << 21)   /* readdir filler receives complete stbuf */
 
 #define FUSE_IOCTL_COMPAT               (1 << 0)
 #define FUSE_IOCTL_UNRESTRICTED         (1 << 1)
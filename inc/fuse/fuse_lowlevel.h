@@ -0,0 +1,279 @@
+/**
+ * @file fuse/fuse_lowlevel.h
+ * WinFsp FUSE compatible API.
+ *
+ * This file is derived from libfuse/include/fuse_lowlevel.h:
+ *     FUSE: Filesystem in Userspace
+ *     Copyright (C) 2001-2007  Miklos Szeredi <miklos@szeredi.hu>
+ *
+ * @copyright 2015-2016 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the
+ * GNU Affero General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#ifndef FUSE_LOWLEVEL_H_
+#define FUSE_LOWLEVEL_H_
+
+#include "fuse_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FUSE_ROOT_ID                    1
+
+#define FUSE_SET_ATTR_MODE              (1 << 0)
+#define FUSE_SET_ATTR_UID               (1 << 1)
+#define FUSE_SET_ATTR_GID               (1 << 2)
+#define FUSE_SET_ATTR_SIZE              (1 << 3)
+#define FUSE_SET_ATTR_ATIME             (1 << 4)
+#define FUSE_SET_ATTR_MTIME             (1 << 5)
+
+typedef struct fuse_req *fuse_req_t;
+
+struct fuse_entry_param
+{
+    fuse_ino_t ino;                     /* 0: negative entry */
+    uint64_t generation;
+    struct fuse_stat attr;
+    double attr_timeout;
+    double entry_timeout;
+};
+
+struct fuse_ctx
+{
+    fuse_uid_t uid;
+    fuse_gid_t gid;
+    fuse_pid_t pid;
+    fuse_mode_t umask;
+};
+
+/*
+ * Operations are called on the WinFsp dispatcher threads. An operation must reply
+ * exactly once; the reply may come from another thread after the operation returns.
+ *
+ * The structure has the field order of libfuse's fuse_lowlevel_ops. Operations that
+ * are not supported (namespace changes, extended attributes, locking, etc.) occupy
+ * reserved slots: volumes served through the low-level API do not support creating,
+ * deleting or renaming files.
+ */
+struct fuse_lowlevel_ops
+{
+    void (*init)(void *userdata, struct fuse_conn_info *conn);
+    void (*destroy)(void *userdata);
+    void (*lookup)(fuse_req_t req, fuse_ino_t parent, const char *name);
+    void (*forget)(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup);
+    void (*getattr)(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+    void (*setattr)(fuse_req_t req, fuse_ino_t ino, struct fuse_stat *attr, int to_set,
+        struct fuse_file_info *fi);
+    void (*readlink)(fuse_req_t req, fuse_ino_t ino);
+    void (*reserved0[7])();             /* mknod, mkdir, unlink, rmdir, symlink, rename, link */
+    void (*open)(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+    void (*read)(fuse_req_t req, fuse_ino_t ino, size_t size, fuse_off_t off,
+        struct fuse_file_info *fi);
+    void (*write)(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, fuse_off_t off,
+        struct fuse_file_info *fi);
+    void (*flush)(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+    void (*release)(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+    void (*fsync)(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi);
+    void (*opendir)(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+    void (*readdir)(fuse_req_t req, fuse_ino_t ino, size_t size, fuse_off_t off,
+        struct fuse_file_info *fi);
+    void (*releasedir)(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+    void (*fsyncdir)(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi);
+    void (*statfs)(fuse_req_t req, fuse_ino_t ino);
+    void (*reserved1[16])();            /* setxattr ... fallocate */
+    void (*readdirplus)(fuse_req_t req, fuse_ino_t ino, size_t size, fuse_off_t off,
+        struct fuse_file_info *fi);
+};
+
+/*
+ * Timeouts are passed to the DLL by reference: the DLL does not use floating point.
+ */
+FSP_FUSE_API struct fuse_session *FSP_FUSE_API_NAME(fsp_fuse_lowlevel_new)(struct fsp_fuse_env *env,
+    struct fuse_args *args,
+    const struct fuse_lowlevel_ops *op, size_t op_size, void *userdata);
+FSP_FUSE_API void FSP_FUSE_API_NAME(fsp_fuse_session_add_chan)(struct fsp_fuse_env *env,
+    struct fuse_session *se, struct fuse_chan *ch);
+FSP_FUSE_API void FSP_FUSE_API_NAME(fsp_fuse_session_destroy)(struct fsp_fuse_env *env,
+    struct fuse_session *se);
+FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_session_loop)(struct fsp_fuse_env *env,
+    struct fuse_session *se);
+FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_session_loop_mt)(struct fsp_fuse_env *env,
+    struct fuse_session *se);
+FSP_FUSE_API void FSP_FUSE_API_NAME(fsp_fuse_session_exit)(struct fsp_fuse_env *env,
+    struct fuse_session *se);
+FSP_FUSE_API void *FSP_FUSE_API_NAME(fsp_fuse_req_userdata)(struct fsp_fuse_env *env,
+    fuse_req_t req);
+FSP_FUSE_API const struct fuse_ctx *FSP_FUSE_API_NAME(fsp_fuse_req_ctx)(struct fsp_fuse_env *env,
+    fuse_req_t req);
+FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_reply_err)(struct fsp_fuse_env *env,
+    fuse_req_t req, int err);
+FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_reply_entry)(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_entry_param *e);
+FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_reply_attr)(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_stat *attr, const double *attr_timeout);
+FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_reply_open)(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_file_info *fi);
+FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_reply_write)(struct fsp_fuse_env *env,
+    fuse_req_t req, size_t count);
+FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_reply_buf)(struct fsp_fuse_env *env,
+    fuse_req_t req, const char *buf, size_t size);
+FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_reply_statfs)(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_statvfs *stbuf);
+FSP_FUSE_API size_t FSP_FUSE_API_NAME(fsp_fuse_add_direntry)(struct fsp_fuse_env *env,
+    fuse_req_t req, char *buf, size_t bufsize,
+    const char *name, const struct fuse_stat *stbuf, fuse_off_t off);
+FSP_FUSE_API size_t FSP_FUSE_API_NAME(fsp_fuse_add_direntry_plus)(struct fsp_fuse_env *env,
+    fuse_req_t req, char *buf, size_t bufsize,
+    const char *name, const struct fuse_entry_param *e, fuse_off_t off);
+
+FSP_FUSE_SYM(
+struct fuse_session *fuse_lowlevel_new(struct fuse_args *args,
+    const struct fuse_lowlevel_ops *op, size_t op_size, void *userdata),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_lowlevel_new)
+        (fsp_fuse_env(), args, op, op_size, userdata);
+})
+
+FSP_FUSE_SYM(
+void fuse_session_add_chan(struct fuse_session *se, struct fuse_chan *ch),
+{
+    FSP_FUSE_API_CALL(fsp_fuse_session_add_chan)
+        (fsp_fuse_env(), se, ch);
+})
+
+FSP_FUSE_SYM(
+void fuse_session_remove_chan(struct fuse_chan *ch),
+{
+    (void)ch;
+})
+
+FSP_FUSE_SYM(
+void fuse_session_destroy(struct fuse_session *se),
+{
+    FSP_FUSE_API_CALL(fsp_fuse_session_destroy)
+        (fsp_fuse_env(), se);
+})
+
+FSP_FUSE_SYM(
+int fuse_session_loop(struct fuse_session *se),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_session_loop)
+        (fsp_fuse_env(), se);
+})
+
+FSP_FUSE_SYM(
+int fuse_session_loop_mt(struct fuse_session *se),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_session_loop_mt)
+        (fsp_fuse_env(), se);
+})
+
+FSP_FUSE_SYM(
+void fuse_session_exit(struct fuse_session *se),
+{
+    FSP_FUSE_API_CALL(fsp_fuse_session_exit)
+        (fsp_fuse_env(), se);
+})
+
+FSP_FUSE_SYM(
+void *fuse_req_userdata(fuse_req_t req),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_req_userdata)
+        (fsp_fuse_env(), req);
+})
+
+FSP_FUSE_SYM(
+const struct fuse_ctx *fuse_req_ctx(fuse_req_t req),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_req_ctx)
+        (fsp_fuse_env(), req);
+})
+
+FSP_FUSE_SYM(
+int fuse_reply_err(fuse_req_t req, int err),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_reply_err)
+        (fsp_fuse_env(), req, err);
+})
+
+FSP_FUSE_SYM(
+void fuse_reply_none(fuse_req_t req),
+{
+    FSP_FUSE_API_CALL(fsp_fuse_reply_err)
+        (fsp_fuse_env(), req, 0);
+})
+
+FSP_FUSE_SYM(
+int fuse_reply_entry(fuse_req_t req, const struct fuse_entry_param *e),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_reply_entry)
+        (fsp_fuse_env(), req, e);
+})
+
+FSP_FUSE_SYM(
+int fuse_reply_attr(fuse_req_t req, const struct fuse_stat *attr, double attr_timeout),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_reply_attr)
+        (fsp_fuse_env(), req, attr, &attr_timeout);
+})
+
+FSP_FUSE_SYM(
+int fuse_reply_open(fuse_req_t req, const struct fuse_file_info *fi),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_reply_open)
+        (fsp_fuse_env(), req, fi);
+})
+
+FSP_FUSE_SYM(
+int fuse_reply_write(fuse_req_t req, size_t count),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_reply_write)
+        (fsp_fuse_env(), req, count);
+})
+
+FSP_FUSE_SYM(
+int fuse_reply_buf(fuse_req_t req, const char *buf, size_t size),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_reply_buf)
+        (fsp_fuse_env(), req, buf, size);
+})
+
+FSP_FUSE_SYM(
+int fuse_reply_statfs(fuse_req_t req, const struct fuse_statvfs *stbuf),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_reply_statfs)
+        (fsp_fuse_env(), req, stbuf);
+})
+
+FSP_FUSE_SYM(
+size_t fuse_add_direntry(fuse_req_t req, char *buf, size_t bufsize,
+    const char *name, const struct fuse_stat *stbuf, fuse_off_t off),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_add_direntry)
+        (fsp_fuse_env(), req, buf, bufsize, name, stbuf, off);
+})
+
+FSP_FUSE_SYM(
+size_t fuse_add_direntry_plus(fuse_req_t req, char *buf, size_t bufsize,
+    const char *name, const struct fuse_entry_param *e, fuse_off_t off),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_add_direntry_plus)
+        (fsp_fuse_env(), req, buf, bufsize, name, e, off);
+})
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
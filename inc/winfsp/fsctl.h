@@ -54,6 +54,8 @@ extern const __declspec(selectany) GUID FspFsvrtDeviceClassGuid =
     CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 't', METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
 #define FSP_FSCTL_STOP                  \
     CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 'S', METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSP_FSCTL_VOLUME_STATISTICS     \
+    CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 'C', METHOD_BUFFERED, FILE_ANY_ACCESS)
 
 #define FSP_FSCTL_VOLUME_NAME_SIZE      (64 * sizeof(WCHAR))
 #define FSP_FSCTL_VOLUME_PREFIX_SIZE    (64 * sizeof(WCHAR))
@@ -102,8 +104,14 @@ enum
     FspFsctlIrpTimeoutDefault = 300000,
     FspFsctlIrpTimeoutDebug = 142,      /* special value for IRP timeout testing */
     FspFsctlIrpCapacityMinimum = 100,
-    FspFsctlIrpCapacityMaximum = 1000,
+    FspFsctlIrpCapacityMaximum = 65536,
     FspFsctlIrpCapacityDefault = 1000,
+    FspFsctlSecurityCacheSizeMinimum = 16384,
+    FspFsctlSecurityCacheSizeMaximum = 16 * 1024 * 1024,
+    FspFsctlSecurityCacheSizeDefault = 256 * 1024,
+    FspFsctlDirInfoCacheSizeMinimum = 65536,
+    FspFsctlDirInfoCacheSizeMaximum = 64 * 1024 * 1024,
+    FspFsctlDirInfoCacheSizeDefault = 2 * 1024 * 1024,
 };
 typedef struct
 {
@@ -117,7 +125,7 @@ typedef struct
     /* I/O timeouts, capacity, etc. */
     UINT32 TransactTimeout;             /* FSP_FSCTL_TRANSACT timeout (millis; 1 sec - 10 sec) */
     UINT32 IrpTimeout;                  /* pending IRP timeout (millis; 1 min - 10 min) */
-    UINT32 IrpCapacity;                 /* maximum number of pending IRP's (100 - 1000)*/
+    UINT32 IrpCapacity;                 /* maximum number of pending IRP's (100 - 65536)*/
     UINT32 FileInfoTimeout;             /* FileInfo/Security/VolumeInfo timeout (millis) */
     /* FILE_FS_ATTRIBUTE_INFORMATION::FileSystemAttributes */
     UINT32 CaseSensitiveSearch:1;       /* file system supports case-sensitive file names */
@@ -130,7 +138,18 @@ typedef struct
     UINT32 ExtendedAttributes:1;        /* unimplemented; set to 0 */
     UINT32 ReadOnlyVolume:1;
     WCHAR Prefix[FSP_FSCTL_VOLUME_PREFIX_SIZE / sizeof(WCHAR)]; /* UNC prefix (\Server\Share) */
+    /* cache budgets; absent from the original (FSP_FSCTL_VOLUME_PARAMS_V0_SIZE) layout */
+    UINT32 SecurityCacheSize;           /* security cache budget (bytes; 16K - 16M; 0 for default) */
+    UINT32 DirInfoCacheSize;            /* directory cache budget (bytes; 64K - 64M; 0 for default) */
 } FSP_FSCTL_VOLUME_PARAMS;
+#define FSP_FSCTL_VOLUME_PARAMS_V0_SIZE 168
+#if defined(WINFSP_SYS_INTERNAL) || defined(WINFSP_DLL_INTERNAL)
+static_assert(FSP_FSCTL_VOLUME_PARAMS_V0_SIZE ==
+    FIELD_OFFSET(FSP_FSCTL_VOLUME_PARAMS, SecurityCacheSize),
+    "FSP_FSCTL_VOLUME_PARAMS must keep its original layout.");
+static_assert(sizeof(FSP_FSCTL_VOLUME_PARAMS) == 176,
+    "FSP_FSCTL_VOLUME_PARAMS must be 176 bytes.");
+#endif
 typedef struct
 {
     UINT64 TotalSize;
@@ -139,6 +158,24 @@ typedef struct
     WCHAR VolumeLabel[32];
 } FSP_FSCTL_VOLUME_INFO;
 typedef struct
+{
+    UINT64 HitCount;
+    UINT64 MissCount;
+    UINT64 EvictionCount;
+    UINT64 DedupCount;                  /* adds satisfied by an existing identical item */
+    UINT32 ItemCount;
+    UINT32 HolderCount;                 /* HolderCount / ItemCount is the dedup ratio */
+    UINT32 Size;                        /* bytes currently in use */
+    UINT32 SizeMax;                     /* byte budget */
+} FSP_FSCTL_META_CACHE_STATISTICS;
+typedef struct
+{
+    FSP_FSCTL_META_CACHE_STATISTICS SecurityCache;
+    FSP_FSCTL_META_CACHE_STATISTICS DirInfoCache;
+    FSP_FSCTL_META_CACHE_STATISTICS NegativeNameCache;
+    FSP_FSCTL_META_CACHE_STATISTICS StatAheadCache;
+} FSP_FSCTL_VOLUME_STATISTICS;
+typedef struct
 {
     UINT32 FileAttributes;
     UINT32 ReparseTag;
@@ -420,6 +457,8 @@ FSP_API NTSTATUS FspFsctlTransact(HANDLE VolumeHandle,
     PVOID RequestBuf, SIZE_T *PRequestBufSize,
     BOOLEAN Batch);
 FSP_API NTSTATUS FspFsctlStop(HANDLE VolumeHandle);
+FSP_API NTSTATUS FspFsctlGetVolumeStatistics(HANDLE VolumeHandle,
+    FSP_FSCTL_VOLUME_STATISTICS *Statistics);
 FSP_API NTSTATUS FspFsctlGetVolumeList(PWSTR DevicePath,
     PWCHAR VolumeListBuf, PSIZE_T PVolumeListSize);
 FSP_API NTSTATUS FspFsctlPreflight(PWSTR DevicePath);
@@ -596,6 +596,29 @@ typedef enum
     FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_FINE = 0,
     FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_COARSE,
 } FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY;
+#define FSP_FILE_SYSTEM_STATISTICS_LATENCY_BUCKETS 32
+typedef struct
+{
+    UINT64 Count;                       /* number of operations processed */
+    UINT64 ErrorCount;                  /* number of operations that failed */
+    UINT64 PendingCount;                /* number of operations that returned STATUS_PENDING */
+    UINT64 Bytes;                       /* bytes transferred (Read, Write, QueryDirectory) */
+    UINT64 Latency[FSP_FILE_SYSTEM_STATISTICS_LATENCY_BUCKETS];
+        /* latency histogram; [0]: < 1us, [i]: [2^(i-1), 2^i) us; last bucket is unbounded */
+} FSP_FILE_SYSTEM_OPERATION_STATISTICS;
+typedef struct
+{
+    UINT64 TransactCount;               /* transacts issued by dispatcher threads */
+    UINT64 ResponseTransactCount;       /* response-only transacts (FspFileSystemSendResponse) */
+    UINT64 TraverseCacheHitCount;       /* traverse checks answered from the traverse cache */
+    UINT64 TraverseCacheMissCount;      /* traverse checks that called GetSecurityByName */
+    FSP_FILE_SYSTEM_OPERATION_STATISTICS Operations[FspFsctlTransactKindCount];
+} FSP_FILE_SYSTEM_STATISTICS;
+typedef VOID FSP_FILE_SYSTEM_STATISTICS_DUMP(struct _FSP_FILE_SYSTEM *FileSystem,
+    FSP_FILE_SYSTEM_STATISTICS *Statistics);
+typedef struct _FSP_FILE_SYSTEM_ASYNC_OPERATION FSP_FILE_SYSTEM_ASYNC_OPERATION;
+typedef VOID FSP_FILE_SYSTEM_DISPATCHER_SCALING(struct _FSP_FILE_SYSTEM *FileSystem,
+    LONG ThreadCount, BOOLEAN Grow);
 typedef struct _FSP_FILE_SYSTEM
 {
     UINT16 Version;
@@ -613,6 +636,18 @@ typedef struct _FSP_FILE_SYSTEM
     UINT32 DebugLog;
     FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY OpGuardStrategy;
     SRWLOCK OpGuardLock;
+    ULONG ResponseQueueDelay;
+    PTP_TIMER ResponseQueueTimer;
+    SLIST_HEADER ResponseQueue;
+    PVOID Statistics;
+    SLIST_HEADER AsyncOperationPool;
+    PVOID TraverseCache;
+    ULONG DispatcherBatchSize;
+    ULONG DispatcherThreadCountMax, DispatcherKeepAlive;
+    LONG DispatcherThreadActiveCount, DispatcherThreadIdleCount;
+    LONG DispatcherThreadRefCount;
+    HANDLE DispatcherThreadRefEvent;
+    FSP_FILE_SYSTEM_DISPATCHER_SCALING *DispatcherScaling;
 } FSP_FILE_SYSTEM;
 /**
  * Create a file system object.
@@ -680,6 +715,99 @@ FSP_API VOID FspFileSystemRemoveMountPoint(FSP_FILE_SYSTEM *FileSystem);
  *     STATUS_SUCCESS on error code.
  */
 FSP_API NTSTATUS FspFileSystemStartDispatcher(FSP_FILE_SYSTEM *FileSystem, ULONG ThreadCount);
+/**
+ * Enable adaptive sizing of the file system dispatcher thread pool.
+ *
+ * By default the file system dispatcher uses the fixed number of threads specified in
+ * FspFileSystemStartDispatcher. With adaptive sizing enabled that number becomes the minimum
+ * number of threads. An additional thread is started (up to the specified maximum) whenever a
+ * dispatcher thread receives a request and no other dispatcher thread is waiting for requests,
+ * or when the FSD sends a batch with more than one request. Additional threads that have not
+ * received any requests for the specified keep-alive time exit.
+ *
+ * This call must be made prior to FspFileSystemStartDispatcher.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param ThreadCountMax
+ *     The maximum number of dispatcher threads. A value of 0 disables adaptive sizing (the
+ *     default).
+ * @param KeepAlive
+ *     The time in milliseconds that an additional thread may remain idle before it exits.
+ *     Idle threads are only checked when a transact with the FSD times out, so the actual
+ *     time may be longer by up to the volume TransactTimeout.
+ * @return
+ *     STATUS_SUCCESS on error code.
+ */
+FSP_API NTSTATUS FspFileSystemSetDispatcherThreadCountMax(FSP_FILE_SYSTEM *FileSystem,
+    ULONG ThreadCountMax, ULONG KeepAlive);
+/**
+ * Set the batch size for the file system dispatcher.
+ *
+ * By default the file system dispatcher receives a single request from the FSD with every
+ * transact and returns a single response with the next one. In batch mode each dispatcher
+ * thread receives multiple requests with every transact, processes them in order and returns
+ * all their responses with the next transact. This reduces the number of kernel transitions
+ * when the file system is processing a large number of small requests.
+ *
+ * This call must be made prior to FspFileSystemStartDispatcher.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param BatchSize
+ *     The approximate number of requests that a dispatcher thread may receive with a single
+ *     transact. A value of 0 disables batch mode (the default). Large values are capped to an
+ *     internal maximum.
+ * @return
+ *     STATUS_SUCCESS on error code.
+ */
+FSP_API NTSTATUS FspFileSystemSetDispatcherBatchSize(FSP_FILE_SYSTEM *FileSystem,
+    ULONG BatchSize);
+/**
+ * Set the response queue delay for the file system.
+ *
+ * By default every response sent using FspFileSystemSendResponse results in a separate
+ * transact with the FSD. When the response queue is enabled FspFileSystemSendResponse
+ * instead places the response in a lock-free queue and the file system dispatcher sends
+ * queued responses to the FSD together with its next transact. If no dispatcher thread picks
+ * up the queued responses within the specified delay, they are sent from a thread pool timer.
+ *
+ * This is beneficial for file systems that complete many operations asynchronously.
+ * This call must be made prior to FspFileSystemStartDispatcher.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param Delay
+ *     The maximum time in milliseconds that a queued response may wait before being sent to
+ *     the FSD. A value of 0 disables the response queue (the default).
+ * @return
+ *     STATUS_SUCCESS on error code.
+ */
+FSP_API NTSTATUS FspFileSystemSetResponseQueueDelay(FSP_FILE_SYSTEM *FileSystem,
+    ULONG Delay);
+/**
+ * Set the traverse cache timeout for the file system.
+ *
+ * When a caller lacks the traverse privilege FspAccessCheck checks every directory in the
+ * path of the file being opened for FILE_TRAVERSE access, which requires a GetSecurityByName
+ * call for each directory. When the traverse cache is enabled, successful traverse checks are
+ * remembered per directory and caller token and are reused until they expire. The cache is
+ * invalidated whenever the file system processes a SetSecurity, Rename or Cleanup(Delete)
+ * operation.
+ *
+ * The traverse cache must only be enabled by file systems that change security descriptors
+ * exclusively through these operations.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param Timeout
+ *     The time in milliseconds that a cached traverse check remains valid. A value of 0
+ *     disables the traverse cache (the default).
+ * @return
+ *     STATUS_SUCCESS or error code.
+ */
+FSP_API NTSTATUS FspFileSystemSetTraverseCacheTimeout(FSP_FILE_SYSTEM *FileSystem,
+    ULONG Timeout);
 /**
  * Stop the file system dispatcher.
  *
@@ -701,6 +829,11 @@ FSP_API VOID FspFileSystemStopDispatcher(FSP_FILE_SYSTEM *FileSystem);
  *
  * These operations are allowed to return STATUS_PENDING to postpone sending a response to the FSD.
  * At a later time the file system can use FspFileSystemSendResponse to send the response.
+ * Alternatively the file system can use FspFileSystemBeginAsyncOperation and the corresponding
+ * completion function, in which case it need not build the response itself.
+ *
+ * If the response queue has been enabled using FspFileSystemSetResponseQueueDelay, the response
+ * is queued and sent to the FSD together with the next dispatcher transact.
  *
  * @param FileSystem
  *     The file system object.
@@ -709,6 +842,127 @@ FSP_API VOID FspFileSystemStopDispatcher(FSP_FILE_SYSTEM *FileSystem);
  */
 FSP_API VOID FspFileSystemSendResponse(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_RSP *Response);
+/**
+ * Begin an asynchronous operation.
+ *
+ * This function may be called from the Read, Write or ReadDirectory operations of
+ * FSP_FILE_SYSTEM_INTERFACE when the file system wants to complete the operation at a later time.
+ * It returns an operation handle that records everything needed to respond to the FSD, with a
+ * response buffer taken from a per-volume pool. After a successful call the operation must
+ * return STATUS_PENDING and later complete the operation handle using one of
+ * FspFileSystemCompleteAsyncRead, FspFileSystemCompleteAsyncWrite or
+ * FspFileSystemCompleteAsyncReadDirectory. The request buffer itself is reused after the
+ * operation returns and must not be accessed after that.
+ *
+ * Completing an operation handle does not allocate memory. If the response queue has been
+ * enabled using FspFileSystemSetResponseQueueDelay, the pooled response is queued as is and
+ * the handle returns to the pool when the queue is drained.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param Request
+ *     The request that is being processed.
+ * @param POperation [out]
+ *     Pointer that will receive the operation handle on successful return from this call.
+ * @return
+ *     STATUS_SUCCESS or error code.
+ */
+FSP_API NTSTATUS FspFileSystemBeginAsyncOperation(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request, FSP_FILE_SYSTEM_ASYNC_OPERATION **POperation);
+/**
+ * Delete an asynchronous operation without sending a response.
+ *
+ * This is useful when the file system decides to complete an operation synchronously after
+ * calling FspFileSystemBeginAsyncOperation. In this case the operation must not return
+ * STATUS_PENDING.
+ *
+ * @param Operation
+ *     The operation handle.
+ */
+FSP_API VOID FspFileSystemDeleteAsyncOperation(FSP_FILE_SYSTEM_ASYNC_OPERATION *Operation);
+/**
+ * Complete an asynchronous Read operation.
+ *
+ * The response is sent to the FSD using FspFileSystemSendResponse and the operation handle
+ * is returned to the pool; it must not be used after this call.
+ *
+ * @param Operation
+ *     The operation handle.
+ * @param Status
+ *     The operation status.
+ * @param BytesTransferred
+ *     The number of bytes read.
+ */
+FSP_API VOID FspFileSystemCompleteAsyncRead(FSP_FILE_SYSTEM_ASYNC_OPERATION *Operation,
+    NTSTATUS Status, ULONG BytesTransferred);
+/**
+ * Complete an asynchronous Write operation.
+ *
+ * The response is sent to the FSD using FspFileSystemSendResponse and the operation handle
+ * is returned to the pool; it must not be used after this call.
+ *
+ * @param Operation
+ *     The operation handle.
+ * @param Status
+ *     The operation status.
+ * @param BytesTransferred
+ *     The number of bytes written.
+ * @param FileInfo
+ *     The file information for the file after the write. Ignored if Status is not a success
+ *     code.
+ */
+FSP_API VOID FspFileSystemCompleteAsyncWrite(FSP_FILE_SYSTEM_ASYNC_OPERATION *Operation,
+    NTSTATUS Status, ULONG BytesTransferred, const FSP_FSCTL_FILE_INFO *FileInfo);
+/**
+ * Complete an asynchronous ReadDirectory operation.
+ *
+ * The response is sent to the FSD using FspFileSystemSendResponse and the operation handle
+ * is returned to the pool; it must not be used after this call.
+ *
+ * @param Operation
+ *     The operation handle.
+ * @param Status
+ *     The operation status.
+ * @param BytesTransferred
+ *     The number of bytes placed in the directory buffer.
+ */
+FSP_API VOID FspFileSystemCompleteAsyncReadDirectory(FSP_FILE_SYSTEM_ASYNC_OPERATION *Operation,
+    NTSTATUS Status, ULONG BytesTransferred);
+/**
+ * Get file system statistics.
+ *
+ * The file system dispatcher maintains per operation kind counters and latency histograms.
+ * The latency of an operation is the time spent processing it in the dispatcher; for operations
+ * that return STATUS_PENDING it does not include the time until the response is sent.
+ *
+ * Statistics are kept per dispatcher thread and are merged when this function is called.
+ * Since this is done without stopping the dispatcher threads the returned values are
+ * approximate.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param Statistics [out]
+ *     Pointer to a structure that will receive the statistics.
+ */
+FSP_API VOID FspFileSystemGetStatistics(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FILE_SYSTEM_STATISTICS *Statistics);
+/**
+ * Set a periodic statistics dump hook.
+ *
+ * The hook is called from a thread pool thread with the current file system statistics
+ * every Interval milliseconds.
+ *
+ * @param FileSystem
+ *     The file system object.
+ * @param Interval
+ *     The dump interval in milliseconds. A value of 0 disables the hook.
+ * @param Dump
+ *     The hook to call. A value of NULL disables the hook.
+ * @return
+ *     STATUS_SUCCESS on error code.
+ */
+FSP_API NTSTATUS FspFileSystemSetStatisticsDump(FSP_FILE_SYSTEM *FileSystem,
+    ULONG Interval, FSP_FILE_SYSTEM_STATISTICS_DUMP *Dump);
 static inline
 PWSTR FspFileSystemMountPoint(FSP_FILE_SYSTEM *FileSystem)
 {
@@ -770,6 +1024,18 @@ VOID FspFileSystemSetDispatcherResult(FSP_FILE_SYSTEM *FileSystem,
     InterlockedCompareExchange(&FileSystem->DispatcherResult, DispatcherResult, 0);
 }
 static inline
+VOID FspFileSystemSetDispatcherScaling(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FILE_SYSTEM_DISPATCHER_SCALING *DispatcherScaling)
+{
+    FileSystem->DispatcherScaling = DispatcherScaling;
+}
+static inline
+ULONG FspFileSystemDispatcherThreadActiveCount(FSP_FILE_SYSTEM *FileSystem)
+{
+    /* 32-bit reads are atomic */
+    return FileSystem->DispatcherThreadActiveCount;
+}
+static inline
 VOID FspFileSystemSetDebugLog(FSP_FILE_SYSTEM *FileSystem,
     UINT32 DebugLog)
 {
@@ -62,6 +62,7 @@ static inline int cygfuse_daemon(int nochdir, int noclose)
 #define FSP_FUSE_SYM(proto, ...)        __attribute__ ((visibility("default"))) proto { __VA_ARGS__ }
 #include <fuse_common.h>
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <fuse_opt.h>
 
 #if defined(__LP64__)
@@ -127,6 +128,25 @@ static void *cygfuse_init_winfsp()
     CYGFUSE_GET_API(h, fsp_fuse_exit);
     CYGFUSE_GET_API(h, fsp_fuse_get_context);
 
+    /* fuse_lowlevel.h */
+    CYGFUSE_GET_API(h, fsp_fuse_lowlevel_new);
+    CYGFUSE_GET_API(h, fsp_fuse_session_add_chan);
+    CYGFUSE_GET_API(h, fsp_fuse_session_destroy);
+    CYGFUSE_GET_API(h, fsp_fuse_session_loop);
+    CYGFUSE_GET_API(h, fsp_fuse_session_loop_mt);
+    CYGFUSE_GET_API(h, fsp_fuse_session_exit);
+    CYGFUSE_GET_API(h, fsp_fuse_req_userdata);
+    CYGFUSE_GET_API(h, fsp_fuse_req_ctx);
+    CYGFUSE_GET_API(h, fsp_fuse_reply_err);
+    CYGFUSE_GET_API(h, fsp_fuse_reply_entry);
+    CYGFUSE_GET_API(h, fsp_fuse_reply_attr);
+    CYGFUSE_GET_API(h, fsp_fuse_reply_open);
+    CYGFUSE_GET_API(h, fsp_fuse_reply_write);
+    CYGFUSE_GET_API(h, fsp_fuse_reply_buf);
+    CYGFUSE_GET_API(h, fsp_fuse_reply_statfs);
+    CYGFUSE_GET_API(h, fsp_fuse_add_direntry);
+    CYGFUSE_GET_API(h, fsp_fuse_add_direntry_plus);
+
     /* fuse_opt.h */
     CYGFUSE_GET_API(h, fsp_fuse_opt_parse);
     CYGFUSE_GET_API(h, fsp_fuse_opt_add_arg);
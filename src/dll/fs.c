@@ -20,8 +20,54 @@
 enum
 {
     FspFileSystemDispatcherThreadCountMin = 2,
+    FspFileSystemDispatcherThreadCountMax = 256,
+    FspFileSystemDispatcherBatchSizeMax = 64,
+    FspFileSystemResponseQueueDelayMax = 1000,
+    FspFileSystemResponseQueueDrainSize = 16 * FSP_FSCTL_TRANSACT_RSP_SIZEMAX,
+    FspFileSystemAsyncOperationPoolMax = 4096,
 };
 
+typedef struct
+{
+    SLIST_ENTRY ListEntry;
+    FSP_FILE_SYSTEM *FileSystem;        /* non-0 if this is an FSP_FILE_SYSTEM_ASYNC_OPERATION */
+    FSP_FSCTL_DECLSPEC_ALIGN UINT8 ResponseBuf[];
+} FSP_FILE_SYSTEM_QUEUED_RESPONSE;
+
+/*
+ * An async operation starts with the same fields as a queued response, so that its pooled
+ * response can be placed in the response queue as is and return to the pool once drained.
+ */
+struct _FSP_FILE_SYSTEM_ASYNC_OPERATION
+{
+    SLIST_ENTRY ListEntry;
+    FSP_FILE_SYSTEM *FileSystem;
+    FSP_FSCTL_DECLSPEC_ALIGN UINT8 ResponseBuf[sizeof(FSP_FSCTL_TRANSACT_RSP)];
+};
+static_assert(
+    FIELD_OFFSET(FSP_FILE_SYSTEM_QUEUED_RESPONSE, FileSystem) ==
+        FIELD_OFFSET(FSP_FILE_SYSTEM_ASYNC_OPERATION, FileSystem) &&
+    FIELD_OFFSET(FSP_FILE_SYSTEM_QUEUED_RESPONSE, ResponseBuf) ==
+        FIELD_OFFSET(FSP_FILE_SYSTEM_ASYNC_OPERATION, ResponseBuf),
+    "FSP_FILE_SYSTEM_ASYNC_OPERATION must start with an FSP_FILE_SYSTEM_QUEUED_RESPONSE");
+
+typedef struct
+{
+    LIST_ENTRY ListEntry;
+    PVOID AllocBase;
+    DECLSPEC_ALIGN(SYSTEM_CACHE_ALIGNMENT_SIZE) FSP_FILE_SYSTEM_STATISTICS Statistics;
+} FSP_FILE_SYSTEM_STATISTICS_SLOT;
+
+typedef struct
+{
+    SRWLOCK Lock;
+    LIST_ENTRY SlotList;
+    volatile LONG64 ResponseTransactCount;
+    PTP_TIMER DumpTimer;
+    FSP_FILE_SYSTEM_STATISTICS_DUMP *Dump;
+    FSP_FILE_SYSTEM_STATISTICS Retired;
+} FSP_FILE_SYSTEM_STATISTICS_STATE;
+
 static FSP_FILE_SYSTEM_INTERFACE FspFileSystemNullInterface;
 
 static INIT_ONCE FspFileSystemInitOnce = INIT_ONCE_STATIC_INIT;
@@ -31,12 +77,18 @@ static NTSTATUS (NTAPI *FspNtMakeTemporaryObject)(
     HANDLE Handle);
 static NTSTATUS (NTAPI *FspNtClose)(
     HANDLE Handle);
+static UINT64 FspFileSystemPerformanceFrequency;
 
 static BOOL WINAPI FspFileSystemInitialize(
     PINIT_ONCE InitOnce, PVOID Parameter, PVOID *Context)
 {
     HANDLE Handle;
 
+    LARGE_INTEGER Frequency;
+
+    QueryPerformanceFrequency(&Frequency);
+    FspFileSystemPerformanceFrequency = Frequency.QuadPart;
+
     Handle = GetModuleHandleW(L"ntdll.dll");
     if (0 != Handle)
     {
@@ -62,6 +114,7 @@ FSP_API NTSTATUS FspFileSystemCreate(PWSTR DevicePath,
 {
     NTSTATUS Result;
     FSP_FILE_SYSTEM *FileSystem;
+    FSP_FILE_SYSTEM_STATISTICS_STATE *Statistics;
 
     *PFileSystem = 0;
 
@@ -75,11 +128,31 @@ FSP_API NTSTATUS FspFileSystemCreate(PWSTR DevicePath,
         return STATUS_INSUFFICIENT_RESOURCES;
     memset(FileSystem, 0, sizeof *FileSystem);
 
+    Statistics = MemAlloc(sizeof *Statistics);
+    if (0 == Statistics)
+    {
+        MemFree(FileSystem);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    memset(Statistics, 0, sizeof *Statistics);
+    InitializeSRWLock(&Statistics->Lock);
+    InitializeListHead(&Statistics->SlotList);
+
+    Result = FspFileSystemCreateTraverseCache(FileSystem, !!VolumeParams->CaseSensitiveSearch);
+    if (!NT_SUCCESS(Result))
+    {
+        MemFree(Statistics);
+        MemFree(FileSystem);
+        return Result;
+    }
+
     Result = FspFsctlCreateVolume(DevicePath, VolumeParams,
         FileSystem->VolumeName, sizeof FileSystem->VolumeName,
         &FileSystem->VolumeHandle);
     if (!NT_SUCCESS(Result))
     {
+        FspFileSystemDeleteTraverseCache(FileSystem);
+        MemFree(Statistics);
         MemFree(FileSystem);
         return Result;
     }
@@ -105,6 +178,11 @@ FSP_API NTSTATUS FspFileSystemCreate(PWSTR DevicePath,
     FileSystem->EnterOperation = FspFileSystemOpEnter;
     FileSystem->LeaveOperation = FspFileSystemOpLeave;
 
+    InitializeSListHead(&FileSystem->ResponseQueue);
+    InitializeSListHead(&FileSystem->AsyncOperationPool);
+
+    FileSystem->Statistics = Statistics;
+
     *PFileSystem = FileSystem;
 
     return STATUS_SUCCESS;
@@ -112,6 +190,29 @@ FSP_API NTSTATUS FspFileSystemCreate(PWSTR DevicePath,
 
 FSP_API VOID FspFileSystemDelete(FSP_FILE_SYSTEM *FileSystem)
 {
+    PSLIST_ENTRY ListEntry;
+
+    if (0 != FileSystem->ResponseQueueTimer)
+    {
+        SetThreadpoolTimer(FileSystem->ResponseQueueTimer, 0, 0, 0);
+        WaitForThreadpoolTimerCallbacks(FileSystem->ResponseQueueTimer, TRUE);
+        CloseThreadpoolTimer(FileSystem->ResponseQueueTimer);
+    }
+
+    while (0 != (ListEntry = InterlockedPopEntrySList(&FileSystem->ResponseQueue)))
+        MemFree(CONTAINING_RECORD(ListEntry, FSP_FILE_SYSTEM_QUEUED_RESPONSE, ListEntry));
+
+    while (0 != (ListEntry = InterlockedPopEntrySList(&FileSystem->AsyncOperationPool)))
+        MemFree(CONTAINING_RECORD(ListEntry, FSP_FILE_SYSTEM_ASYNC_OPERATION, ListEntry));
+
+    if (0 != FileSystem->DispatcherThreadRefEvent)
+        CloseHandle(FileSystem->DispatcherThreadRefEvent);
+
+    FspFileSystemSetStatisticsDump(FileSystem, 0, 0);
+    MemFree(FileSystem->Statistics);
+
+    FspFileSystemDeleteTraverseCache(FileSystem);
+
     FspFileSystemRemoveMountPoint(FileSystem);
     CloseHandle(FileSystem->VolumeHandle);
     MemFree(FileSystem);
@@ -235,100 +336,460 @@ FSP_API VOID FspFileSystemRemoveMountPoint(FSP_FILE_SYSTEM *FileSystem)
     }
 }
 
-static DWORD WINAPI FspFileSystemDispatcherThread(PVOID FileSystem0)
+static VOID FspFileSystemAddStatistics(
+    FSP_FILE_SYSTEM_STATISTICS *Statistics, FSP_FILE_SYSTEM_STATISTICS *AddStatistics)
 {
-    FSP_FILE_SYSTEM *FileSystem = FileSystem0;
-    NTSTATUS Result;
-    SIZE_T RequestSize, ResponseSize;
-    FSP_FSCTL_TRANSACT_REQ *Request = 0;
-    FSP_FSCTL_TRANSACT_RSP *Response = 0;
-    HANDLE DispatcherThread = 0;
+    /* statistics consist solely of UINT64 counters */
+    PUINT64 P = (PUINT64)Statistics, Q = (PUINT64)AddStatistics;
+    for (ULONG I = 0; sizeof *Statistics / sizeof(UINT64) > I; I++)
+        P[I] += Q[I];
+}
+
+static FSP_FILE_SYSTEM_STATISTICS *FspFileSystemAcquireStatistics(FSP_FILE_SYSTEM *FileSystem)
+{
+    FSP_FILE_SYSTEM_STATISTICS_STATE *State = FileSystem->Statistics;
+    FSP_FILE_SYSTEM_STATISTICS_SLOT *Slot;
+    PVOID AllocBase;
+
+    /* allocate a cache-line-aligned slot so that threads do not share cache lines */
+    AllocBase = MemAlloc(sizeof *Slot + SYSTEM_CACHE_ALIGNMENT_SIZE);
+    if (0 == AllocBase)
+        return 0;
+    Slot = (PVOID)(((UINT_PTR)AllocBase + SYSTEM_CACHE_ALIGNMENT_SIZE - 1) &
+        ~(UINT_PTR)(SYSTEM_CACHE_ALIGNMENT_SIZE - 1));
+    memset(Slot, 0, sizeof *Slot);
+    Slot->AllocBase = AllocBase;
+
+    AcquireSRWLockExclusive(&State->Lock);
+    InsertTailList(&State->SlotList, &Slot->ListEntry);
+    ReleaseSRWLockExclusive(&State->Lock);
+
+    return &Slot->Statistics;
+}
+
+static VOID FspFileSystemReleaseStatistics(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FILE_SYSTEM_STATISTICS *Statistics)
+{
+    FSP_FILE_SYSTEM_STATISTICS_STATE *State = FileSystem->Statistics;
+    FSP_FILE_SYSTEM_STATISTICS_SLOT *Slot;
 
-    Request = MemAlloc(FSP_FSCTL_TRANSACT_BUFFER_SIZEMIN);
-    Response = MemAlloc(FSP_FSCTL_TRANSACT_RSP_SIZEMAX);
-    if (0 == Request || 0 == Response)
+    if (0 == Statistics)
+        return;
+
+    Slot = CONTAINING_RECORD(Statistics, FSP_FILE_SYSTEM_STATISTICS_SLOT, Statistics);
+
+    AcquireSRWLockExclusive(&State->Lock);
+    RemoveEntryList(&Slot->ListEntry);
+    FspFileSystemAddStatistics(&State->Retired, &Slot->Statistics);
+    ReleaseSRWLockExclusive(&State->Lock);
+
+    MemFree(Slot->AllocBase);
+}
+
+static VOID FspFileSystemUpdateStatistics(FSP_FILE_SYSTEM_STATISTICS *Statistics,
+    FSP_FSCTL_TRANSACT_RSP *Response, UINT64 Ticks)
+{
+    FSP_FILE_SYSTEM_OPERATION_STATISTICS *OperationStatistics;
+    UINT64 Latency;
+    ULONG Index;
+
+    if (0 == Statistics || FspFsctlTransactKindCount <= Response->Kind)
+        return;
+
+    OperationStatistics = &Statistics->Operations[Response->Kind];
+    OperationStatistics->Count++;
+    if (STATUS_PENDING == Response->IoStatus.Status)
+        OperationStatistics->PendingCount++;
+    else if (!NT_SUCCESS(Response->IoStatus.Status))
+        OperationStatistics->ErrorCount++;
+    else if (FspFsctlTransactReadKind == Response->Kind ||
+        FspFsctlTransactWriteKind == Response->Kind ||
+        FspFsctlTransactQueryDirectoryKind == Response->Kind)
+        OperationStatistics->Bytes += Response->IoStatus.Information;
+
+    /* latency histogram buckets: [0]: <1us, [i]: [2^(i-1), 2^i) us */
+    Latency = Ticks * 1000000 / FspFileSystemPerformanceFrequency;
+    if (0 == Latency)
+        Index = 0;
+    else if (0xffffffff < Latency)
+        Index = FSP_FILE_SYSTEM_STATISTICS_LATENCY_BUCKETS - 1;
+    else
     {
-        Result = STATUS_INSUFFICIENT_RESOURCES;
-        goto exit;
+        _BitScanReverse(&Index, (ULONG)Latency);
+        Index++;
+        if (FSP_FILE_SYSTEM_STATISTICS_LATENCY_BUCKETS <= Index)
+            Index = FSP_FILE_SYSTEM_STATISTICS_LATENCY_BUCKETS - 1;
     }
+    OperationStatistics->Latency[Index]++;
+}
 
-    if (1 < FileSystem->DispatcherThreadCount)
+static VOID CALLBACK FspFileSystemStatisticsDumpTimer(
+    PTP_CALLBACK_INSTANCE Instance, PVOID FileSystem0, PTP_TIMER Timer)
+{
+    FSP_FILE_SYSTEM *FileSystem = FileSystem0;
+    FSP_FILE_SYSTEM_STATISTICS_STATE *State = FileSystem->Statistics;
+    FSP_FILE_SYSTEM_STATISTICS *Statistics;
+
+    Statistics = MemAlloc(sizeof *Statistics);
+    if (0 == Statistics)
+        return;
+
+    FspFileSystemGetStatistics(FileSystem, Statistics);
+    State->Dump(FileSystem, Statistics);
+
+    MemFree(Statistics);
+}
+
+static VOID FspFileSystemSetResponseQueueTimer(FSP_FILE_SYSTEM *FileSystem)
+{
+    LARGE_INTEGER DueTime;
+    FILETIME FileTime;
+
+    /* negative due time means relative; convert millis to 100ns units */
+    DueTime.QuadPart = -(LONGLONG)FileSystem->ResponseQueueDelay * 10000;
+    FileTime.dwLowDateTime = DueTime.LowPart;
+    FileTime.dwHighDateTime = DueTime.HighPart;
+    SetThreadpoolTimer(FileSystem->ResponseQueueTimer, &FileTime, 0, 0);
+}
+
+static FSP_FSCTL_TRANSACT_RSP *FspFileSystemDrainResponseQueue(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_RSP *Response, PVOID ResponseBufEnd)
+{
+    PSLIST_ENTRY ListEntry;
+    FSP_FILE_SYSTEM_QUEUED_RESPONSE *QueuedResponse;
+    FSP_FSCTL_TRANSACT_RSP *QueuedResponseRsp;
+    SIZE_T ResponseSize;
+
+    /*
+     * Move as many queued responses as will fit into the response buffer. The FSD matches
+     * responses to IRP's using the Hint field, so the order of responses is not important.
+     */
+    while (0 != (ListEntry = InterlockedPopEntrySList(&FileSystem->ResponseQueue)))
     {
-        FileSystem->DispatcherThreadCount--;
-        DispatcherThread = CreateThread(0, 0, FspFileSystemDispatcherThread, FileSystem, 0, 0);
-        if (0 == DispatcherThread)
+        QueuedResponse = CONTAINING_RECORD(ListEntry, FSP_FILE_SYSTEM_QUEUED_RESPONSE, ListEntry);
+        QueuedResponseRsp = (FSP_FSCTL_TRANSACT_RSP *)QueuedResponse->ResponseBuf;
+        ResponseSize = FSP_FSCTL_DEFAULT_ALIGN_UP(QueuedResponseRsp->Size);
+
+        if ((PUINT8)Response + ResponseSize > (PUINT8)ResponseBufEnd)
         {
-            Result = FspNtStatusFromWin32(GetLastError());
-            goto exit;
+            /* if the queue was empty make sure that it gets flushed in a timely manner */
+            if (0 == InterlockedPushEntrySList(&FileSystem->ResponseQueue, ListEntry))
+                FspFileSystemSetResponseQueueTimer(FileSystem);
+            break;
         }
+
+        memcpy(Response, QueuedResponseRsp, ResponseSize);
+        Response = FspFsctlTransactProduceResponse(Response, ResponseSize);
+
+        if (0 != QueuedResponse->FileSystem)
+            FspFileSystemDeleteAsyncOperation((FSP_FILE_SYSTEM_ASYNC_OPERATION *)QueuedResponse);
+        else
+            MemFree(QueuedResponse);
+    }
+
+    return Response;
+}
+
+static VOID CALLBACK FspFileSystemResponseQueueTimer(
+    PTP_CALLBACK_INSTANCE Instance, PVOID FileSystem0, PTP_TIMER Timer)
+{
+    FSP_FILE_SYSTEM *FileSystem = FileSystem0;
+    NTSTATUS Result;
+    PVOID ResponseBuf;
+    FSP_FSCTL_TRANSACT_RSP *Response;
+
+    /*
+     * The dispatcher threads did not pick up the queued responses in time (most likely because
+     * they are all waiting for new requests). Send the queued responses ourselves.
+     */
+    ResponseBuf = MemAlloc(FspFileSystemResponseQueueDrainSize);
+    if (0 == ResponseBuf)
+    {
+        /* try again later */
+        FspFileSystemSetResponseQueueTimer(FileSystem);
+        return;
     }
 
-    memset(Response, 0, sizeof *Response);
     for (;;)
     {
-        RequestSize = FSP_FSCTL_TRANSACT_BUFFER_SIZEMIN;
+        Response = FspFileSystemDrainResponseQueue(FileSystem,
+            ResponseBuf, (PUINT8)ResponseBuf + FspFileSystemResponseQueueDrainSize);
+        if (ResponseBuf == (PVOID)Response)
+            break;
+
+        InterlockedIncrement64(
+            &((FSP_FILE_SYSTEM_STATISTICS_STATE *)FileSystem->Statistics)->ResponseTransactCount);
         Result = FspFsctlTransact(FileSystem->VolumeHandle,
-            Response, Response->Size, Request, &RequestSize, FALSE);
+            ResponseBuf, (PUINT8)Response - (PUINT8)ResponseBuf, 0, 0, FALSE);
         if (!NT_SUCCESS(Result))
-            goto exit;
+        {
+            FspFileSystemSetDispatcherResult(FileSystem, Result);
 
-        memset(Response, 0, sizeof *Response);
-        if (0 == RequestSize)
-            continue;
+            FspFsctlStop(FileSystem->VolumeHandle);
+            break;
+        }
+    }
+
+    MemFree(ResponseBuf);
+}
 
-        if (FileSystem->DebugLog)
+static SIZE_T FspFileSystemDispatchRequest(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FILE_SYSTEM_STATISTICS *Statistics,
+    FSP_FSCTL_TRANSACT_REQ *Request, FSP_FSCTL_TRANSACT_RSP *Response)
+{
+    SIZE_T ResponseSize;
+    LARGE_INTEGER StartTime, EndTime;
+
+    if (FileSystem->DebugLog)
+    {
+        if (FspFsctlTransactKindCount <= Request->Kind ||
+            (FileSystem->DebugLog & (1 << Request->Kind)))
+            FspDebugLogRequest(Request);
+    }
+
+    QueryPerformanceCounter(&StartTime);
+
+    memset(Response, 0, sizeof *Response);
+    Response->Size = sizeof *Response;
+    Response->Kind = Request->Kind;
+    Response->Hint = Request->Hint;
+    if (FspFsctlTransactKindCount > Request->Kind && 0 != FileSystem->Operations[Request->Kind])
+    {
+        Response->IoStatus.Status =
+            FspFileSystemEnterOperation(FileSystem, Request, Response);
+        if (NT_SUCCESS(Response->IoStatus.Status))
         {
-            if (FspFsctlTransactKindCount <= Request->Kind ||
-                (FileSystem->DebugLog & (1 << Request->Kind)))
-                FspDebugLogRequest(Request);
+            Response->IoStatus.Status =
+                FileSystem->Operations[Request->Kind](FileSystem, Request, Response);
+            FspFileSystemLeaveOperation(FileSystem, Request, Response);
         }
+    }
+    else
+        Response->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
 
+    QueryPerformanceCounter(&EndTime);
+    FspFileSystemUpdateStatistics(Statistics, Response, EndTime.QuadPart - StartTime.QuadPart);
+
+    if (FileSystem->DebugLog)
+    {
+        if (FspFsctlTransactKindCount <= Response->Kind ||
+            (FileSystem->DebugLog & (1 << Response->Kind)))
+            FspDebugLogResponse(Response);
+    }
+
+    ResponseSize = FSP_FSCTL_DEFAULT_ALIGN_UP(Response->Size);
+    if (FSP_FSCTL_TRANSACT_RSP_SIZEMAX < ResponseSize/* should NOT happen */)
+    {
+        memset(Response, 0, sizeof *Response);
         Response->Size = sizeof *Response;
         Response->Kind = Request->Kind;
         Response->Hint = Request->Hint;
-        if (FspFsctlTransactKindCount > Request->Kind && 0 != FileSystem->Operations[Request->Kind])
+        Response->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+        ResponseSize = FSP_FSCTL_DEFAULT_ALIGN_UP(Response->Size);
+    }
+    else if (STATUS_PENDING == Response->IoStatus.Status)
+    {
+        memset(Response, 0, sizeof *Response);
+        ResponseSize = 0;
+    }
+    else
+    {
+        memset((PUINT8)Response + Response->Size, 0, ResponseSize - Response->Size);
+        Response->Size = (UINT16)ResponseSize;
+    }
+
+    return ResponseSize;
+}
+
+static DWORD WINAPI FspFileSystemAdaptiveDispatcherThread(PVOID FileSystem0);
+
+static VOID FspFileSystemReleaseDispatcherThreadRef(FSP_FILE_SYSTEM *FileSystem)
+{
+    if (0 == InterlockedDecrement(&FileSystem->DispatcherThreadRefCount))
+        SetEvent(FileSystem->DispatcherThreadRefEvent);
+}
+
+static VOID FspFileSystemGrowDispatcher(FSP_FILE_SYSTEM *FileSystem)
+{
+    LONG ThreadCount;
+    HANDLE DispatcherThread;
+
+    do
+    {
+        ThreadCount = FileSystem->DispatcherThreadActiveCount;
+        if (ThreadCount >= (LONG)FileSystem->DispatcherThreadCountMax)
+            return;
+    } while (ThreadCount != InterlockedCompareExchange(&FileSystem->DispatcherThreadActiveCount,
+        ThreadCount + 1, ThreadCount));
+
+    /* the new thread holds a reference that FspFileSystemStopDispatcher waits for */
+    InterlockedIncrement(&FileSystem->DispatcherThreadRefCount);
+    DispatcherThread = CreateThread(0, 0, FspFileSystemAdaptiveDispatcherThread, FileSystem, 0, 0);
+    if (0 == DispatcherThread)
+    {
+        InterlockedDecrement(&FileSystem->DispatcherThreadActiveCount);
+        FspFileSystemReleaseDispatcherThreadRef(FileSystem);
+        return;
+    }
+    CloseHandle(DispatcherThread);
+
+    if (0 != FileSystem->DispatcherScaling)
+        FileSystem->DispatcherScaling(FileSystem, ThreadCount + 1, TRUE);
+}
+
+static NTSTATUS FspFileSystemDispatcherLoop(FSP_FILE_SYSTEM *FileSystem, BOOLEAN Adaptive)
+{
+    NTSTATUS Result;
+    ULONG BatchSize;
+    SIZE_T RequestBufSize, ResponseBufSize, RequestSize, ResponseSize;
+    PVOID RequestBuf = 0, ResponseBuf = 0;
+    PUINT8 RequestBufEnd, ResponseBufEnd;
+    FSP_FSCTL_TRANSACT_REQ *Request, *NextRequest;
+    FSP_FSCTL_TRANSACT_RSP *Response;
+    BOOLEAN Scalable = 0 != FileSystem->DispatcherThreadCountMax;
+    LONG IdleCount, ActiveCount;
+    UINT64 LastRequestTime;
+    FSP_FILE_SYSTEM_STATISTICS *Statistics = 0;
+
+    /*
+     * In batch mode the FSD may send us multiple requests with a single transact.
+     * We process them all and send the responses back with the next transact.
+     */
+    BatchSize = FileSystem->DispatcherBatchSize;
+    if (0 == BatchSize)
+    {
+        RequestBufSize = FSP_FSCTL_TRANSACT_BUFFER_SIZEMIN;
+        ResponseBufSize = FSP_FSCTL_TRANSACT_RSP_SIZEMAX;
+    }
+    else
+    {
+        RequestBufSize = BatchSize * FSP_FSCTL_TRANSACT_REQ_SIZEMAX;
+        if (FSP_FSCTL_TRANSACT_BATCH_BUFFER_SIZEMIN > RequestBufSize)
+            RequestBufSize = FSP_FSCTL_TRANSACT_BATCH_BUFFER_SIZEMIN;
+        ResponseBufSize = BatchSize * FSP_FSCTL_TRANSACT_RSP_SIZEMAX;
+    }
+    if (0 != FileSystem->ResponseQueueDelay)
+        ResponseBufSize += FspFileSystemResponseQueueDrainSize;
+
+    RequestBuf = MemAlloc(RequestBufSize);
+    ResponseBuf = MemAlloc(ResponseBufSize);
+    if (0 == RequestBuf || 0 == ResponseBuf)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+    ResponseBufEnd = (PUINT8)ResponseBuf + ResponseBufSize;
+
+    Statistics = FspFileSystemAcquireStatistics(FileSystem);
+
+    LastRequestTime = GetTickCount64();
+    Response = ResponseBuf;
+    for (;;)
+    {
+        if (0 != FileSystem->ResponseQueueDelay)
+            Response = FspFileSystemDrainResponseQueue(FileSystem, Response, ResponseBufEnd);
+
+        if (Scalable)
+            InterlockedIncrement(&FileSystem->DispatcherThreadIdleCount);
+
+        if (0 != Statistics)
+            Statistics->TransactCount++;
+
+        RequestSize = RequestBufSize;
+        Result = FspFsctlTransact(FileSystem->VolumeHandle,
+            ResponseBuf, (PUINT8)Response - (PUINT8)ResponseBuf, RequestBuf, &RequestSize,
+            0 != BatchSize);
+
+        if (Scalable)
         {
-            Response->IoStatus.Status =
-                FspFileSystemEnterOperation(FileSystem, Request, Response);
-            if (NT_SUCCESS(Response->IoStatus.Status))
+            IdleCount = InterlockedDecrement(&FileSystem->DispatcherThreadIdleCount);
+
+            if (!NT_SUCCESS(Result))
+                goto exit;
+
+            if (0 != RequestSize)
+            {
+                /*
+                 * If no other thread is waiting for requests or the FSD sent us a backlog
+                 * of requests (batch mode) we are falling behind; start another thread.
+                 */
+                LastRequestTime = GetTickCount64();
+                if (0 == IdleCount ||
+                    RequestSize > FSP_FSCTL_DEFAULT_ALIGN_UP(((FSP_FSCTL_TRANSACT_REQ *)RequestBuf)->Size))
+                    FspFileSystemGrowDispatcher(FileSystem);
+            }
+            else if (Adaptive &&
+                GetTickCount64() - LastRequestTime >= FileSystem->DispatcherKeepAlive)
             {
-                Response->IoStatus.Status =
-                    FileSystem->Operations[Request->Kind](FileSystem, Request, Response);
-                FspFileSystemLeaveOperation(FileSystem, Request, Response);
+                /* no requests for KeepAlive millis; retire this thread */
+                ActiveCount = InterlockedDecrement(&FileSystem->DispatcherThreadActiveCount);
+                if (0 != FileSystem->DispatcherScaling)
+                    FileSystem->DispatcherScaling(FileSystem, ActiveCount, FALSE);
+                Result = STATUS_SUCCESS;
+                goto exit;
             }
         }
-        else
-            Response->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+        else if (!NT_SUCCESS(Result))
+            goto exit;
 
-        if (FileSystem->DebugLog)
+        Response = ResponseBuf;
+        Request = RequestBuf;
+        RequestBufEnd = (PUINT8)RequestBuf + RequestSize;
+        for (;;)
         {
-            if (FspFsctlTransactKindCount <= Response->Kind ||
-                (FileSystem->DebugLog & (1 << Response->Kind)))
-                FspDebugLogResponse(Response);
-        }
+            NextRequest = FspFsctlTransactConsumeRequest(Request, RequestBufEnd);
+            if (0 == NextRequest)
+                break;
 
-        ResponseSize = FSP_FSCTL_DEFAULT_ALIGN_UP(Response->Size);
-        if (FSP_FSCTL_TRANSACT_RSP_SIZEMAX < ResponseSize/* should NOT happen */)
-        {
-            memset(Response, 0, sizeof *Response);
-            Response->Size = sizeof *Response;
-            Response->Kind = Request->Kind;
-            Response->Hint = Request->Hint;
-            Response->IoStatus.Status = STATUS_INVALID_DEVICE_REQUEST;
+            if (!FspFsctlTransactCanProduceResponse(Response, ResponseBufEnd))
+            {
+                /* response buffer is full; flush it before processing more requests */
+                if (0 != Statistics)
+                    Statistics->TransactCount++;
+                Result = FspFsctlTransact(FileSystem->VolumeHandle,
+                    ResponseBuf, (PUINT8)Response - (PUINT8)ResponseBuf, 0, 0, FALSE);
+                if (!NT_SUCCESS(Result))
+                    goto exit;
+
+                Response = ResponseBuf;
+            }
+
+            ResponseSize = FspFileSystemDispatchRequest(FileSystem, Statistics, Request, Response);
+            Response = FspFsctlTransactProduceResponse(Response, ResponseSize);
+
+            Request = NextRequest;
         }
-        else if (STATUS_PENDING == Response->IoStatus.Status)
-            memset(Response, 0, sizeof *Response);
-        else
+    }
+
+exit:
+    FspFileSystemReleaseStatistics(FileSystem, Statistics);
+
+    MemFree(ResponseBuf);
+    MemFree(RequestBuf);
+
+    return Result;
+}
+
+static DWORD WINAPI FspFileSystemDispatcherThread(PVOID FileSystem0)
+{
+    FSP_FILE_SYSTEM *FileSystem = FileSystem0;
+    NTSTATUS Result;
+    HANDLE DispatcherThread = 0;
+
+    if (1 < FileSystem->DispatcherThreadCount)
+    {
+        FileSystem->DispatcherThreadCount--;
+        DispatcherThread = CreateThread(0, 0, FspFileSystemDispatcherThread, FileSystem, 0, 0);
+        if (0 == DispatcherThread)
         {
-            memset((PUINT8)Response + Response->Size, 0, ResponseSize - Response->Size);
-            Response->Size = (UINT16)ResponseSize;
+            Result = FspNtStatusFromWin32(GetLastError());
+            goto exit;
         }
     }
 
-exit:
-    MemFree(Response);
-    MemFree(Request);
+    Result = FspFileSystemDispatcherLoop(FileSystem, FALSE);
 
+exit:
     FspFileSystemSetDispatcherResult(FileSystem, Result);
 
     FspFsctlStop(FileSystem->VolumeHandle);
@@ -342,6 +803,24 @@ exit:
     return Result;
 }
 
+static DWORD WINAPI FspFileSystemAdaptiveDispatcherThread(PVOID FileSystem0)
+{
+    FSP_FILE_SYSTEM *FileSystem = FileSystem0;
+    NTSTATUS Result;
+
+    Result = FspFileSystemDispatcherLoop(FileSystem, TRUE);
+    if (!NT_SUCCESS(Result))
+    {
+        FspFileSystemSetDispatcherResult(FileSystem, Result);
+
+        FspFsctlStop(FileSystem->VolumeHandle);
+    }
+
+    FspFileSystemReleaseDispatcherThreadRef(FileSystem);
+
+    return Result;
+}
+
 FSP_API NTSTATUS FspFileSystemStartDispatcher(FSP_FILE_SYSTEM *FileSystem, ULONG ThreadCount)
 {
     if (0 != FileSystem->DispatcherThread)
@@ -361,6 +840,17 @@ FSP_API NTSTATUS FspFileSystemStartDispatcher(FSP_FILE_SYSTEM *FileSystem, ULONG
     if (ThreadCount < FspFileSystemDispatcherThreadCountMin)
         ThreadCount = FspFileSystemDispatcherThreadCountMin;
 
+    if (0 != FileSystem->DispatcherThreadCountMax)
+    {
+        if (FileSystem->DispatcherThreadCountMax < ThreadCount)
+            FileSystem->DispatcherThreadCountMax = ThreadCount;
+
+        FileSystem->DispatcherThreadActiveCount = ThreadCount;
+        FileSystem->DispatcherThreadIdleCount = 0;
+        FileSystem->DispatcherThreadRefCount = 1;
+        ResetEvent(FileSystem->DispatcherThreadRefEvent);
+    }
+
     FileSystem->DispatcherThreadCount = ThreadCount;
     FileSystem->DispatcherThread = CreateThread(0, 0,
         FspFileSystemDispatcherThread, FileSystem, 0, 0);
@@ -370,6 +860,64 @@ FSP_API NTSTATUS FspFileSystemStartDispatcher(FSP_FILE_SYSTEM *FileSystem, ULONG
     return STATUS_SUCCESS;
 }
 
+FSP_API NTSTATUS FspFileSystemSetDispatcherBatchSize(FSP_FILE_SYSTEM *FileSystem,
+    ULONG BatchSize)
+{
+    if (0 != FileSystem->DispatcherThread)
+        return STATUS_INVALID_PARAMETER;
+
+    if (BatchSize > FspFileSystemDispatcherBatchSizeMax)
+        BatchSize = FspFileSystemDispatcherBatchSizeMax;
+
+    FileSystem->DispatcherBatchSize = BatchSize;
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API NTSTATUS FspFileSystemSetDispatcherThreadCountMax(FSP_FILE_SYSTEM *FileSystem,
+    ULONG ThreadCountMax, ULONG KeepAlive)
+{
+    if (0 != FileSystem->DispatcherThread)
+        return STATUS_INVALID_PARAMETER;
+
+    if (ThreadCountMax > FspFileSystemDispatcherThreadCountMax)
+        ThreadCountMax = FspFileSystemDispatcherThreadCountMax;
+
+    if (0 != ThreadCountMax && 0 == FileSystem->DispatcherThreadRefEvent)
+    {
+        FileSystem->DispatcherThreadRefEvent = CreateEventW(0, TRUE, FALSE, 0);
+        if (0 == FileSystem->DispatcherThreadRefEvent)
+            return FspNtStatusFromWin32(GetLastError());
+    }
+
+    FileSystem->DispatcherThreadCountMax = ThreadCountMax;
+    FileSystem->DispatcherKeepAlive = KeepAlive;
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API NTSTATUS FspFileSystemSetResponseQueueDelay(FSP_FILE_SYSTEM *FileSystem,
+    ULONG Delay)
+{
+    if (0 != FileSystem->DispatcherThread)
+        return STATUS_INVALID_PARAMETER;
+
+    if (Delay > FspFileSystemResponseQueueDelayMax)
+        Delay = FspFileSystemResponseQueueDelayMax;
+
+    if (0 != Delay && 0 == FileSystem->ResponseQueueTimer)
+    {
+        FileSystem->ResponseQueueTimer = CreateThreadpoolTimer(
+            FspFileSystemResponseQueueTimer, FileSystem, 0);
+        if (0 == FileSystem->ResponseQueueTimer)
+            return FspNtStatusFromWin32(GetLastError());
+    }
+
+    FileSystem->ResponseQueueDelay = Delay;
+
+    return STATUS_SUCCESS;
+}
+
 FSP_API VOID FspFileSystemStopDispatcher(FSP_FILE_SYSTEM *FileSystem)
 {
     if (0 == FileSystem->DispatcherThread)
@@ -380,10 +928,58 @@ FSP_API VOID FspFileSystemStopDispatcher(FSP_FILE_SYSTEM *FileSystem)
     WaitForSingleObject(FileSystem->DispatcherThread, INFINITE);
     CloseHandle(FileSystem->DispatcherThread);
     FileSystem->DispatcherThread = 0;
+
+    if (0 != FileSystem->DispatcherThreadCountMax)
+    {
+        /* wait for any adaptive dispatcher threads to exit */
+        FspFileSystemReleaseDispatcherThreadRef(FileSystem);
+        WaitForSingleObject(FileSystem->DispatcherThreadRefEvent, INFINITE);
+    }
 }
 
-FSP_API VOID FspFileSystemSendResponse(FSP_FILE_SYSTEM *FileSystem,
-    FSP_FSCTL_TRANSACT_RSP *Response)
+FSP_API NTSTATUS FspFileSystemLoopbackTransact(FSP_FILE_SYSTEM *FileSystem,
+    PVOID RequestBuf, SIZE_T RequestBufSize,
+    PVOID ResponseBuf, SIZE_T *PResponseBufSize)
+{
+    NTSTATUS Result = STATUS_SUCCESS;
+    PUINT8 RequestBufEnd = (PUINT8)RequestBuf + RequestBufSize;
+    PUINT8 ResponseBufEnd = (PUINT8)ResponseBuf + *PResponseBufSize;
+    FSP_FSCTL_TRANSACT_REQ *Request, *NextRequest;
+    FSP_FSCTL_TRANSACT_RSP *Response;
+    SIZE_T ResponseSize;
+    FSP_FILE_SYSTEM_STATISTICS *Statistics;
+
+    Statistics = FspFileSystemAcquireStatistics(FileSystem);
+
+    Request = RequestBuf;
+    Response = ResponseBuf;
+    for (;;)
+    {
+        NextRequest = FspFsctlTransactConsumeRequest(Request, RequestBufEnd);
+        if (0 == NextRequest)
+            break;
+
+        if (!FspFsctlTransactCanProduceResponse(Response, ResponseBufEnd))
+        {
+            Result = STATUS_BUFFER_TOO_SMALL;
+            break;
+        }
+
+        ResponseSize = FspFileSystemDispatchRequest(FileSystem, Statistics, Request, Response);
+        Response = FspFsctlTransactProduceResponse(Response, ResponseSize);
+
+        Request = NextRequest;
+    }
+
+    FspFileSystemReleaseStatistics(FileSystem, Statistics);
+
+    *PResponseBufSize = (PUINT8)Response - (PUINT8)ResponseBuf;
+
+    return Result;
+}
+
+static BOOLEAN FspFileSystemSendResponseEx(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_RSP *Response, FSP_FILE_SYSTEM_ASYNC_OPERATION *Operation)
 {
     NTSTATUS Result;
 
@@ -394,6 +990,42 @@ FSP_API VOID FspFileSystemSendResponse(FSP_FILE_SYSTEM *FileSystem,
             FspDebugLogResponse(Response);
     }
 
+    if (0 != FileSystem->ResponseQueueDelay)
+    {
+        FSP_FILE_SYSTEM_QUEUED_RESPONSE *QueuedResponse;
+        SIZE_T ResponseSize = FSP_FSCTL_DEFAULT_ALIGN_UP(Response->Size);
+
+        if (0 != Operation)
+        {
+            /* queue the pooled response in place; it returns to the pool once drained */
+            QueuedResponse = (FSP_FILE_SYSTEM_QUEUED_RESPONSE *)Operation;
+        }
+        else
+        {
+            QueuedResponse = MemAlloc(sizeof *QueuedResponse + ResponseSize);
+            if (0 != QueuedResponse)
+            {
+                QueuedResponse->FileSystem = 0;
+                memcpy(QueuedResponse->ResponseBuf, Response, Response->Size);
+                memset(QueuedResponse->ResponseBuf + Response->Size, 0, ResponseSize - Response->Size);
+                ((FSP_FSCTL_TRANSACT_RSP *)QueuedResponse->ResponseBuf)->Size = (UINT16)ResponseSize;
+            }
+        }
+
+        if (0 != QueuedResponse)
+        {
+            /* if the queue was empty make sure that it gets flushed in a timely manner */
+            if (0 == InterlockedPushEntrySList(&FileSystem->ResponseQueue, &QueuedResponse->ListEntry))
+                FspFileSystemSetResponseQueueTimer(FileSystem);
+
+            return TRUE;
+        }
+
+        /* could not queue response; fall back to sending it directly */
+    }
+
+    InterlockedIncrement64(
+        &((FSP_FILE_SYSTEM_STATISTICS_STATE *)FileSystem->Statistics)->ResponseTransactCount);
     Result = FspFsctlTransact(FileSystem->VolumeHandle,
         Response, Response->Size, 0, 0, FALSE);
     if (!NT_SUCCESS(Result))
@@ -402,4 +1034,149 @@ FSP_API VOID FspFileSystemSendResponse(FSP_FILE_SYSTEM *FileSystem,
 
         FspFsctlStop(FileSystem->VolumeHandle);
     }
+
+    return FALSE;
+}
+
+FSP_API VOID FspFileSystemSendResponse(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_RSP *Response)
+{
+    FspFileSystemSendResponseEx(FileSystem, Response, 0);
+}
+
+FSP_API VOID FspFileSystemGetStatistics(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FILE_SYSTEM_STATISTICS *Statistics)
+{
+    FSP_FILE_SYSTEM_STATISTICS_STATE *State = FileSystem->Statistics;
+    FSP_FILE_SYSTEM_STATISTICS_SLOT *Slot;
+
+    AcquireSRWLockShared(&State->Lock);
+    memcpy(Statistics, &State->Retired, sizeof *Statistics);
+    for (PLIST_ENTRY ListEntry = State->SlotList.Flink;
+        &State->SlotList != ListEntry;
+        ListEntry = ListEntry->Flink)
+    {
+        Slot = CONTAINING_RECORD(ListEntry, FSP_FILE_SYSTEM_STATISTICS_SLOT, ListEntry);
+        FspFileSystemAddStatistics(Statistics, &Slot->Statistics);
+    }
+    ReleaseSRWLockShared(&State->Lock);
+
+    Statistics->ResponseTransactCount = State->ResponseTransactCount;
+    FspFileSystemGetTraverseCacheStatistics(FileSystem,
+        &Statistics->TraverseCacheHitCount, &Statistics->TraverseCacheMissCount);
+}
+
+FSP_API NTSTATUS FspFileSystemSetStatisticsDump(FSP_FILE_SYSTEM *FileSystem,
+    ULONG Interval, FSP_FILE_SYSTEM_STATISTICS_DUMP *Dump)
+{
+    FSP_FILE_SYSTEM_STATISTICS_STATE *State = FileSystem->Statistics;
+    LARGE_INTEGER DueTime;
+    FILETIME FileTime;
+
+    if (0 != State->DumpTimer)
+    {
+        SetThreadpoolTimer(State->DumpTimer, 0, 0, 0);
+        WaitForThreadpoolTimerCallbacks(State->DumpTimer, TRUE);
+        CloseThreadpoolTimer(State->DumpTimer);
+        State->DumpTimer = 0;
+    }
+
+    State->Dump = Dump;
+
+    if (0 == Interval || 0 == Dump)
+        return STATUS_SUCCESS;
+
+    State->DumpTimer = CreateThreadpoolTimer(FspFileSystemStatisticsDumpTimer, FileSystem, 0);
+    if (0 == State->DumpTimer)
+        return FspNtStatusFromWin32(GetLastError());
+
+    /* negative due time means relative; convert millis to 100ns units */
+    DueTime.QuadPart = -(LONGLONG)Interval * 10000;
+    FileTime.dwLowDateTime = DueTime.LowPart;
+    FileTime.dwHighDateTime = DueTime.HighPart;
+    SetThreadpoolTimer(State->DumpTimer, &FileTime, Interval, 0);
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API NTSTATUS FspFileSystemBeginAsyncOperation(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request, FSP_FILE_SYSTEM_ASYNC_OPERATION **POperation)
+{
+    FSP_FILE_SYSTEM_ASYNC_OPERATION *Operation;
+    PSLIST_ENTRY ListEntry;
+    FSP_FSCTL_TRANSACT_RSP *Response;
+
+    *POperation = 0;
+
+    if (FspFsctlTransactReadKind != Request->Kind &&
+        FspFsctlTransactWriteKind != Request->Kind &&
+        FspFsctlTransactQueryDirectoryKind != Request->Kind)
+        return STATUS_INVALID_PARAMETER;
+
+    ListEntry = InterlockedPopEntrySList(&FileSystem->AsyncOperationPool);
+    if (0 != ListEntry)
+        Operation = CONTAINING_RECORD(ListEntry, FSP_FILE_SYSTEM_ASYNC_OPERATION, ListEntry);
+    else
+    {
+        Operation = MemAlloc(sizeof *Operation);
+        if (0 == Operation)
+            return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Operation->FileSystem = FileSystem;
+    Response = (FSP_FSCTL_TRANSACT_RSP *)Operation->ResponseBuf;
+    memset(Response, 0, sizeof *Response);
+    Response->Size = sizeof *Response;
+    Response->Kind = Request->Kind;
+    Response->Hint = Request->Hint;
+
+    *POperation = Operation;
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API VOID FspFileSystemDeleteAsyncOperation(FSP_FILE_SYSTEM_ASYNC_OPERATION *Operation)
+{
+    FSP_FILE_SYSTEM *FileSystem = Operation->FileSystem;
+
+    if (FspFileSystemAsyncOperationPoolMax > QueryDepthSList(&FileSystem->AsyncOperationPool))
+        InterlockedPushEntrySList(&FileSystem->AsyncOperationPool, &Operation->ListEntry);
+    else
+        MemFree(Operation);
+}
+
+static VOID FspFileSystemCompleteAsyncOperation(FSP_FILE_SYSTEM_ASYNC_OPERATION *Operation,
+    NTSTATUS Status, ULONG Information, const FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    FSP_FSCTL_TRANSACT_RSP *Response = (FSP_FSCTL_TRANSACT_RSP *)Operation->ResponseBuf;
+
+    Response->IoStatus.Status = Status;
+    if (NT_SUCCESS(Status))
+    {
+        Response->IoStatus.Information = Information;
+        if (0 != FileInfo)
+            memcpy(&Response->Rsp.Write.FileInfo, FileInfo, sizeof *FileInfo);
+    }
+
+    /* if the response was queued the operation returns to the pool when the queue is drained */
+    if (!FspFileSystemSendResponseEx(Operation->FileSystem, Response, Operation))
+        FspFileSystemDeleteAsyncOperation(Operation);
+}
+
+FSP_API VOID FspFileSystemCompleteAsyncRead(FSP_FILE_SYSTEM_ASYNC_OPERATION *Operation,
+    NTSTATUS Status, ULONG BytesTransferred)
+{
+    FspFileSystemCompleteAsyncOperation(Operation, Status, BytesTransferred, 0);
+}
+
+FSP_API VOID FspFileSystemCompleteAsyncWrite(FSP_FILE_SYSTEM_ASYNC_OPERATION *Operation,
+    NTSTATUS Status, ULONG BytesTransferred, const FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    FspFileSystemCompleteAsyncOperation(Operation, Status, BytesTransferred, FileInfo);
+}
+
+FSP_API VOID FspFileSystemCompleteAsyncReadDirectory(FSP_FILE_SYSTEM_ASYNC_OPERATION *Operation,
+    NTSTATUS Status, ULONG BytesTransferred)
+{
+    FspFileSystemCompleteAsyncOperation(Operation, Status, BytesTransferred, 0);
 }
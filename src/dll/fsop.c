@@ -570,6 +570,9 @@ FSP_API NTSTATUS FspFileSystemOpCleanup(FSP_FILE_SYSTEM *FileSystem,
             0 != Request->FileName.Size ? (PWSTR)Request->Buffer : 0,
             0 != Request->Req.Cleanup.Delete);
 
+    if (Request->Req.Cleanup.Delete)
+        FspFileSystemInvalidateTraverseCache(FileSystem);
+
     return STATUS_SUCCESS;
 }
 
@@ -738,6 +741,7 @@ FSP_API NTSTATUS FspFileSystemOpSetInformation(FSP_FILE_SYSTEM *FileSystem,
                 (PWSTR)Request->Buffer,
                 (PWSTR)(Request->Buffer + Request->Req.SetInformation.Info.Rename.NewFileName.Offset),
                 0 != Request->Req.SetInformation.Info.Rename.AccessToken);
+            FspFileSystemInvalidateTraverseCache(FileSystem);
         }
         break;
     }
@@ -844,13 +848,19 @@ FSP_API NTSTATUS FspFileSystemOpQuerySecurity(FSP_FILE_SYSTEM *FileSystem,
 FSP_API NTSTATUS FspFileSystemOpSetSecurity(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_REQ *Request, FSP_FSCTL_TRANSACT_RSP *Response)
 {
+    NTSTATUS Result;
+
     if (0 == FileSystem->Interface->SetSecurity)
         return STATUS_INVALID_DEVICE_REQUEST;
 
-    return FileSystem->Interface->SetSecurity(FileSystem, Request,
+    Result = FileSystem->Interface->SetSecurity(FileSystem, Request,
         (PVOID)Request->Req.SetSecurity.UserContext,
         Request->Req.SetSecurity.SecurityInformation,
         (PSECURITY_DESCRIPTOR)Request->Buffer);
+
+    FspFileSystemInvalidateTraverseCache(FileSystem);
+
+    return Result;
 }
 
 FSP_API BOOLEAN FspFileSystemAddDirInfo(FSP_FSCTL_DIR_INFO *DirInfo,
@@ -37,10 +37,14 @@ struct fsp_fuse_core_opt_data
         set_umask, umask,
         set_uid, uid,
         set_gid, gid,
-        set_attr_timeout, attr_timeout;
+        set_attr_timeout, attr_timeout,
+        set_entry_timeout, entry_timeout,
+        negative_timeout;
     int set_FileInfoTimeout;
     int CaseInsensitiveSearch, ReparsePoints,
         NamedStreams, ReadOnlyVolume;
+    int ReaddirPlus;
+    unsigned readdir_parallel;
     FSP_FSCTL_VOLUME_PARAMS VolumeParams;
 };
 
@@ -58,6 +62,7 @@ static struct fuse_opt fsp_fuse_core_opts[] =
     FSP_FUSE_CORE_OPT("hard_remove", hard_remove, 1),
     FSP_FUSE_CORE_OPT("use_ino", use_ino, 1),
     FSP_FUSE_CORE_OPT("readdir_ino", readdir_ino, 1),
+    FSP_FUSE_CORE_OPT("readdir_parallel=%u", readdir_parallel, 0),
     FUSE_OPT_KEY("direct_io", FUSE_OPT_KEY_DISCARD),
     FUSE_OPT_KEY("kernel_cache", FUSE_OPT_KEY_DISCARD),
     FUSE_OPT_KEY("auto_cache", FUSE_OPT_KEY_DISCARD),
@@ -68,11 +73,12 @@ static struct fuse_opt fsp_fuse_core_opts[] =
     FSP_FUSE_CORE_OPT("uid=%d", uid, 0),
     FSP_FUSE_CORE_OPT("gid=", set_gid, 1),
     FSP_FUSE_CORE_OPT("gid=%d", gid, 0),
-    FUSE_OPT_KEY("entry_timeout", FUSE_OPT_KEY_DISCARD),
+    FSP_FUSE_CORE_OPT("entry_timeout=", set_entry_timeout, 1),
+    FSP_FUSE_CORE_OPT("entry_timeout=%d", entry_timeout, 0),
     FSP_FUSE_CORE_OPT("attr_timeout=", set_attr_timeout, 1),
     FSP_FUSE_CORE_OPT("attr_timeout=%d", attr_timeout, 0),
     FUSE_OPT_KEY("ac_attr_timeout", FUSE_OPT_KEY_DISCARD),
-    FUSE_OPT_KEY("negative_timeout", FUSE_OPT_KEY_DISCARD),
+    FSP_FUSE_CORE_OPT("negative_timeout=%d", negative_timeout, 0),
     FUSE_OPT_KEY("noforget", FUSE_OPT_KEY_DISCARD),
     FUSE_OPT_KEY("intr", FUSE_OPT_KEY_DISCARD),
     FUSE_OPT_KEY("intr_signal=", FUSE_OPT_KEY_DISCARD),
@@ -88,12 +94,15 @@ static struct fuse_opt fsp_fuse_core_opts[] =
     FSP_FUSE_CORE_OPT("IrpCapacity=%u", VolumeParams.IrpCapacity, 0),
     FSP_FUSE_CORE_OPT("FileInfoTimeout=", set_FileInfoTimeout, 1),
     FSP_FUSE_CORE_OPT("FileInfoTimeout=%d", VolumeParams.FileInfoTimeout, 0),
+    FSP_FUSE_CORE_OPT("SecurityCacheSize=%u", VolumeParams.SecurityCacheSize, 0),
+    FSP_FUSE_CORE_OPT("DirInfoCacheSize=%u", VolumeParams.DirInfoCacheSize, 0),
     FSP_FUSE_CORE_OPT("CaseInsensitiveSearch", CaseInsensitiveSearch, 1),
     FSP_FUSE_CORE_OPT("ReparsePoints", ReparsePoints, 1),
     FSP_FUSE_CORE_OPT("NamedStreams", NamedStreams, 1),
     FUSE_OPT_KEY("HardLinks", FUSE_OPT_KEY_DISCARD),
     FUSE_OPT_KEY("ExtendedAttributes", FUSE_OPT_KEY_DISCARD),
     FSP_FUSE_CORE_OPT("ReadOnlyVolume", ReadOnlyVolume, 1),
+    FSP_FUSE_CORE_OPT("ReaddirPlus", ReaddirPlus, 1),
     FUSE_OPT_KEY("--UNC=", 'U'),
     FUSE_OPT_KEY("--VolumePrefix=", 'U'),
 
@@ -168,6 +177,7 @@ VOID fsp_fuse_finalize_thread(VOID)
         context = TlsGetValue(fsp_fuse_tlskey);
         if (0 != context)
         {
+            MemFree(FSP_FUSE_HDR_FROM_CONTEXT(context)->ArenaBuf);
             fsp_fuse_obj_free(FSP_FUSE_HDR_FROM_CONTEXT(context));
             TlsSetValue(fsp_fuse_tlskey, 0);
         }
@@ -253,16 +263,13 @@ static NTSTATUS fsp_fuse_preflight(struct fuse *f)
     return STATUS_SUCCESS;
 }
 
-static NTSTATUS fsp_fuse_svcstart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
+static NTSTATUS fsp_fuse_start(struct fuse *f, BOOLEAN StartDispatcher)
 {
-    struct fuse *f = Service->UserContext;
     struct fuse_context *context;
     struct fuse_conn_info conn;
     NTSTATUS Result;
 
-    f->Service = Service;
-
-    context = fsp_fuse_get_context(f->env);
+    context = fsp_fuse_get_context_internal(f->env);
     if (0 == context)
     {
         Result = STATUS_INSUFFICIENT_RESOURCES;
@@ -284,22 +291,34 @@ static NTSTATUS fsp_fuse_svcstart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
         //FUSE_CAP_ATOMIC_O_TRUNC |     /* due to Windows/WinFsp design, no support */
         //FUSE_CAP_EXPORT_SUPPORT |     /* not needed in Windows/WinFsp */
         FUSE_CAP_BIG_WRITES |
-        FUSE_CAP_DONT_MASK;
-    if (0 != f->ops.init)
+        FUSE_CAP_DONT_MASK |
+        FSP_FUSE_CAP_READDIR_PLUS;
+    if (f->ReaddirPlus)
+        conn.want |= FSP_FUSE_CAP_READDIR_PLUS;
+    if (f->LowLevel)
+    {
+        if (0 != f->llops.init)
+            f->llops.init(f->data, &conn);
+    }
+    else if (0 != f->ops.init)
         context->private_data = f->data = f->ops.init(&conn);
     f->fsinit = TRUE;
-    if (0 != f->ops.statfs)
+    f->ReaddirPlus = 0 != (conn.want & FSP_FUSE_CAP_READDIR_PLUS);
+    if (f->LowLevel ? 0 != f->llops.statfs : 0 != f->ops.statfs)
     {
         struct fuse_statvfs stbuf;
         int err;
 
         memset(&stbuf, 0, sizeof stbuf);
-        err = f->ops.statfs("/", &stbuf);
-        if (0 != err)
+        if (f->LowLevel)
+            Result = fsp_fuse_ll_statfs(f, &stbuf);
+        else
         {
+            err = f->ops.statfs("/", &stbuf);
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
-            goto fail;
         }
+        if (!NT_SUCCESS(Result))
+            goto fail;
 
         if (stbuf.f_frsize > FSP_FUSE_SECTORSIZE_MAX)
             stbuf.f_frsize = FSP_FUSE_SECTORSIZE_MAX;
@@ -308,18 +327,21 @@ static NTSTATUS fsp_fuse_svcstart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
         if (0 == f->VolumeParams.MaxComponentLength)
             f->VolumeParams.MaxComponentLength = (UINT16)stbuf.f_namemax;
     }
-    if (0 != f->ops.getattr)
+    if (f->LowLevel ? 0 != f->llops.getattr : 0 != f->ops.getattr)
     {
         struct fuse_stat stbuf;
         int err;
 
         memset(&stbuf, 0, sizeof stbuf);
-        err = f->ops.getattr("/", (void *)&stbuf);
-        if (0 != err)
+        if (f->LowLevel)
+            Result = fsp_fuse_ll_getattr(f, FUSE_ROOT_ID, &stbuf);
+        else
         {
+            err = f->ops.getattr("/", (void *)&stbuf);
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
-            goto fail;
         }
+        if (!NT_SUCCESS(Result))
+            goto fail;
 
         if (0 == f->VolumeParams.VolumeCreationTime)
         {
@@ -359,7 +381,7 @@ static NTSTATUS fsp_fuse_svcstart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
     Result = FspFileSystemCreate(
         f->VolumeParams.Prefix[0] ?
             L"" FSP_FSCTL_NET_DEVICE_NAME : L"" FSP_FSCTL_DISK_DEVICE_NAME,
-        &f->VolumeParams, &fsp_fuse_intf,
+        &f->VolumeParams, f->LowLevel ? &fsp_fuse_ll_intf : &fsp_fuse_intf,
         &f->FileSystem);
     if (!NT_SUCCESS(Result))
     {
@@ -385,12 +407,15 @@ static NTSTATUS fsp_fuse_svcstart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
         }
     }
 
-    Result = FspFileSystemStartDispatcher(f->FileSystem, 0);
-    if (!NT_SUCCESS(Result))
+    if (StartDispatcher)
     {
-        FspServiceLog(EVENTLOG_ERROR_TYPE,
-            L"Cannot start " FSP_FUSE_LIBRARY_NAME " file system dispatcher.");
-        goto fail;
+        Result = FspFileSystemStartDispatcher(f->FileSystem, 0);
+        if (!NT_SUCCESS(Result))
+        {
+            FspServiceLog(EVENTLOG_ERROR_TYPE,
+                L"Cannot start " FSP_FUSE_LIBRARY_NAME " file system dispatcher.");
+            goto fail;
+        }
     }
 
     return STATUS_SUCCESS;
@@ -401,6 +426,15 @@ fail:
     return Result;
 }
 
+static NTSTATUS fsp_fuse_svcstart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
+{
+    struct fuse *f = Service->UserContext;
+
+    f->Service = Service;
+
+    return fsp_fuse_start(f, TRUE);
+}
+
 static NTSTATUS fsp_fuse_svcstop(FSP_SERVICE *Service)
 {
     struct fuse *f = Service->UserContext;
@@ -414,6 +448,16 @@ static NTSTATUS fsp_fuse_svcstop(FSP_SERVICE *Service)
 
 static void fsp_fuse_cleanup(struct fuse *f)
 {
+    if (0 != f->DebugLog && 0 != f->ReaddirGetattrAvoidedCount)
+        FspDebugLog(FSP_FUSE_LIBRARY_NAME ": readdir: %lu getattr calls avoided\n",
+            (ULONG)f->ReaddirGetattrAvoidedCount);
+    if (0 != f->DebugLog && 0 != f->AttrCacheBuckets)
+        FspDebugLog(FSP_FUSE_LIBRARY_NAME ": attr cache: %lu getattr calls, %lu hits\n",
+            (ULONG)f->GetattrCount, (ULONG)f->AttrCacheHitCount);
+    if (0 != f->DebugLog && f->LowLevel)
+        FspDebugLog(FSP_FUSE_LIBRARY_NAME ": dentry cache: %lu lookup calls, %lu hits\n",
+            (ULONG)f->LookupCount, (ULONG)f->DentryCacheHitCount);
+
     if (0 != f->FileSystem)
     {
         FspFileSystemDelete(f->FileSystem);
@@ -422,7 +466,15 @@ static void fsp_fuse_cleanup(struct fuse *f)
 
     if (f->fsinit)
     {
-        if (f->ops.destroy)
+        if (f->LowLevel)
+        {
+            /* return all lookup counts before the file system goes away */
+            fsp_fuse_ll_file_desc_release_all(f);
+            fsp_fuse_ll_dentry_cache_flush(f);
+            if (f->llops.destroy)
+                f->llops.destroy(f->data);
+        }
+        else if (f->ops.destroy)
             f->ops.destroy(f->data);
         f->fsinit = FALSE;
     }
@@ -448,7 +500,11 @@ static int fsp_fuse_core_opt_proc(void *opt_data0, const char *arg, int key,
             "    -o VolumeCreationTime=T    volume creation time (FILETIME hex format)\n"
             "    -o VolumeSerialNumber=N    32-bit wide\n"
             "    -o FileInfoTimeout=N       FileInfo/Security/VolumeInfo timeout (millisec)\n"
+            "    -o SecurityCacheSize=N     security cache budget (bytes)\n"
+            "    -o DirInfoCacheSize=N      directory cache budget (bytes)\n"
             "    -o CaseInsensitiveSearch   file system supports case-insensitive file names\n"
+            "    -o ReaddirPlus             readdir stbuf is complete; skip getattr on listing\n"
+            "    -o readdir_parallel=N      fetch missing readdir attributes with N threads\n"
             //"    -o ReparsePoints           file system supports reparse points\n"
             //"    -o NamedStreams            file system supports named streams\n"
             //"    -o ReadOnlyVolume          file system is read only\n"
@@ -473,9 +529,62 @@ static int fsp_fuse_core_opt_proc(void *opt_data0, const char *arg, int key,
     }
 }
 
-FSP_FUSE_API struct fuse *fsp_fuse_new(struct fsp_fuse_env *env,
+static NTSTATUS fsp_fuse_set_chan(struct fuse *f, struct fuse_chan *ch,
+    PWSTR *PErrorMessage)
+{
+    ULONG Size;
+    NTSTATUS Result;
+
+    Size = (lstrlenW(ch->MountPoint) + 1) * sizeof(WCHAR);
+    f->MountPoint = fsp_fuse_obj_alloc(f->env, Size);
+    if (0 == f->MountPoint)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    memcpy(f->MountPoint, ch->MountPoint, Size);
+
+    Result = fsp_fuse_preflight(f);
+    if (!NT_SUCCESS(Result))
+    {
+        switch (Result)
+        {
+        case STATUS_ACCESS_DENIED:
+            *PErrorMessage = L": access denied.";
+            break;
+
+        case STATUS_NO_SUCH_DEVICE:
+            *PErrorMessage = L": FSD not found.";
+            break;
+
+        case STATUS_OBJECT_NAME_INVALID:
+            *PErrorMessage = L": invalid mount point.";
+            break;
+
+        case STATUS_OBJECT_NAME_COLLISION:
+            *PErrorMessage = L": mount point in use.";
+            break;
+
+        default:
+            *PErrorMessage = L": unspecified error.";
+            break;
+        }
+
+        fsp_fuse_obj_free(f->MountPoint);
+        f->MountPoint = 0;
+
+        return Result;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Creates a file system for either the high-level (ops) or the low-level (llops) API.
+ * The channel is optional: low-level sessions get it later with fuse_session_add_chan.
+ */
+static struct fuse *fsp_fuse_new_common(struct fsp_fuse_env *env,
     struct fuse_chan *ch, struct fuse_args *args,
-    const struct fuse_operations *ops, size_t opsize, void *data)
+    const struct fuse_operations *ops, size_t opsize,
+    const struct fuse_lowlevel_ops *llops, size_t llopsize,
+    void *data)
 {
     struct fuse *f = 0;
     struct fsp_fuse_core_opt_data opt_data;
@@ -485,6 +594,8 @@ FSP_FUSE_API struct fuse *fsp_fuse_new(struct fsp_fuse_env *env,
 
     if (opsize > sizeof(struct fuse_operations))
         opsize = sizeof(struct fuse_operations);
+    if (llopsize > sizeof(struct fuse_lowlevel_ops))
+        llopsize = sizeof(struct fuse_lowlevel_ops);
 
     memset(&opt_data, 0, sizeof opt_data);
     opt_data.env = env;
@@ -495,7 +606,7 @@ FSP_FUSE_API struct fuse *fsp_fuse_new(struct fsp_fuse_env *env,
         return 0;
 
     if (!opt_data.set_FileInfoTimeout && opt_data.set_attr_timeout)
-        opt_data.VolumeParams.FileInfoTimeout = opt_data.set_attr_timeout * 1000;
+        opt_data.VolumeParams.FileInfoTimeout = opt_data.attr_timeout * 1000;
     opt_data.VolumeParams.CaseSensitiveSearch = !opt_data.CaseInsensitiveSearch;
     opt_data.VolumeParams.PersistentAcls = TRUE;
     opt_data.VolumeParams.ReparsePoints = !!opt_data.ReparsePoints;
@@ -510,44 +621,54 @@ FSP_FUSE_API struct fuse *fsp_fuse_new(struct fsp_fuse_env *env,
     f->set_umask = opt_data.set_umask; f->umask = opt_data.umask;
     f->set_uid = opt_data.set_uid; f->uid = opt_data.uid;
     f->set_gid = opt_data.set_gid; f->gid = opt_data.gid;
-    memcpy(&f->ops, ops, opsize);
+    if (0 != llops)
+    {
+        f->LowLevel = TRUE;
+        memcpy(&f->llops, llops, llopsize);
+    }
+    else
+        memcpy(&f->ops, ops, opsize);
     f->data = data;
     f->DebugLog = opt_data.debug ? -1 : 0;
+    f->ReaddirPlus = !!opt_data.ReaddirPlus;
+    f->ReaddirParallel = opt_data.readdir_parallel < FSP_FUSE_READDIR_PARALLEL_MAX ?
+        opt_data.readdir_parallel : FSP_FUSE_READDIR_PARALLEL_MAX;
+    if (opt_data.set_attr_timeout)
+    {
+        /* cached attributes cannot outlive the entry that they were obtained through */
+        if (opt_data.set_entry_timeout && opt_data.entry_timeout < opt_data.attr_timeout)
+            opt_data.attr_timeout = opt_data.entry_timeout;
+        if (0 < opt_data.attr_timeout)
+            f->AttrTimeout = (UINT64)opt_data.attr_timeout * 1000;
+    }
+    if (0 < opt_data.negative_timeout)
+        f->NegativeTimeout = (UINT64)opt_data.negative_timeout * 1000;
     memcpy(&f->VolumeParams, &opt_data.VolumeParams, sizeof opt_data.VolumeParams);
 
-    Size = (lstrlenW(ch->MountPoint) + 1) * sizeof(WCHAR);
-    f->MountPoint = fsp_fuse_obj_alloc(env, Size);
-    if (0 == f->MountPoint)
-        goto fail;
-    memcpy(f->MountPoint, ch->MountPoint, Size);
-
-    Result = fsp_fuse_preflight(f);
-    if (!NT_SUCCESS(Result))
+    if (!f->LowLevel && (0 != f->AttrTimeout || 0 != f->NegativeTimeout))
     {
-        switch (Result)
-        {
-        case STATUS_ACCESS_DENIED:
-            ErrorMessage = L": access denied.";
-            break;
-
-        case STATUS_NO_SUCH_DEVICE:
-            ErrorMessage = L": FSD not found.";
-            break;
-
-        case STATUS_OBJECT_NAME_INVALID:
-            ErrorMessage = L": invalid mount point.";
-            break;
-
-        case STATUS_OBJECT_NAME_COLLISION:
-            ErrorMessage = L": mount point in use.";
-            break;
+        Size = FSP_FUSE_ATTR_CACHE_BUCKETS * sizeof f->AttrCacheBuckets[0];
+        f->AttrCacheBuckets = MemAlloc(Size);
+        if (0 == f->AttrCacheBuckets)
+            goto fail;
+        memset(f->AttrCacheBuckets, 0, Size);
+    }
 
-        default:
-            ErrorMessage = L": unspecified error.";
-            break;
-        }
+    if (f->LowLevel)
+    {
+        Size = FSP_FUSE_DENTRY_CACHE_BUCKETS * sizeof f->DentryCacheBuckets[0];
+        f->DentryCacheBuckets = MemAlloc(Size);
+        if (0 == f->DentryCacheBuckets)
+            goto fail;
+        memset(f->DentryCacheBuckets, 0, Size);
+        InitializeListHead(&f->FileDescList);
+    }
 
-        goto fail;
+    if (0 != ch)
+    {
+        Result = fsp_fuse_set_chan(f, ch, &ErrorMessage);
+        if (!NT_SUCCESS(Result))
+            goto fail;
     }
 
     return f;
@@ -563,12 +684,26 @@ fail:
     return 0;
 }
 
+FSP_FUSE_API struct fuse *fsp_fuse_new(struct fsp_fuse_env *env,
+    struct fuse_chan *ch, struct fuse_args *args,
+    const struct fuse_operations *ops, size_t opsize, void *data)
+{
+    return fsp_fuse_new_common(env, ch, args, ops, opsize, 0, 0, data);
+}
+
 FSP_FUSE_API void fsp_fuse_destroy(struct fsp_fuse_env *env,
     struct fuse *f)
 {
     fsp_fuse_cleanup(f);
 
-    fsp_fuse_obj_free(f->MountPoint);
+    fsp_fuse_file_desc_pool_finalize(f);
+
+    fsp_fuse_attr_cache_finalize(f);
+
+    fsp_fuse_ll_dentry_cache_finalize(f);
+
+    if (0 != f->MountPoint)
+        fsp_fuse_obj_free(f->MountPoint);
 
     fsp_fuse_obj_free(f);
 }
@@ -589,6 +724,23 @@ FSP_FUSE_API int fsp_fuse_loop_mt(struct fsp_fuse_env *env,
         0 : -1;
 }
 
+FSP_FUSE_API NTSTATUS fsp_fuse_loopback_start(struct fsp_fuse_env *env,
+    struct fuse *f, FSP_FILE_SYSTEM **PFileSystem)
+{
+    NTSTATUS Result;
+
+    *PFileSystem = 0;
+
+    f->OpGuardStrategy = FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_FINE;
+    Result = fsp_fuse_start(f, FALSE);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    *PFileSystem = f->FileSystem;
+
+    return STATUS_SUCCESS;
+}
+
 FSP_FUSE_API void fsp_fuse_exit(struct fsp_fuse_env *env,
     struct fuse *f)
 {
@@ -596,7 +748,67 @@ FSP_FUSE_API void fsp_fuse_exit(struct fsp_fuse_env *env,
         FspServiceStop(f->Service);
 }
 
-FSP_FUSE_API struct fuse_context *fsp_fuse_get_context(struct fsp_fuse_env *env)
+/*
+ * A low-level session is a struct fuse that serves llops (see also fuse_get_session).
+ */
+FSP_FUSE_API struct fuse_session *fsp_fuse_lowlevel_new(struct fsp_fuse_env *env,
+    struct fuse_args *args,
+    const struct fuse_lowlevel_ops *op, size_t op_size, void *userdata)
+{
+    return (struct fuse_session *)fsp_fuse_new_common(env, 0, args, 0, 0, op, op_size, userdata);
+}
+
+FSP_FUSE_API void fsp_fuse_session_add_chan(struct fsp_fuse_env *env,
+    struct fuse_session *se, struct fuse_chan *ch)
+{
+    struct fuse *f = (struct fuse *)se;
+    PWSTR ErrorMessage = L".";
+
+    /* only a single channel is supported */
+    if (0 != f->MountPoint)
+        return;
+
+    if (!NT_SUCCESS(fsp_fuse_set_chan(f, ch, &ErrorMessage)))
+        FspServiceLog(EVENTLOG_ERROR_TYPE,
+            L"Cannot create " FSP_FUSE_LIBRARY_NAME " file system%s",
+            ErrorMessage);
+}
+
+FSP_FUSE_API void fsp_fuse_session_destroy(struct fsp_fuse_env *env,
+    struct fuse_session *se)
+{
+    fsp_fuse_destroy(env, (struct fuse *)se);
+}
+
+FSP_FUSE_API int fsp_fuse_session_loop(struct fsp_fuse_env *env,
+    struct fuse_session *se)
+{
+    struct fuse *f = (struct fuse *)se;
+
+    if (0 == f->MountPoint)
+        return -1;
+
+    return fsp_fuse_loop(env, f);
+}
+
+FSP_FUSE_API int fsp_fuse_session_loop_mt(struct fsp_fuse_env *env,
+    struct fuse_session *se)
+{
+    struct fuse *f = (struct fuse *)se;
+
+    if (0 == f->MountPoint)
+        return -1;
+
+    return fsp_fuse_loop_mt(env, f);
+}
+
+FSP_FUSE_API void fsp_fuse_session_exit(struct fsp_fuse_env *env,
+    struct fuse_session *se)
+{
+    fsp_fuse_exit(env, (struct fuse *)se);
+}
+
+struct fuse_context *fsp_fuse_get_context_internal(struct fsp_fuse_env *env)
 {
     struct fuse_context *context;
 
@@ -623,6 +835,18 @@ FSP_FUSE_API struct fuse_context *fsp_fuse_get_context(struct fsp_fuse_env *env)
     return context;
 }
 
+FSP_FUSE_API struct fuse_context *fsp_fuse_get_context(struct fsp_fuse_env *env)
+{
+    struct fuse_context *context;
+
+    context = fsp_fuse_get_context_internal(env);
+    if (0 != context)
+        /* uid/gid are resolved lazily; failure leaves them at -1 */
+        fsp_fuse_context_resolve_ids(context);
+
+    return context;
+}
+
 FSP_FUSE_API int32_t fsp_fuse_ntstatus_from_errno(struct fsp_fuse_env *env,
     int err)
 {
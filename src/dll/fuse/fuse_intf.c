@@ -17,17 +17,402 @@
 
 #include <dll/fuse/library.h>
 
-NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
-    FSP_FSCTL_TRANSACT_REQ *Request, FSP_FSCTL_TRANSACT_RSP *Response)
+/*
+ * Request-scoped temporaries (POSIX paths, token information, directory scratch buffers)
+ * are allocated from a per-thread bump arena that is reset in fsp_fuse_op_leave. Requests
+ * that do not fit in the arena fall back to the heap; fsp_fuse_arena_free must therefore
+ * be called on every arena pointer, but it is a no-op for memory inside the arena.
+ */
+PVOID fsp_fuse_arena_alloc(struct fsp_fuse_context_header *contexthdr, ULONG Size)
 {
-    struct fuse *f = FileSystem->UserContext;
-    struct fuse_context *context;
-    struct fsp_fuse_context_header *contexthdr;
-    char *PosixPath = 0;
-    UINT32 Uid = -1, Gid = -1;
-    PWSTR FileName = 0, Suffix;
-    WCHAR Root[2] = L"\\";
-    HANDLE Token = 0;
+    PVOID Pointer;
+
+    Size = FSP_FSCTL_DEFAULT_ALIGN_UP(Size);
+
+    if (0 == contexthdr->ArenaBuf)
+        contexthdr->ArenaBuf = MemAlloc(FSP_FUSE_ARENA_SIZE);
+
+    if (0 != contexthdr->ArenaBuf && FSP_FUSE_ARENA_SIZE - contexthdr->ArenaUsed >= Size)
+    {
+        Pointer = contexthdr->ArenaBuf + contexthdr->ArenaUsed;
+        contexthdr->ArenaUsed += Size;
+        return Pointer;
+    }
+
+    return MemAlloc(Size);
+}
+
+VOID fsp_fuse_arena_free(struct fsp_fuse_context_header *contexthdr, PVOID Pointer)
+{
+    if (0 != contexthdr->ArenaBuf &&
+        contexthdr->ArenaBuf <= (PUINT8)Pointer &&
+        contexthdr->ArenaBuf + FSP_FUSE_ARENA_SIZE > (PUINT8)Pointer)
+        return;
+
+    MemFree(Pointer);
+}
+
+NTSTATUS fsp_fuse_arena_posix_path(struct fsp_fuse_context_header *contexthdr,
+    PWSTR WindowsPath, char **PPosixPath)
+{
+    char *PosixPath;
+    ULONG Size;
+    NTSTATUS Result;
+
+    *PPosixPath = 0;
+
+    /* a UTF-16 code unit never needs more than 3 bytes of UTF-8 */
+    Size = lstrlenW(WindowsPath) * 3 + 1;
+    PosixPath = fsp_fuse_arena_alloc(contexthdr, Size);
+    if (0 == PosixPath)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Result = FspPosixMapWindowsToPosixPathEx(WindowsPath, PosixPath, &Size);
+    if (!NT_SUCCESS(Result))
+    {
+        fsp_fuse_arena_free(contexthdr, PosixPath);
+        return Result;
+    }
+
+    *PPosixPath = PosixPath;
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * File descriptors outlive the request that creates them, so they come from a per-file
+ * system pool instead. Paths that fit in PosixPathBuf are stored inline.
+ */
+static struct fsp_fuse_file_desc *fsp_fuse_file_desc_alloc(struct fuse *f,
+    const char *PosixPath)
+{
+    struct fsp_fuse_file_desc *filedesc;
+    PSLIST_ENTRY ListEntry;
+    ULONG Size;
+
+    ListEntry = InterlockedPopEntrySList(&f->FileDescPool);
+    if (0 != ListEntry)
+        filedesc = CONTAINING_RECORD(ListEntry, struct fsp_fuse_file_desc, ListEntry);
+    else
+    {
+        filedesc = MemAlloc(sizeof *filedesc);
+        if (0 == filedesc)
+            return 0;
+    }
+
+    Size = lstrlenA(PosixPath) + 1;
+    if (sizeof filedesc->PosixPathBuf >= Size)
+        filedesc->PosixPath = filedesc->PosixPathBuf;
+    else
+    {
+        filedesc->PosixPath = MemAlloc(Size);
+        if (0 == filedesc->PosixPath)
+        {
+            MemFree(filedesc);
+            return 0;
+        }
+    }
+    memcpy(filedesc->PosixPath, PosixPath, Size);
+
+    filedesc->IsDirectory = FALSE;
+    filedesc->OpenFlags = 0;
+    filedesc->FileHandle = -1;
+    filedesc->DirBuffer = 0;
+    filedesc->DirBufferSize = 0;
+
+    return filedesc;
+}
+
+static VOID fsp_fuse_file_desc_free(struct fuse *f, struct fsp_fuse_file_desc *filedesc)
+{
+    if (0 == filedesc)
+        return;
+
+    MemFree(filedesc->DirBuffer);
+    if (filedesc->PosixPathBuf != filedesc->PosixPath)
+        MemFree(filedesc->PosixPath);
+
+    if (FSP_FUSE_FILE_DESC_POOLMAX > QueryDepthSList(&f->FileDescPool))
+        InterlockedPushEntrySList(&f->FileDescPool, &filedesc->ListEntry);
+    else
+        MemFree(filedesc);
+}
+
+VOID fsp_fuse_file_desc_pool_finalize(struct fuse *f)
+{
+    PSLIST_ENTRY ListEntry;
+
+    while (0 != (ListEntry = InterlockedPopEntrySList(&f->FileDescPool)))
+        MemFree(CONTAINING_RECORD(ListEntry, struct fsp_fuse_file_desc, ListEntry));
+}
+
+/*
+ * Attribute cache (-o attr_timeout=N,entry_timeout=N,negative_timeout=N).
+ *
+ * Results of getattr are cached by POSIX path: successful results for attr_timeout (bounded
+ * by entry_timeout) and ENOENT results for negative_timeout. Operations done through this
+ * adapter keep the cache coherent: writes and truncates update the cached size and times,
+ * while create, unlink, rmdir, utimens, chmod and chown invalidate the affected path and a
+ * rename flushes the cache (as it also renames all descendants). Changes made to the backing
+ * store by other means are only observed after the timeouts expire, which is the libfuse
+ * attr_timeout/entry_timeout/negative_timeout contract.
+ *
+ * On case-insensitive mounts different spellings of a path name the same file, so items are
+ * hashed and compared with ASCII case folding. A path with non-ASCII characters is never
+ * cached there and invalidating one flushes the cache, because Windows case rules can make
+ * such a path equal to an ASCII one (e.g. U+0131 and "I").
+ */
+struct fsp_fuse_attr_cache_item
+{
+    struct fsp_fuse_attr_cache_item *DictNext;
+    ULONG Hash, PosixPathSize;
+    UINT64 ExpirationTime;
+    BOOLEAN Negative;
+    struct fuse_stat stbuf;
+    char PosixPath[];
+};
+
+static inline UINT8 fsp_fuse_attr_cache_fold(UINT8 c)
+{
+    return 'A' <= c && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static BOOLEAN fsp_fuse_attr_cache_hash(struct fuse *f, const char *PosixPath,
+    PULONG PHash, PULONG PSize)
+{
+    BOOLEAN CaseInsensitive = !f->VolumeParams.CaseSensitiveSearch;
+    ULONG Hash = 2166136261;
+    const char *P;
+    UINT8 c;
+
+    for (P = PosixPath; *P; P++)
+    {
+        c = (UINT8)*P;
+        if (CaseInsensitive)
+        {
+            if (0x80 <= c)
+                return FALSE;
+            c = fsp_fuse_attr_cache_fold(c);
+        }
+        Hash = (Hash ^ c) * 16777619;
+    }
+    *PHash = Hash;
+    *PSize = (ULONG)(P - PosixPath) + 1;
+
+    return TRUE;
+}
+
+static BOOLEAN fsp_fuse_attr_cache_equal(struct fuse *f,
+    const char *PosixPath1, const char *PosixPath2, ULONG Size)
+{
+    if (f->VolumeParams.CaseSensitiveSearch)
+        return 0 == memcmp(PosixPath1, PosixPath2, Size);
+
+    for (ULONG I = 0; Size > I; I++)
+        if (fsp_fuse_attr_cache_fold(PosixPath1[I]) != fsp_fuse_attr_cache_fold(PosixPath2[I]))
+            return FALSE;
+
+    return TRUE;
+}
+
+static VOID fsp_fuse_attr_cache_flush_nolock(struct fuse *f)
+{
+    struct fsp_fuse_attr_cache_item *Item, *NextItem;
+
+    for (ULONG I = 0; FSP_FUSE_ATTR_CACHE_BUCKETS > I; I++)
+    {
+        for (Item = f->AttrCacheBuckets[I]; 0 != Item; Item = NextItem)
+        {
+            NextItem = Item->DictNext;
+            MemFree(Item);
+        }
+        f->AttrCacheBuckets[I] = 0;
+    }
+    f->AttrCacheItemCount = 0;
+}
+
+static struct fsp_fuse_attr_cache_item **fsp_fuse_attr_cache_find_nolock(struct fuse *f,
+    const char *PosixPath, ULONG Hash, ULONG Size)
+{
+    struct fsp_fuse_attr_cache_item **P;
+
+    for (P = &f->AttrCacheBuckets[Hash % FSP_FUSE_ATTR_CACHE_BUCKETS]; 0 != *P; P = &(*P)->DictNext)
+        if ((*P)->Hash == Hash && (*P)->PosixPathSize == Size &&
+            fsp_fuse_attr_cache_equal(f, (*P)->PosixPath, PosixPath, Size))
+            break;
+
+    return P;
+}
+
+static BOOLEAN fsp_fuse_attr_cache_lookup(struct fuse *f, const char *PosixPath,
+    struct fuse_stat *stbuf, int *perr)
+{
+    ULONG Size, Hash;
+    UINT64 CurrentTime = GetTickCount64();
+    struct fsp_fuse_attr_cache_item *Item;
+    BOOLEAN Found = FALSE;
+
+    if (!fsp_fuse_attr_cache_hash(f, PosixPath, &Hash, &Size))
+        return FALSE;
+
+    AcquireSRWLockShared(&f->AttrCacheLock);
+    Item = *fsp_fuse_attr_cache_find_nolock(f, PosixPath, Hash, Size);
+    if (0 != Item && CurrentTime < Item->ExpirationTime)
+    {
+        if (Item->Negative)
+            *perr = -ENOENT;
+        else
+        {
+            memcpy(stbuf, &Item->stbuf, sizeof *stbuf);
+            *perr = 0;
+        }
+        Found = TRUE;
+    }
+    ReleaseSRWLockShared(&f->AttrCacheLock);
+
+    if (Found)
+        InterlockedIncrement64(&f->AttrCacheHitCount);
+
+    return Found;
+}
+
+static VOID fsp_fuse_attr_cache_add(struct fuse *f, const char *PosixPath,
+    const struct fuse_stat *stbuf, LONG Generation)
+{
+    UINT64 Timeout = 0 != stbuf ? f->AttrTimeout : f->NegativeTimeout;
+    struct fsp_fuse_attr_cache_item **P, *Item;
+    ULONG Size, Hash;
+
+    if (0 == Timeout)
+        return;
+
+    if (!fsp_fuse_attr_cache_hash(f, PosixPath, &Hash, &Size))
+        return;
+    Item = MemAlloc(sizeof *Item + Size);
+    if (0 == Item)
+        return;
+    Item->Hash = Hash;
+    Item->PosixPathSize = Size;
+    Item->ExpirationTime = GetTickCount64() + Timeout;
+    Item->Negative = 0 == stbuf;
+    if (0 != stbuf)
+        memcpy(&Item->stbuf, stbuf, sizeof *stbuf);
+    memcpy(Item->PosixPath, PosixPath, Size);
+
+    AcquireSRWLockExclusive(&f->AttrCacheLock);
+
+    /* an invalidation raced with the backend call; the result may be stale */
+    if (Generation != f->AttrCacheGeneration)
+        goto exit;
+
+    P = fsp_fuse_attr_cache_find_nolock(f, PosixPath, Hash, Size);
+    if (0 != *P)
+    {
+        Item->DictNext = (*P)->DictNext;
+        MemFree(*P);
+        *P = Item;
+    }
+    else
+    {
+        if (FSP_FUSE_ATTR_CACHE_ITEMMAX <= f->AttrCacheItemCount)
+        {
+            fsp_fuse_attr_cache_flush_nolock(f);
+            P = &f->AttrCacheBuckets[Hash % FSP_FUSE_ATTR_CACHE_BUCKETS];
+        }
+        Item->DictNext = 0;
+        *P = Item;
+        f->AttrCacheItemCount++;
+    }
+    Item = 0;
+
+exit:
+    ReleaseSRWLockExclusive(&f->AttrCacheLock);
+
+    MemFree(Item);
+}
+
+static VOID fsp_fuse_attr_cache_invalidate(struct fuse *f, const char *PosixPath)
+{
+    struct fsp_fuse_attr_cache_item **P, *Item;
+    ULONG Size = 0, Hash = 0;
+
+    if (0 == f->AttrCacheBuckets)
+        return;
+
+    if (0 != PosixPath && !fsp_fuse_attr_cache_hash(f, PosixPath, &Hash, &Size))
+        PosixPath = 0;
+
+    AcquireSRWLockExclusive(&f->AttrCacheLock);
+    InterlockedIncrement(&f->AttrCacheGeneration);
+    if (0 != PosixPath)
+    {
+        P = fsp_fuse_attr_cache_find_nolock(f, PosixPath, Hash, Size);
+        if (0 != (Item = *P))
+        {
+            *P = Item->DictNext;
+            MemFree(Item);
+            f->AttrCacheItemCount--;
+        }
+    }
+    else
+        fsp_fuse_attr_cache_flush_nolock(f);
+    ReleaseSRWLockExclusive(&f->AttrCacheLock);
+}
+
+static VOID fsp_fuse_attr_cache_set_size(struct fuse *f, const char *PosixPath,
+    UINT64 FileSize)
+{
+    struct fsp_fuse_attr_cache_item *Item;
+    FILETIME FileTime;
+    UINT64 UnixTime;
+    ULONG Size, Hash;
+
+    if (0 == f->AttrCacheBuckets)
+        return;
+
+    if (!fsp_fuse_attr_cache_hash(f, PosixPath, &Hash, &Size))
+    {
+        fsp_fuse_attr_cache_invalidate(f, 0);
+        return;
+    }
+
+    /* the backend has just updated size and modification time; mirror that locally */
+    GetSystemTimeAsFileTime(&FileTime);
+    UnixTime = *(PUINT64)&FileTime - 116444736000000000;
+
+    AcquireSRWLockExclusive(&f->AttrCacheLock);
+    InterlockedIncrement(&f->AttrCacheGeneration);
+    Item = *fsp_fuse_attr_cache_find_nolock(f, PosixPath, Hash, Size);
+    if (0 != Item && !Item->Negative)
+    {
+        Item->stbuf.st_size = FileSize;
+#if defined(_WIN64)
+        Item->stbuf.st_mtim.tv_sec = (int64_t)(UnixTime / 10000000);
+        Item->stbuf.st_mtim.tv_nsec = (int64_t)(UnixTime % 10000000) * 100;
+#else
+        Item->stbuf.st_mtim.tv_sec = (int32_t)(UnixTime / 10000000);
+        Item->stbuf.st_mtim.tv_nsec = (int32_t)(UnixTime % 10000000) * 100;
+#endif
+        Item->stbuf.st_ctim = Item->stbuf.st_mtim;
+    }
+    ReleaseSRWLockExclusive(&f->AttrCacheLock);
+}
+
+VOID fsp_fuse_attr_cache_finalize(struct fuse *f)
+{
+    if (0 == f->AttrCacheBuckets)
+        return;
+
+    fsp_fuse_attr_cache_flush_nolock(f);
+    MemFree(f->AttrCacheBuckets);
+    f->AttrCacheBuckets = 0;
+}
+
+NTSTATUS fsp_fuse_context_resolve_ids(struct fuse_context *context)
+{
+    struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+    HANDLE Token = contexthdr->Token;
+    UINT32 Uid, Gid;
     union
     {
         TOKEN_USER V;
@@ -43,6 +428,96 @@ NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
     DWORD Size;
     NTSTATUS Result;
 
+    if (0 == Token)
+        return STATUS_SUCCESS;
+
+    /* resolve at most once per operation; on failure uid/gid remain -1 */
+    contexthdr->Token = 0;
+
+    if (!GetTokenInformation(Token, TokenUser, UserInfo, sizeof UserInfoBuf, &Size))
+    {
+        if (ERROR_INSUFFICIENT_BUFFER != GetLastError())
+        {
+            Result = FspNtStatusFromWin32(GetLastError());
+            goto exit;
+        }
+
+        UserInfo = fsp_fuse_arena_alloc(contexthdr, Size);
+        if (0 == UserInfo)
+        {
+            Result = STATUS_INSUFFICIENT_RESOURCES;
+            goto exit;
+        }
+
+        if (!GetTokenInformation(Token, TokenUser, UserInfo, Size, &Size))
+        {
+            Result = FspNtStatusFromWin32(GetLastError());
+            goto exit;
+        }
+    }
+
+    if (!GetTokenInformation(Token, TokenPrimaryGroup, GroupInfo, sizeof GroupInfoBuf, &Size))
+    {
+        if (ERROR_INSUFFICIENT_BUFFER != GetLastError())
+        {
+            Result = FspNtStatusFromWin32(GetLastError());
+            goto exit;
+        }
+
+        GroupInfo = fsp_fuse_arena_alloc(contexthdr, Size);
+        if (0 == GroupInfo)
+        {
+            Result = STATUS_INSUFFICIENT_RESOURCES;
+            goto exit;
+        }
+
+        if (!GetTokenInformation(Token, TokenPrimaryGroup, GroupInfo, Size, &Size))
+        {
+            Result = FspNtStatusFromWin32(GetLastError());
+            goto exit;
+        }
+    }
+
+    Result = FspPosixMapSidToUid(UserInfo->User.Sid, &Uid);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    Result = FspPosixMapSidToUid(GroupInfo->PrimaryGroup, &Gid);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    context->uid = Uid;
+    context->gid = Gid;
+
+    Result = STATUS_SUCCESS;
+
+exit:
+    if (UserInfo != &UserInfoBuf.V)
+        fsp_fuse_arena_free(contexthdr, UserInfo);
+
+    if (GroupInfo != &GroupInfoBuf.V)
+        fsp_fuse_arena_free(contexthdr, GroupInfo);
+
+    return Result;
+}
+
+NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request, FSP_FSCTL_TRANSACT_RSP *Response)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context;
+    struct fsp_fuse_context_header *contexthdr;
+    char *PosixPath = 0;
+    PWSTR FileName = 0, Suffix;
+    WCHAR Root[2] = L"\\";
+    HANDLE Token = 0;
+    NTSTATUS Result;
+
+    context = fsp_fuse_get_context_internal(f->env);
+    if (0 == context)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+
     if (FspFsctlTransactCreateKind == Request->Kind)
     {
         if (Request->Req.Create.OpenTargetDirectory)
@@ -62,100 +537,42 @@ NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
 
     if (0 != FileName)
     {
-        Result = FspPosixMapWindowsToPosixPath(FileName, &PosixPath);
+        Result = fsp_fuse_arena_posix_path(contexthdr, FileName, &PosixPath);
         if (FspFsctlTransactCreateKind == Request->Kind && Request->Req.Create.OpenTargetDirectory)
             FspPathCombine((PWSTR)Request->Buffer, Suffix);
         if (!NT_SUCCESS(Result))
             goto exit;
     }
 
-    if (0 != Token)
-    {
-        if (!GetTokenInformation(Token, TokenUser, UserInfo, sizeof UserInfoBuf, &Size))
-        {
-            if (ERROR_INSUFFICIENT_BUFFER != GetLastError())
-            {
-                Result = FspNtStatusFromWin32(GetLastError());
-                goto exit;
-            }
-
-            UserInfo = MemAlloc(Size);
-            if (0 == UserInfo)
-            {
-                Result = STATUS_INSUFFICIENT_RESOURCES;
-                goto exit;
-            }
-
-            if (!GetTokenInformation(Token, TokenUser, UserInfo, Size, &Size))
-            {
-                Result = FspNtStatusFromWin32(GetLastError());
-                goto exit;
-            }
-        }
-
-        if (!GetTokenInformation(Token, TokenPrimaryGroup, GroupInfo, sizeof GroupInfoBuf, &Size))
-        {
-            if (ERROR_INSUFFICIENT_BUFFER != GetLastError())
-            {
-                Result = FspNtStatusFromWin32(GetLastError());
-                goto exit;
-            }
-
-            GroupInfo = MemAlloc(Size);
-            if (0 == UserInfo)
-            {
-                Result = STATUS_INSUFFICIENT_RESOURCES;
-                goto exit;
-            }
-
-            if (!GetTokenInformation(Token, TokenPrimaryGroup, GroupInfo, Size, &Size))
-            {
-                Result = FspNtStatusFromWin32(GetLastError());
-                goto exit;
-            }
-        }
-
-        Result = FspPosixMapSidToUid(UserInfo->User.Sid, &Uid);
-        if (!NT_SUCCESS(Result))
-            goto exit;
-
-        Result = FspPosixMapSidToUid(GroupInfo->PrimaryGroup, &Gid);
-        if (!NT_SUCCESS(Result))
-            goto exit;
-    }
-
-    context = fsp_fuse_get_context(f->env);
-    if (0 == context)
-    {
-        Result = STATUS_INSUFFICIENT_RESOURCES;
-        goto exit;
-    }
-
     Result = FspFileSystemOpEnter(FileSystem, Request, Response);
     if (!NT_SUCCESS(Result))
         goto exit;
 
+    /*
+     * The caller's uid/gid are resolved from the access token on first use of the
+     * context (see fsp_fuse_get_context); most file systems never look at them.
+     */
     context->fuse = f;
     context->private_data = f->data;
-    context->uid = Uid;
-    context->gid = Gid;
+    context->uid = -1;
+    context->gid = -1;
 
-    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
     contexthdr->Request = Request;
     contexthdr->Response = Response;
     contexthdr->PosixPath = PosixPath;
+    contexthdr->Token = Token;
 
     Result = STATUS_SUCCESS;
 
 exit:
-    if (UserInfo != &UserInfoBuf.V)
-        MemFree(UserInfo);
-
-    if (GroupInfo != &GroupInfoBuf.V)
-        MemFree(GroupInfo);
+    if (!NT_SUCCESS(Result))
+    {
+        if (0 != PosixPath)
+            fsp_fuse_arena_free(contexthdr, PosixPath);
 
-    if (!NT_SUCCESS(Result) && 0 != PosixPath)
-        FspPosixDeletePath(PosixPath);
+        /* fsp_fuse_op_leave will not be called; release the arena now */
+        contexthdr->ArenaUsed = 0;
+    }
 
     return Result;
 }
@@ -169,7 +586,7 @@ NTSTATUS fsp_fuse_op_leave(FSP_FILE_SYSTEM *FileSystem,
 
     FspFileSystemOpLeave(FileSystem, Request, Response);
 
-    context = fsp_fuse_get_context(f->env);
+    context = fsp_fuse_get_context_internal(f->env);
     context->fuse = 0;
     context->private_data = 0;
     context->uid = -1;
@@ -177,65 +594,87 @@ NTSTATUS fsp_fuse_op_leave(FSP_FILE_SYSTEM *FileSystem,
 
     contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
     if (0 != contexthdr->PosixPath)
-        FspPosixDeletePath(contexthdr->PosixPath);
-    memset(contexthdr, 0, sizeof *contexthdr);
+        fsp_fuse_arena_free(contexthdr, contexthdr->PosixPath);
+    contexthdr->Request = 0;
+    contexthdr->Response = 0;
+    contexthdr->PosixPath = 0;
+    contexthdr->Token = 0;
+    contexthdr->ArenaUsed = 0;
 
     return STATUS_SUCCESS;
 }
 
-static NTSTATUS fsp_fuse_intf_GetFileInfoEx(FSP_FILE_SYSTEM *FileSystem,
-    const char *PosixPath, struct fuse_file_info *fi,
+VOID fsp_fuse_intf_FileInfoFromStat(struct fuse *f, struct fuse_stat *stbuf,
     PUINT32 PUid, PUINT32 PGid, PUINT32 PMode,
     FSP_FSCTL_FILE_INFO *FileInfo)
 {
-    struct fuse *f = FileSystem->UserContext;
     UINT64 AllocationUnit;
-    struct fuse_stat stbuf;
-    int err;
-
-    memset(&stbuf, 0, sizeof stbuf);
-
-    if (0 != f->ops.fgetattr && 0 != fi && -1 != fi->fh)
-        err = f->ops.fgetattr(PosixPath, (void *)&stbuf, fi);
-    else if (0 != f->ops.getattr)
-        err = f->ops.getattr(PosixPath, (void *)&stbuf);
-    else
-        return STATUS_INVALID_DEVICE_REQUEST;
-
-    if (0 != err)
-        return fsp_fuse_ntstatus_from_errno(f->env, err);
 
     if (f->set_umask)
-        stbuf.st_mode = (stbuf.st_mode & 0170000) | (0777 & ~f->umask);
+        stbuf->st_mode = (stbuf->st_mode & 0170000) | (0777 & ~f->umask);
     if (f->set_uid)
-        stbuf.st_uid = f->uid;
+        stbuf->st_uid = f->uid;
     if (f->set_gid)
-        stbuf.st_gid = f->gid;
+        stbuf->st_gid = f->gid;
 
-    *PUid = stbuf.st_uid;
-    *PGid = stbuf.st_gid;
-    *PMode = stbuf.st_mode;
+    *PUid = stbuf->st_uid;
+    *PGid = stbuf->st_gid;
+    *PMode = stbuf->st_mode;
 
     AllocationUnit = (UINT64)f->VolumeParams.SectorSize *
         (UINT64)f->VolumeParams.SectorsPerAllocationUnit;
-    FileInfo->FileAttributes = (stbuf.st_mode & 0040000) ? FILE_ATTRIBUTE_DIRECTORY : 0;
+    FileInfo->FileAttributes = (stbuf->st_mode & 0040000) ? FILE_ATTRIBUTE_DIRECTORY : 0;
     FileInfo->ReparseTag = 0;
-    FileInfo->FileSize = stbuf.st_size;
+    FileInfo->FileSize = stbuf->st_size;
     FileInfo->AllocationSize =
         (FileInfo->FileSize + AllocationUnit - 1) / AllocationUnit * AllocationUnit;
     FileInfo->CreationTime =
-        Int32x32To64(stbuf.st_birthtim.tv_sec, 10000000) + 116444736000000000 +
-        stbuf.st_birthtim.tv_nsec / 100;
+        Int32x32To64(stbuf->st_birthtim.tv_sec, 10000000) + 116444736000000000 +
+        stbuf->st_birthtim.tv_nsec / 100;
     FileInfo->LastAccessTime =
-        Int32x32To64(stbuf.st_atim.tv_sec, 10000000) + 116444736000000000 +
-        stbuf.st_atim.tv_nsec / 100;
+        Int32x32To64(stbuf->st_atim.tv_sec, 10000000) + 116444736000000000 +
+        stbuf->st_atim.tv_nsec / 100;
     FileInfo->LastWriteTime =
-        Int32x32To64(stbuf.st_mtim.tv_sec, 10000000) + 116444736000000000 +
-        stbuf.st_mtim.tv_nsec / 100;
+        Int32x32To64(stbuf->st_mtim.tv_sec, 10000000) + 116444736000000000 +
+        stbuf->st_mtim.tv_nsec / 100;
     FileInfo->ChangeTime =
-        Int32x32To64(stbuf.st_ctim.tv_sec, 10000000) + 116444736000000000 +
-        stbuf.st_ctim.tv_nsec / 100;
-    FileInfo->IndexNumber = stbuf.st_ino;
+        Int32x32To64(stbuf->st_ctim.tv_sec, 10000000) + 116444736000000000 +
+        stbuf->st_ctim.tv_nsec / 100;
+    FileInfo->IndexNumber = stbuf->st_ino;
+}
+
+static NTSTATUS fsp_fuse_intf_GetFileInfoEx(FSP_FILE_SYSTEM *FileSystem,
+    const char *PosixPath, struct fuse_file_info *fi,
+    PUINT32 PUid, PUINT32 PGid, PUINT32 PMode,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_stat stbuf;
+    LONG Generation;
+    int err;
+
+    memset(&stbuf, 0, sizeof stbuf);
+
+    if (0 == f->AttrCacheBuckets || !fsp_fuse_attr_cache_lookup(f, PosixPath, &stbuf, &err))
+    {
+        Generation = f->AttrCacheGeneration;
+
+        if (0 != f->ops.fgetattr && 0 != fi && -1 != fi->fh)
+            err = f->ops.fgetattr(PosixPath, (void *)&stbuf, fi);
+        else if (0 != f->ops.getattr)
+            err = f->ops.getattr(PosixPath, (void *)&stbuf);
+        else
+            return STATUS_INVALID_DEVICE_REQUEST;
+        InterlockedIncrement64(&f->GetattrCount);
+
+        if (0 != f->AttrCacheBuckets && (0 == err || -ENOENT == err))
+            fsp_fuse_attr_cache_add(f, PosixPath, 0 == err ? &stbuf : 0, Generation);
+    }
+
+    if (0 != err)
+        return fsp_fuse_ntstatus_from_errno(f->env, err);
+
+    fsp_fuse_intf_FileInfoFromStat(f, &stbuf, PUid, PGid, PMode, FileInfo);
 
     return STATUS_SUCCESS;
 }
@@ -330,10 +769,12 @@ static NTSTATUS fsp_fuse_intf_GetSecurityByName(FSP_FILE_SYSTEM *FileSystem,
     PSECURITY_DESCRIPTOR SecurityDescriptorBuf, SIZE_T *PSecurityDescriptorSize)
 {
     struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context = fsp_fuse_get_context_internal(f->env);
+    struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
     char *PosixPath = 0;
     NTSTATUS Result;
 
-    Result = FspPosixMapWindowsToPosixPath(FileName, &PosixPath);
+    Result = fsp_fuse_arena_posix_path(contexthdr, FileName, &PosixPath);
     if (!NT_SUCCESS(Result))
         goto exit;
 
@@ -346,7 +787,7 @@ static NTSTATUS fsp_fuse_intf_GetSecurityByName(FSP_FILE_SYSTEM *FileSystem,
 
 exit:
     if (0 != PosixPath)
-        FspPosixDeletePath(PosixPath);
+        fsp_fuse_arena_free(contexthdr, PosixPath);
 
     return Result;
 }
@@ -358,7 +799,7 @@ static NTSTATUS fsp_fuse_intf_Create(FSP_FILE_SYSTEM *FileSystem,
     PVOID *PFileNode, FSP_FSCTL_FILE_INFO *FileInfo)
 {
     struct fuse *f = FileSystem->UserContext;
-    struct fuse_context *context = fsp_fuse_get_context(f->env);
+    struct fuse_context *context = fsp_fuse_get_context_internal(f->env);
     struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
     UINT32 Uid, Gid, Mode;
     FSP_FSCTL_FILE_INFO FileInfoBuf;
@@ -368,13 +809,17 @@ static NTSTATUS fsp_fuse_intf_Create(FSP_FILE_SYSTEM *FileSystem,
     int err;
     NTSTATUS Result;
 
-    filedesc = MemAlloc(sizeof *filedesc);
+    filedesc = fsp_fuse_file_desc_alloc(f, contexthdr->PosixPath);
     if (0 == filedesc)
     {
         Result = STATUS_INSUFFICIENT_RESOURCES;
         goto exit;
     }
 
+    Result = fsp_fuse_context_resolve_ids(context);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
     Uid = context->uid;
     Gid = context->gid;
     Mode = 0777;
@@ -440,6 +885,7 @@ static NTSTATUS fsp_fuse_intf_Create(FSP_FILE_SYSTEM *FileSystem,
         else
             Result = STATUS_INVALID_DEVICE_REQUEST;
     }
+    fsp_fuse_attr_cache_invalidate(f, contexthdr->PosixPath);
     if (!NT_SUCCESS(Result))
         goto exit;
 
@@ -449,6 +895,7 @@ static NTSTATUS fsp_fuse_intf_Create(FSP_FILE_SYSTEM *FileSystem,
         if (0 != f->ops.chown)
         {
             err = f->ops.chown(contexthdr->PosixPath, Uid, Gid);
+            fsp_fuse_attr_cache_invalidate(f, contexthdr->PosixPath);
             if (0 != err)
             {
                 Result = fsp_fuse_ntstatus_from_errno(f->env, err);
@@ -473,13 +920,9 @@ static NTSTATUS fsp_fuse_intf_Create(FSP_FILE_SYSTEM *FileSystem,
     *PFileNode = 0;
     memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
 
-    filedesc->PosixPath = contexthdr->PosixPath;
     filedesc->IsDirectory = !!(FileInfoBuf.FileAttributes & FILE_ATTRIBUTE_DIRECTORY);
     filedesc->OpenFlags = fi.flags;
     filedesc->FileHandle = fi.fh;
-    filedesc->DirBuffer = 0;
-    filedesc->DirBufferSize = 0;
-    contexthdr->PosixPath = 0;
     contexthdr->Response->Rsp.Create.Opened.UserContext2 = (UINT64)(UINT_PTR)filedesc;
 
     Result = STATUS_SUCCESS;
@@ -501,7 +944,7 @@ exit:
             }
         }
 
-        MemFree(filedesc);
+        fsp_fuse_file_desc_free(f, filedesc);
     }
 
     return Result;
@@ -513,7 +956,7 @@ static NTSTATUS fsp_fuse_intf_Open(FSP_FILE_SYSTEM *FileSystem,
     PVOID *PFileNode, FSP_FSCTL_FILE_INFO *FileInfo)
 {
     struct fuse *f = FileSystem->UserContext;
-    struct fuse_context *context = fsp_fuse_get_context(f->env);
+    struct fuse_context *context = fsp_fuse_get_context_internal(f->env);
     struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
     UINT32 Uid, Gid, Mode;
     FSP_FSCTL_FILE_INFO FileInfoBuf;
@@ -527,7 +970,7 @@ static NTSTATUS fsp_fuse_intf_Open(FSP_FILE_SYSTEM *FileSystem,
     if (!NT_SUCCESS(Result))
         goto exit;
 
-    filedesc = MemAlloc(sizeof *filedesc);
+    filedesc = fsp_fuse_file_desc_alloc(f, contexthdr->PosixPath);
     if (0 == filedesc)
     {
         Result = STATUS_INSUFFICIENT_RESOURCES;
@@ -587,20 +1030,16 @@ static NTSTATUS fsp_fuse_intf_Open(FSP_FILE_SYSTEM *FileSystem,
     *PFileNode = 0;
     memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
 
-    filedesc->PosixPath = contexthdr->PosixPath;
     filedesc->IsDirectory = !!(FileInfoBuf.FileAttributes & FILE_ATTRIBUTE_DIRECTORY);
     filedesc->OpenFlags = fi.flags;
     filedesc->FileHandle = fi.fh;
-    filedesc->DirBuffer = 0;
-    filedesc->DirBufferSize = 0;
-    contexthdr->PosixPath = 0;
     contexthdr->Response->Rsp.Create.Opened.UserContext2 = (UINT64)(UINT_PTR)filedesc;
 
     Result = STATUS_SUCCESS;
 
 exit:
     if (!NT_SUCCESS(Result))
-        MemFree(filedesc);
+        fsp_fuse_file_desc_free(f, filedesc);
 
     return Result;
 }
@@ -634,6 +1073,7 @@ static NTSTATUS fsp_fuse_intf_Overwrite(FSP_FILE_SYSTEM *FileSystem,
     }
     else
         Result = STATUS_INVALID_DEVICE_REQUEST;
+    fsp_fuse_attr_cache_invalidate(f, filedesc->PosixPath);
     if (!NT_SUCCESS(Result))
         return Result;
 
@@ -667,6 +1107,7 @@ static VOID fsp_fuse_intf_Cleanup(FSP_FILE_SYSTEM *FileSystem,
      */
 
     if (Delete)
+    {
         if (filedesc->IsDirectory)
         {
             if (0 != f->ops.rmdir)
@@ -677,6 +1118,9 @@ static VOID fsp_fuse_intf_Cleanup(FSP_FILE_SYSTEM *FileSystem,
             if (0 != f->ops.unlink)
                 f->ops.unlink(filedesc->PosixPath);
         }
+
+        fsp_fuse_attr_cache_invalidate(f, filedesc->PosixPath);
+    }
 }
 
 static VOID fsp_fuse_intf_Close(FSP_FILE_SYSTEM *FileSystem,
@@ -705,9 +1149,7 @@ static VOID fsp_fuse_intf_Close(FSP_FILE_SYSTEM *FileSystem,
             f->ops.release(filedesc->PosixPath, &fi);
     }
 
-    MemFree(filedesc->DirBuffer);
-    MemFree(filedesc->PosixPath);
-    MemFree(filedesc);
+    fsp_fuse_file_desc_free(f, filedesc);
 }
 
 static NTSTATUS fsp_fuse_intf_Read(FSP_FILE_SYSTEM *FileSystem,
@@ -792,6 +1234,9 @@ static NTSTATUS fsp_fuse_intf_Write(FSP_FILE_SYSTEM *FileSystem,
 
     *PBytesTransferred = bytes;
 
+    fsp_fuse_attr_cache_set_size(f, filedesc->PosixPath,
+        Offset + bytes > FileInfoBuf.FileSize ? Offset + bytes : FileInfoBuf.FileSize);
+
     AllocationUnit = (UINT64)f->VolumeParams.SectorSize *
         (UINT64)f->VolumeParams.SectorsPerAllocationUnit;
     FileInfoBuf.FileSize = Offset + bytes;
@@ -934,6 +1379,7 @@ static NTSTATUS fsp_fuse_intf_SetBasicInfo(FSP_FILE_SYSTEM *FileSystem,
         err = f->ops.utime(filedesc->PosixPath, &timbuf);
         Result = fsp_fuse_ntstatus_from_errno(f->env, err);
     }
+    fsp_fuse_attr_cache_invalidate(f, filedesc->PosixPath);
     if (!NT_SUCCESS(Result))
         return Result;
 
@@ -987,7 +1433,12 @@ static NTSTATUS fsp_fuse_intf_SetFileSize(FSP_FILE_SYSTEM *FileSystem,
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         }
         if (!NT_SUCCESS(Result))
+        {
+            fsp_fuse_attr_cache_invalidate(f, filedesc->PosixPath);
             return Result;
+        }
+
+        fsp_fuse_attr_cache_set_size(f, filedesc->PosixPath, NewSize);
 
         AllocationUnit = (UINT64)f->VolumeParams.SectorSize *
             (UINT64)f->VolumeParams.SectorsPerAllocationUnit;
@@ -1065,7 +1516,7 @@ static NTSTATUS fsp_fuse_intf_Rename(FSP_FILE_SYSTEM *FileSystem,
     PWSTR FileName, PWSTR NewFileName, BOOLEAN ReplaceIfExists)
 {
     struct fuse *f = FileSystem->UserContext;
-    struct fuse_context *context = fsp_fuse_get_context(f->env);
+    struct fuse_context *context = fsp_fuse_get_context_internal(f->env);
     struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
     UINT32 Uid, Gid, Mode;
     FSP_FSCTL_FILE_INFO FileInfoBuf;
@@ -1091,6 +1542,7 @@ static NTSTATUS fsp_fuse_intf_Rename(FSP_FILE_SYSTEM *FileSystem,
     }
 
     err = f->ops.rename(filedesc->PosixPath, contexthdr->PosixPath);
+    fsp_fuse_attr_cache_invalidate(f, 0);
     return fsp_fuse_ntstatus_from_errno(f->env, err);
 }
 
@@ -1178,6 +1630,8 @@ static NTSTATUS fsp_fuse_intf_SetSecurity(FSP_FILE_SYSTEM *FileSystem,
     Result = STATUS_SUCCESS;
 
 exit:
+    fsp_fuse_attr_cache_invalidate(f, filedesc->PosixPath);
+
     if (0 != NewSecurityDescriptor)
         FspDeleteSecurityDescriptor(NewSecurityDescriptor,
             FspSetSecurityDescriptor);
@@ -1194,6 +1648,8 @@ int fsp_fuse_intf_AddDirInfo(void *buf, const char *name,
 {
     struct fuse_dirhandle *dh = buf;
     struct fsp_fuse_dirinfo *di;
+    struct fuse_stat stbufcopy;
+    UINT32 Uid, Gid, Mode;
     ULONG len, xfersize;
 
     len = lstrlenA(name);
@@ -1233,6 +1689,13 @@ int fsp_fuse_intf_AddDirInfo(void *buf, const char *name,
 
     di->Size = (UINT16)(sizeof(struct fsp_fuse_dirinfo) + len + 1);
     di->FileInfoValid = FALSE;
+    if (0 != stbuf && 0 != dh->fuse)
+    {
+        /* readdirplus: the file system promised a complete stbuf; no getattr is needed */
+        memcpy(&stbufcopy, stbuf, sizeof stbufcopy);
+        fsp_fuse_intf_FileInfoFromStat(dh->fuse, &stbufcopy, &Uid, &Gid, &Mode, &di->FileInfo);
+        di->FileInfoValid = TRUE;
+    }
     di->NextOffset = 0 != off ? off : dh->BytesTransferred;
     memcpy(di->PosixNameBuf, name, len);
     di->PosixNameBuf[len] = '\0';
@@ -1246,6 +1709,162 @@ int fsp_fuse_intf_AddDirInfoOld(fuse_dirh_t dh, const char *name,
     return fsp_fuse_intf_AddDirInfo(dh, name, 0, 0) ? -ENOMEM : 0;
 }
 
+/*
+ * Parallel readdir attribute fetch (-o readdir_parallel=N).
+ *
+ * Directory entries that were added without attributes are fetched with getattr by up to N
+ * threads: the dispatcher thread and N-1 thread pool callbacks, all pulling entries from a
+ * shared index. Fetched attributes are stored back into the fsp_fuse_dirinfo entries, so that
+ * they are also available to later queries that resume from filedesc->DirBuffer. Entries that
+ * fail here are left alone; the serial loop in fsp_fuse_intf_ReadDirectory retries them and
+ * reports any error.
+ */
+static inline BOOLEAN fsp_fuse_intf_IsDotName(const char *name)
+{
+    return '.' == name[0] && ('\0' == name[1] || ('.' == name[1] && '\0' == name[2]));
+}
+
+struct fsp_fuse_intf_readdir_parallel
+{
+    FSP_FILE_SYSTEM *FileSystem;
+    struct fuse_context *context;
+    const char *DirPath;
+    ULONG DirPathSize;
+    struct fsp_fuse_dirinfo **Entries;
+    LONG Count;
+    volatile LONG Next;
+    volatile LONG Pending;
+    HANDLE Event;
+};
+
+static VOID fsp_fuse_intf_ReadDirectoryParallelFetch(struct fsp_fuse_intf_readdir_parallel *Parallel)
+{
+    struct fsp_fuse_dirinfo *di;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    UINT32 Uid, Gid, Mode;
+    char *PosixPath, *PosixName;
+    ULONG Size;
+    LONG Index;
+
+    PosixPath = MemAlloc(Parallel->DirPathSize + 1 + 255 + 1);
+    if (0 == PosixPath)
+        return;
+
+    Size = Parallel->DirPathSize;
+    memcpy(PosixPath, Parallel->DirPath, Size);
+    if (1 < Size)
+        /* if not root */
+        PosixPath[Size++] = '/';
+    PosixName = PosixPath + Size;
+
+    for (;;)
+    {
+        Index = InterlockedIncrement(&Parallel->Next) - 1;
+        if (Parallel->Count <= Index)
+            break;
+
+        di = Parallel->Entries[Index];
+        Size = lstrlenA(di->PosixNameBuf);
+        if (Size > 255)
+            Size = 255;
+        memcpy(PosixName, di->PosixNameBuf, Size);
+        PosixName[Size] = '\0';
+
+        if (NT_SUCCESS(fsp_fuse_intf_GetFileInfoEx(Parallel->FileSystem, PosixPath, 0,
+            &Uid, &Gid, &Mode, &FileInfo)))
+        {
+            memcpy(&di->FileInfo, &FileInfo, sizeof FileInfo);
+            di->FileInfoValid = TRUE;
+        }
+    }
+
+    MemFree(PosixPath);
+}
+
+static VOID CALLBACK fsp_fuse_intf_ReadDirectoryParallelWork(
+    PTP_CALLBACK_INSTANCE Instance, PVOID Context)
+{
+    struct fsp_fuse_intf_readdir_parallel *Parallel = Context;
+    struct fuse *f = Parallel->FileSystem->UserContext;
+    struct fuse_context *context;
+
+    /* getattr may call fuse_get_context; give it the caller's context */
+    context = fsp_fuse_get_context_internal(f->env);
+    if (0 != context)
+    {
+        memcpy(context, Parallel->context, sizeof *context);
+        fsp_fuse_intf_ReadDirectoryParallelFetch(Parallel);
+
+        /* the pool thread runs unrelated work next; do not leave the caller's identity behind */
+        memset(context, 0, sizeof *context);
+        context->pid = -1;
+    }
+
+    if (0 == InterlockedDecrement(&Parallel->Pending))
+        SetEvent(Parallel->Event);
+}
+
+static VOID fsp_fuse_intf_ReadDirectoryParallel(FSP_FILE_SYSTEM *FileSystem,
+    struct fuse_context *context, const char *DirPath,
+    struct fsp_fuse_dirinfo *di, PUINT8 diend, ULONG Length)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_intf_readdir_parallel Parallel;
+    ULONG EstimatedLength, Count, Threads;
+
+    /* count entries without attributes that can fit in the response buffer */
+    Count = 0;
+    EstimatedLength = 0;
+    for (struct fsp_fuse_dirinfo *p = di;
+        (PUINT8)p + sizeof(p->Size) <= diend && sizeof(struct fsp_fuse_dirinfo) <= p->Size;
+        p = (PVOID)((PUINT8)p + FSP_FSCTL_DEFAULT_ALIGN_UP(p->Size)))
+    {
+        EstimatedLength += FSP_FSCTL_DEFAULT_ALIGN_UP(sizeof(FSP_FSCTL_DIR_INFO) +
+            (p->Size - sizeof(struct fsp_fuse_dirinfo) - 1) * sizeof(WCHAR));
+        if (EstimatedLength > Length)
+            break;
+        if (!p->FileInfoValid && !fsp_fuse_intf_IsDotName(p->PosixNameBuf))
+            Count++;
+    }
+    if (2 > Count)
+        return;
+
+    memset(&Parallel, 0, sizeof Parallel);
+    Parallel.FileSystem = FileSystem;
+    Parallel.context = context;
+    Parallel.DirPath = DirPath;
+    Parallel.DirPathSize = lstrlenA(DirPath);
+    Parallel.Entries = MemAlloc(Count * sizeof(struct fsp_fuse_dirinfo *));
+    if (0 == Parallel.Entries)
+        return;
+    Parallel.Event = CreateEventW(0, TRUE, FALSE, 0);
+    if (0 == Parallel.Event)
+    {
+        MemFree(Parallel.Entries);
+        return;
+    }
+
+    for (struct fsp_fuse_dirinfo *p = di;
+        Count > (ULONG)Parallel.Count;
+        p = (PVOID)((PUINT8)p + FSP_FSCTL_DEFAULT_ALIGN_UP(p->Size)))
+        if (!p->FileInfoValid && !fsp_fuse_intf_IsDotName(p->PosixNameBuf))
+            Parallel.Entries[Parallel.Count++] = p;
+
+    Threads = f->ReaddirParallel < Count ? f->ReaddirParallel : Count;
+    Parallel.Pending = Threads;
+    for (ULONG I = 1; Threads > I; I++)
+        if (!TrySubmitThreadpoolCallback(fsp_fuse_intf_ReadDirectoryParallelWork, &Parallel, 0))
+            InterlockedDecrement(&Parallel.Pending);
+
+    fsp_fuse_intf_ReadDirectoryParallelFetch(&Parallel);
+
+    if (0 != InterlockedDecrement(&Parallel.Pending))
+        WaitForSingleObject(Parallel.Event, INFINITE);
+
+    CloseHandle(Parallel.Event);
+    MemFree(Parallel.Entries);
+}
+
 static NTSTATUS fsp_fuse_intf_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_REQ *Request,
     PVOID FileNode, PVOID Buffer, UINT64 Offset, ULONG Length,
@@ -1253,6 +1872,8 @@ static NTSTATUS fsp_fuse_intf_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
     PULONG PBytesTransferred)
 {
     struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context = fsp_fuse_get_context_internal(f->env);
+    struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
     struct fsp_fuse_file_desc *filedesc =
         (PVOID)(UINT_PTR)Request->Req.QueryDirectory.UserContext2;
     struct fuse_file_info fi;
@@ -1262,17 +1883,18 @@ static NTSTATUS fsp_fuse_intf_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
     union
     {
         FSP_FSCTL_DIR_INFO V;
-        UINT8 B[sizeof(FSP_FSCTL_DIR_INFO) + 255 * sizeof(WCHAR)];
+        UINT8 B[sizeof(FSP_FSCTL_DIR_INFO) + (255 + 1) * sizeof(WCHAR)];
     } DirInfoBuf;
     FSP_FSCTL_DIR_INFO *DirInfo = &DirInfoBuf.V;
     UINT32 Uid, Gid, Mode;
     char *PosixPath = 0, *PosixName, *PosixPathEnd, SavedPathChar;
-    PWSTR FileName = 0;
     ULONG Size;
     int err;
     NTSTATUS Result;
 
     memset(&dh, 0, sizeof dh);
+    if (f->ReaddirPlus)
+        dh.fuse = f;
 
     if (0 == filedesc->DirBuffer)
     {
@@ -1323,6 +1945,11 @@ static NTSTATUS fsp_fuse_intf_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
         diend = (PUINT8)filedesc->DirBuffer + filedesc->DirBufferSize;
     }
 
+    if (1 < f->ReaddirParallel &&
+        FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_FINE == f->OpGuardStrategy)
+        fsp_fuse_intf_ReadDirectoryParallel(FileSystem, context, filedesc->PosixPath,
+            di, diend, Length);
+
     for (;
         (PUINT8)di + sizeof(di->Size) <= diend;
         di = (PVOID)((PUINT8)di + FSP_FSCTL_DEFAULT_ALIGN_UP(di->Size)))
@@ -1335,7 +1962,7 @@ static NTSTATUS fsp_fuse_intf_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
             if (0 == PosixPath)
             {
                 Size = lstrlenA(filedesc->PosixPath);
-                PosixPath = MemAlloc(Size + 1 + 255 + 1);
+                PosixPath = fsp_fuse_arena_alloc(contexthdr, Size + 1 + 255 + 1);
                 if (0 == PosixPath)
                 {
                     Result = STATUS_INSUFFICIENT_RESOURCES;
@@ -1389,17 +2016,12 @@ static NTSTATUS fsp_fuse_intf_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
         }
         memcpy(&DirInfo->FileInfo, &di->FileInfo, sizeof di->FileInfo);
 
-        Result = FspPosixMapPosixToWindowsPath(di->PosixNameBuf, &FileName);
+        /* PosixNameBuf holds at most 255 bytes, which never map to more than 255 WCHAR's */
+        Size = 255 + 1;
+        Result = FspPosixMapPosixToWindowsPathEx(di->PosixNameBuf, DirInfo->FileNameBuf, &Size);
         if (!NT_SUCCESS(Result))
             goto exit;
-
-        Size = lstrlenW(FileName);
-        if (Size > 255)
-            Size = 255;
-        Size *= sizeof(WCHAR);
-        memcpy(DirInfo->FileNameBuf, FileName, Size);
-
-        FspPosixDeletePath(FileName);
+        Size = (Size - 1) * sizeof(WCHAR);
 
         memset(DirInfo->Padding, 0, sizeof DirInfo->Padding);
         DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) + Size);
@@ -1416,7 +2038,8 @@ success:
     Result = STATUS_SUCCESS;
 
 exit:
-    MemFree(PosixPath);
+    if (0 != PosixPath)
+        fsp_fuse_arena_free(contexthdr, PosixPath);
     MemFree(dh.Buffer);
 
     return Result;
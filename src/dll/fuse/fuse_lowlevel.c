@@ -0,0 +1,1521 @@
+/**
+ * @file dll/fuse/fuse_lowlevel.c
+ *
+ * @copyright 2015-2016 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the
+ * GNU Affero General Public License version 3 as published by the
+ * Free Software Foundation.
+ *
+ * Licensees holding a valid commercial license may use this file in
+ * accordance with the commercial license agreement provided with the
+ * software.
+ */
+
+#include <dll/fuse/library.h>
+
+/*
+ * FUSE low-level (inode) API.
+ *
+ * Low-level file systems address files by inode number rather than by path. WinFsp still
+ * opens files by path, so Open resolves the path one component at a time through a dentry
+ * cache keyed by (parent inode, name); only components that are missing from the cache or
+ * whose entry_timeout has expired are looked up in the file system. All other operations
+ * go through the inode kept in the per-handle file descriptor and never see a path.
+ *
+ * Every lookup reply (and every readdirplus entry) increments the lookup count of an inode.
+ * Dentries accumulate these counts and return them to the file system with forget when they
+ * are evicted and no open file refers to them any longer.
+ *
+ * Requests live on the stack of the dispatcher thread, which waits for the reply. A file
+ * system may reply from within the operation or later from a thread of its own.
+ */
+
+#define FSP_FUSE_LL_REQ_REPLIED         ((PVOID)(UINT_PTR)1)
+#define FSP_FUSE_LL_TIMEOUT_MAX         ((UINT64)1 << 62)
+
+struct fuse_req
+{
+    struct fuse *fuse;
+    struct fuse_context *context;       /* of the dispatcher thread; used by fuse_req_ctx */
+    struct fuse_ctx ctx;
+    PVOID volatile Wait;                /* 0, waiter event or FSP_FUSE_LL_REQ_REPLIED */
+    int err;
+    /* reply destinations; 0 when the reply is not expected */
+    struct fuse_entry_param *Entry;
+    struct fuse_stat *Attr;
+    UINT64 EntryTimeout, AttrTimeout;   /* millisec */
+    struct fuse_file_info *FileInfo;
+    struct fuse_statvfs *Statvfs;
+    PVOID Buffer;
+    size_t BufferSize;
+    size_t BytesTransferred;
+};
+
+struct fsp_fuse_dentry
+{
+    struct fsp_fuse_dentry *DictNext;
+    volatile LONG RefCount;             /* one for the cache and one per user */
+    ULONG Hash, NameSize;
+    fuse_ino_t Parent, Ino;
+    UINT64 Nlookup;
+    UINT64 EntryExpirationTime, AttrExpirationTime;
+    struct fuse_stat Attr;
+    char Name[];
+};
+
+struct fsp_fuse_ll_file_desc
+{
+    LIST_ENTRY ListEntry;
+    struct fsp_fuse_dentry *Dentry;     /* 0 for the root directory */
+    fuse_ino_t Ino;
+    BOOLEAN IsDirectory;
+    int OpenFlags;
+    UINT64 FileHandle;
+};
+
+struct fsp_fuse_ll_dirent
+{
+    UINT16 Size;
+    BOOLEAN Plus;
+    UINT64 EntryTimeout, AttrTimeout;   /* millisec */
+    UINT64 NextOffset;
+    struct fuse_entry_param Entry;      /* Plus: complete; otherwise zero */
+    char Name[];                        /* includes term-0 */
+};
+
+/*
+ * Converts a timeout in seconds to milliseconds. The DLL does not use floating point,
+ * so the IEEE 754 double is decoded by hand.
+ */
+static UINT64 fsp_fuse_ll_timeout(const double *ptimeout)
+{
+    UINT64 Bits, Mantissa, Millis;
+    INT32 Exponent;
+
+    memcpy(&Bits, ptimeout, sizeof Bits);
+    Exponent = (INT32)((Bits >> 52) & 0x7ff);
+    Mantissa = Bits & 0x000fffffffffffffULL;
+
+    if (0 != (Bits >> 63) || 0 == Exponent)
+        return 0;                       /* negative, zero or subnormal */
+    if (0x7ff == Exponent)
+        return 0 == Mantissa ? FSP_FUSE_LL_TIMEOUT_MAX : 0; /* infinity or NaN */
+
+    /* value = (2^52 + Mantissa) * 2^(Exponent - 1075); the product fits in 63 bits */
+    Mantissa = (Mantissa | 0x0010000000000000ULL) * 1000;
+    Exponent -= 1023 + 52;
+    if (0 <= Exponent)
+        return FSP_FUSE_LL_TIMEOUT_MAX;
+    Millis = -64 < Exponent ? Mantissa >> -Exponent : 0;
+
+    return Millis < FSP_FUSE_LL_TIMEOUT_MAX ? Millis : FSP_FUSE_LL_TIMEOUT_MAX;
+}
+
+static inline BOOLEAN fsp_fuse_ll_IsDotName(const char *name)
+{
+    return '.' == name[0] && ('\0' == name[1] || ('.' == name[1] && '\0' == name[2]));
+}
+
+static VOID fsp_fuse_ll_req_init(struct fuse *f, struct fuse_req *req)
+{
+    memset(req, 0, sizeof *req);
+    req->fuse = f;
+    req->context = fsp_fuse_get_context_internal(f->env);
+    req->ctx.uid = -1;
+    req->ctx.gid = -1;
+    req->ctx.pid = -1;
+}
+
+static NTSTATUS fsp_fuse_ll_req_wait(struct fuse_req *req)
+{
+    HANDLE Event;
+
+    if (FSP_FUSE_LL_REQ_REPLIED != req->Wait)
+    {
+        /* the operation returned without replying; the reply will come from another thread */
+        Event = CreateEventW(0, TRUE, FALSE, 0);
+        if (0 != Event)
+        {
+            if (0 == InterlockedCompareExchangePointer(&req->Wait, Event, 0))
+                WaitForSingleObject(Event, INFINITE);
+            CloseHandle(Event);
+        }
+        else
+            while (FSP_FUSE_LL_REQ_REPLIED != req->Wait)
+                Sleep(1);
+    }
+
+    return fsp_fuse_ntstatus_from_errno(req->fuse->env, req->err);
+}
+
+static int fsp_fuse_ll_reply(struct fuse_req *req, int err)
+{
+    PVOID Wait;
+
+    /* the request belongs to the waiter as soon as it is marked as replied */
+    req->err = 0 > err ? -err : err;
+    Wait = InterlockedExchangePointer(&req->Wait, FSP_FUSE_LL_REQ_REPLIED);
+    if (0 != Wait && FSP_FUSE_LL_REQ_REPLIED != Wait)
+        SetEvent(Wait);
+
+    return 0;
+}
+
+static VOID fsp_fuse_ll_forget(struct fuse *f, fuse_ino_t Ino, UINT64 Nlookup)
+{
+    struct fuse_req req;
+
+    if (0 == f->llops.forget)
+        return;
+
+    fsp_fuse_ll_req_init(f, &req);
+    f->llops.forget(&req, Ino, Nlookup);
+    fsp_fuse_ll_req_wait(&req);
+}
+
+/*
+ * Dentry cache.
+ */
+static ULONG fsp_fuse_ll_dentry_hash(fuse_ino_t Parent, const char *Name, PULONG PSize)
+{
+    ULONG Hash = 2166136261;
+    const char *P;
+
+    for (ULONG I = 0; sizeof Parent > I; I++)
+        Hash = (Hash ^ (UINT8)(Parent >> (I * 8))) * 16777619;
+    for (P = Name; *P; P++)
+        Hash = (Hash ^ (UINT8)*P) * 16777619;
+    *PSize = (ULONG)(P - Name) + 1;
+
+    return Hash;
+}
+
+static VOID fsp_fuse_ll_dentry_release(struct fuse *f, struct fsp_fuse_dentry *Dentry)
+{
+    if (0 != InterlockedDecrement(&Dentry->RefCount))
+        return;
+
+    if (0 != Dentry->Nlookup)
+        fsp_fuse_ll_forget(f, Dentry->Ino, Dentry->Nlookup);
+
+    MemFree(Dentry);
+}
+
+static VOID fsp_fuse_ll_dentry_release_list(struct fuse *f, struct fsp_fuse_dentry *Dentry)
+{
+    struct fsp_fuse_dentry *NextDentry;
+
+    for (; 0 != Dentry; Dentry = NextDentry)
+    {
+        NextDentry = Dentry->DictNext;
+        fsp_fuse_ll_dentry_release(f, Dentry);
+    }
+}
+
+static VOID fsp_fuse_ll_dentry_cache_flush_nolock(struct fuse *f,
+    struct fsp_fuse_dentry **PReleaseList)
+{
+    struct fsp_fuse_dentry *Dentry, *NextDentry;
+
+    for (ULONG I = 0; FSP_FUSE_DENTRY_CACHE_BUCKETS > I; I++)
+    {
+        for (Dentry = f->DentryCacheBuckets[I]; 0 != Dentry; Dentry = NextDentry)
+        {
+            NextDentry = Dentry->DictNext;
+            Dentry->DictNext = *PReleaseList;
+            *PReleaseList = Dentry;
+        }
+        f->DentryCacheBuckets[I] = 0;
+    }
+    f->DentryCacheItemCount = 0;
+}
+
+static struct fsp_fuse_dentry **fsp_fuse_ll_dentry_find_nolock(struct fuse *f,
+    fuse_ino_t Parent, const char *Name, ULONG Hash, ULONG Size)
+{
+    struct fsp_fuse_dentry **P;
+
+    for (P = &f->DentryCacheBuckets[Hash % FSP_FUSE_DENTRY_CACHE_BUCKETS]; 0 != *P; P = &(*P)->DictNext)
+        if ((*P)->Hash == Hash && (*P)->Parent == Parent && (*P)->NameSize == Size &&
+            0 == memcmp((*P)->Name, Name, Size))
+            break;
+
+    return P;
+}
+
+static struct fsp_fuse_dentry *fsp_fuse_ll_dentry_lookup(struct fuse *f,
+    fuse_ino_t Parent, const char *Name)
+{
+    ULONG Size, Hash = fsp_fuse_ll_dentry_hash(Parent, Name, &Size);
+    UINT64 CurrentTime = GetTickCount64();
+    struct fsp_fuse_dentry *Dentry;
+
+    AcquireSRWLockShared(&f->DentryCacheLock);
+    Dentry = *fsp_fuse_ll_dentry_find_nolock(f, Parent, Name, Hash, Size);
+    if (0 != Dentry && CurrentTime < Dentry->EntryExpirationTime)
+        InterlockedIncrement(&Dentry->RefCount);
+    else
+        Dentry = 0;
+    ReleaseSRWLockShared(&f->DentryCacheLock);
+
+    if (0 != Dentry)
+        InterlockedIncrement64(&f->DentryCacheHitCount);
+
+    return Dentry;
+}
+
+/*
+ * Records a lookup of Name in Parent. The returned dentry is referenced on behalf of the
+ * caller; if it cannot be allocated the lookup is forgotten right away.
+ */
+static struct fsp_fuse_dentry *fsp_fuse_ll_dentry_add(struct fuse *f,
+    fuse_ino_t Parent, const char *Name, const struct fuse_entry_param *e,
+    UINT64 EntryTimeout, UINT64 AttrTimeout)
+{
+    UINT64 CurrentTime = GetTickCount64();
+    struct fsp_fuse_dentry **P, *Dentry, *NewDentry, *ReleaseList = 0;
+    ULONG Size, Hash;
+
+    Hash = fsp_fuse_ll_dentry_hash(Parent, Name, &Size);
+    NewDentry = MemAlloc(sizeof *NewDentry + Size);
+    if (0 == NewDentry)
+    {
+        fsp_fuse_ll_forget(f, e->ino, 1);
+        return 0;
+    }
+    NewDentry->RefCount = 2;
+    NewDentry->Hash = Hash;
+    NewDentry->NameSize = Size;
+    NewDentry->Parent = Parent;
+    NewDentry->Ino = e->ino;
+    NewDentry->Nlookup = 1;
+    NewDentry->EntryExpirationTime = CurrentTime + EntryTimeout;
+    NewDentry->AttrExpirationTime = CurrentTime + AttrTimeout;
+    memcpy(&NewDentry->Attr, &e->attr, sizeof e->attr);
+    memcpy(NewDentry->Name, Name, Size);
+
+    AcquireSRWLockExclusive(&f->DentryCacheLock);
+    P = fsp_fuse_ll_dentry_find_nolock(f, Parent, Name, Hash, Size);
+    if (0 != *P && (*P)->Ino == e->ino)
+    {
+        /* same inode: fold the lookup into the cached dentry */
+        Dentry = *P;
+        Dentry->Nlookup++;
+        Dentry->EntryExpirationTime = NewDentry->EntryExpirationTime;
+        Dentry->AttrExpirationTime = NewDentry->AttrExpirationTime;
+        memcpy(&Dentry->Attr, &NewDentry->Attr, sizeof Dentry->Attr);
+        InterlockedIncrement(&Dentry->RefCount);
+    }
+    else
+    {
+        if (0 != *P)
+        {
+            /* the name now refers to a different inode */
+            Dentry = *P;
+            *P = Dentry->DictNext;
+            Dentry->DictNext = ReleaseList;
+            ReleaseList = Dentry;
+            f->DentryCacheItemCount--;
+        }
+        if (FSP_FUSE_DENTRY_CACHE_ITEMMAX <= f->DentryCacheItemCount)
+        {
+            fsp_fuse_ll_dentry_cache_flush_nolock(f, &ReleaseList);
+            P = &f->DentryCacheBuckets[Hash % FSP_FUSE_DENTRY_CACHE_BUCKETS];
+        }
+        NewDentry->DictNext = *P;
+        *P = NewDentry;
+        f->DentryCacheItemCount++;
+        Dentry = NewDentry;
+        NewDentry = 0;
+    }
+    ReleaseSRWLockExclusive(&f->DentryCacheLock);
+
+    MemFree(NewDentry);
+    fsp_fuse_ll_dentry_release_list(f, ReleaseList);
+
+    return Dentry;
+}
+
+static BOOLEAN fsp_fuse_ll_dentry_get_attr(struct fuse *f, struct fsp_fuse_dentry *Dentry,
+    struct fuse_stat *stbuf)
+{
+    UINT64 CurrentTime = GetTickCount64();
+    BOOLEAN Found = FALSE;
+
+    AcquireSRWLockShared(&f->DentryCacheLock);
+    if (CurrentTime < Dentry->AttrExpirationTime)
+    {
+        memcpy(stbuf, &Dentry->Attr, sizeof *stbuf);
+        Found = TRUE;
+    }
+    ReleaseSRWLockShared(&f->DentryCacheLock);
+
+    return Found;
+}
+
+static VOID fsp_fuse_ll_dentry_set_attr(struct fuse *f, struct fsp_fuse_dentry *Dentry,
+    const struct fuse_stat *stbuf, UINT64 AttrTimeout)
+{
+    AcquireSRWLockExclusive(&f->DentryCacheLock);
+    if (0 != stbuf)
+    {
+        memcpy(&Dentry->Attr, stbuf, sizeof Dentry->Attr);
+        Dentry->AttrExpirationTime = GetTickCount64() + AttrTimeout;
+    }
+    else
+        Dentry->AttrExpirationTime = 0;
+    ReleaseSRWLockExclusive(&f->DentryCacheLock);
+}
+
+static VOID fsp_fuse_ll_dentry_set_size(struct fuse *f, struct fsp_fuse_dentry *Dentry,
+    UINT64 FileSize)
+{
+    FILETIME FileTime;
+    UINT64 UnixTime;
+
+    /* the file system has just updated size and modification time; mirror that locally */
+    GetSystemTimeAsFileTime(&FileTime);
+    UnixTime = *(PUINT64)&FileTime - 116444736000000000;
+
+    AcquireSRWLockExclusive(&f->DentryCacheLock);
+    Dentry->Attr.st_size = FileSize;
+#if defined(_WIN64)
+    Dentry->Attr.st_mtim.tv_sec = (int64_t)(UnixTime / 10000000);
+    Dentry->Attr.st_mtim.tv_nsec = (int64_t)(UnixTime % 10000000) * 100;
+#else
+    Dentry->Attr.st_mtim.tv_sec = (int32_t)(UnixTime / 10000000);
+    Dentry->Attr.st_mtim.tv_nsec = (int32_t)(UnixTime % 10000000) * 100;
+#endif
+    Dentry->Attr.st_ctim = Dentry->Attr.st_mtim;
+    ReleaseSRWLockExclusive(&f->DentryCacheLock);
+}
+
+VOID fsp_fuse_ll_file_desc_release_all(struct fuse *f)
+{
+    struct fsp_fuse_ll_file_desc *filedesc;
+    PLIST_ENTRY ListEntry;
+
+    if (0 == f->DentryCacheBuckets)
+        return;
+
+    /*
+     * Handles that are still open when the file system is torn down never see a Close.
+     * Release their dentries so that the lookup counts they hold are also forgotten.
+     */
+    AcquireSRWLockExclusive(&f->DentryCacheLock);
+    while (&f->FileDescList != (ListEntry = f->FileDescList.Flink))
+    {
+        RemoveEntryList(ListEntry);
+        ReleaseSRWLockExclusive(&f->DentryCacheLock);
+
+        filedesc = CONTAINING_RECORD(ListEntry, struct fsp_fuse_ll_file_desc, ListEntry);
+        if (0 != filedesc->Dentry)
+            fsp_fuse_ll_dentry_release(f, filedesc->Dentry);
+        MemFree(filedesc);
+
+        AcquireSRWLockExclusive(&f->DentryCacheLock);
+    }
+    ReleaseSRWLockExclusive(&f->DentryCacheLock);
+}
+
+VOID fsp_fuse_ll_dentry_cache_flush(struct fuse *f)
+{
+    struct fsp_fuse_dentry *ReleaseList = 0;
+
+    if (0 == f->DentryCacheBuckets)
+        return;
+
+    AcquireSRWLockExclusive(&f->DentryCacheLock);
+    fsp_fuse_ll_dentry_cache_flush_nolock(f, &ReleaseList);
+    ReleaseSRWLockExclusive(&f->DentryCacheLock);
+
+    fsp_fuse_ll_dentry_release_list(f, ReleaseList);
+}
+
+VOID fsp_fuse_ll_dentry_cache_finalize(struct fuse *f)
+{
+    /* the cache has been flushed (and its inodes forgotten) before destroy */
+    MemFree(f->DentryCacheBuckets);
+    f->DentryCacheBuckets = 0;
+}
+
+/*
+ * Requests.
+ */
+static NTSTATUS fsp_fuse_ll_lookup(struct fuse *f, fuse_ino_t Parent, const char *Name,
+    struct fsp_fuse_dentry **PDentry)
+{
+    struct fsp_fuse_dentry *Dentry;
+    struct fuse_entry_param e;
+    struct fuse_req req;
+    NTSTATUS Result;
+
+    *PDentry = 0;
+
+    Dentry = fsp_fuse_ll_dentry_lookup(f, Parent, Name);
+    if (0 != Dentry)
+    {
+        *PDentry = Dentry;
+        return STATUS_SUCCESS;
+    }
+
+    if (0 == f->llops.lookup)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    memset(&e, 0, sizeof e);
+    fsp_fuse_ll_req_init(f, &req);
+    req.Entry = &e;
+    f->llops.lookup(&req, Parent, Name);
+    Result = fsp_fuse_ll_req_wait(&req);
+    InterlockedIncrement64(&f->LookupCount);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    if (0 == e.ino)
+        return STATUS_OBJECT_NAME_NOT_FOUND; /* negative entry */
+
+    Dentry = fsp_fuse_ll_dentry_add(f, Parent, Name, &e, req.EntryTimeout, req.AttrTimeout);
+    if (0 == Dentry)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    *PDentry = Dentry;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_resolve(struct fuse *f, const char *PosixPath,
+    struct fsp_fuse_dentry **PDentry, fuse_ino_t *PIno)
+{
+    struct fuse_context *context = fsp_fuse_get_context_internal(f->env);
+    struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+    struct fsp_fuse_dentry *Dentry = 0, *ChildDentry;
+    fuse_ino_t Ino = FUSE_ROOT_ID;
+    char *Path, *Name, *P;
+    ULONG Size;
+    NTSTATUS Result;
+
+    *PDentry = 0;
+    *PIno = 0;
+
+    Size = lstrlenA(PosixPath) + 1;
+    Path = fsp_fuse_arena_alloc(contexthdr, Size);
+    if (0 == Path)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    memcpy(Path, PosixPath, Size);
+
+    for (P = Path;;)
+    {
+        while ('/' == *P)
+            P++;
+        if ('\0' == *P)
+            break;
+
+        Name = P;
+        while ('\0' != *P && '/' != *P)
+            P++;
+        if ('/' == *P)
+            *P++ = '\0';
+
+        /* keep the parent referenced until the child is; it must not be forgotten meanwhile */
+        Result = fsp_fuse_ll_lookup(f, Ino, Name, &ChildDentry);
+        if (0 != Dentry)
+            fsp_fuse_ll_dentry_release(f, Dentry);
+        Dentry = ChildDentry;
+        if (!NT_SUCCESS(Result))
+            goto exit;
+
+        Ino = Dentry->Ino;
+    }
+
+    *PDentry = Dentry;
+    *PIno = Ino;
+
+    Result = STATUS_SUCCESS;
+
+exit:
+    fsp_fuse_arena_free(contexthdr, Path);
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_ll_getattr_ex(struct fuse *f, struct fsp_fuse_dentry *Dentry,
+    fuse_ino_t Ino, struct fuse_file_info *fi, struct fuse_stat *stbuf)
+{
+    struct fuse_req req;
+    NTSTATUS Result;
+
+    if (0 != Dentry && fsp_fuse_ll_dentry_get_attr(f, Dentry, stbuf))
+        return STATUS_SUCCESS;
+
+    if (0 == f->llops.getattr)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    memset(stbuf, 0, sizeof *stbuf);
+    fsp_fuse_ll_req_init(f, &req);
+    req.Attr = stbuf;
+    f->llops.getattr(&req, Ino, fi);
+    Result = fsp_fuse_ll_req_wait(&req);
+    if (NT_SUCCESS(Result) && 0 != Dentry)
+        fsp_fuse_ll_dentry_set_attr(f, Dentry, stbuf, req.AttrTimeout);
+
+    return Result;
+}
+
+NTSTATUS fsp_fuse_ll_getattr(struct fuse *f, fuse_ino_t ino, struct fuse_stat *stbuf)
+{
+    return fsp_fuse_ll_getattr_ex(f, 0, ino, 0, stbuf);
+}
+
+NTSTATUS fsp_fuse_ll_statfs(struct fuse *f, struct fuse_statvfs *stbuf)
+{
+    struct fuse_req req;
+
+    if (0 == f->llops.statfs)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    memset(stbuf, 0, sizeof *stbuf);
+    fsp_fuse_ll_req_init(f, &req);
+    req.Statvfs = stbuf;
+    f->llops.statfs(&req, FUSE_ROOT_ID);
+
+    return fsp_fuse_ll_req_wait(&req);
+}
+
+static NTSTATUS fsp_fuse_ll_setattr(struct fuse *f, struct fsp_fuse_ll_file_desc *filedesc,
+    struct fuse_stat *attr, int to_set, struct fuse_stat *stbuf)
+{
+    struct fuse_file_info fi;
+    struct fuse_req req;
+    NTSTATUS Result;
+
+    if (0 == f->llops.setattr)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    memset(&fi, 0, sizeof fi);
+    fi.flags = filedesc->OpenFlags;
+    fi.fh = filedesc->FileHandle;
+
+    memset(stbuf, 0, sizeof *stbuf);
+    fsp_fuse_ll_req_init(f, &req);
+    req.Attr = stbuf;
+    f->llops.setattr(&req, filedesc->Ino, attr, to_set, &fi);
+    Result = fsp_fuse_ll_req_wait(&req);
+    if (0 != filedesc->Dentry)
+        fsp_fuse_ll_dentry_set_attr(f, filedesc->Dentry,
+            NT_SUCCESS(Result) ? stbuf : 0, req.AttrTimeout);
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_ll_GetFileInfoEx(struct fuse *f, struct fsp_fuse_dentry *Dentry,
+    fuse_ino_t Ino, struct fuse_file_info *fi,
+    PUINT32 PUid, PUINT32 PGid, PUINT32 PMode,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse_stat stbuf;
+    NTSTATUS Result;
+
+    Result = fsp_fuse_ll_getattr_ex(f, Dentry, Ino, fi, &stbuf);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    fsp_fuse_intf_FileInfoFromStat(f, &stbuf, PUid, PGid, PMode, FileInfo);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_GetSecurityEx(struct fuse *f, struct fsp_fuse_dentry *Dentry,
+    fuse_ino_t Ino, struct fuse_file_info *fi,
+    PUINT32 PFileAttributes,
+    PSECURITY_DESCRIPTOR SecurityDescriptorBuf, SIZE_T *PSecurityDescriptorSize)
+{
+    UINT32 Uid, Gid, Mode;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    PSECURITY_DESCRIPTOR SecurityDescriptor = 0;
+    SIZE_T SecurityDescriptorSize;
+    NTSTATUS Result;
+
+    Result = fsp_fuse_ll_GetFileInfoEx(f, Dentry, Ino, fi, &Uid, &Gid, &Mode, &FileInfo);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    if (0 != PSecurityDescriptorSize)
+    {
+        Result = FspPosixMapPermissionsToSecurityDescriptor(Uid, Gid, Mode, &SecurityDescriptor);
+        if (!NT_SUCCESS(Result))
+            goto exit;
+
+        SecurityDescriptorSize = GetSecurityDescriptorLength(SecurityDescriptor);
+
+        if (SecurityDescriptorSize > *PSecurityDescriptorSize)
+        {
+            *PSecurityDescriptorSize = SecurityDescriptorSize;
+            Result = STATUS_BUFFER_OVERFLOW;
+            goto exit;
+        }
+
+        *PSecurityDescriptorSize = SecurityDescriptorSize;
+        if (0 != SecurityDescriptorBuf)
+            memcpy(SecurityDescriptorBuf, SecurityDescriptor, SecurityDescriptorSize);
+    }
+
+    if (0 != PFileAttributes)
+        *PFileAttributes = FileInfo.FileAttributes;
+
+    Result = STATUS_SUCCESS;
+
+exit:
+    if (0 != SecurityDescriptor)
+        FspDeleteSecurityDescriptor(SecurityDescriptor,
+            FspPosixMapPermissionsToSecurityDescriptor);
+
+    return Result;
+}
+
+/*
+ * File system interface.
+ */
+static NTSTATUS fsp_fuse_ll_GetVolumeInfo(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    FSP_FSCTL_VOLUME_INFO *VolumeInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_statvfs stbuf;
+    NTSTATUS Result;
+
+    Result = fsp_fuse_ll_statfs(f, &stbuf);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    VolumeInfo->TotalSize = (UINT64)stbuf.f_blocks * (UINT64)stbuf.f_frsize;
+    VolumeInfo->FreeSize = (UINT64)stbuf.f_bfree * (UINT64)stbuf.f_frsize;
+    VolumeInfo->VolumeLabelLength = 0;
+    VolumeInfo->VolumeLabel[0] = L'\0';
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_SetVolumeLabel(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PWSTR VolumeLabel,
+    FSP_FSCTL_VOLUME_INFO *VolumeInfo)
+{
+    /* there is no volume label concept in FUSE */
+    return STATUS_INVALID_PARAMETER;
+}
+
+static NTSTATUS fsp_fuse_ll_GetSecurityByName(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR FileName, PUINT32 PFileAttributes,
+    PSECURITY_DESCRIPTOR SecurityDescriptorBuf, SIZE_T *PSecurityDescriptorSize)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context = fsp_fuse_get_context_internal(f->env);
+    struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+    char *PosixPath = 0;
+    struct fsp_fuse_dentry *Dentry = 0;
+    fuse_ino_t Ino;
+    NTSTATUS Result;
+
+    Result = fsp_fuse_arena_posix_path(contexthdr, FileName, &PosixPath);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    Result = fsp_fuse_ll_resolve(f, PosixPath, &Dentry, &Ino);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    Result = fsp_fuse_ll_GetSecurityEx(f, Dentry, Ino, 0,
+        PFileAttributes, SecurityDescriptorBuf, PSecurityDescriptorSize);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    Result = STATUS_SUCCESS;
+
+exit:
+    if (0 != Dentry)
+        fsp_fuse_ll_dentry_release(f, Dentry);
+    if (0 != PosixPath)
+        fsp_fuse_arena_free(contexthdr, PosixPath);
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_ll_Create(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PWSTR FileName, BOOLEAN CaseSensitive, UINT32 CreateOptions,
+    UINT32 FileAttributes, PSECURITY_DESCRIPTOR SecurityDescriptor, UINT64 AllocationSize,
+    PVOID *PFileNode, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    /* namespace changing operations are not supported through the low-level API yet */
+    return STATUS_INVALID_DEVICE_REQUEST;
+}
+
+static NTSTATUS fsp_fuse_ll_Open(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PWSTR FileName, BOOLEAN CaseSensitive, UINT32 CreateOptions,
+    PVOID *PFileNode, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context = fsp_fuse_get_context_internal(f->env);
+    struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+    struct fsp_fuse_dentry *Dentry = 0;
+    fuse_ino_t Ino;
+    UINT32 Uid, Gid, Mode;
+    FSP_FSCTL_FILE_INFO FileInfoBuf;
+    struct fsp_fuse_ll_file_desc *filedesc = 0;
+    struct fuse_file_info fi;
+    struct fuse_req req;
+    BOOLEAN IsDirectory;
+    NTSTATUS Result;
+
+    Result = fsp_fuse_ll_resolve(f, contexthdr->PosixPath, &Dentry, &Ino);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    Result = fsp_fuse_ll_GetFileInfoEx(f, Dentry, Ino, 0, &Uid, &Gid, &Mode, &FileInfoBuf);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    filedesc = MemAlloc(sizeof *filedesc);
+    if (0 == filedesc)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+
+    memset(&fi, 0, sizeof fi);
+    switch (Request->Req.Create.DesiredAccess & (FILE_READ_DATA | FILE_WRITE_DATA))
+    {
+    default:
+    case FILE_READ_DATA:
+        fi.flags = 0/*O_RDONLY*/;
+        break;
+    case FILE_WRITE_DATA:
+        fi.flags = 1/*O_WRONLY*/;
+        break;
+    case FILE_READ_DATA | FILE_WRITE_DATA:
+        fi.flags = 2/*O_RDWR*/;
+        break;
+    }
+
+    /* like libfuse, a file system without open/opendir accepts every open */
+    IsDirectory = !!(FileInfoBuf.FileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+    fsp_fuse_ll_req_init(f, &req);
+    req.FileInfo = &fi;
+    if (IsDirectory && 0 != f->llops.opendir)
+    {
+        f->llops.opendir(&req, Ino, &fi);
+        Result = fsp_fuse_ll_req_wait(&req);
+    }
+    else if (!IsDirectory && 0 != f->llops.open)
+    {
+        f->llops.open(&req, Ino, &fi);
+        Result = fsp_fuse_ll_req_wait(&req);
+    }
+    else
+        Result = STATUS_SUCCESS;
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    /*
+     * The FSD shares the FileNode among all opens of a file, so the inode is kept in
+     * a per-handle descriptor in UserContext2 (as with the high-level API).
+     */
+    *PFileNode = 0;
+    memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
+
+    filedesc->Dentry = Dentry;
+    filedesc->Ino = Ino;
+    filedesc->IsDirectory = IsDirectory;
+    filedesc->OpenFlags = fi.flags;
+    filedesc->FileHandle = fi.fh;
+    contexthdr->Response->Rsp.Create.Opened.UserContext2 = (UINT64)(UINT_PTR)filedesc;
+    Dentry = 0;
+
+    AcquireSRWLockExclusive(&f->DentryCacheLock);
+    InsertTailList(&f->FileDescList, &filedesc->ListEntry);
+    ReleaseSRWLockExclusive(&f->DentryCacheLock);
+
+    Result = STATUS_SUCCESS;
+
+exit:
+    if (!NT_SUCCESS(Result))
+        MemFree(filedesc);
+    if (0 != Dentry)
+        fsp_fuse_ll_dentry_release(f, Dentry);
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_ll_Overwrite(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PVOID FileNode, UINT32 FileAttributes, BOOLEAN ReplaceFileAttributes,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_ll_file_desc *filedesc =
+        (PVOID)(UINT_PTR)Request->Req.Overwrite.UserContext2;
+    UINT32 Uid, Gid, Mode;
+    struct fuse_stat attr, stbuf;
+    NTSTATUS Result;
+
+    memset(&attr, 0, sizeof attr);
+    Result = fsp_fuse_ll_setattr(f, filedesc, &attr, FUSE_SET_ATTR_SIZE, &stbuf);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    fsp_fuse_intf_FileInfoFromStat(f, &stbuf, &Uid, &Gid, &Mode, FileInfo);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID fsp_fuse_ll_Close(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PVOID FileNode)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_ll_file_desc *filedesc =
+        (PVOID)(UINT_PTR)Request->Req.Close.UserContext2;
+    struct fuse_file_info fi;
+    struct fuse_req req;
+
+    memset(&fi, 0, sizeof fi);
+    fi.flags = filedesc->OpenFlags;
+    fi.fh = filedesc->FileHandle;
+
+    if (filedesc->IsDirectory)
+    {
+        if (0 != f->llops.releasedir)
+        {
+            fsp_fuse_ll_req_init(f, &req);
+            f->llops.releasedir(&req, filedesc->Ino, &fi);
+            fsp_fuse_ll_req_wait(&req);
+        }
+    }
+    else
+    {
+        if (0 != f->llops.flush)
+        {
+            fsp_fuse_ll_req_init(f, &req);
+            f->llops.flush(&req, filedesc->Ino, &fi);
+            fsp_fuse_ll_req_wait(&req);
+        }
+        if (0 != f->llops.release)
+        {
+            fsp_fuse_ll_req_init(f, &req);
+            f->llops.release(&req, filedesc->Ino, &fi);
+            fsp_fuse_ll_req_wait(&req);
+        }
+    }
+
+    AcquireSRWLockExclusive(&f->DentryCacheLock);
+    RemoveEntryList(&filedesc->ListEntry);
+    ReleaseSRWLockExclusive(&f->DentryCacheLock);
+
+    if (0 != filedesc->Dentry)
+        fsp_fuse_ll_dentry_release(f, filedesc->Dentry);
+    MemFree(filedesc);
+}
+
+static NTSTATUS fsp_fuse_ll_Read(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PVOID FileNode, PVOID Buffer, UINT64 Offset, ULONG Length,
+    PULONG PBytesTransferred)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_ll_file_desc *filedesc =
+        (PVOID)(UINT_PTR)Request->Req.Read.UserContext2;
+    struct fuse_file_info fi;
+    struct fuse_req req;
+    NTSTATUS Result;
+
+    if (0 == f->llops.read)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    memset(&fi, 0, sizeof fi);
+    fi.flags = filedesc->OpenFlags;
+    fi.fh = filedesc->FileHandle;
+
+    fsp_fuse_ll_req_init(f, &req);
+    req.Buffer = Buffer;
+    req.BufferSize = Length;
+    f->llops.read(&req, filedesc->Ino, Length, Offset, &fi);
+    Result = fsp_fuse_ll_req_wait(&req);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    if (0 == req.BytesTransferred)
+        return STATUS_END_OF_FILE;
+
+    *PBytesTransferred = (ULONG)req.BytesTransferred;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_Write(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PVOID FileNode, PVOID Buffer, UINT64 Offset, ULONG Length,
+    BOOLEAN WriteToEndOfFile, BOOLEAN ConstrainedIo,
+    PULONG PBytesTransferred, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_ll_file_desc *filedesc =
+        (PVOID)(UINT_PTR)Request->Req.Write.UserContext2;
+    UINT32 Uid, Gid, Mode;
+    struct fuse_file_info fi;
+    struct fuse_req req;
+    FSP_FSCTL_FILE_INFO FileInfoBuf;
+    UINT64 EndOffset, AllocationUnit;
+    NTSTATUS Result;
+
+    if (0 == f->llops.write)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    memset(&fi, 0, sizeof fi);
+    fi.flags = filedesc->OpenFlags;
+    fi.fh = filedesc->FileHandle;
+
+    Result = fsp_fuse_ll_GetFileInfoEx(f, filedesc->Dentry, filedesc->Ino, &fi,
+        &Uid, &Gid, &Mode, &FileInfoBuf);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    if (ConstrainedIo)
+    {
+        if (Offset >= FileInfoBuf.FileSize)
+            goto success;
+        EndOffset = Offset + Length;
+        if (EndOffset > FileInfoBuf.FileSize)
+            EndOffset = FileInfoBuf.FileSize;
+    }
+    else
+    {
+        if (WriteToEndOfFile)
+            Offset = FileInfoBuf.FileSize;
+        EndOffset = Offset + Length;
+    }
+
+    fsp_fuse_ll_req_init(f, &req);
+    f->llops.write(&req, filedesc->Ino, Buffer, (size_t)(EndOffset - Offset), Offset, &fi);
+    Result = fsp_fuse_ll_req_wait(&req);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    *PBytesTransferred = (ULONG)req.BytesTransferred;
+
+    EndOffset = Offset + req.BytesTransferred;
+    if (EndOffset > FileInfoBuf.FileSize)
+        FileInfoBuf.FileSize = EndOffset;
+    if (0 != filedesc->Dentry)
+        fsp_fuse_ll_dentry_set_size(f, filedesc->Dentry, FileInfoBuf.FileSize);
+
+    AllocationUnit = (UINT64)f->VolumeParams.SectorSize *
+        (UINT64)f->VolumeParams.SectorsPerAllocationUnit;
+    FileInfoBuf.AllocationSize =
+        (FileInfoBuf.FileSize + AllocationUnit - 1) / AllocationUnit * AllocationUnit;
+
+success:
+    memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_Flush(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PVOID FileNode)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_ll_file_desc *filedesc =
+        (PVOID)(UINT_PTR)Request->Req.FlushBuffers.UserContext2;
+    struct fuse_file_info fi;
+    struct fuse_req req;
+
+    if (0 == filedesc)
+        return STATUS_SUCCESS; /* FUSE cannot flush volumes */
+
+    memset(&fi, 0, sizeof fi);
+    fi.flags = filedesc->OpenFlags;
+    fi.fh = filedesc->FileHandle;
+
+    /* just say success, if fs does not support fsync */
+    fsp_fuse_ll_req_init(f, &req);
+    if (filedesc->IsDirectory && 0 != f->llops.fsyncdir)
+        f->llops.fsyncdir(&req, filedesc->Ino, 0, &fi);
+    else if (!filedesc->IsDirectory && 0 != f->llops.fsync)
+        f->llops.fsync(&req, filedesc->Ino, 0, &fi);
+    else
+        return STATUS_SUCCESS;
+
+    return fsp_fuse_ll_req_wait(&req);
+}
+
+static NTSTATUS fsp_fuse_ll_GetFileInfo(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PVOID FileNode,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_ll_file_desc *filedesc =
+        (PVOID)(UINT_PTR)Request->Req.QueryInformation.UserContext2;
+    UINT32 Uid, Gid, Mode;
+    struct fuse_file_info fi;
+
+    memset(&fi, 0, sizeof fi);
+    fi.flags = filedesc->OpenFlags;
+    fi.fh = filedesc->FileHandle;
+
+    return fsp_fuse_ll_GetFileInfoEx(f, filedesc->Dentry, filedesc->Ino, &fi,
+        &Uid, &Gid, &Mode, FileInfo);
+}
+
+static NTSTATUS fsp_fuse_ll_SetBasicInfo(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PVOID FileNode, UINT32 FileAttributes,
+    UINT64 CreationTime, UINT64 LastAccessTime, UINT64 LastWriteTime,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_ll_file_desc *filedesc =
+        (PVOID)(UINT_PTR)Request->Req.SetInformation.UserContext2;
+    UINT32 Uid, Gid, Mode;
+    struct fuse_stat attr, stbuf;
+    int to_set = 0;
+    NTSTATUS Result;
+
+    if (0 == f->llops.setattr)
+        return STATUS_SUCCESS; /* liar! */
+
+    /* no way to set FileAttributes, CreationTime! */
+    if (0 == LastAccessTime && 0 == LastWriteTime)
+        return fsp_fuse_ll_GetFileInfo(FileSystem, Request, FileNode, FileInfo);
+
+    /* UNIX epoch in 100-ns intervals */
+    memset(&attr, 0, sizeof attr);
+    if (0 != LastAccessTime)
+    {
+        LastAccessTime -= 116444736000000000;
+#if defined(_WIN64)
+        attr.st_atim.tv_sec = (int64_t)(LastAccessTime / 10000000);
+        attr.st_atim.tv_nsec = (int64_t)(LastAccessTime % 10000000) * 100;
+#else
+        attr.st_atim.tv_sec = (int32_t)(LastAccessTime / 10000000);
+        attr.st_atim.tv_nsec = (int32_t)(LastAccessTime % 10000000) * 100;
+#endif
+        to_set |= FUSE_SET_ATTR_ATIME;
+    }
+    if (0 != LastWriteTime)
+    {
+        LastWriteTime -= 116444736000000000;
+#if defined(_WIN64)
+        attr.st_mtim.tv_sec = (int64_t)(LastWriteTime / 10000000);
+        attr.st_mtim.tv_nsec = (int64_t)(LastWriteTime % 10000000) * 100;
+#else
+        attr.st_mtim.tv_sec = (int32_t)(LastWriteTime / 10000000);
+        attr.st_mtim.tv_nsec = (int32_t)(LastWriteTime % 10000000) * 100;
+#endif
+        to_set |= FUSE_SET_ATTR_MTIME;
+    }
+
+    Result = fsp_fuse_ll_setattr(f, filedesc, &attr, to_set, &stbuf);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    fsp_fuse_intf_FileInfoFromStat(f, &stbuf, &Uid, &Gid, &Mode, FileInfo);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_SetFileSize(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PVOID FileNode, UINT64 NewSize, BOOLEAN SetAllocationSize,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_ll_file_desc *filedesc =
+        (PVOID)(UINT_PTR)Request->Req.SetInformation.UserContext2;
+    UINT32 Uid, Gid, Mode;
+    struct fuse_file_info fi;
+    struct fuse_stat attr, stbuf;
+    FSP_FSCTL_FILE_INFO FileInfoBuf;
+    NTSTATUS Result;
+
+    if (0 == f->llops.setattr)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    memset(&fi, 0, sizeof fi);
+    fi.flags = filedesc->OpenFlags;
+    fi.fh = filedesc->FileHandle;
+
+    Result = fsp_fuse_ll_GetFileInfoEx(f, filedesc->Dentry, filedesc->Ino, &fi,
+        &Uid, &Gid, &Mode, &FileInfoBuf);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    if (!SetAllocationSize || FileInfoBuf.FileSize > NewSize)
+    {
+        /*
+         * "FileInfoBuf.FileSize > NewSize" explanation:
+         * FUSE 2.8 does not support allocation size. However if the new AllocationSize
+         * is less than the current FileSize we must truncate the file.
+         */
+        memset(&attr, 0, sizeof attr);
+        attr.st_size = NewSize;
+        Result = fsp_fuse_ll_setattr(f, filedesc, &attr, FUSE_SET_ATTR_SIZE, &stbuf);
+        if (!NT_SUCCESS(Result))
+            return Result;
+
+        fsp_fuse_intf_FileInfoFromStat(f, &stbuf, &Uid, &Gid, &Mode, &FileInfoBuf);
+    }
+
+    memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_CanDelete(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PVOID FileNode, PWSTR FileName)
+{
+    /* namespace changing operations are not supported through the low-level API yet */
+    return STATUS_INVALID_DEVICE_REQUEST;
+}
+
+static NTSTATUS fsp_fuse_ll_GetSecurity(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PVOID FileNode,
+    PSECURITY_DESCRIPTOR SecurityDescriptorBuf, SIZE_T *PSecurityDescriptorSize)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_ll_file_desc *filedesc =
+        (PVOID)(UINT_PTR)Request->Req.QuerySecurity.UserContext2;
+    struct fuse_file_info fi;
+    UINT32 FileAttributes;
+
+    memset(&fi, 0, sizeof fi);
+    fi.flags = filedesc->OpenFlags;
+    fi.fh = filedesc->FileHandle;
+
+    return fsp_fuse_ll_GetSecurityEx(f, filedesc->Dentry, filedesc->Ino, &fi,
+        &FileAttributes, SecurityDescriptorBuf, PSecurityDescriptorSize);
+}
+
+/*
+ * ReadDirectory is stateless: every query asks the file system for the entries following
+ * Offset, which is the fuse_off_t of the last entry returned. With readdirplus the entry
+ * attributes come with the listing; with readdir they are looked up through the dentry cache.
+ */
+static NTSTATUS fsp_fuse_ll_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request,
+    PVOID FileNode, PVOID Buffer, UINT64 Offset, ULONG Length,
+    PWSTR Pattern,
+    PULONG PBytesTransferred)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context = fsp_fuse_get_context_internal(f->env);
+    struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+    struct fsp_fuse_ll_file_desc *filedesc =
+        (PVOID)(UINT_PTR)Request->Req.QueryDirectory.UserContext2;
+    struct fuse_file_info fi;
+    struct fuse_req req;
+    struct fsp_fuse_ll_dirent *de;
+    struct fsp_fuse_dentry *Dentry;
+    PUINT8 DirBuffer = 0, deend;
+    union
+    {
+        FSP_FSCTL_DIR_INFO V;
+        UINT8 B[sizeof(FSP_FSCTL_DIR_INFO) + (255 + 1) * sizeof(WCHAR)];
+    } DirInfoBuf;
+    FSP_FSCTL_DIR_INFO *DirInfo = &DirInfoBuf.V;
+    struct fuse_stat stbuf;
+    UINT32 Uid, Gid, Mode;
+    ULONG Size;
+    NTSTATUS Result;
+
+    if (0 == f->llops.readdirplus && 0 == f->llops.readdir)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    DirBuffer = fsp_fuse_arena_alloc(contexthdr, Length);
+    if (0 == DirBuffer)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+
+    memset(&fi, 0, sizeof fi);
+    fi.flags = filedesc->OpenFlags;
+    fi.fh = filedesc->FileHandle;
+
+    fsp_fuse_ll_req_init(f, &req);
+    req.Buffer = DirBuffer;
+    req.BufferSize = Length;
+    if (0 != f->llops.readdirplus)
+        f->llops.readdirplus(&req, filedesc->Ino, Length, Offset, &fi);
+    else
+        f->llops.readdir(&req, filedesc->Ino, Length, Offset, &fi);
+    Result = fsp_fuse_ll_req_wait(&req);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    if (0 == req.BytesTransferred)
+    {
+        /* EOF */
+        FspFileSystemAddDirInfo(0, Buffer, Length, PBytesTransferred);
+        goto success;
+    }
+
+    /*
+     * Every readdirplus entry counts as a lookup, including those that will not fit in
+     * this query's buffer; account for all of them before producing any output.
+     */
+    deend = DirBuffer + req.BytesTransferred;
+    for (de = (PVOID)DirBuffer;
+        (PUINT8)de + sizeof(struct fsp_fuse_ll_dirent) <= deend &&
+            sizeof(struct fsp_fuse_ll_dirent) < de->Size && (PUINT8)de + de->Size <= deend;
+        de = (PVOID)((PUINT8)de + FSP_FSCTL_DEFAULT_ALIGN_UP(de->Size)))
+        if (de->Plus && 0 != de->Entry.ino && !fsp_fuse_ll_IsDotName(de->Name))
+        {
+            Dentry = fsp_fuse_ll_dentry_add(f, filedesc->Ino, de->Name, &de->Entry,
+                de->EntryTimeout, de->AttrTimeout);
+            if (0 != Dentry)
+                fsp_fuse_ll_dentry_release(f, Dentry);
+        }
+
+    for (de = (PVOID)DirBuffer;
+        (PUINT8)de + sizeof(struct fsp_fuse_ll_dirent) <= deend &&
+            sizeof(struct fsp_fuse_ll_dirent) < de->Size && (PUINT8)de + de->Size <= deend;
+        de = (PVOID)((PUINT8)de + FSP_FSCTL_DEFAULT_ALIGN_UP(de->Size)))
+    {
+        if ('.' == de->Name[0] && '\0' == de->Name[1])
+            Result = fsp_fuse_ll_getattr_ex(f, filedesc->Dentry, filedesc->Ino, 0, &stbuf);
+        else
+        if ('.' == de->Name[0] && '.' == de->Name[1] && '\0' == de->Name[2])
+            Result = fsp_fuse_ll_getattr_ex(f, 0,
+                0 != filedesc->Dentry ? filedesc->Dentry->Parent : FUSE_ROOT_ID, 0, &stbuf);
+        else
+        if (de->Plus && 0 != de->Entry.ino)
+        {
+            memcpy(&stbuf, &de->Entry.attr, sizeof stbuf);
+            Result = STATUS_SUCCESS;
+        }
+        else
+        {
+            Result = fsp_fuse_ll_lookup(f, filedesc->Ino, de->Name, &Dentry);
+            if (NT_SUCCESS(Result))
+            {
+                Result = fsp_fuse_ll_getattr_ex(f, Dentry, Dentry->Ino, 0, &stbuf);
+                fsp_fuse_ll_dentry_release(f, Dentry);
+            }
+
+            /* the entry may have been removed since it was listed; skip it */
+            if (!NT_SUCCESS(Result))
+                continue;
+        }
+        if (!NT_SUCCESS(Result))
+            goto exit;
+
+        fsp_fuse_intf_FileInfoFromStat(f, &stbuf, &Uid, &Gid, &Mode, &DirInfo->FileInfo);
+
+        /* Name holds at most 255 bytes, which never map to more than 255 WCHAR's */
+        Size = 255 + 1;
+        Result = FspPosixMapPosixToWindowsPathEx(de->Name, DirInfo->FileNameBuf, &Size);
+        if (!NT_SUCCESS(Result))
+            goto exit;
+        Size = (Size - 1) * sizeof(WCHAR);
+
+        memset(DirInfo->Padding, 0, sizeof DirInfo->Padding);
+        DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) + Size);
+        DirInfo->NextOffset = de->NextOffset;
+
+        if (!FspFileSystemAddDirInfo(DirInfo, Buffer, Length, PBytesTransferred))
+            break;
+    }
+
+success:
+    Result = STATUS_SUCCESS;
+
+exit:
+    if (0 != DirBuffer)
+        fsp_fuse_arena_free(contexthdr, DirBuffer);
+
+    return Result;
+}
+
+FSP_FILE_SYSTEM_INTERFACE fsp_fuse_ll_intf =
+{
+    fsp_fuse_ll_GetVolumeInfo,
+    fsp_fuse_ll_SetVolumeLabel,
+    fsp_fuse_ll_GetSecurityByName,
+    fsp_fuse_ll_Create,
+    fsp_fuse_ll_Open,
+    fsp_fuse_ll_Overwrite,
+    0,
+    fsp_fuse_ll_Close,
+    fsp_fuse_ll_Read,
+    fsp_fuse_ll_Write,
+    fsp_fuse_ll_Flush,
+    fsp_fuse_ll_GetFileInfo,
+    fsp_fuse_ll_SetBasicInfo,
+    fsp_fuse_ll_SetFileSize,
+    fsp_fuse_ll_CanDelete,
+    0,
+    fsp_fuse_ll_GetSecurity,
+    0,
+    fsp_fuse_ll_ReadDirectory,
+};
+
+/*
+ * Reply API.
+ */
+FSP_FUSE_API void *fsp_fuse_req_userdata(struct fsp_fuse_env *env,
+    fuse_req_t req)
+{
+    return req->fuse->data;
+}
+
+FSP_FUSE_API const struct fuse_ctx *fsp_fuse_req_ctx(struct fsp_fuse_env *env,
+    fuse_req_t req)
+{
+    struct fuse_context *context = req->context;
+
+    if (0 != context)
+    {
+        /* uid/gid are resolved lazily; failure leaves them at -1 */
+        fsp_fuse_context_resolve_ids(context);
+        req->ctx.uid = context->uid;
+        req->ctx.gid = context->gid;
+        req->ctx.pid = context->pid;
+        req->ctx.umask = context->umask;
+    }
+
+    return &req->ctx;
+}
+
+FSP_FUSE_API int fsp_fuse_reply_err(struct fsp_fuse_env *env,
+    fuse_req_t req, int err)
+{
+    return fsp_fuse_ll_reply(req, err);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_entry(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_entry_param *e)
+{
+    if (0 == req->Entry)
+        return fsp_fuse_ll_reply(req, EIO);
+
+    memcpy(req->Entry, e, sizeof *e);
+    req->EntryTimeout = fsp_fuse_ll_timeout(&e->entry_timeout);
+    req->AttrTimeout = fsp_fuse_ll_timeout(&e->attr_timeout);
+
+    return fsp_fuse_ll_reply(req, 0);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_attr(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_stat *attr, const double *attr_timeout)
+{
+    if (0 == req->Attr)
+        return fsp_fuse_ll_reply(req, EIO);
+
+    memcpy(req->Attr, attr, sizeof *attr);
+    req->AttrTimeout = fsp_fuse_ll_timeout(attr_timeout);
+
+    return fsp_fuse_ll_reply(req, 0);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_open(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_file_info *fi)
+{
+    if (0 == req->FileInfo)
+        return fsp_fuse_ll_reply(req, EIO);
+
+    if (req->FileInfo != fi)
+        memcpy(req->FileInfo, fi, sizeof *fi);
+
+    return fsp_fuse_ll_reply(req, 0);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_write(struct fsp_fuse_env *env,
+    fuse_req_t req, size_t count)
+{
+    req->BytesTransferred = count;
+
+    return fsp_fuse_ll_reply(req, 0);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_buf(struct fsp_fuse_env *env,
+    fuse_req_t req, const char *buf, size_t size)
+{
+    if (0 == req->Buffer)
+        return fsp_fuse_ll_reply(req, EIO);
+
+    if (size > req->BufferSize)
+        size = req->BufferSize;
+    memcpy(req->Buffer, buf, size);
+    req->BytesTransferred = size;
+
+    return fsp_fuse_ll_reply(req, 0);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_statfs(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_statvfs *stbuf)
+{
+    if (0 == req->Statvfs)
+        return fsp_fuse_ll_reply(req, EIO);
+
+    memcpy(req->Statvfs, stbuf, sizeof *stbuf);
+
+    return fsp_fuse_ll_reply(req, 0);
+}
+
+static size_t fsp_fuse_ll_add_direntry(char *buf, size_t bufsize,
+    const char *name, const struct fuse_entry_param *e, fuse_off_t off)
+{
+    struct fsp_fuse_ll_dirent *de = (PVOID)buf;
+    size_t len, entsize;
+
+    len = lstrlenA(name);
+    if (len > 255)
+        len = 255;
+
+    entsize = FSP_FSCTL_DEFAULT_ALIGN_UP(sizeof(struct fsp_fuse_ll_dirent) + len + 1);
+    if (0 == buf || entsize > bufsize)
+        return entsize;
+
+    de->Size = (UINT16)(sizeof(struct fsp_fuse_ll_dirent) + len + 1);
+    de->Plus = 0 != e;
+    de->NextOffset = off;
+    if (0 != e)
+    {
+        memcpy(&de->Entry, e, sizeof *e);
+        de->EntryTimeout = fsp_fuse_ll_timeout(&e->entry_timeout);
+        de->AttrTimeout = fsp_fuse_ll_timeout(&e->attr_timeout);
+    }
+    else
+    {
+        memset(&de->Entry, 0, sizeof de->Entry);
+        de->EntryTimeout = 0;
+        de->AttrTimeout = 0;
+    }
+    memcpy(de->Name, name, len);
+    de->Name[len] = '\0';
+
+    return entsize;
+}
+
+FSP_FUSE_API size_t fsp_fuse_add_direntry(struct fsp_fuse_env *env,
+    fuse_req_t req, char *buf, size_t bufsize,
+    const char *name, const struct fuse_stat *stbuf, fuse_off_t off)
+{
+    /* plain readdir entries carry no attributes; they are looked up when listed */
+    return fsp_fuse_ll_add_direntry(buf, bufsize, name, 0, off);
+}
+
+FSP_FUSE_API size_t fsp_fuse_add_direntry_plus(struct fsp_fuse_env *env,
+    fuse_req_t req, char *buf, size_t bufsize,
+    const char *name, const struct fuse_entry_param *e, fuse_off_t off)
+{
+    return fsp_fuse_ll_add_direntry(buf, bufsize, name, e, off);
+}
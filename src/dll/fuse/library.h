@@ -20,10 +20,20 @@
 
 #include <dll/library.h>
 #include <fuse/fuse.h>
+#include <fuse/fuse_lowlevel.h>
 #include <fuse/fuse_opt.h>
 
 #define FSP_FUSE_LIBRARY_NAME           LIBRARY_NAME "-FUSE"
 
+#define FSP_FUSE_ARENA_SIZE             (16 * 1024)
+#define FSP_FUSE_FILE_DESC_PATHSIZE     256
+#define FSP_FUSE_FILE_DESC_POOLMAX      1024
+#define FSP_FUSE_READDIR_PARALLEL_MAX   64
+#define FSP_FUSE_ATTR_CACHE_BUCKETS     1024
+#define FSP_FUSE_ATTR_CACHE_ITEMMAX     16384
+#define FSP_FUSE_DENTRY_CACHE_BUCKETS   1024
+#define FSP_FUSE_DENTRY_CACHE_ITEMMAX   16384
+
 #define FSP_FUSE_HDR_FROM_CONTEXT(c)    \
     (struct fsp_fuse_context_header *)((PUINT8)(c) - sizeof(struct fsp_fuse_context_header))
 #define FSP_FUSE_CONTEXT_FROM_HDR(h)    \
@@ -44,6 +54,23 @@ struct fuse
     FSP_FILE_SYSTEM *FileSystem;
     BOOLEAN fsinit;
     FSP_SERVICE *Service; /* weak */
+    SLIST_HEADER FileDescPool;
+    BOOLEAN ReaddirPlus;
+    ULONG ReaddirParallel;
+    volatile LONG64 ReaddirGetattrAvoidedCount;
+    UINT64 AttrTimeout, NegativeTimeout;    /* millisec; 0: do not cache */
+    SRWLOCK AttrCacheLock;
+    struct fsp_fuse_attr_cache_item **AttrCacheBuckets;
+    ULONG AttrCacheItemCount;
+    volatile LONG AttrCacheGeneration;
+    volatile LONG64 GetattrCount, AttrCacheHitCount;
+    BOOLEAN LowLevel;                   /* fuse_lowlevel_new: llops instead of ops */
+    struct fuse_lowlevel_ops llops;
+    SRWLOCK DentryCacheLock;
+    struct fsp_fuse_dentry **DentryCacheBuckets;
+    ULONG DentryCacheItemCount;
+    LIST_ENTRY FileDescList;            /* open handles; protected by DentryCacheLock */
+    volatile LONG64 LookupCount, DentryCacheHitCount;
 };
 
 struct fsp_fuse_context_header
@@ -51,21 +78,27 @@ struct fsp_fuse_context_header
     FSP_FSCTL_TRANSACT_REQ *Request;
     FSP_FSCTL_TRANSACT_RSP *Response;
     char *PosixPath;
+    HANDLE Token;                       /* uid/gid not yet resolved from this token */
+    PUINT8 ArenaBuf;                    /* per-thread; reset on every fsp_fuse_op_leave */
+    ULONG ArenaUsed;
     __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) UINT8 ContextBuf[];
 };
 
 struct fsp_fuse_file_desc
 {
-    char *PosixPath;
+    SLIST_ENTRY ListEntry;
+    char *PosixPath;                    /* points to PosixPathBuf unless the path is too long */
     BOOLEAN IsDirectory;
     int OpenFlags;
     UINT64 FileHandle;
     PVOID DirBuffer;
     ULONG DirBufferSize;
+    char PosixPathBuf[FSP_FUSE_FILE_DESC_PATHSIZE];
 };
 
 struct fuse_dirhandle
 {
+    struct fuse *fuse;                  /* set when readdir stbuf is used (readdirplus) */
     PVOID Buffer;
     ULONG Length;
     ULONG BytesTransferred;
@@ -82,11 +115,40 @@ struct fsp_fuse_dirinfo
     char PosixNameBuf[];                /* includes term-0 (unlike FSP_FSCTL_DIR_INFO) */
 };
 
+PVOID fsp_fuse_arena_alloc(struct fsp_fuse_context_header *contexthdr, ULONG Size);
+VOID fsp_fuse_arena_free(struct fsp_fuse_context_header *contexthdr, PVOID Pointer);
+NTSTATUS fsp_fuse_arena_posix_path(struct fsp_fuse_context_header *contexthdr,
+    PWSTR WindowsPath, char **PPosixPath);
+VOID fsp_fuse_intf_FileInfoFromStat(struct fuse *f, struct fuse_stat *stbuf,
+    PUINT32 PUid, PUINT32 PGid, PUINT32 PMode,
+    FSP_FSCTL_FILE_INFO *FileInfo);
+
+struct fuse_context *fsp_fuse_get_context_internal(struct fsp_fuse_env *env);
+NTSTATUS fsp_fuse_context_resolve_ids(struct fuse_context *context);
 NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_REQ *Request, FSP_FSCTL_TRANSACT_RSP *Response);
 NTSTATUS fsp_fuse_op_leave(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_REQ *Request, FSP_FSCTL_TRANSACT_RSP *Response);
 
+/*
+ * fsp_fuse_loopback_start creates the file system of a struct fuse without a service,
+ * mount point or dispatcher, so that the test suite can drive it with
+ * FspFileSystemLoopbackTransact. It is exported for the test suite only and is not part
+ * of the public API; fuse_destroy deletes the file system.
+ */
+FSP_FUSE_API NTSTATUS fsp_fuse_loopback_start(struct fsp_fuse_env *env,
+    struct fuse *f, FSP_FILE_SYSTEM **PFileSystem);
+
+VOID fsp_fuse_file_desc_pool_finalize(struct fuse *f);
+VOID fsp_fuse_attr_cache_finalize(struct fuse *f);
+
+NTSTATUS fsp_fuse_ll_statfs(struct fuse *f, struct fuse_statvfs *stbuf);
+NTSTATUS fsp_fuse_ll_getattr(struct fuse *f, fuse_ino_t ino, struct fuse_stat *stbuf);
+VOID fsp_fuse_ll_file_desc_release_all(struct fuse *f);
+VOID fsp_fuse_ll_dentry_cache_flush(struct fuse *f);
+VOID fsp_fuse_ll_dentry_cache_finalize(struct fuse *f);
+
 extern FSP_FILE_SYSTEM_INTERFACE fsp_fuse_intf;
+extern FSP_FILE_SYSTEM_INTERFACE fsp_fuse_ll_intf;
 
 #endif
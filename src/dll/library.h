@@ -37,6 +37,7 @@
 #endif
 
 VOID FspPosixFinalize(BOOLEAN Dynamic);
+VOID FspSecurityFinalize(BOOLEAN Dynamic);
 VOID FspEventLogFinalize(BOOLEAN Dynamic);
 VOID FspServiceFinalize(BOOLEAN Dynamic);
 VOID fsp_fuse_finalize(BOOLEAN Dynamic);
@@ -51,6 +52,24 @@ NTSTATUS FspEventLogUnregister(VOID);
 
 PWSTR FspDiagIdent(VOID);
 
+/*
+ * FspFileSystemLoopbackTransact processes a buffer of requests in the same way as the
+ * file system dispatcher, but without transacting with the FSD. It is exported for the
+ * test suite only and is not part of the public API.
+ */
+FSP_API NTSTATUS FspFileSystemLoopbackTransact(FSP_FILE_SYSTEM *FileSystem,
+    PVOID RequestBuf, SIZE_T RequestBufSize,
+    PVOID ResponseBuf, SIZE_T *PResponseBufSize);
+
+NTSTATUS FspFileSystemCreateTraverseCache(FSP_FILE_SYSTEM *FileSystem, BOOLEAN CaseSensitive);
+VOID FspFileSystemDeleteTraverseCache(FSP_FILE_SYSTEM *FileSystem);
+VOID FspFileSystemInvalidateTraverseCache(FSP_FILE_SYSTEM *FileSystem);
+VOID FspFileSystemGetTraverseCacheStatistics(FSP_FILE_SYSTEM *FileSystem,
+    PUINT64 PHitCount, PUINT64 PMissCount);
+
+NTSTATUS FspPosixMapWindowsToPosixPathEx(PWSTR WindowsPath, char *PosixPath, PULONG PSize);
+NTSTATUS FspPosixMapPosixToWindowsPathEx(const char *PosixPath, PWSTR WindowsPath, PULONG PSize);
+
 BOOL WINAPI FspServiceConsoleCtrlHandler(DWORD CtrlType);
 
 #endif
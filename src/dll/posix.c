@@ -53,6 +53,33 @@ static PISID FspAccountDomainSid, FspPrimaryDomainSid;
 #define FspUnmappedSid                  (&FspUnmappedSidBuf.V)
 #define FspUnmappedUid                  (65534)
 
+/*
+ * SID to UID cache
+ *
+ * Mapping a domain account requires comparing its SID against the account and primary
+ * domain SIDs. The mapping is fixed for the lifetime of the process, so the result is
+ * cached by SID. The set of principals seen by a file system is small; the cache is
+ * bounded and is simply flushed when full.
+ */
+enum
+{
+    FspPosixUidCacheBucketCount = 64,
+    FspPosixUidCacheItemCountMax = 256,
+};
+
+typedef struct _FSP_POSIX_UID_CACHE_ITEM
+{
+    struct _FSP_POSIX_UID_CACHE_ITEM *DictNext;
+    ULONG Hash;
+    UINT32 Uid;
+    ULONG SidSize;
+    UINT8 Sid[];
+} FSP_POSIX_UID_CACHE_ITEM;
+
+static SRWLOCK FspPosixUidCacheLock = SRWLOCK_INIT;
+static ULONG FspPosixUidCacheItemCount;
+static FSP_POSIX_UID_CACHE_ITEM *FspPosixUidCacheBuckets[FspPosixUidCacheBucketCount];
+
 static BOOL WINAPI FspPosixInitialize(
     PINIT_ONCE InitOnce, PVOID Parameter, PVOID *Context)
 {
@@ -103,6 +130,84 @@ exit:
     return TRUE;
 }
 
+static VOID FspPosixUidCacheFlush(VOID)
+{
+    FSP_POSIX_UID_CACHE_ITEM *Item, *NextItem;
+
+    for (ULONG I = 0; FspPosixUidCacheBucketCount > I; I++)
+    {
+        for (Item = FspPosixUidCacheBuckets[I]; 0 != Item; Item = NextItem)
+        {
+            NextItem = Item->DictNext;
+            MemFree(Item);
+        }
+        FspPosixUidCacheBuckets[I] = 0;
+    }
+    FspPosixUidCacheItemCount = 0;
+}
+
+static ULONG FspPosixUidCacheHash(PUINT8 Sid, ULONG SidSize)
+{
+    ULONG Hash = 2166136261;
+
+    for (ULONG I = 0; SidSize > I; I++)
+        Hash = (Hash ^ Sid[I]) * 16777619;
+
+    return Hash;
+}
+
+static BOOLEAN FspPosixUidCacheLookup(PSID Sid, ULONG SidSize, ULONG Hash, PUINT32 PUid)
+{
+    FSP_POSIX_UID_CACHE_ITEM *Item;
+    BOOLEAN Found = FALSE;
+
+    AcquireSRWLockShared(&FspPosixUidCacheLock);
+    for (Item = FspPosixUidCacheBuckets[Hash % FspPosixUidCacheBucketCount];
+        0 != Item; Item = Item->DictNext)
+        if (Item->Hash == Hash && Item->SidSize == SidSize && 0 == memcmp(Item->Sid, Sid, SidSize))
+        {
+            *PUid = Item->Uid;
+            Found = TRUE;
+            break;
+        }
+    ReleaseSRWLockShared(&FspPosixUidCacheLock);
+
+    return Found;
+}
+
+static VOID FspPosixUidCacheAdd(PSID Sid, ULONG SidSize, ULONG Hash, UINT32 Uid)
+{
+    FSP_POSIX_UID_CACHE_ITEM *Item, *NewItem;
+
+    NewItem = MemAlloc(sizeof *NewItem + SidSize);
+    if (0 == NewItem)
+        return;
+    NewItem->Hash = Hash;
+    NewItem->Uid = Uid;
+    NewItem->SidSize = SidSize;
+    memcpy(NewItem->Sid, Sid, SidSize);
+
+    AcquireSRWLockExclusive(&FspPosixUidCacheLock);
+
+    for (Item = FspPosixUidCacheBuckets[Hash % FspPosixUidCacheBucketCount];
+        0 != Item; Item = Item->DictNext)
+        if (Item->Hash == Hash && Item->SidSize == SidSize && 0 == memcmp(Item->Sid, Sid, SidSize))
+            goto exit;
+
+    if (FspPosixUidCacheItemCountMax <= FspPosixUidCacheItemCount)
+        FspPosixUidCacheFlush();
+
+    NewItem->DictNext = FspPosixUidCacheBuckets[Hash % FspPosixUidCacheBucketCount];
+    FspPosixUidCacheBuckets[Hash % FspPosixUidCacheBucketCount] = NewItem;
+    FspPosixUidCacheItemCount++;
+    NewItem = 0;
+
+exit:
+    ReleaseSRWLockExclusive(&FspPosixUidCacheLock);
+
+    MemFree(NewItem);
+}
+
 VOID FspPosixFinalize(BOOLEAN Dynamic)
 {
     /*
@@ -112,6 +217,7 @@ VOID FspPosixFinalize(BOOLEAN Dynamic)
 
     if (Dynamic)
     {
+        FspPosixUidCacheFlush();
         MemFree(FspAccountDomainSid);
         MemFree(FspPrimaryDomainSid);
     }
@@ -239,12 +345,18 @@ FSP_API NTSTATUS FspPosixMapSidToUid(PSID Sid, PUINT32 PUid)
     BYTE Authority;
     BYTE Count;
     UINT32 SubAuthority0, Rid;
+    ULONG SidSize, Hash;
 
     *PUid = -1;
 
     if (!IsValidSid(Sid) || 0 == (Count = *GetSidSubAuthorityCount(Sid)))
         return STATUS_INVALID_SID;
 
+    SidSize = GetLengthSid(Sid);
+    Hash = FspPosixUidCacheHash(Sid, SidSize);
+    if (FspPosixUidCacheLookup(Sid, SidSize, Hash, PUid))
+        return STATUS_SUCCESS;
+
     Authority = GetSidIdentifierAuthority(Sid)->Value[5];
     SubAuthority0 = 2 <= Count ? *GetSidSubAuthority(Sid, 0) : 0;
     Rid = *GetSidSubAuthority(Sid, Count - 1);
@@ -339,6 +451,8 @@ FSP_API NTSTATUS FspPosixMapSidToUid(PSID Sid, PUINT32 PUid)
     if (-1 == *PUid)
         *PUid = FspUnmappedUid;
 
+    FspPosixUidCacheAdd(Sid, SidSize, Hash, *PUid);
+
     return STATUS_SUCCESS;
 }
 
@@ -805,28 +919,25 @@ static UINT32 FspPosixInvalidPathChars[4] =
     0x00000008,
 };
 
-FSP_API NTSTATUS FspPosixMapWindowsToPosixPath(PWSTR WindowsPath, char **PPosixPath)
+NTSTATUS FspPosixMapWindowsToPosixPathEx(PWSTR WindowsPath, char *PosixPath, PULONG PSize)
 {
-    NTSTATUS Result;
     ULONG Size;
-    char *PosixPath = 0, *p, *q;
+    char *p, *q;
 
-    *PPosixPath = 0;
-
-    Size = WideCharToMultiByte(CP_UTF8, 0, WindowsPath, -1, 0, 0, 0, 0);
+    Size = 0 != PosixPath && 0 != *PSize ?
+        WideCharToMultiByte(CP_UTF8, 0, WindowsPath, -1, PosixPath, *PSize, 0, 0) : 0;
     if (0 == Size)
-        goto lasterror;
-
-    PosixPath = MemAlloc(Size);
-    if (0 == PosixPath)
     {
-        Result = STATUS_INSUFFICIENT_RESOURCES;
-        goto exit;
-    }
+        if (0 != PosixPath && 0 != *PSize && ERROR_INSUFFICIENT_BUFFER != GetLastError())
+            return FspNtStatusFromWin32(GetLastError());
 
-    Size = WideCharToMultiByte(CP_UTF8, 0, WindowsPath, -1, PosixPath, Size, 0, 0);
-    if (0 == Size)
-        goto lasterror;
+        Size = WideCharToMultiByte(CP_UTF8, 0, WindowsPath, -1, 0, 0, 0, 0);
+        if (0 == Size)
+            return FspNtStatusFromWin32(GetLastError());
+
+        *PSize = Size;
+        return STATUS_BUFFER_TOO_SMALL;
+    }
 
     for (p = PosixPath, q = p; *p; p++)
     {
@@ -848,6 +959,69 @@ FSP_API NTSTATUS FspPosixMapWindowsToPosixPath(PWSTR WindowsPath, char **PPosixP
     }
     *q = '\0';
 
+    *PSize = (ULONG)(q - PosixPath + 1);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS FspPosixMapPosixToWindowsPathEx(const char *PosixPath, PWSTR WindowsPath, PULONG PSize)
+{
+    ULONG Size;
+    PWSTR p;
+
+    Size = 0 != WindowsPath && 0 != *PSize ?
+        MultiByteToWideChar(CP_UTF8, 0, PosixPath, -1, WindowsPath, *PSize) : 0;
+    if (0 == Size)
+    {
+        if (0 != WindowsPath && 0 != *PSize && ERROR_INSUFFICIENT_BUFFER != GetLastError())
+            return FspNtStatusFromWin32(GetLastError());
+
+        Size = MultiByteToWideChar(CP_UTF8, 0, PosixPath, -1, 0, 0);
+        if (0 == Size)
+            return FspNtStatusFromWin32(GetLastError());
+
+        *PSize = Size;
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    for (p = WindowsPath; *p; p++)
+    {
+        WCHAR c = *p;
+
+        if (L'/' == c)
+            *p = L'\\';
+        else if (128 > c && (FspPosixInvalidPathChars[c >> 5] & (0x80000000 >> (c & 0x1f))))
+            *p |= 0xf000;
+    }
+
+    *PSize = Size;
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API NTSTATUS FspPosixMapWindowsToPosixPath(PWSTR WindowsPath, char **PPosixPath)
+{
+    NTSTATUS Result;
+    ULONG Size;
+    char *PosixPath = 0;
+
+    *PPosixPath = 0;
+
+    Result = FspPosixMapWindowsToPosixPathEx(WindowsPath, 0, &Size);
+    if (STATUS_BUFFER_TOO_SMALL != Result)
+        goto exit;
+
+    PosixPath = MemAlloc(Size);
+    if (0 == PosixPath)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+
+    Result = FspPosixMapWindowsToPosixPathEx(WindowsPath, PosixPath, &Size);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
     *PPosixPath = PosixPath;
 
     Result = STATUS_SUCCESS;
@@ -857,44 +1031,30 @@ exit:
         MemFree(PosixPath);
 
     return Result;
-
-lasterror:
-    Result = FspNtStatusFromWin32(GetLastError());
-    goto exit;
 }
 
 FSP_API NTSTATUS FspPosixMapPosixToWindowsPath(const char *PosixPath, PWSTR *PWindowsPath)
 {
     NTSTATUS Result;
     ULONG Size;
-    PWSTR WindowsPath = 0, p;
+    PWSTR WindowsPath = 0;
 
     *PWindowsPath = 0;
 
-    Size = MultiByteToWideChar(CP_UTF8, 0, PosixPath, -1, 0, 0);
-    if (0 == Size)
-        goto lasterror;
+    Result = FspPosixMapPosixToWindowsPathEx(PosixPath, 0, &Size);
+    if (STATUS_BUFFER_TOO_SMALL != Result)
+        goto exit;
 
     WindowsPath = MemAlloc(Size * sizeof(WCHAR));
-    if (0 == PosixPath)
+    if (0 == WindowsPath)
     {
         Result = STATUS_INSUFFICIENT_RESOURCES;
         goto exit;
     }
 
-    Size = MultiByteToWideChar(CP_UTF8, 0, PosixPath, -1, WindowsPath, Size);
-    if (0 == Size)
-        goto lasterror;
-
-    for (p = WindowsPath; *p; p++)
-    {
-        WCHAR c = *p;
-
-        if (L'/' == c)
-            *p = L'\\';
-        else if (128 > c && (FspPosixInvalidPathChars[c >> 5] & (0x80000000 >> (c & 0x1f))))
-            *p |= 0xf000;
-    }
+    Result = FspPosixMapPosixToWindowsPathEx(PosixPath, WindowsPath, &Size);
+    if (!NT_SUCCESS(Result))
+        goto exit;
 
     *PWindowsPath = WindowsPath;
 
@@ -905,10 +1065,6 @@ exit:
         MemFree(WindowsPath);
 
     return Result;
-
-lasterror:
-    Result = FspNtStatusFromWin32(GetLastError());
-    goto exit;
 }
 
 FSP_API VOID FspPosixDeletePath(void *Path)
@@ -48,6 +48,258 @@ static NTSTATUS FspGetSecurityByName(FSP_FILE_SYSTEM *FileSystem,
     }
 }
 
+/*
+ * Traverse cache
+ *
+ * The traverse cache remembers successful FILE_TRAVERSE checks made by FspAccessCheckEx.
+ * Items are keyed by directory path and caller token identity (TokenId and ModifiedId, so
+ * that a token whose groups or privileges are adjusted does not reuse old results). Every
+ * item expires after the configured timeout and the whole cache is flushed on operations
+ * that may change the security of a directory (SetSecurity, Rename, Cleanup(Delete)).
+ * A generation number ensures that a traverse check that raced with a flush is not added.
+ */
+enum
+{
+    FspTraverseCacheBucketCount = 1024,
+    FspTraverseCacheItemCountMax = 16384,
+};
+
+typedef struct
+{
+    LUID TokenId, ModifiedId;
+} FSP_TRAVERSE_CACHE_TOKEN_IDENTITY;
+
+typedef struct _FSP_TRAVERSE_CACHE_ITEM
+{
+    struct _FSP_TRAVERSE_CACHE_ITEM *DictNext;
+    ULONG Hash;
+    FSP_TRAVERSE_CACHE_TOKEN_IDENTITY TokenIdentity;
+    UINT64 ExpirationTime;
+    ULONG FileNameLength;
+    WCHAR FileName[];
+} FSP_TRAVERSE_CACHE_ITEM;
+
+typedef struct
+{
+    SRWLOCK Lock;
+    BOOLEAN CaseSensitive;
+    ULONG Timeout;
+    ULONG ItemCount;
+    volatile LONG Generation;
+    volatile LONG64 HitCount, MissCount;
+    FSP_TRAVERSE_CACHE_ITEM *Buckets[FspTraverseCacheBucketCount];
+} FSP_TRAVERSE_CACHE;
+
+static inline WCHAR FspTraverseCacheFoldChar(FSP_TRAVERSE_CACHE *TraverseCache, WCHAR C)
+{
+    /* ASCII folding only; names that differ in non-ASCII case simply do not share items */
+    return !TraverseCache->CaseSensitive && L'a' <= C && C <= L'z' ? C - L'a' + L'A' : C;
+}
+
+static ULONG FspTraverseCacheHash(FSP_TRAVERSE_CACHE *TraverseCache,
+    PWSTR FileName, ULONG FileNameLength, FSP_TRAVERSE_CACHE_TOKEN_IDENTITY *TokenIdentity)
+{
+    ULONG Hash = 2166136261;
+
+    for (ULONG I = 0; FileNameLength > I; I++)
+        Hash = (Hash ^ FspTraverseCacheFoldChar(TraverseCache, FileName[I])) * 16777619;
+    Hash = (Hash ^ TokenIdentity->TokenId.LowPart) * 16777619;
+    Hash = (Hash ^ TokenIdentity->ModifiedId.LowPart) * 16777619;
+
+    return Hash;
+}
+
+static BOOLEAN FspTraverseCacheItemEqual(FSP_TRAVERSE_CACHE *TraverseCache,
+    FSP_TRAVERSE_CACHE_ITEM *Item, ULONG Hash,
+    PWSTR FileName, ULONG FileNameLength, FSP_TRAVERSE_CACHE_TOKEN_IDENTITY *TokenIdentity)
+{
+    if (Item->Hash != Hash ||
+        Item->FileNameLength != FileNameLength ||
+        0 != memcmp(&Item->TokenIdentity, TokenIdentity, sizeof *TokenIdentity))
+        return FALSE;
+
+    for (ULONG I = 0; FileNameLength > I; I++)
+        if (FspTraverseCacheFoldChar(TraverseCache, Item->FileName[I]) !=
+            FspTraverseCacheFoldChar(TraverseCache, FileName[I]))
+            return FALSE;
+
+    return TRUE;
+}
+
+static VOID FspTraverseCacheFlush(FSP_TRAVERSE_CACHE *TraverseCache)
+{
+    FSP_TRAVERSE_CACHE_ITEM *Item, *NextItem;
+
+    for (ULONG I = 0; FspTraverseCacheBucketCount > I; I++)
+    {
+        for (Item = TraverseCache->Buckets[I]; 0 != Item; Item = NextItem)
+        {
+            NextItem = Item->DictNext;
+            MemFree(Item);
+        }
+        TraverseCache->Buckets[I] = 0;
+    }
+    TraverseCache->ItemCount = 0;
+}
+
+static BOOLEAN FspTraverseCacheGetTokenIdentity(FSP_TRAVERSE_CACHE *TraverseCache,
+    HANDLE Token, FSP_TRAVERSE_CACHE_TOKEN_IDENTITY *TokenIdentity)
+{
+    TOKEN_STATISTICS Statistics;
+    DWORD Size;
+
+    if (0 == TraverseCache || 0 == TraverseCache->Timeout)
+        return FALSE;
+
+    if (!GetTokenInformation(Token, TokenStatistics, &Statistics, sizeof Statistics, &Size))
+        return FALSE;
+
+    TokenIdentity->TokenId = Statistics.TokenId;
+    TokenIdentity->ModifiedId = Statistics.ModifiedId;
+
+    return TRUE;
+}
+
+static inline LONG FspTraverseCacheGeneration(FSP_TRAVERSE_CACHE *TraverseCache)
+{
+    return TraverseCache->Generation;
+}
+
+static BOOLEAN FspTraverseCacheLookup(FSP_TRAVERSE_CACHE *TraverseCache,
+    PWSTR FileName, ULONG FileNameLength, FSP_TRAVERSE_CACHE_TOKEN_IDENTITY *TokenIdentity)
+{
+    ULONG Hash = FspTraverseCacheHash(TraverseCache, FileName, FileNameLength, TokenIdentity);
+    UINT64 CurrentTime = GetTickCount64();
+    FSP_TRAVERSE_CACHE_ITEM *Item;
+    BOOLEAN Found = FALSE;
+
+    AcquireSRWLockShared(&TraverseCache->Lock);
+    for (Item = TraverseCache->Buckets[Hash % FspTraverseCacheBucketCount]; 0 != Item; Item = Item->DictNext)
+        if (FspTraverseCacheItemEqual(TraverseCache, Item, Hash, FileName, FileNameLength, TokenIdentity))
+        {
+            Found = CurrentTime < Item->ExpirationTime;
+            break;
+        }
+    ReleaseSRWLockShared(&TraverseCache->Lock);
+
+    InterlockedIncrement64(Found ? &TraverseCache->HitCount : &TraverseCache->MissCount);
+
+    return Found;
+}
+
+static VOID FspTraverseCacheAdd(FSP_TRAVERSE_CACHE *TraverseCache,
+    PWSTR FileName, ULONG FileNameLength, FSP_TRAVERSE_CACHE_TOKEN_IDENTITY *TokenIdentity,
+    LONG Generation)
+{
+    ULONG Hash = FspTraverseCacheHash(TraverseCache, FileName, FileNameLength, TokenIdentity);
+    UINT64 ExpirationTime = GetTickCount64() + TraverseCache->Timeout;
+    FSP_TRAVERSE_CACHE_ITEM *Item, *NewItem;
+
+    NewItem = MemAlloc(sizeof *NewItem + FileNameLength * sizeof(WCHAR));
+    if (0 == NewItem)
+        return;
+    NewItem->Hash = Hash;
+    NewItem->TokenIdentity = *TokenIdentity;
+    NewItem->ExpirationTime = ExpirationTime;
+    NewItem->FileNameLength = FileNameLength;
+    memcpy(NewItem->FileName, FileName, FileNameLength * sizeof(WCHAR));
+
+    AcquireSRWLockExclusive(&TraverseCache->Lock);
+
+    if (Generation != TraverseCache->Generation)
+        goto exit;
+
+    for (Item = TraverseCache->Buckets[Hash % FspTraverseCacheBucketCount]; 0 != Item; Item = Item->DictNext)
+        if (FspTraverseCacheItemEqual(TraverseCache, Item, Hash, FileName, FileNameLength, TokenIdentity))
+        {
+            Item->ExpirationTime = ExpirationTime;
+            goto exit;
+        }
+
+    /* the cache is a bounded accelerator; start over rather than track item age */
+    if (FspTraverseCacheItemCountMax <= TraverseCache->ItemCount)
+        FspTraverseCacheFlush(TraverseCache);
+
+    NewItem->DictNext = TraverseCache->Buckets[Hash % FspTraverseCacheBucketCount];
+    TraverseCache->Buckets[Hash % FspTraverseCacheBucketCount] = NewItem;
+    TraverseCache->ItemCount++;
+    NewItem = 0;
+
+exit:
+    ReleaseSRWLockExclusive(&TraverseCache->Lock);
+
+    MemFree(NewItem);
+}
+
+NTSTATUS FspFileSystemCreateTraverseCache(FSP_FILE_SYSTEM *FileSystem, BOOLEAN CaseSensitive)
+{
+    FSP_TRAVERSE_CACHE *TraverseCache;
+
+    TraverseCache = MemAlloc(sizeof *TraverseCache);
+    if (0 == TraverseCache)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    memset(TraverseCache, 0, sizeof *TraverseCache);
+    InitializeSRWLock(&TraverseCache->Lock);
+    TraverseCache->CaseSensitive = CaseSensitive;
+
+    FileSystem->TraverseCache = TraverseCache;
+
+    return STATUS_SUCCESS;
+}
+
+VOID FspFileSystemDeleteTraverseCache(FSP_FILE_SYSTEM *FileSystem)
+{
+    FSP_TRAVERSE_CACHE *TraverseCache = FileSystem->TraverseCache;
+
+    if (0 == TraverseCache)
+        return;
+
+    FspTraverseCacheFlush(TraverseCache);
+    MemFree(TraverseCache);
+
+    FileSystem->TraverseCache = 0;
+}
+
+VOID FspFileSystemInvalidateTraverseCache(FSP_FILE_SYSTEM *FileSystem)
+{
+    FSP_TRAVERSE_CACHE *TraverseCache = FileSystem->TraverseCache;
+
+    if (0 == TraverseCache || 0 == TraverseCache->Timeout)
+        return;
+
+    AcquireSRWLockExclusive(&TraverseCache->Lock);
+    InterlockedIncrement(&TraverseCache->Generation);
+    FspTraverseCacheFlush(TraverseCache);
+    ReleaseSRWLockExclusive(&TraverseCache->Lock);
+}
+
+VOID FspFileSystemGetTraverseCacheStatistics(FSP_FILE_SYSTEM *FileSystem,
+    PUINT64 PHitCount, PUINT64 PMissCount)
+{
+    FSP_TRAVERSE_CACHE *TraverseCache = FileSystem->TraverseCache;
+
+    *PHitCount = 0 != TraverseCache ? TraverseCache->HitCount : 0;
+    *PMissCount = 0 != TraverseCache ? TraverseCache->MissCount : 0;
+}
+
+FSP_API NTSTATUS FspFileSystemSetTraverseCacheTimeout(FSP_FILE_SYSTEM *FileSystem,
+    ULONG Timeout)
+{
+    FSP_TRAVERSE_CACHE *TraverseCache = FileSystem->TraverseCache;
+
+    if (0 != FileSystem->DispatcherThread)
+        return STATUS_INVALID_PARAMETER;
+
+    AcquireSRWLockExclusive(&TraverseCache->Lock);
+    InterlockedIncrement(&TraverseCache->Generation);
+    FspTraverseCacheFlush(TraverseCache);
+    TraverseCache->Timeout = Timeout;
+    ReleaseSRWLockExclusive(&TraverseCache->Lock);
+
+    return STATUS_SUCCESS;
+}
+
 FSP_API NTSTATUS FspAccessCheckEx(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_REQ *Request,
     BOOLEAN CheckParentDirectory, BOOLEAN AllowTraverseCheck,
@@ -75,7 +327,11 @@ FSP_API NTSTATUS FspAccessCheckEx(FSP_FILE_SYSTEM *FileSystem,
 
     NTSTATUS Result;
     WCHAR Root[2] = L"\\", TraverseCheckRoot[2] = L"\\";
-    PWSTR FileName, Suffix, Prefix, Remain;
+    PWSTR FileName, Suffix, Prefix, Remain, Separator;
+    ULONG PrefixLength;
+    FSP_TRAVERSE_CACHE_TOKEN_IDENTITY TokenIdentity;
+    BOOLEAN TraverseCacheEnabled;
+    LONG TraverseCacheGeneration;
     UINT32 FileAttributes;
     PSECURITY_DESCRIPTOR SecurityDescriptor = 0;
     SIZE_T SecurityDescriptorSize;
@@ -101,38 +357,64 @@ FSP_API NTSTATUS FspAccessCheckEx(FSP_FILE_SYSTEM *FileSystem,
     if (Request->Req.Create.UserMode &&
         AllowTraverseCheck && !Request->Req.Create.HasTraversePrivilege)
     {
-        Remain = (PWSTR)FileName;
+        TraverseCacheEnabled = FspTraverseCacheGetTokenIdentity(FileSystem->TraverseCache,
+            (HANDLE)Request->Req.Create.AccessToken, &TokenIdentity);
+
+        Separator = FileName;
         for (;;)
         {
-            FspPathPrefix(Remain, &Prefix, &Remain, TraverseCheckRoot);
-            if (L'\0' == Remain[0])
-            {
-                FspPathCombine(FileName, Remain);
+            for (Remain = Separator; L'\\' == *Remain; Remain++)
+                ;
+            if (L'\0' == *Remain)
                 break;
-            }
-
-            Result = FspGetSecurityByName(FileSystem, Prefix, 0,
-                &SecurityDescriptor, &SecurityDescriptorSize);
 
-            FspPathCombine(FileName, Remain);
-
-            if (!NT_SUCCESS(Result))
+            /* a path component follows; check the directory that contains it */
+            if (FileName == Separator)
+                Prefix = TraverseCheckRoot;
+            else
             {
-                if (STATUS_OBJECT_NAME_NOT_FOUND == Result)
-                    Result = STATUS_OBJECT_PATH_NOT_FOUND;
-                goto exit;
+                *Separator = L'\0';
+                Prefix = FileName;
             }
+            PrefixLength = lstrlenW(Prefix);
 
-            if (0 < SecurityDescriptorSize)
+            if (TraverseCacheEnabled &&
+                FspTraverseCacheLookup(FileSystem->TraverseCache, Prefix, PrefixLength, &TokenIdentity))
+                Result = STATUS_SUCCESS;
+            else
             {
-                if (AccessCheck(SecurityDescriptor, (HANDLE)Request->Req.Create.AccessToken, FILE_TRAVERSE,
-                    &FspFileGenericMapping, PrivilegeSet, &PrivilegeSetLength, &TraverseAccess, &AccessStatus))
-                    Result = AccessStatus ? STATUS_SUCCESS : STATUS_ACCESS_DENIED;
-                else
-                    Result = FspNtStatusFromWin32(GetLastError());
+                TraverseCacheGeneration = FspTraverseCacheGeneration(FileSystem->TraverseCache);
+
+                Result = FspGetSecurityByName(FileSystem, Prefix, 0,
+                    &SecurityDescriptor, &SecurityDescriptorSize);
                 if (!NT_SUCCESS(Result))
-                    goto exit;
+                {
+                    if (STATUS_OBJECT_NAME_NOT_FOUND == Result)
+                        Result = STATUS_OBJECT_PATH_NOT_FOUND;
+                }
+                else if (0 < SecurityDescriptorSize)
+                {
+                    if (AccessCheck(SecurityDescriptor, (HANDLE)Request->Req.Create.AccessToken, FILE_TRAVERSE,
+                        &FspFileGenericMapping, PrivilegeSet, &PrivilegeSetLength, &TraverseAccess, &AccessStatus))
+                        Result = AccessStatus ? STATUS_SUCCESS : STATUS_ACCESS_DENIED;
+                    else
+                        Result = FspNtStatusFromWin32(GetLastError());
+                }
+
+                if (TraverseCacheEnabled && NT_SUCCESS(Result))
+                    FspTraverseCacheAdd(FileSystem->TraverseCache, Prefix, PrefixLength, &TokenIdentity,
+                        TraverseCacheGeneration);
             }
+
+            if (FileName != Separator)
+                *Separator = L'\\';
+
+            if (!NT_SUCCESS(Result))
+                goto exit;
+
+            for (; L'\0' != *Remain && L'\\' != *Remain; Remain++)
+                ;
+            Separator = Remain;
         }
     }
 
@@ -272,16 +554,229 @@ exit:
     return Result;
 }
 
+/*
+ * Inherited security descriptor cache
+ *
+ * When a file is created without an explicit security descriptor, the descriptor computed
+ * by CreatePrivateObjectSecurity depends only on the parent descriptor, whether the new
+ * file is a directory and the owner, primary group, default DACL and integrity level of the
+ * creator's token (a creator below medium integrity gets a mandatory label).
+ * These inputs are serialized into a key and the derived descriptor is cached under it, so
+ * that creating many files in the same directory derives the descriptor once.
+ *
+ * Cached descriptors are returned as copies allocated on the process heap, which is where
+ * CreatePrivateObjectSecurity allocates its descriptors. This way FspDeleteSecurityDescriptor
+ * releases them exactly as before.
+ */
+enum
+{
+    FspSecurityDescriptorCacheBucketCount = 256,
+    FspSecurityDescriptorCacheItemCountMax = 1024,
+    FspSecurityDescriptorCacheTokenInfoSize = 1024,
+};
+
+typedef struct _FSP_SECURITY_DESCRIPTOR_CACHE_ITEM
+{
+    struct _FSP_SECURITY_DESCRIPTOR_CACHE_ITEM *DictNext;
+    ULONG Hash;
+    ULONG KeySize, DescriptorSize;
+    UINT8 Buffer[];                     /* key followed by descriptor */
+} FSP_SECURITY_DESCRIPTOR_CACHE_ITEM;
+
+static SRWLOCK FspSecurityDescriptorCacheLock = SRWLOCK_INIT;
+static ULONG FspSecurityDescriptorCacheItemCount;
+static FSP_SECURITY_DESCRIPTOR_CACHE_ITEM
+    *FspSecurityDescriptorCacheBuckets[FspSecurityDescriptorCacheBucketCount];
+
+static VOID FspSecurityDescriptorCacheFlush(VOID)
+{
+    FSP_SECURITY_DESCRIPTOR_CACHE_ITEM *Item, *NextItem;
+
+    for (ULONG I = 0; FspSecurityDescriptorCacheBucketCount > I; I++)
+    {
+        for (Item = FspSecurityDescriptorCacheBuckets[I]; 0 != Item; Item = NextItem)
+        {
+            NextItem = Item->DictNext;
+            MemFree(Item);
+        }
+        FspSecurityDescriptorCacheBuckets[I] = 0;
+    }
+    FspSecurityDescriptorCacheItemCount = 0;
+}
+
+static ULONG FspSecurityDescriptorCacheHash(PUINT8 Key, ULONG KeySize)
+{
+    ULONG Hash = 2166136261;
+
+    for (ULONG I = 0; KeySize > I; I++)
+        Hash = (Hash ^ Key[I]) * 16777619;
+
+    return Hash;
+}
+
+static BOOLEAN FspSecurityDescriptorCacheKey(FSP_FSCTL_TRANSACT_REQ *Request,
+    PSECURITY_DESCRIPTOR ParentDescriptor, PUINT8 *PKey, PULONG PKeySize)
+{
+    UINT8 OwnerBuf[FspSecurityDescriptorCacheTokenInfoSize];
+    UINT8 GroupBuf[FspSecurityDescriptorCacheTokenInfoSize];
+    UINT8 DefaultDaclBuf[FspSecurityDescriptorCacheTokenInfoSize];
+    UINT8 IntegrityBuf[FspSecurityDescriptorCacheTokenInfoSize];
+    HANDLE Token = (HANDLE)Request->Req.Create.AccessToken;
+    SECURITY_DESCRIPTOR_CONTROL Control;
+    DWORD Revision, Size;
+    PSID Owner, Group, Integrity;
+    PACL DefaultDacl;
+    ULONG ParentSize, OwnerSize, GroupSize, DefaultDaclSize, IntegritySize, KeySize;
+    PUINT8 Key, P;
+
+    *PKey = 0;
+    *PKeySize = 0;
+
+    /* an explicit descriptor may require privilege checks against the token; do not cache */
+    if (0 != Request->Req.Create.SecurityDescriptor.Offset)
+        return FALSE;
+
+    ParentSize = 0;
+    if (0 != ParentDescriptor)
+    {
+        /* only a self-relative descriptor can be used as a key */
+        if (!GetSecurityDescriptorControl(ParentDescriptor, &Control, &Revision) ||
+            0 == (SE_SELF_RELATIVE & Control))
+            return FALSE;
+        ParentSize = GetSecurityDescriptorLength(ParentDescriptor);
+    }
+
+    if (!GetTokenInformation(Token, TokenOwner, OwnerBuf, sizeof OwnerBuf, &Size) ||
+        !GetTokenInformation(Token, TokenPrimaryGroup, GroupBuf, sizeof GroupBuf, &Size) ||
+        !GetTokenInformation(Token, TokenDefaultDacl, DefaultDaclBuf, sizeof DefaultDaclBuf, &Size) ||
+        !GetTokenInformation(Token, TokenIntegrityLevel, IntegrityBuf, sizeof IntegrityBuf, &Size))
+        return FALSE;
+    Owner = ((PTOKEN_OWNER)OwnerBuf)->Owner;
+    Group = ((PTOKEN_PRIMARY_GROUP)GroupBuf)->PrimaryGroup;
+    DefaultDacl = ((PTOKEN_DEFAULT_DACL)DefaultDaclBuf)->DefaultDacl;
+    Integrity = ((PTOKEN_MANDATORY_LABEL)IntegrityBuf)->Label.Sid;
+    OwnerSize = GetLengthSid(Owner);
+    GroupSize = GetLengthSid(Group);
+    DefaultDaclSize = 0 != DefaultDacl ? DefaultDacl->AclSize : 0;
+    IntegritySize = GetLengthSid(Integrity);
+
+    KeySize = 6 * sizeof(ULONG) +
+        ParentSize + OwnerSize + GroupSize + DefaultDaclSize + IntegritySize;
+    Key = MemAlloc(KeySize);
+    if (0 == Key)
+        return FALSE;
+
+    P = Key;
+    *(PULONG)P = 0 != (Request->Req.Create.CreateOptions & FILE_DIRECTORY_FILE); P += sizeof(ULONG);
+    *(PULONG)P = ParentSize; P += sizeof(ULONG);
+    *(PULONG)P = OwnerSize; P += sizeof(ULONG);
+    *(PULONG)P = GroupSize; P += sizeof(ULONG);
+    *(PULONG)P = DefaultDaclSize; P += sizeof(ULONG);
+    *(PULONG)P = IntegritySize; P += sizeof(ULONG);
+    memcpy(P, ParentDescriptor, ParentSize); P += ParentSize;
+    memcpy(P, Owner, OwnerSize); P += OwnerSize;
+    memcpy(P, Group, GroupSize); P += GroupSize;
+    memcpy(P, DefaultDacl, DefaultDaclSize); P += DefaultDaclSize;
+    memcpy(P, Integrity, IntegritySize);
+
+    *PKey = Key;
+    *PKeySize = KeySize;
+
+    return TRUE;
+}
+
+static BOOLEAN FspSecurityDescriptorCacheLookup(PUINT8 Key, ULONG KeySize,
+    PSECURITY_DESCRIPTOR *PSecurityDescriptor)
+{
+    ULONG Hash = FspSecurityDescriptorCacheHash(Key, KeySize);
+    FSP_SECURITY_DESCRIPTOR_CACHE_ITEM *Item;
+    PSECURITY_DESCRIPTOR SecurityDescriptor = 0;
+
+    AcquireSRWLockShared(&FspSecurityDescriptorCacheLock);
+    for (Item = FspSecurityDescriptorCacheBuckets[Hash % FspSecurityDescriptorCacheBucketCount];
+        0 != Item; Item = Item->DictNext)
+        if (Item->Hash == Hash && Item->KeySize == KeySize && 0 == memcmp(Item->Buffer, Key, KeySize))
+        {
+            SecurityDescriptor = HeapAlloc(GetProcessHeap(), 0, Item->DescriptorSize);
+            if (0 != SecurityDescriptor)
+                memcpy(SecurityDescriptor, Item->Buffer + KeySize, Item->DescriptorSize);
+            break;
+        }
+    ReleaseSRWLockShared(&FspSecurityDescriptorCacheLock);
+
+    *PSecurityDescriptor = SecurityDescriptor;
+
+    return 0 != SecurityDescriptor;
+}
+
+static VOID FspSecurityDescriptorCacheAdd(PUINT8 Key, ULONG KeySize,
+    PSECURITY_DESCRIPTOR SecurityDescriptor)
+{
+    ULONG Hash = FspSecurityDescriptorCacheHash(Key, KeySize);
+    ULONG DescriptorSize = GetSecurityDescriptorLength(SecurityDescriptor);
+    FSP_SECURITY_DESCRIPTOR_CACHE_ITEM *Item, *NewItem;
+
+    NewItem = MemAlloc(sizeof *NewItem + KeySize + DescriptorSize);
+    if (0 == NewItem)
+        return;
+    NewItem->Hash = Hash;
+    NewItem->KeySize = KeySize;
+    NewItem->DescriptorSize = DescriptorSize;
+    memcpy(NewItem->Buffer, Key, KeySize);
+    memcpy(NewItem->Buffer + KeySize, SecurityDescriptor, DescriptorSize);
+
+    AcquireSRWLockExclusive(&FspSecurityDescriptorCacheLock);
+
+    for (Item = FspSecurityDescriptorCacheBuckets[Hash % FspSecurityDescriptorCacheBucketCount];
+        0 != Item; Item = Item->DictNext)
+        if (Item->Hash == Hash && Item->KeySize == KeySize && 0 == memcmp(Item->Buffer, Key, KeySize))
+            goto exit;
+
+    if (FspSecurityDescriptorCacheItemCountMax <= FspSecurityDescriptorCacheItemCount)
+        FspSecurityDescriptorCacheFlush();
+
+    NewItem->DictNext = FspSecurityDescriptorCacheBuckets[Hash % FspSecurityDescriptorCacheBucketCount];
+    FspSecurityDescriptorCacheBuckets[Hash % FspSecurityDescriptorCacheBucketCount] = NewItem;
+    FspSecurityDescriptorCacheItemCount++;
+    NewItem = 0;
+
+exit:
+    ReleaseSRWLockExclusive(&FspSecurityDescriptorCacheLock);
+
+    MemFree(NewItem);
+}
+
+VOID FspSecurityFinalize(BOOLEAN Dynamic)
+{
+    /*
+     * This function is called during DLL_PROCESS_DETACH. We must therefore keep
+     * finalization tasks to a minimum.
+     */
+
+    if (Dynamic)
+        FspSecurityDescriptorCacheFlush();
+}
+
 FSP_API NTSTATUS FspCreateSecurityDescriptor(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_REQ *Request,
     PSECURITY_DESCRIPTOR ParentDescriptor,
     PSECURITY_DESCRIPTOR *PSecurityDescriptor)
 {
+    PUINT8 Key;
+    ULONG KeySize;
+
     *PSecurityDescriptor = 0;
 
     if (FspFsctlTransactCreateKind != Request->Kind)
         return STATUS_INVALID_PARAMETER;
 
+    if (FspSecurityDescriptorCacheKey(Request, ParentDescriptor, &Key, &KeySize) &&
+        FspSecurityDescriptorCacheLookup(Key, KeySize, PSecurityDescriptor))
+    {
+        MemFree(Key);
+        return STATUS_SUCCESS;
+    }
+
     if (!CreatePrivateObjectSecurity(
         ParentDescriptor,
         0 != Request->Req.Create.SecurityDescriptor.Offset ?
@@ -290,7 +785,16 @@ FSP_API NTSTATUS FspCreateSecurityDescriptor(FSP_FILE_SYSTEM *FileSystem,
         0 != (Request->Req.Create.CreateOptions & FILE_DIRECTORY_FILE),
         (HANDLE)Request->Req.Create.AccessToken,
         &FspFileGenericMapping))
+    {
+        MemFree(Key);
         return FspNtStatusFromWin32(GetLastError());
+    }
+
+    if (0 != Key)
+    {
+        FspSecurityDescriptorCacheAdd(Key, KeySize, *PSecurityDescriptor);
+        MemFree(Key);
+    }
 
     //DEBUGLOGSD("SDDL=%s", *PSecurityDescriptor);
 
@@ -50,9 +50,19 @@
 NTSYSAPI VOID NTAPI RtlFillMemory(VOID *Destination, DWORD Length, BYTE Fill);
 NTSYSAPI VOID NTAPI RtlMoveMemory(VOID *Destination, CONST VOID *Source, DWORD Length);
 
+#pragma function(memcmp)
 #pragma function(memcpy)
 #pragma function(memset)
 static inline
+int memcmp(const void *p1, const void *p2, size_t siz)
+{
+    const unsigned char *b1 = p1, *b2 = p2;
+    for (; 0 < siz; siz--, b1++, b2++)
+        if (*b1 != *b2)
+            return *b1 - *b2;
+    return 0;
+}
+static inline
 void *memcpy(void *dst, const void *src, size_t siz)
 {
     RtlMoveMemory(dst, src, (DWORD)siz);
@@ -19,6 +19,7 @@
 #include <sys/driver.h>
 
 FAST_IO_CHECK_IF_POSSIBLE FspFastIoCheckIfPossible;
+FAST_IO_QUERY_OPEN FspFastIoQueryOpen;
 FAST_IO_ACQUIRE_FILE FspAcquireFileForNtCreateSection;
 FAST_IO_RELEASE_FILE FspReleaseFileForNtCreateSection;
 FAST_IO_ACQUIRE_FOR_MOD_WRITE FspAcquireForModWrite;
@@ -39,6 +40,7 @@ VOID FspPropagateTopFlags(PIRP Irp, PIRP TopLevelFlags);
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FspFastIoCheckIfPossible)
+#pragma alloc_text(PAGE, FspFastIoQueryOpen)
 #pragma alloc_text(PAGE, FspAcquireFileForNtCreateSection)
 #pragma alloc_text(PAGE, FspReleaseFileForNtCreateSection)
 #pragma alloc_text(PAGE, FspAcquireForModWrite)
@@ -69,6 +71,109 @@ BOOLEAN FspFastIoCheckIfPossible(
     FSP_LEAVE_BOOL("FileObject=%p", FileObject);
 }
 
+BOOLEAN FspFastIoQueryOpen(
+    PIRP Irp,
+    PFILE_NETWORK_OPEN_INFORMATION NetworkInformation,
+    PDEVICE_OBJECT DeviceObject)
+{
+    /* Callers:
+     *     IopQueryAttributes (e.g. NtQueryAttributesFile, NtQueryFullAttributesFile)
+     */
+
+    FSP_ENTER_BOOL(PAGED_CODE());
+
+    PDEVICE_OBJECT FsvolDeviceObject = DeviceObject;
+    PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation(Irp);
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PACCESS_STATE AccessState = IrpSp->Parameters.Create.SecurityContext->AccessState;
+    UNICODE_STRING FileName = FileObject->FileName;
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension;
+    PACCESS_TOKEN AccessToken;
+    FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY Identity;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    BOOLEAN FileIsOpen;
+
+    /*
+     * Answer the query from the stat-ahead cache that directory listings fill.
+     * On a miss return FALSE and let the I/O manager do a regular open/query/close.
+     */
+    Result = FALSE;
+
+    if (FspFsvolDeviceExtensionKind != FspDeviceExtension(DeviceObject)->Kind)
+        FSP_RETURN();
+
+    FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    if (0 == FsvolDeviceExtension->StatAheadCache)
+        FSP_RETURN();
+
+    /* only absolute opens of regular names; see FspFsvolCreateNoLock */
+    if (0 != FileObject->RelatedFileObject || FlagOn(IrpSp->Flags, SL_OPEN_TARGET_DIRECTORY))
+        FSP_RETURN();
+    if (sizeof(WCHAR) * 2 <= FileName.Length &&
+        L'\\' == FileName.Buffer[1] && L'\\' == FileName.Buffer[0])
+    {
+        FileName.Length -= sizeof(WCHAR);
+        FileName.MaximumLength -= sizeof(WCHAR);
+        FileName.Buffer++;
+    }
+    if (0 < FsvolDeviceExtension->VolumePrefix.Length)
+    {
+        if (FileName.Length <= FsvolDeviceExtension->VolumePrefix.Length ||
+            !RtlEqualMemory(FileName.Buffer, FsvolDeviceExtension->VolumePrefix.Buffer,
+                FsvolDeviceExtension->VolumePrefix.Length) ||
+            '\\' != FileName.Buffer[FsvolDeviceExtension->VolumePrefix.Length / sizeof(WCHAR)])
+            FSP_RETURN();
+
+        FileName.Length -= FsvolDeviceExtension->VolumePrefix.Length;
+        FileName.MaximumLength -= FsvolDeviceExtension->VolumePrefix.Length;
+        FileName.Buffer += FsvolDeviceExtension->VolumePrefix.Length / sizeof(WCHAR);
+    }
+    if (sizeof(WCHAR) * 2/* not empty or root */ > FileName.Length ||
+        L'\\' != FileName.Buffer[0] ||
+        L'\\' == FileName.Buffer[FileName.Length / sizeof(WCHAR) - 1])
+        FSP_RETURN();
+    for (PWSTR P = FileName.Buffer, EndP = P + FileName.Length / sizeof(WCHAR); EndP > P; P++)
+        if (L':' == *P)
+            FSP_RETURN(); /* named streams are not listed in directories */
+
+    /* the stat-ahead items are tagged with the token that listed the directory */
+    AccessToken = SeQuerySubjectContextToken(&AccessState->SubjectSecurityContext);
+    if (!FspFsvolDeviceStatAheadIdentity(AccessToken, &Identity))
+        FSP_RETURN();
+
+    if (!FspDeviceReference(FsvolDeviceObject))
+        FSP_RETURN();
+
+    if (FspFsvolDeviceLookupStatAhead(FsvolDeviceObject, &FileName, &Identity, &FileInfo))
+    {
+        /* an open file may be changing; its FileNode has the authoritative FileInfo */
+        FspFsvolDeviceLockContextTable(FsvolDeviceObject);
+        FileIsOpen = 0 != FspFsvolDeviceLookupContextByName(FsvolDeviceObject, &FileName);
+        FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
+
+        /* reparse points must go through a regular open */
+        if (!FileIsOpen && !FlagOn(FileInfo.FileAttributes, FILE_ATTRIBUTE_REPARSE_POINT))
+        {
+            NetworkInformation->CreationTime.QuadPart = FileInfo.CreationTime;
+            NetworkInformation->LastAccessTime.QuadPart = FileInfo.LastAccessTime;
+            NetworkInformation->LastWriteTime.QuadPart = FileInfo.LastWriteTime;
+            NetworkInformation->ChangeTime.QuadPart = FileInfo.ChangeTime;
+            NetworkInformation->AllocationSize.QuadPart = FileInfo.AllocationSize;
+            NetworkInformation->EndOfFile.QuadPart = FileInfo.FileSize;
+            NetworkInformation->FileAttributes = 0 != FileInfo.FileAttributes ?
+                FileInfo.FileAttributes : FILE_ATTRIBUTE_NORMAL;
+
+            Irp->IoStatus.Status = STATUS_SUCCESS;
+            Irp->IoStatus.Information = sizeof *NetworkInformation;
+            Result = TRUE;
+        }
+    }
+
+    FspDeviceDereference(FsvolDeviceObject);
+
+    FSP_LEAVE_BOOL("FileObject=%p", FileObject);
+}
+
 VOID FspAcquireFileForNtCreateSection(
     PFILE_OBJECT FileObject)
 {
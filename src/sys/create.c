@@ -31,6 +31,10 @@ static NTSTATUS FspFsvolCreateTryOpen(PIRP Irp, const FSP_FSCTL_TRANSACT_RSP *Re
     FSP_FILE_NODE *FileNode, FSP_FILE_DESC *FileDesc, PFILE_OBJECT FileObject,
     BOOLEAN FlushImage);
 static VOID FspFsvolCreatePostClose(FSP_FILE_DESC *FileDesc);
+static BOOLEAN FspFsvolCreateNegativeNameCacheable(PDEVICE_OBJECT FsvolDeviceObject,
+    PIO_STACK_LOCATION IrpSp, BOOLEAN HasTraversePrivilege, BOOLEAN Add);
+static VOID FspFsvolCreateInvalidateNegativeName(PDEVICE_OBJECT FsvolDeviceObject,
+    PUNICODE_STRING FileName);
 static FSP_IOP_REQUEST_FINI FspFsvolCreateRequestFini;
 static FSP_IOP_REQUEST_FINI FspFsvolCreateTryOpenRequestFini;
 static FSP_IOP_REQUEST_FINI FspFsvolCreateOverwriteRequestFini;
@@ -45,6 +49,8 @@ FSP_DRIVER_DISPATCH FspCreate;
 #pragma alloc_text(PAGE, FspFsvolCreateComplete)
 #pragma alloc_text(PAGE, FspFsvolCreateTryOpen)
 #pragma alloc_text(PAGE, FspFsvolCreatePostClose)
+#pragma alloc_text(PAGE, FspFsvolCreateNegativeNameCacheable)
+#pragma alloc_text(PAGE, FspFsvolCreateInvalidateNegativeName)
 #pragma alloc_text(PAGE, FspFsvolCreateRequestFini)
 #pragma alloc_text(PAGE, FspFsvolCreateTryOpenRequestFini)
 #pragma alloc_text(PAGE, FspFsvolCreateOverwriteRequestFini)
@@ -317,6 +323,14 @@ static NTSTATUS FspFsvolCreateNoLock(
         return STATUS_CANNOT_DELETE;
     }
 
+    /* did the user-mode file system recently tell us that this name does not exist? */
+    if (FspFsvolCreateNegativeNameCacheable(FsvolDeviceObject, IrpSp, HasTraversePrivilege, FALSE) &&
+        FspFsvolDeviceLookupNegativeName(FsvolDeviceObject, &FileNode->FileName))
+    {
+        FspFileNodeDereference(FileNode);
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
     Result = FspFileDescCreate(&FileDesc);
     if (!NT_SUCCESS(Result))
     {
@@ -349,6 +363,14 @@ static NTSTATUS FspFsvolCreateNoLock(
         0 != FsvolDeviceExtension->VolumeParams.CaseSensitiveSearch ||
         BooleanFlagOn(Flags, SL_CASE_SENSITIVE);
     FileDesc->HasTraversePrivilege = HasTraversePrivilege;
+    FileDesc->NegativeNameChangeNumber = FspFsvolDeviceNegativeNameChangeNumber(FsvolDeviceObject);
+    if (0 != FsvolDeviceExtension->StatAheadCache)
+    {
+        /* directory listings through this handle will stat-ahead for the opener's token */
+        PACCESS_TOKEN AccessToken = SeQuerySubjectContextToken(&AccessState->SubjectSecurityContext);
+        FileDesc->HasStatAheadIdentity =
+            FspFsvolDeviceStatAheadIdentity(AccessToken, &FileDesc->StatAheadIdentity);
+    }
     FspFsvolDeviceFileRenameSetOwner(FsvolDeviceObject, Request);
     FspIopRequestContext(Request, RequestDeviceObject) = FsvolDeviceObject;
     FspIopRequestContext(Request, RequestFileDesc) = FileDesc;
@@ -492,6 +514,12 @@ NTSTATUS FspFsvolCreateComplete(
         /* did the user-mode file system sent us a failure code? */
         if (!NT_SUCCESS(Response->IoStatus.Status))
         {
+            if (STATUS_OBJECT_NAME_NOT_FOUND == Response->IoStatus.Status &&
+                FspFsvolCreateNegativeNameCacheable(FsvolDeviceObject, IrpSp,
+                    FileDesc->HasTraversePrivilege, TRUE))
+                FspFsvolDeviceAddNegativeName(FsvolDeviceObject, &FileNode->FileName,
+                    FileDesc->NegativeNameChangeNumber);
+
             Irp->IoStatus.Information = 0;
             Result = Response->IoStatus.Status;
             FSP_RETURN();
@@ -562,6 +590,10 @@ NTSTATUS FspFsvolCreateComplete(
             FspUnicodePathSuffix(&FileNode->FileName, &FileNode->FileName, &Suffix);
         }
 
+        /* a newly created name must no longer be reported as missing */
+        if (FILE_CREATED == Response->IoStatus.Information)
+            FspFsvolCreateInvalidateNegativeName(FsvolDeviceObject, &FileNode->FileName);
+
         /* populate the FileNode/FileDesc fields from the Response */
         FileNode->UserContext = Response->Rsp.Create.Opened.UserContext;
         FileNode->IndexNumber = Response->Rsp.Create.Opened.FileInfo.IndexNumber;
@@ -812,6 +844,53 @@ static VOID FspFsvolCreatePostClose(FSP_FILE_DESC *FileDesc)
      */
 }
 
+static BOOLEAN FspFsvolCreateNegativeNameCacheable(PDEVICE_OBJECT FsvolDeviceObject,
+    PIO_STACK_LOCATION IrpSp, BOOLEAN HasTraversePrivilege, BOOLEAN Add)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    ULONG CreateDisposition = (IrpSp->Parameters.Create.Options >> 24) & 0xff;
+    ULONG Flags = IrpSp->Flags;
+
+    /* only opens that fail when the name does not exist */
+    if (FILE_OPEN != CreateDisposition && FILE_OVERWRITE != CreateDisposition)
+        return FALSE;
+
+    /* SL_OPEN_TARGET_DIRECTORY opens the parent directory */
+    if (FlagOn(Flags, SL_OPEN_TARGET_DIRECTORY))
+        return FALSE;
+
+    /* without traverse privilege the file system may have to report an access error instead */
+    if (!HasTraversePrivilege)
+        return FALSE;
+
+    /* a case-sensitive miss on a case-insensitive volume says nothing about other cases */
+    if (Add && 0 == FsvolDeviceExtension->VolumeParams.CaseSensitiveSearch &&
+        FlagOn(Flags, SL_CASE_SENSITIVE))
+        return FALSE;
+
+    return TRUE;
+}
+
+static VOID FspFsvolCreateInvalidateNegativeName(PDEVICE_OBJECT FsvolDeviceObject,
+    PUNICODE_STRING FileName)
+{
+    PAGED_CODE();
+
+    UNICODE_STRING MainFileName = *FileName;
+
+    FspFsvolDeviceInvalidateNegativeName(FsvolDeviceObject, FileName);
+
+    /* creating a named stream also creates its main file if that does not exist */
+    for (PWSTR P = FileName->Buffer + FileName->Length / sizeof(WCHAR) - 1;
+        FileName->Buffer <= P && L'\\' != *P; P--)
+        if (L':' == *P)
+            MainFileName.Length = (USHORT)((PUINT8)P - (PUINT8)FileName->Buffer);
+    if (MainFileName.Length != FileName->Length)
+        FspFsvolDeviceInvalidateNegativeName(FsvolDeviceObject, &MainFileName);
+}
+
 static VOID FspFsvolCreateRequestFini(FSP_FSCTL_TRANSACT_REQ *Request, PVOID Context[4])
 {
     PAGED_CODE();
@@ -56,6 +56,24 @@ VOID FspFsvolDeviceDeleteContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STR
 static RTL_AVL_COMPARE_ROUTINE FspFsvolDeviceCompareContextByName;
 static RTL_AVL_ALLOCATE_ROUTINE FspFsvolDeviceAllocateContextByName;
 static RTL_AVL_FREE_ROUTINE FspFsvolDeviceFreeContextByName;
+static NTSTATUS FspFsvolDeviceFileNameKey(PDEVICE_OBJECT DeviceObject,
+    PUNICODE_STRING FileName, PUNICODE_STRING Key);
+static VOID FspFsvolDeviceFileNameKeyFree(PUNICODE_STRING FileName, PUNICODE_STRING Key);
+BOOLEAN FspFsvolDeviceLookupNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName);
+ULONG FspFsvolDeviceNegativeNameChangeNumber(PDEVICE_OBJECT DeviceObject);
+VOID FspFsvolDeviceAddNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    ULONG NegativeNameChangeNumber);
+VOID FspFsvolDeviceInvalidateNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName);
+BOOLEAN FspFsvolDeviceStatAheadIdentity(PACCESS_TOKEN AccessToken,
+    FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY *Identity);
+BOOLEAN FspFsvolDeviceLookupStatAhead(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY *Identity, FSP_FSCTL_FILE_INFO *FileInfo);
+ULONG FspFsvolDeviceStatAheadChangeNumber(PDEVICE_OBJECT DeviceObject);
+VOID FspFsvolDeviceAddStatAhead(PDEVICE_OBJECT DeviceObject,
+    PUNICODE_STRING DirectoryName, PUNICODE_STRING FileName,
+    FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY *Identity, const FSP_FSCTL_FILE_INFO *FileInfo,
+    ULONG StatAheadChangeNumber);
+VOID FspFsvolDeviceInvalidateStatAhead(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName);
 VOID FspFsvolDeviceGetVolumeInfo(PDEVICE_OBJECT DeviceObject, FSP_FSCTL_VOLUME_INFO *VolumeInfo);
 BOOLEAN FspFsvolDeviceTryGetVolumeInfo(PDEVICE_OBJECT DeviceObject, FSP_FSCTL_VOLUME_INFO *VolumeInfo);
 VOID FspFsvolDeviceSetVolumeInfo(PDEVICE_OBJECT DeviceObject, const FSP_FSCTL_VOLUME_INFO *VolumeInfo);
@@ -89,6 +107,15 @@ VOID FspDeviceDeleteAll(VOID);
 #pragma alloc_text(PAGE, FspFsvolDeviceCompareContextByName)
 #pragma alloc_text(PAGE, FspFsvolDeviceAllocateContextByName)
 #pragma alloc_text(PAGE, FspFsvolDeviceFreeContextByName)
+#pragma alloc_text(PAGE, FspFsvolDeviceFileNameKey)
+#pragma alloc_text(PAGE, FspFsvolDeviceFileNameKeyFree)
+#pragma alloc_text(PAGE, FspFsvolDeviceLookupNegativeName)
+#pragma alloc_text(PAGE, FspFsvolDeviceAddNegativeName)
+#pragma alloc_text(PAGE, FspFsvolDeviceInvalidateNegativeName)
+#pragma alloc_text(PAGE, FspFsvolDeviceStatAheadIdentity)
+#pragma alloc_text(PAGE, FspFsvolDeviceLookupStatAhead)
+#pragma alloc_text(PAGE, FspFsvolDeviceAddStatAhead)
+#pragma alloc_text(PAGE, FspFsvolDeviceInvalidateStatAhead)
 #pragma alloc_text(PAGE, FspDeviceCopyList)
 #pragma alloc_text(PAGE, FspDeviceDeleteList)
 #pragma alloc_text(PAGE, FspDeviceDeleteAll)
@@ -295,7 +322,7 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
     NTSTATUS Result;
     FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
     LARGE_INTEGER IrpTimeout;
-    LARGE_INTEGER SecurityTimeout, DirInfoTimeout;
+    LARGE_INTEGER SecurityTimeout, DirInfoTimeout, NegativeNameTimeout, StatAheadTimeout;
 
     /*
      * Volume device initialization is a mess, because of the different ways of
@@ -331,7 +358,7 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
     SecurityTimeout.QuadPart = FspTimeoutFromMillis(FsvolDeviceExtension->VolumeParams.FileInfoTimeout);
         /* convert millis to nanos */
     Result = FspMetaCacheCreate(
-        FspFsvolDeviceSecurityCacheCapacity, FspFsvolDeviceSecurityCacheItemSizeMax, &SecurityTimeout,
+        FsvolDeviceExtension->VolumeParams.SecurityCacheSize, FspFsvolDeviceSecurityCacheItemSizeMax, &SecurityTimeout,
         &FsvolDeviceExtension->SecurityCache);
     if (!NT_SUCCESS(Result))
         return Result;
@@ -341,12 +368,33 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
     DirInfoTimeout.QuadPart = FspTimeoutFromMillis(FsvolDeviceExtension->VolumeParams.FileInfoTimeout);
         /* convert millis to nanos */
     Result = FspMetaCacheCreate(
-        FspFsvolDeviceDirInfoCacheCapacity, FspFsvolDeviceDirInfoCacheItemSizeMax, &DirInfoTimeout,
+        FsvolDeviceExtension->VolumeParams.DirInfoCacheSize,
+        FspFsvolDeviceDirInfoCacheItemSizeMax + FspFsvolDeviceDirInfoCacheIndexSizeMax, &DirInfoTimeout,
         &FsvolDeviceExtension->DirInfoCache);
     if (!NT_SUCCESS(Result))
         return Result;
     FsvolDeviceExtension->InitDoneDir = 1;
 
+    /* create our negative name meta cache */
+    NegativeNameTimeout.QuadPart = FspTimeoutFromMillis(FsvolDeviceExtension->VolumeParams.FileInfoTimeout);
+        /* convert millis to nanos */
+    Result = FspMetaCacheCreate(
+        FspFsvolDeviceNegativeNameCacheSize, FspFsvolDeviceNegativeNameCacheItemSizeMax, &NegativeNameTimeout,
+        &FsvolDeviceExtension->NegativeNameCache);
+    if (!NT_SUCCESS(Result))
+        return Result;
+    FsvolDeviceExtension->InitDoneNeg = 1;
+
+    /* create our stat-ahead meta cache */
+    StatAheadTimeout.QuadPart = FspTimeoutFromMillis(FsvolDeviceExtension->VolumeParams.FileInfoTimeout);
+        /* convert millis to nanos */
+    Result = FspMetaCacheCreate(
+        FspFsvolDeviceStatAheadCacheSize, FspFsvolDeviceStatAheadCacheItemSizeMax, &StatAheadTimeout,
+        &FsvolDeviceExtension->StatAheadCache);
+    if (!NT_SUCCESS(Result))
+        return Result;
+    FsvolDeviceExtension->InitDoneStat = 1;
+
     /* initialize the FSRTL Notify mechanism */
     Result = FspNotifyInitializeSync(&FsvolDeviceExtension->NotifySync);
     if (!NT_SUCCESS(Result))
@@ -406,6 +454,14 @@ static VOID FspFsvolDeviceFini(PDEVICE_OBJECT DeviceObject)
         FspNotifyUninitializeSync(&FsvolDeviceExtension->NotifySync);
     }
 
+    /* delete the stat-ahead meta cache */
+    if (FsvolDeviceExtension->InitDoneStat)
+        FspMetaCacheDelete(FsvolDeviceExtension->StatAheadCache);
+
+    /* delete the negative name meta cache */
+    if (FsvolDeviceExtension->InitDoneNeg)
+        FspMetaCacheDelete(FsvolDeviceExtension->NegativeNameCache);
+
     /* delete the directory meta cache */
     if (FsvolDeviceExtension->InitDoneDir)
         FspMetaCacheDelete(FsvolDeviceExtension->DirInfoCache);
@@ -484,6 +540,8 @@ static VOID FspFsvolDeviceExpirationRoutine(PVOID Context)
     InterruptTime = KeQueryInterruptTime();
     FspMetaCacheInvalidateExpired(FsvolDeviceExtension->SecurityCache, InterruptTime);
     FspMetaCacheInvalidateExpired(FsvolDeviceExtension->DirInfoCache, InterruptTime);
+    FspMetaCacheInvalidateExpired(FsvolDeviceExtension->NegativeNameCache, InterruptTime);
+    FspMetaCacheInvalidateExpired(FsvolDeviceExtension->StatAheadCache, InterruptTime);
     FspIoqRemoveExpired(FsvolDeviceExtension->Ioq, InterruptTime);
 
     KeAcquireSpinLock(&FsvolDeviceExtension->ExpirationLock, &Irql);
@@ -715,6 +773,294 @@ static VOID NTAPI FspFsvolDeviceFreeContextByName(
     PAGED_CODE();
 }
 
+/*
+ * The negative name cache remembers file names for which the user mode file system
+ * recently reported STATUS_OBJECT_NAME_NOT_FOUND, so that repeated probes for them
+ * can be failed without a round trip. Names are kept as content addressed items in
+ * a meta cache (upcased on case-insensitive volumes) and expire like FileInfo.
+ *
+ * A name is removed when a Create creates it; a Rename may move a whole subtree
+ * of names into existence, so it flushes the cache. Deletes are ignored, as they
+ * cannot make a name that does not exist appear. NegativeNameChangeNumber is
+ * incremented on every invalidation; a Create captures it before going to user mode
+ * and only adds its name if no invalidation happened while the request was in flight.
+ */
+static NTSTATUS FspFsvolDeviceFileNameKey(PDEVICE_OBJECT DeviceObject,
+    PUNICODE_STRING FileName, PUNICODE_STRING Key)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+
+    if (0 != FsvolDeviceExtension->VolumeParams.CaseSensitiveSearch)
+    {
+        *Key = *FileName;
+        return STATUS_SUCCESS;
+    }
+
+    return RtlUpcaseUnicodeString(Key, FileName, TRUE);
+}
+
+static VOID FspFsvolDeviceFileNameKeyFree(PUNICODE_STRING FileName, PUNICODE_STRING Key)
+{
+    PAGED_CODE();
+
+    if (Key->Buffer != FileName->Buffer)
+        RtlFreeUnicodeString(Key);
+}
+
+BOOLEAN FspFsvolDeviceLookupNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+    UNICODE_STRING Key;
+    BOOLEAN Result;
+
+    if (0 == FsvolDeviceExtension->NegativeNameCache)
+        return FALSE;
+
+    if (!NT_SUCCESS(FspFsvolDeviceFileNameKey(DeviceObject, FileName, &Key)))
+        return FALSE;
+
+    Result = FspMetaCacheLookupItemShared(FsvolDeviceExtension->NegativeNameCache,
+        Key.Buffer, Key.Length);
+
+    FspFsvolDeviceFileNameKeyFree(FileName, &Key);
+
+    return Result;
+}
+
+ULONG FspFsvolDeviceNegativeNameChangeNumber(PDEVICE_OBJECT DeviceObject)
+{
+    // !PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+
+    return (ULONG)InterlockedCompareExchange(&FsvolDeviceExtension->NegativeNameChangeNumber, 0, 0);
+}
+
+VOID FspFsvolDeviceAddNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    ULONG NegativeNameChangeNumber)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+    UNICODE_STRING Key;
+
+    if (0 == FsvolDeviceExtension->NegativeNameCache ||
+        FspFsvolDeviceNegativeNameChangeNumber(DeviceObject) != NegativeNameChangeNumber)
+        return;
+
+    if (!NT_SUCCESS(FspFsvolDeviceFileNameKey(DeviceObject, FileName, &Key)))
+        return;
+
+    FspMetaCacheAddItemShared(FsvolDeviceExtension->NegativeNameCache,
+        Key.Buffer, Key.Length);
+
+    /* an invalidation that raced with us may have missed the item we just added */
+    if (FspFsvolDeviceNegativeNameChangeNumber(DeviceObject) != NegativeNameChangeNumber)
+        FspMetaCacheInvalidateItemShared(FsvolDeviceExtension->NegativeNameCache,
+            Key.Buffer, Key.Length);
+
+    FspFsvolDeviceFileNameKeyFree(FileName, &Key);
+}
+
+VOID FspFsvolDeviceInvalidateNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+    UNICODE_STRING Key;
+
+    InterlockedIncrement(&FsvolDeviceExtension->NegativeNameChangeNumber);
+
+    if (0 == FsvolDeviceExtension->NegativeNameCache)
+        return;
+
+    /* invalidate everything if there is no FileName or if we cannot compute its key */
+    if (0 == FileName || !NT_SUCCESS(FspFsvolDeviceFileNameKey(DeviceObject, FileName, &Key)))
+    {
+        FspMetaCacheInvalidateExpired(FsvolDeviceExtension->NegativeNameCache, (UINT64)-1LL);
+        return;
+    }
+
+    FspMetaCacheInvalidateItemShared(FsvolDeviceExtension->NegativeNameCache,
+        Key.Buffer, Key.Length);
+
+    FspFsvolDeviceFileNameKeyFree(FileName, &Key);
+}
+
+/*
+ * The stat-ahead cache remembers the FileInfo that directory listings report for
+ * the files they contain, so that a subsequent GetFileAttributesEx (or other
+ * FastIoQueryOpen) on such a file can be answered without an open/query/close round
+ * trip to user mode. Items are keyed by the full file name (upcased on case-insensitive
+ * volumes) and expire like FileInfo.
+ *
+ * An item is only served to the token that listed the directory and only
+ * while the file is not open; a file that is open may be changing and has its own
+ * FileInfo in its FileNode. An item is removed when the last handle to its file is
+ * closed and a Rename flushes the cache. StatAheadChangeNumber works like
+ * NegativeNameChangeNumber: a QueryDirectory captures it before going to user mode
+ * and only adds its entries if no invalidation happened while the request was in flight.
+ */
+typedef struct
+{
+    FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY Identity;
+    FSP_FSCTL_FILE_INFO FileInfo;
+} FSP_FSVOL_DEVICE_STAT_AHEAD;
+
+BOOLEAN FspFsvolDeviceStatAheadIdentity(PACCESS_TOKEN AccessToken,
+    FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY *Identity)
+{
+    PAGED_CODE();
+
+    /*
+     * The identity is the TokenId plus ModifiedId of the token, not its logon session:
+     * AppContainer and low integrity tokens share the logon session of the user, but
+     * must not see attributes of files that only an unsandboxed process could list.
+     */
+    PTOKEN_STATISTICS Statistics;
+
+    if (SeTokenIsRestricted(AccessToken) ||
+        !NT_SUCCESS(SeQueryInformationToken(AccessToken, TokenStatistics, &Statistics)))
+        return FALSE;
+
+    Identity->TokenId = Statistics->TokenId;
+    Identity->ModifiedId = Statistics->ModifiedId;
+    ExFreePool(Statistics);
+
+    return TRUE;
+}
+
+BOOLEAN FspFsvolDeviceLookupStatAhead(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY *Identity, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+    UNICODE_STRING Key;
+    PCVOID ItemBuffer;
+    ULONG ItemSize;
+    FSP_FSVOL_DEVICE_STAT_AHEAD *StatAhead;
+    BOOLEAN Result = FALSE;
+
+    if (0 == FsvolDeviceExtension->StatAheadCache)
+        return FALSE;
+
+    if (!NT_SUCCESS(FspFsvolDeviceFileNameKey(DeviceObject, FileName, &Key)))
+        return FALSE;
+
+    if (FspMetaCacheReferenceItemBufferByKey(FsvolDeviceExtension->StatAheadCache,
+        Key.Buffer, Key.Length, &ItemBuffer, &ItemSize))
+    {
+        StatAhead = (PVOID)((PUINT8)ItemBuffer + FSP_FSCTL_DEFAULT_ALIGN_UP(Key.Length));
+        ASSERT(FSP_FSCTL_DEFAULT_ALIGN_UP(Key.Length) + sizeof *StatAhead == ItemSize);
+        if (RtlEqualLuid(&StatAhead->Identity.TokenId, &Identity->TokenId) &&
+            RtlEqualLuid(&StatAhead->Identity.ModifiedId, &Identity->ModifiedId))
+        {
+            RtlCopyMemory(FileInfo, &StatAhead->FileInfo, sizeof *FileInfo);
+            Result = TRUE;
+        }
+        FspMetaCacheDereferenceItemBuffer(ItemBuffer);
+    }
+
+    FspFsvolDeviceFileNameKeyFree(FileName, &Key);
+
+    return Result;
+}
+
+ULONG FspFsvolDeviceStatAheadChangeNumber(PDEVICE_OBJECT DeviceObject)
+{
+    // !PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+
+    return (ULONG)InterlockedCompareExchange(&FsvolDeviceExtension->StatAheadChangeNumber, 0, 0);
+}
+
+VOID FspFsvolDeviceAddStatAhead(PDEVICE_OBJECT DeviceObject,
+    PUNICODE_STRING DirectoryName, PUNICODE_STRING FileName,
+    FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY *Identity, const FSP_FSCTL_FILE_INFO *FileInfo,
+    ULONG StatAheadChangeNumber)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+    BOOLEAN AppendBackslash;
+    UNICODE_STRING Key;
+    ULONG KeySize, ItemSize;
+    PUINT8 ItemBuffer;
+    FSP_FSVOL_DEVICE_STAT_AHEAD *StatAhead;
+
+    if (0 == FsvolDeviceExtension->StatAheadCache ||
+        FspFsvolDeviceStatAheadChangeNumber(DeviceObject) != StatAheadChangeNumber)
+        return;
+
+    /* the key is the full file name; the root directory name already ends in a backslash */
+    AppendBackslash = sizeof(WCHAR) <= DirectoryName->Length &&
+        L'\\' != DirectoryName->Buffer[DirectoryName->Length / sizeof(WCHAR) - 1];
+    KeySize = DirectoryName->Length + (AppendBackslash ? sizeof(WCHAR) : 0) + FileName->Length;
+    ItemSize = FSP_FSCTL_DEFAULT_ALIGN_UP(KeySize) + sizeof *StatAhead;
+    if (MAXUSHORT < KeySize || FspFsvolDeviceStatAheadCacheItemSizeMax < ItemSize)
+        return;
+
+    ItemBuffer = FspAlloc(ItemSize);
+    if (0 == ItemBuffer)
+        return;
+    RtlZeroMemory(ItemBuffer, ItemSize);
+
+    Key.Length = 0;
+    Key.MaximumLength = (USHORT)KeySize;
+    Key.Buffer = (PVOID)ItemBuffer;
+    RtlAppendUnicodeStringToString(&Key, DirectoryName);
+    if (AppendBackslash)
+        RtlAppendUnicodeToString(&Key, L"\\");
+    RtlAppendUnicodeStringToString(&Key, FileName);
+    if (0 == FsvolDeviceExtension->VolumeParams.CaseSensitiveSearch)
+        RtlUpcaseUnicodeString(&Key, &Key, FALSE);
+
+    StatAhead = (PVOID)(ItemBuffer + FSP_FSCTL_DEFAULT_ALIGN_UP(KeySize));
+    StatAhead->Identity = *Identity;
+    StatAhead->FileInfo = *FileInfo;
+
+    FspMetaCacheAddItemKeyed(FsvolDeviceExtension->StatAheadCache,
+        ItemBuffer, ItemSize, KeySize);
+
+    /* an invalidation that raced with us may have missed the item we just added */
+    if (FspFsvolDeviceStatAheadChangeNumber(DeviceObject) != StatAheadChangeNumber)
+        FspMetaCacheInvalidateItemShared(FsvolDeviceExtension->StatAheadCache,
+            ItemBuffer, KeySize);
+
+    FspFree(ItemBuffer);
+}
+
+VOID FspFsvolDeviceInvalidateStatAhead(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName)
+{
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
+    UNICODE_STRING Key;
+
+    InterlockedIncrement(&FsvolDeviceExtension->StatAheadChangeNumber);
+
+    if (0 == FsvolDeviceExtension->StatAheadCache)
+        return;
+
+    /* invalidate everything if there is no FileName or if we cannot compute its key */
+    if (0 == FileName || !NT_SUCCESS(FspFsvolDeviceFileNameKey(DeviceObject, FileName, &Key)))
+    {
+        FspMetaCacheInvalidateExpired(FsvolDeviceExtension->StatAheadCache, (UINT64)-1LL);
+        return;
+    }
+
+    FspMetaCacheInvalidateItemShared(FsvolDeviceExtension->StatAheadCache,
+        Key.Buffer, Key.Length);
+
+    FspFsvolDeviceFileNameKeyFree(FileName, &Key);
+}
+
 VOID FspFsvolDeviceGetVolumeInfo(PDEVICE_OBJECT DeviceObject, FSP_FSCTL_VOLUME_INFO *VolumeInfo)
 {
     // !PAGED_CODE();
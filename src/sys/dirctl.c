@@ -18,11 +18,15 @@
 #include <sys/driver.h>
 
 static NTSTATUS FspFsvolQueryDirectoryCopy(
-    PUNICODE_STRING DirectoryPattern, BOOLEAN CaseInsensitive,
-    UINT64 DirectoryOffset, PUINT64 PDirectoryOffset,
+    FSP_FILE_DESC *FileDesc,
+    PUINT64 PDirectoryOffset,
     FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
     FSP_FSCTL_DIR_INFO **PDirInfo, ULONG DirInfoSize,
     PVOID DestBuf, PULONG PDestLen);
+static NTSTATUS FspFsvolQueryDirectorySeekCache(
+    UINT64 DirectoryOffset,
+    PCVOID *PDirInfoBuffer, PULONG PDirInfoSize,
+    PULONG PChunk, PULONG PHint);
 static NTSTATUS FspFsvolQueryDirectoryCopyCache(
     FSP_FILE_DESC *FileDesc, BOOLEAN ResetCache,
     FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
@@ -33,6 +37,9 @@ static NTSTATUS FspFsvolQueryDirectoryCopyInPlace(
     FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
     FSP_FSCTL_DIR_INFO *DirInfo, ULONG DirInfoSize,
     PVOID DestBuf, PULONG PDestLen);
+static VOID FspFsvolQueryDirectoryStatAhead(
+    PDEVICE_OBJECT FsvolDeviceObject, FSP_FILE_DESC *FileDesc,
+    FSP_FSCTL_DIR_INFO *DirInfo, ULONG DirInfoSize);
 static NTSTATUS FspFsvolQueryDirectoryRetry(
     PDEVICE_OBJECT FsvolDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp,
     BOOLEAN CanWait);
@@ -51,8 +58,10 @@ FSP_DRIVER_DISPATCH FspDirectoryControl;
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FspFsvolQueryDirectoryCopy)
+#pragma alloc_text(PAGE, FspFsvolQueryDirectorySeekCache)
 #pragma alloc_text(PAGE, FspFsvolQueryDirectoryCopyCache)
 #pragma alloc_text(PAGE, FspFsvolQueryDirectoryCopyInPlace)
+#pragma alloc_text(PAGE, FspFsvolQueryDirectoryStatAhead)
 #pragma alloc_text(PAGE, FspFsvolQueryDirectoryRetry)
 #pragma alloc_text(PAGE, FspFsvolQueryDirectory)
 #pragma alloc_text(PAGE, FspFsvolNotifyChangeDirectory)
@@ -84,8 +93,8 @@ enum
 };
 
 static NTSTATUS FspFsvolQueryDirectoryCopy(
-    PUNICODE_STRING DirectoryPattern, BOOLEAN CaseInsensitive,
-    UINT64 DirectoryOffset, PUINT64 PDirectoryOffset,
+    FSP_FILE_DESC *FileDesc,
+    PUINT64 PDirectoryOffset,
     FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
     FSP_FSCTL_DIR_INFO **PDirInfo, ULONG DirInfoSize,
     PVOID DestBuf, PULONG PDestLen)
@@ -117,8 +126,7 @@ static NTSTATUS FspFsvolQueryDirectoryCopy(
 
     PAGED_CODE();
 
-    BOOLEAN MatchAll = FspFileDescDirectoryPatternMatchAll == DirectoryPattern->Buffer;
-    BOOLEAN Loop = TRUE, DirectoryOffsetFound = FALSE;
+    BOOLEAN Loop = TRUE;
     FSP_FSCTL_DIR_INFO *DirInfo = *PDirInfo;
     PUINT8 DirInfoEnd = (PUINT8)DirInfo + DirInfoSize;
     PUINT8 DestBufBgn = (PUINT8)DestBuf;
@@ -168,17 +176,11 @@ static NTSTATUS FspFsvolQueryDirectoryCopy(
                 break;
             }
 
-            if (0 != DirectoryOffset && !DirectoryOffsetFound)
-            {
-                DirectoryOffsetFound = DirInfo->NextOffset == DirectoryOffset;
-                continue;
-            }
-
             FileName.Length =
             FileName.MaximumLength = (USHORT)(DirInfoSize - sizeof(FSP_FSCTL_DIR_INFO));
             FileName.Buffer = DirInfo->FileNameBuf;
 
-            if (MatchAll || FsRtlIsNameInExpression(DirectoryPattern, &FileName, CaseInsensitive, 0))
+            if (FspFileDescDirectoryPatternMatch(FileDesc, &FileName))
             {
                 if ((PUINT8)DestBuf +
                     FSP_FSCTL_ALIGN_UP(BaseInfoLen + FileName.Length, sizeof(LONGLONG)) > DestBufEnd)
@@ -264,6 +266,38 @@ static NTSTATUS FspFsvolQueryDirectoryCopy(
 #undef FILL_INFO_BASE
 }
 
+static NTSTATUS FspFsvolQueryDirectorySeekCache(
+    UINT64 DirectoryOffset,
+    PCVOID *PDirInfoBuffer, PULONG PDirInfoSize,
+    PULONG PChunk, PULONG PHint)
+{
+    PAGED_CODE();
+
+    NTSTATUS Result;
+    PCVOID DirInfoBuffer = *PDirInfoBuffer;
+    ULONG DirInfoSize = *PDirInfoSize;
+    ULONG Chunk = 0;
+
+    for (;;)
+    {
+        Result = FspFileNodeSeekDirInfo(DirInfoBuffer, DirInfoSize, DirectoryOffset, PHint);
+        if (STATUS_NOT_FOUND != Result)
+        {
+            if (NT_SUCCESS(Result))
+            {
+                *PDirInfoBuffer = DirInfoBuffer;
+                *PDirInfoSize = DirInfoSize;
+                *PChunk = Chunk;
+            }
+            return Result;
+        }
+
+        if (!FspFileNodeNextDirInfo(DirInfoBuffer, &DirInfoBuffer, &DirInfoSize))
+            return STATUS_NOT_FOUND;
+        Chunk++;
+    }
+}
+
 static NTSTATUS FspFsvolQueryDirectoryCopyCache(
     FSP_FILE_DESC *FileDesc, BOOLEAN ResetCache,
     FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
@@ -277,32 +311,96 @@ static NTSTATUS FspFsvolQueryDirectoryCopyCache(
     FSP_FILE_NODE *FileNode = FileDesc->FileNode;
 
     if (ResetCache || FileDesc->DirInfo != FileNode->NonPaged->DirInfo)
-        FileDesc->DirInfoCacheHint = 0; /* reset the DirInfo hint if anything looks fishy! */
+    {
+        /* reset the DirInfo hint if anything looks fishy! */
+        FileDesc->DirInfoCacheChunk = 0;
+        FileDesc->DirInfoCacheHint = 0;
+    }
 
     FileDesc->DirInfo = FileNode->NonPaged->DirInfo;
+    FileDesc->DirInfoCacheAppend = FALSE;
 
     NTSTATUS Result;
-    BOOLEAN CaseInsensitive = !FileDesc->CaseSensitive;
-    PUNICODE_STRING DirectoryPattern = &FileDesc->DirectoryPattern;
     UINT64 DirectoryOffset = FileDesc->DirectoryOffset;
-    PUINT8 DirInfoBgn = (PUINT8)DirInfo;
-    PUINT8 DirInfoEnd = (PUINT8)DirInfo + DirInfoSize;
+    PCVOID DirInfoBuffer = DirInfo;
+    ULONG Chunk = FileDesc->DirInfoCacheChunk;
+    ULONG Hint = FileDesc->DirInfoCacheHint;
+    ULONG DestLen = *PDestLen;
 
-    DirInfo = (PVOID)(DirInfoBgn + FileDesc->DirInfoCacheHint);
-    DirInfoSize = (ULONG)(DirInfoEnd - (PUINT8)DirInfo);
+    /*
+     * The cached DirInfo may consist of multiple chunks. The position of the FileDesc
+     * within the cache is (DirInfoCacheChunk, DirInfoCacheHint). If there is no such
+     * position, find the chunk and entry that follow the DirectoryOffset.
+     */
+    if (0 == Chunk && 0 == Hint)
+    {
+        if (0 != DirectoryOffset)
+        {
+            Result = FspFsvolQueryDirectorySeekCache(DirectoryOffset,
+                &DirInfoBuffer, &DirInfoSize, &Chunk, &Hint);
+            if (STATUS_NOT_FOUND == Result)
+            {
+                *PDestLen = 0;
+                return STATUS_SUCCESS;
+            }
+            if (!NT_SUCCESS(Result))
+            {
+                *PDestLen = 0;
+                goto exit;
+            }
+        }
+    }
+    else
+    {
+        for (ULONG Index = 0; Chunk > Index; Index++)
+            if (!FspFileNodeNextDirInfo(DirInfoBuffer, &DirInfoBuffer, &DirInfoSize))
+            {
+                /* chunks are never removed; this should not happen */
+                ASSERT(0);
+                *PDestLen = 0;
+                return STATUS_SUCCESS;
+            }
+    }
 
-    Result = FspFsvolQueryDirectoryCopy(DirectoryPattern, CaseInsensitive,
-        0 != FileDesc->DirInfoCacheHint ? 0 : DirectoryOffset, &DirectoryOffset,
-        FileInformationClass, ReturnSingleEntry,
-        &DirInfo, DirInfoSize,
-        DestBuf, PDestLen);
+    for (;;)
+    {
+        PUINT8 DirInfoBgn = (PUINT8)DirInfoBuffer;
+        PUINT8 DirInfoEnd = DirInfoBgn + DirInfoSize;
+
+        DirInfo = (PVOID)(DirInfoBgn + Hint);
+        *PDestLen = DestLen;
 
+        Result = FspFsvolQueryDirectoryCopy(FileDesc,
+            &DirectoryOffset,
+            FileInformationClass, ReturnSingleEntry,
+            &DirInfo, (ULONG)(DirInfoEnd - (PUINT8)DirInfo),
+            DestBuf, PDestLen);
+        if (!NT_SUCCESS(Result))
+            break;
+
+        Hint = (ULONG)((PUINT8)DirInfo - DirInfoBgn);
+        if (0 != *PDestLen)
+            break;
+
+        /* this chunk is exhausted; continue with the next one */
+        if (!FspFileNodeNextDirInfo(DirInfoBuffer, &DirInfoBuffer, &DirInfoSize))
+        {
+            /* end of the cached DirInfo; the next user mode response may be appended to it */
+            FileDesc->DirInfoCacheAppend = TRUE;
+            break;
+        }
+        Chunk++;
+        Hint = 0;
+    }
+
+exit:
     if (NT_SUCCESS(Result))
     {
         if (0 != *PDestLen)
             FileDesc->DirectoryHasSuchFile = TRUE;
         FileDesc->DirectoryOffset = DirectoryOffset;
-        FileDesc->DirInfoCacheHint = (ULONG)((PUINT8)DirInfo - DirInfoBgn);
+        FileDesc->DirInfoCacheChunk = Chunk;
+        FileDesc->DirInfoCacheHint = Hint;
     }
     else if (STATUS_NO_MORE_FILES == Result && !FileDesc->DirectoryHasSuchFile)
         Result = STATUS_NO_SUCH_FILE;
@@ -321,8 +419,6 @@ static NTSTATUS FspFsvolQueryDirectoryCopyInPlace(
     PAGED_CODE();
 
     NTSTATUS Result;
-    BOOLEAN CaseInsensitive = !FileDesc->CaseSensitive;
-    PUNICODE_STRING DirectoryPattern = &FileDesc->DirectoryPattern;
     UINT64 DirectoryOffset = FileDesc->DirectoryOffset;
 
     ASSERT(DirInfo == DestBuf);
@@ -331,8 +427,8 @@ static NTSTATUS FspFsvolQueryDirectoryCopyInPlace(
         FIELD_OFFSET(FILE_ID_BOTH_DIR_INFORMATION, FileName),
         "FSP_FSCTL_DIR_INFO must be bigger than FILE_ID_BOTH_DIR_INFORMATION");
 
-    Result = FspFsvolQueryDirectoryCopy(DirectoryPattern, CaseInsensitive,
-        0, &DirectoryOffset,
+    Result = FspFsvolQueryDirectoryCopy(FileDesc,
+        &DirectoryOffset,
         FileInformationClass, ReturnSingleEntry,
         &DirInfo, DirInfoSize,
         DestBuf, PDestLen);
@@ -349,6 +445,72 @@ static NTSTATUS FspFsvolQueryDirectoryCopyInPlace(
     return Result;
 }
 
+static VOID FspFsvolQueryDirectoryStatAhead(
+    PDEVICE_OBJECT FsvolDeviceObject, FSP_FILE_DESC *FileDesc,
+    FSP_FSCTL_DIR_INFO *DirInfo, ULONG DirInfoSize)
+{
+    /*
+     * Add the FileInfo of every listed file to the volume's stat-ahead cache,
+     * so that a following GetFileAttributesEx on it can be answered without
+     * going to user mode (see FspFastIoQueryOpen).
+     */
+
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    FSP_FILE_NODE *FileNode = FileDesc->FileNode;
+    PUINT8 DirInfoEnd = (PUINT8)DirInfo + DirInfoSize;
+    UNICODE_STRING DirectoryName, FileName;
+
+    if (0 == FsvolDeviceExtension->StatAheadCache || !FileDesc->HasStatAheadIdentity)
+        return;
+
+    /* FileNode->FileName may change on rename; take a copy under the context table lock */
+    FspFsvolDeviceLockContextTable(FsvolDeviceObject);
+    DirectoryName.Length = DirectoryName.MaximumLength = FileNode->FileName.Length;
+    DirectoryName.Buffer = FspAlloc(FileNode->FileName.Length + sizeof(WCHAR));
+    if (0 != DirectoryName.Buffer)
+        RtlCopyMemory(DirectoryName.Buffer, FileNode->FileName.Buffer, FileNode->FileName.Length);
+    FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
+    if (0 == DirectoryName.Buffer)
+        return;
+
+    for (;
+        (PUINT8)DirInfo + sizeof(DirInfo->Size) <= DirInfoEnd;
+        DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfoSize)))
+    {
+        DirInfoSize = DirInfo->Size;
+        if (sizeof(FSP_FSCTL_DIR_INFO) > DirInfoSize || (PUINT8)DirInfo + DirInfoSize > DirInfoEnd)
+            break;
+
+        FileName.Length = FileName.MaximumLength =
+            (USHORT)(DirInfoSize - sizeof(FSP_FSCTL_DIR_INFO));
+        FileName.Buffer = DirInfo->FileNameBuf;
+
+        /* skip the dot entries, reparse points and anything that is not a plain name */
+        if (0 == FileName.Length || 0 != FileName.Length % sizeof(WCHAR) ||
+            (sizeof(WCHAR) == FileName.Length && L'.' == FileName.Buffer[0]) ||
+            (sizeof(WCHAR) * 2 == FileName.Length &&
+                L'.' == FileName.Buffer[0] && L'.' == FileName.Buffer[1]) ||
+            FlagOn(DirInfo->FileInfo.FileAttributes, FILE_ATTRIBUTE_REPARSE_POINT))
+            continue;
+        for (PWSTR P = FileName.Buffer, EndP = P + FileName.Length / sizeof(WCHAR); EndP > P; P++)
+            if (L'\\' == *P || L':' == *P)
+            {
+                FileName.Length = 0;
+                break;
+            }
+        if (0 == FileName.Length)
+            continue;
+
+        FspFsvolDeviceAddStatAhead(FsvolDeviceObject, &DirectoryName, &FileName,
+            &FileDesc->StatAheadIdentity, &DirInfo->FileInfo,
+            FileDesc->StatAheadChangeNumber);
+    }
+
+    FspFree(DirectoryName.Buffer);
+}
+
 static inline NTSTATUS FspFsvolQueryDirectoryBufferUserBuffer(
     FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension, PIRP Irp, PULONG PLength)
 {
@@ -493,19 +655,18 @@ static NTSTATUS FspFsvolQueryDirectoryRetry(
     {
         FileDesc->DirectoryHasSuchFile = FALSE;
         FileDesc->DirectoryOffset = OFFSET_FROM_FILE_INDEX(FileIndex);
+        FileDesc->DirInfoCacheAppend = FALSE;
     }
     else if (RestartScan)
     {
         FileDesc->DirectoryHasSuchFile = FALSE;
         FileDesc->DirectoryOffset = 0;
+        FileDesc->DirInfoCacheAppend = FALSE;
     }
 
     /* see if the required information is still in the cache and valid! */
     if (FspFileNodeReferenceDirInfo(FileNode, &DirInfoBuffer, &DirInfoSize))
     {
-        if (0 == SystemBufferLength)
-            SystemBufferLength = GetSystemBufferLengthNonCached();
-
         Result = FspFsvolQueryDirectoryCopyCache(FileDesc,
             IndexSpecified || RestartScan,
             FileInformationClass, ReturnSingleEntry,
@@ -519,6 +680,11 @@ static NTSTATUS FspFsvolQueryDirectoryRetry(
             Irp->IoStatus.Information = Length;
             return Result;
         }
+
+        /* if we are going to extend the cached DirInfo, read a full chunk */
+        if (0 == SystemBufferLength)
+            SystemBufferLength = FileDesc->DirInfoCacheAppend ?
+                FspFsvolDeviceDirInfoCacheItemSizeMax : GetSystemBufferLengthNonCached();
     }
     else
     {
@@ -565,6 +731,8 @@ static NTSTATUS FspFsvolQueryDirectoryRetry(
             L'\0';
     }
 
+    FileDesc->StatAheadChangeNumber = FspFsvolDeviceStatAheadChangeNumber(FsvolDeviceObject);
+
     FspFileNodeSetOwner(FileNode, Full, Request);
     FspIopRequestContext(Request, RequestFileNode) = FileNode;
 
@@ -861,6 +1029,10 @@ NTSTATUS FspFsvolDirectoryControlComplete(
         Request->Kind = FspFsctlTransactReservedKind;
         FspIopResetRequest(Request, 0);
         FspIopRequestContext(Request, RequestDirInfoChangeNumber) = (PVOID)DirInfoChangeNumber;
+
+        /* the response is still intact (and no longer mapped into user mode); stat-ahead now */
+        FspFsvolQueryDirectoryStatAhead(IrpSp->DeviceObject, FileDesc,
+            Irp->AssociatedIrp.SystemBuffer, (ULONG)Response->IoStatus.Information);
     }
     else
         DirInfoChangeNumber =
@@ -888,6 +1060,24 @@ NTSTATUS FspFsvolDirectoryControlComplete(
 
         FspFileNodeDereferenceDirInfo(DirInfoBuffer);
     }
+    else if (0 != FileDesc->DirectoryOffset &&
+        FileDesc->DirInfoCacheAppend &&
+        FileDesc->DirInfo == FileNode->NonPaged->DirInfo &&
+        FileNode->DirInfoChangeNumber == DirInfoChangeNumber &&
+        FspFileNodeAppendDirInfo(FileNode,
+            FileDesc->DirInfoCacheChunk + 1,
+            Irp->AssociatedIrp.SystemBuffer,
+            (ULONG)Response->IoStatus.Information) &&
+        FspFileNodeReferenceDirInfo(FileNode, &DirInfoBuffer, &DirInfoSize))
+    {
+        /* the response continues the cached DirInfo; it has been appended as a new chunk */
+        Result = FspFsvolQueryDirectoryCopyCache(FileDesc,
+            FALSE,
+            FileInformationClass, ReturnSingleEntry,
+            DirInfoBuffer, DirInfoSize, Buffer, &Length);
+
+        FspFileNodeDereferenceDirInfo(DirInfoBuffer);
+    }
     else
     {
         DirInfoBuffer = Irp->AssociatedIrp.SystemBuffer;
@@ -915,6 +1105,8 @@ NTSTATUS FspFsvolDirectoryControlComplete(
         Request->Req.QueryDirectory.Address = 0;
         Request->Req.QueryDirectory.Offset = FileDesc->DirectoryOffset;
 
+        FileDesc->StatAheadChangeNumber = FspFsvolDeviceStatAheadChangeNumber(FsvolDeviceObject);
+
         FspFileNodeSetOwner(FileNode, Full, Request);
         FspIopRequestContext(Request, RequestFileNode) = FileNode;
 
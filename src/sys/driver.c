@@ -46,6 +46,10 @@ NTSTATUS DriverEntry(
 
     FspDriverMultiVersionInitialize();
 
+    Result = FspIopInitialize();
+    if (!NT_SUCCESS(Result))
+        FSP_RETURN();
+
     FspDriverObject = DriverObject;
     ExInitializeResourceLite(&FspDeviceGlobalResource);
 
@@ -59,14 +63,14 @@ NTSTATUS DriverEntry(
         &DeviceSddl, &FspFsctlDeviceClassGuid,
         &FspFsctlDiskDeviceObject);
     if (!NT_SUCCESS(Result))
-        FSP_RETURN();
+        FSP_RETURN(FspIopFinalize());
     RtlInitUnicodeString(&DeviceName, L"\\Device\\" FSP_FSCTL_NET_DEVICE_NAME);
     Result = FspDeviceCreateSecure(FspFsctlDeviceExtensionKind, 0,
         &DeviceName, FILE_DEVICE_NETWORK_FILE_SYSTEM, FILE_DEVICE_SECURE_OPEN,
         &DeviceSddl, &FspFsctlDeviceClassGuid,
         &FspFsctlNetDeviceObject);
     if (!NT_SUCCESS(Result))
-        FSP_RETURN(FspDeviceDelete(FspFsctlDiskDeviceObject));
+        FSP_RETURN(FspDeviceDelete(FspFsctlDiskDeviceObject); FspIopFinalize());
     Result = FspDeviceInitialize(FspFsctlDiskDeviceObject);
     ASSERT(STATUS_SUCCESS == Result);
     Result = FspDeviceInitialize(FspFsctlNetDeviceObject);
@@ -148,7 +152,7 @@ NTSTATUS DriverEntry(
     //FspFastIoDispatch.FastIoWriteCompressed = 0;
     //FspFastIoDispatch.MdlReadCompleteCompressed = 0;
     //FspFastIoDispatch.MdlWriteCompleteCompressed = 0;
-    //FspFastIoDispatch.FastIoQueryOpen = 0;
+    FspFastIoDispatch.FastIoQueryOpen = FspFastIoQueryOpen;
     FspFastIoDispatch.ReleaseForModWrite = FspReleaseForModWrite;
     FspFastIoDispatch.AcquireForCcFlush = FspAcquireForCcFlush;
     FspFastIoDispatch.ReleaseForCcFlush = FspReleaseForCcFlush;
@@ -203,6 +207,8 @@ VOID FspUnload(
     ExDeleteResourceLite(&FspDeviceGlobalResource);
     FspDriverObject = 0;
 
+    FspIopFinalize();
+
 #pragma prefast(suppress:28175, "We are in DriverUnload: ok to access DriverName")
     FSP_LEAVE_VOID("DriverName=\"%wZ\"",
         &DriverObject->DriverName);
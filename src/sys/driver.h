@@ -327,6 +327,7 @@ FSP_IOCMPL_DISPATCH FspFsvolWriteComplete;
 
 /* fast I/O and resource acquisition callbacks */
 FAST_IO_CHECK_IF_POSSIBLE FspFastIoCheckIfPossible;
+FAST_IO_QUERY_OPEN FspFastIoQueryOpen;
 FAST_IO_ACQUIRE_FILE FspAcquireFileForNtCreateSection;
 FAST_IO_RELEASE_FILE FspReleaseFileForNtCreateSection;
 FAST_IO_ACQUIRE_FOR_MOD_WRITE FspAcquireForModWrite;
@@ -348,6 +349,8 @@ VOID FspPropagateTopFlags(PIRP Irp, PIRP TopLevelIrp);
 /* memory allocation */
 #define FspAlloc(Size)                  ExAllocatePoolWithTag(PagedPool, Size, FSP_ALLOC_INTERNAL_TAG)
 #define FspAllocNonPaged(Size)          ExAllocatePoolWithTag(NonPagedPool, Size, FSP_ALLOC_INTERNAL_TAG)
+#define FspAllocNonPagedCacheAligned(Size)\
+    ExAllocatePoolWithTag(NonPagedPoolCacheAligned, Size, FSP_ALLOC_INTERNAL_TAG)
 #define FspAllocMustSucceed(Size)       FspAllocatePoolMustSucceed(PagedPool, Size, FSP_ALLOC_INTERNAL_TAG)
 #define FspFree(Pointer)                ExFreePoolWithTag(Pointer, FSP_ALLOC_INTERNAL_TAG)
 #define FspAllocExternal(Size)          ExAllocatePoolWithTag(PagedPool, Size, FSP_ALLOC_EXTERNAL_TAG)
@@ -533,6 +536,9 @@ NTSTATUS FspIrpHookNext(PDEVICE_OBJECT DeviceObject, PIRP Irp, PVOID Context);
     (*(ULONG *)&(Irp)->Tail.Overlay.DriverContext[0])
 #define FspIrpDictNext(Irp)             \
     (*(PIRP *)&(Irp)->Tail.Overlay.DriverContext[1])
+#define FspIrpPendingSequence(Irp)      \
+    (*(ULONG *)&(Irp)->Tail.Overlay.DriverContext[1])
+    /* shares storage with FspIrpDictNext; only valid while the IRP is in the Pending queue */
 static inline
 FSP_FSCTL_TRANSACT_REQ *FspIrpRequest(PIRP Irp)
 {
@@ -575,18 +581,33 @@ VOID FspIrpSetTopFlags(PIRP Irp, ULONG Flags)
 #define FspIoqCancelled                 ((PIRP)2)
 #define FspIoqPostIrp(Q, I, R)          FspIoqPostIrpEx(Q, I, FALSE, R)
 #define FspIoqPostIrpBestEffort(Q, I, R)FspIoqPostIrpEx(Q, I, TRUE, R)
-typedef struct
+typedef struct _FSP_IOQ FSP_IOQ;
+typedef struct DECLSPEC_CACHEALIGN
 {
     KSPIN_LOCK SpinLock;
-    BOOLEAN Stopped;
     KEVENT PendingIrpEvent;
-    LIST_ENTRY PendingIrpList, ProcessIrpList, RetriedIrpList;
-    IO_CSQ PendingIoCsq, ProcessIoCsq, RetriedIoCsq;
+    LIST_ENTRY PendingIrpList;
+    IO_CSQ PendingIoCsq;
+    ULONG PendingIrpCount;
+    FSP_IOQ *Ioq;
+} FSP_IOQ_SHARD;
+typedef struct _FSP_IOQ
+{
+    KSPIN_LOCK SpinLock;
+    BOOLEAN Stopped;
+    LIST_ENTRY ProcessIrpList, RetriedIrpList;
+    IO_CSQ ProcessIoCsq, RetriedIoCsq;
     ULONG IrpTimeout;
-    ULONG PendingIrpCapacity, PendingIrpCount, ProcessIrpCount, RetriedIrpCount;
+    ULONG PendingIrpCapacity, ProcessIrpCount, RetriedIrpCount;
+    LONG volatile PendingIrpCount, PendingSequence;
+    ULONG ShardCount;
+    FSP_IOQ_SHARD *Shards;
     VOID (*CompleteCanceledIrp)(PIRP Irp);
-    ULONG ProcessIrpBucketCount;
-    PVOID ProcessIrpBuckets[];
+    ULONG ProcessIrpBucketCount, ProcessIrpBucketCountMin;
+    PVOID *ProcessIrpBuckets;
+    ULONG ProcessIrpOldBucketCount, ProcessIrpOldBucketIndex;
+    PVOID *ProcessIrpOldBuckets, *ProcessIrpRetiredBuckets;
+    PVOID ProcessIrpBucketsBuf[];
 } FSP_IOQ;
 NTSTATUS FspIoqCreate(
     ULONG IrpCapacity, PLARGE_INTEGER IrpTimeout, VOID (*CompleteCanceledIrp)(PIRP Irp),
@@ -596,7 +617,8 @@ VOID FspIoqStop(FSP_IOQ *Ioq);
 BOOLEAN FspIoqStopped(FSP_IOQ *Ioq);
 VOID FspIoqRemoveExpired(FSP_IOQ *Ioq, UINT64 InterruptTime);
 BOOLEAN FspIoqPostIrpEx(FSP_IOQ *Ioq, PIRP Irp, BOOLEAN BestEffort, NTSTATUS *PResult);
-PIRP FspIoqNextPendingIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp, PLARGE_INTEGER Timeout,
+ULONG FspIoqPendingSequence(FSP_IOQ *Ioq);
+PIRP FspIoqNextPendingIrp(FSP_IOQ *Ioq, PULONG PBoundarySequence, PLARGE_INTEGER Timeout,
     PIRP CancellableIrp);
 ULONG FspIoqPendingIrpCount(FSP_IOQ *Ioq);
 BOOLEAN FspIoqStartProcessingIrp(FSP_IOQ *Ioq, PIRP Irp);
@@ -607,27 +629,53 @@ PIRP FspIoqNextCompleteIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp);
 ULONG FspIoqRetriedIrpCount(FSP_IOQ *Ioq);
 
 /* meta cache */
+enum
+{
+    FspMetaCacheStripeCountMax = 8,
+    FspMetaCacheStripeItemsMin = 4,     /* minimum number of ItemSizeMax items per stripe */
+};
+typedef struct DECLSPEC_CACHEALIGN
+{
+    EX_SPIN_LOCK SpinLock;
+    ULONG MetaSizeMax, MetaSize, ItemCount, HolderCount;
+    LONG64 volatile HitCount, MissCount;
+    UINT64 EvictionCount, DedupCount;
+    LIST_ENTRY ItemList, LruList;
+    ULONG ItemBucketCount;
+    PVOID *ContentBuckets;
+    PVOID ItemBuckets[];
+} FSP_META_CACHE_STRIPE;
 typedef struct
 {
-    KSPIN_LOCK SpinLock;
     UINT64 MetaTimeout;
-    ULONG MetaCapacity, ItemCount;
+    ULONG MetaSizeMax;
     ULONG ItemSizeMax;
-    UINT64 ItemIndex;
-    LIST_ENTRY ItemList;
-    ULONG ItemBucketCount;
-    PVOID ItemBuckets[];
+    LONG64 volatile ItemIndex;
+    ULONG StripeCount;
+    FSP_META_CACHE_STRIPE *Stripes[];
 } FSP_META_CACHE;
 NTSTATUS FspMetaCacheCreate(
-    ULONG MetaCapacity, ULONG ItemSizeMax, PLARGE_INTEGER MetaTimeout,
+    ULONG MetaSizeMax, ULONG ItemSizeMax, PLARGE_INTEGER MetaTimeout,
     FSP_META_CACHE **PMetaCache);
 VOID FspMetaCacheDelete(FSP_META_CACHE *MetaCache);
 VOID FspMetaCacheInvalidateExpired(FSP_META_CACHE *MetaCache, UINT64 ExpirationTime);
 BOOLEAN FspMetaCacheReferenceItemBuffer(FSP_META_CACHE *MetaCache, UINT64 ItemIndex,
     PCVOID *PBuffer, PULONG PSize);
+BOOLEAN FspMetaCacheNextItemBuffer(PCVOID Buffer, PCVOID *PBuffer, PULONG PSize);
 VOID FspMetaCacheDereferenceItemBuffer(PCVOID Buffer);
 UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size);
+UINT64 FspMetaCacheAddItemShared(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size);
+UINT64 FspMetaCacheAddItemKeyed(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size,
+    ULONG KeySize);
+BOOLEAN FspMetaCacheReferenceItemBufferByKey(FSP_META_CACHE *MetaCache, PCVOID Key, ULONG KeySize,
+    PCVOID *PBuffer, PULONG PSize);
+BOOLEAN FspMetaCacheLookupItemShared(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size);
+BOOLEAN FspMetaCacheAppendItemChunk(FSP_META_CACHE *MetaCache, UINT64 ItemIndex,
+    ULONG ChunkIndex, PCVOID Buffer, ULONG Size);
 VOID FspMetaCacheInvalidateItem(FSP_META_CACHE *MetaCache, UINT64 ItemIndex);
+VOID FspMetaCacheInvalidateItemShared(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size);
+VOID FspMetaCacheQueryStatistics(FSP_META_CACHE *MetaCache,
+    FSP_FSCTL_META_CACHE_STATISTICS *Statistics);
 
 /* I/O processing */
 #define FSP_FSCTL_WORK                  \
@@ -661,6 +709,7 @@ typedef struct
     FSP_IOP_REQUEST_FINI *RequestFini;
     PVOID Context[4];
     FSP_FSCTL_TRANSACT_RSP *Response;
+    UINT16 RequestSizeClass, ResponseSizeClass;
     __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) UINT8 RequestBuf[];
 } FSP_FSCTL_TRANSACT_REQ_HEADER;
 static inline
@@ -669,6 +718,8 @@ PVOID *FspIopRequestContextAddress(FSP_FSCTL_TRANSACT_REQ *Request, ULONG I)
     FSP_FSCTL_TRANSACT_REQ_HEADER *RequestHeader = (PVOID)((PUINT8)Request - sizeof *RequestHeader);
     return &RequestHeader->Context[I];
 }
+NTSTATUS FspIopInitialize(VOID);
+VOID FspIopFinalize(VOID);
 NTSTATUS FspIopCreateRequestFunnel(
     PIRP Irp, PUNICODE_STRING FileName, ULONG ExtraSize, FSP_IOP_REQUEST_FINI *RequestFini,
     ULONG Flags, FSP_FSCTL_TRANSACT_REQ **PRequest);
@@ -714,10 +765,14 @@ VOID FspWqPostIrpWorkItem(PIRP Irp);
 /* device management */
 enum
 {
-    FspFsvolDeviceSecurityCacheCapacity = 100,
     FspFsvolDeviceSecurityCacheItemSizeMax = 4096,
-    FspFsvolDeviceDirInfoCacheCapacity = 100,
     FspFsvolDeviceDirInfoCacheItemSizeMax = FSP_FSCTL_ALIGN_UP(16384, PAGE_SIZE),
+    FspFsvolDeviceDirInfoCacheIndexSizeMax =    /* DirInfo chunk index; see file.c */
+        16 + FspFsvolDeviceDirInfoCacheItemSizeMax / 4,
+    FspFsvolDeviceNegativeNameCacheSize = 1024 * 1024,
+    FspFsvolDeviceNegativeNameCacheItemSizeMax = 2048,
+    FspFsvolDeviceStatAheadCacheSize = 4 * 1024 * 1024,
+    FspFsvolDeviceStatAheadCacheItemSizeMax = 2048,
 };
 typedef struct
 {
@@ -744,8 +799,8 @@ typedef struct
 typedef struct
 {
     FSP_DEVICE_EXTENSION Base;
-    UINT32 InitDoneFsvrt:1, InitDoneIoq:1, InitDoneSec:1, InitDoneDir:1,
-        InitDoneCtxTab:1, InitDoneTimer:1, InitDoneInfo:1, InitDoneNotify:1;
+    UINT32 InitDoneFsvrt:1, InitDoneIoq:1, InitDoneSec:1, InitDoneDir:1, InitDoneNeg:1,
+        InitDoneStat:1, InitDoneCtxTab:1, InitDoneTimer:1, InitDoneInfo:1, InitDoneNotify:1;
     PDEVICE_OBJECT FsctlDeviceObject;
     PDEVICE_OBJECT FsvrtDeviceObject;
     HANDLE MupHandle;
@@ -756,6 +811,10 @@ typedef struct
     FSP_IOQ *Ioq;
     FSP_META_CACHE *SecurityCache;
     FSP_META_CACHE *DirInfoCache;
+    FSP_META_CACHE *NegativeNameCache;
+    LONG NegativeNameChangeNumber;
+    FSP_META_CACHE *StatAheadCache;
+    LONG StatAheadChangeNumber;
     KSPIN_LOCK ExpirationLock;
     WORK_QUEUE_ITEM ExpirationWorkItem;
     BOOLEAN ExpirationInProgress;
@@ -810,6 +869,25 @@ PVOID FspFsvolDeviceInsertContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_ST
     FSP_DEVICE_CONTEXT_BY_NAME_TABLE_ELEMENT *ElementStorage, PBOOLEAN PInserted);
 VOID FspFsvolDeviceDeleteContextByName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
     PBOOLEAN PDeleted);
+BOOLEAN FspFsvolDeviceLookupNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName);
+ULONG FspFsvolDeviceNegativeNameChangeNumber(PDEVICE_OBJECT DeviceObject);
+VOID FspFsvolDeviceAddNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    ULONG NegativeNameChangeNumber);
+VOID FspFsvolDeviceInvalidateNegativeName(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName);
+typedef struct
+{
+    LUID TokenId, ModifiedId;
+} FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY;
+BOOLEAN FspFsvolDeviceStatAheadIdentity(PACCESS_TOKEN AccessToken,
+    FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY *Identity);
+BOOLEAN FspFsvolDeviceLookupStatAhead(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName,
+    FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY *Identity, FSP_FSCTL_FILE_INFO *FileInfo);
+ULONG FspFsvolDeviceStatAheadChangeNumber(PDEVICE_OBJECT DeviceObject);
+VOID FspFsvolDeviceAddStatAhead(PDEVICE_OBJECT DeviceObject,
+    PUNICODE_STRING DirectoryName, PUNICODE_STRING FileName,
+    FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY *Identity, const FSP_FSCTL_FILE_INFO *FileInfo,
+    ULONG StatAheadChangeNumber);
+VOID FspFsvolDeviceInvalidateStatAhead(PDEVICE_OBJECT DeviceObject, PUNICODE_STRING FileName);
 VOID FspFsvolDeviceGetVolumeInfo(PDEVICE_OBJECT DeviceObject, FSP_FSCTL_VOLUME_INFO *VolumeInfo);
 BOOLEAN FspFsvolDeviceTryGetVolumeInfo(PDEVICE_OBJECT DeviceObject, FSP_FSCTL_VOLUME_INFO *VolumeInfo);
 VOID FspFsvolDeviceSetVolumeInfo(PDEVICE_OBJECT DeviceObject, const FSP_FSCTL_VOLUME_INFO *VolumeInfo);
@@ -854,6 +932,8 @@ NTSTATUS FspVolumeTransact(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 NTSTATUS FspVolumeStop(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
+NTSTATUS FspVolumeGetStatistics(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 NTSTATUS FspVolumeWork(
     PDEVICE_OBJECT FsvolDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 
@@ -936,10 +1016,24 @@ typedef struct
     BOOLEAN DeleteOnClose;
     BOOLEAN DirectoryHasSuchFile;
     UNICODE_STRING DirectoryPattern;
+    ULONG DirectoryPatternKind;
     UINT64 DirectoryOffset;
     UINT64 DirInfo;
-    ULONG DirInfoCacheHint;
+    ULONG DirInfoCacheChunk, DirInfoCacheHint;
+    BOOLEAN DirInfoCacheAppend;
+    ULONG NegativeNameChangeNumber;
+    ULONG StatAheadChangeNumber;
+    BOOLEAN HasStatAheadIdentity;
+    FSP_FSVOL_DEVICE_STAT_AHEAD_IDENTITY StatAheadIdentity;
 } FSP_FILE_DESC;
+enum
+{
+    FspFileDescDirectoryPatternExpression = 0,  /* full wildcard expression */
+    FspFileDescDirectoryPatternAll,             /* "*" */
+    FspFileDescDirectoryPatternLiteral,         /* "name" */
+    FspFileDescDirectoryPatternPrefix,          /* "prefix*" */
+    FspFileDescDirectoryPatternSuffix,          /* "*suffix" (e.g. "*.ext") */
+};
 NTSTATUS FspFileNodeCopyList(PDEVICE_OBJECT DeviceObject,
     FSP_FILE_NODE ***PFileNodes, PULONG PFileNodeCount);
 VOID FspFileNodeDeleteList(FSP_FILE_NODE **FileNodes, ULONG FileNodeCount);
@@ -988,15 +1082,21 @@ VOID FspFileNodeSetSecurity(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size);
 BOOLEAN FspFileNodeTrySetSecurity(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size,
     ULONG SecurityChangeNumber);
 BOOLEAN FspFileNodeReferenceDirInfo(FSP_FILE_NODE *FileNode, PCVOID *PBuffer, PULONG PSize);
+BOOLEAN FspFileNodeNextDirInfo(PCVOID Buffer, PCVOID *PBuffer, PULONG PSize);
+NTSTATUS FspFileNodeSeekDirInfo(PCVOID Buffer, ULONG Size,
+    UINT64 DirectoryOffset, PULONG PPosition);
 VOID FspFileNodeSetDirInfo(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size);
 BOOLEAN FspFileNodeTrySetDirInfo(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size,
     ULONG DirInfoChangeNumber);
+BOOLEAN FspFileNodeAppendDirInfo(FSP_FILE_NODE *FileNode, ULONG ChunkIndex,
+    PCVOID Buffer, ULONG Size);
 VOID FspFileNodeNotifyChange(FSP_FILE_NODE *FileNode, ULONG Filter, ULONG Action);
 NTSTATUS FspFileNodeProcessLockIrp(FSP_FILE_NODE *FileNode, PIRP Irp);
 NTSTATUS FspFileDescCreate(FSP_FILE_DESC **PFileDesc);
 VOID FspFileDescDelete(FSP_FILE_DESC *FileDesc);
 NTSTATUS FspFileDescResetDirectoryPattern(FSP_FILE_DESC *FileDesc,
     PUNICODE_STRING FileName, BOOLEAN Reset);
+BOOLEAN FspFileDescDirectoryPatternMatch(FSP_FILE_DESC *FileDesc, PUNICODE_STRING FileName);
 #define FspFileNodeAcquireShared(N,F)   FspFileNodeAcquireSharedF(N, FspFileNodeAcquire ## F)
 #define FspFileNodeTryAcquireShared(N,F)    FspFileNodeTryAcquireSharedF(N, FspFileNodeAcquire ## F, FALSE)
 #define FspFileNodeAcquireExclusive(N,F)    FspFileNodeAcquireExclusiveF(N, FspFileNodeAcquire ## F)
@@ -52,10 +52,18 @@ BOOLEAN FspFileNodeReferenceSecurity(FSP_FILE_NODE *FileNode, PCVOID *PBuffer, P
 VOID FspFileNodeSetSecurity(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size);
 BOOLEAN FspFileNodeTrySetSecurity(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size,
     ULONG SecurityChangeNumber);
+static NTSTATUS FspFileNodeCreateDirInfoChunk(PCVOID Buffer, ULONG Size,
+    PVOID *PChunk, PULONG PChunkSize);
+static ULONG FspFileNodeDirInfoChunkSize(PCVOID Chunk, ULONG ChunkSize);
 BOOLEAN FspFileNodeReferenceDirInfo(FSP_FILE_NODE *FileNode, PCVOID *PBuffer, PULONG PSize);
+BOOLEAN FspFileNodeNextDirInfo(PCVOID Buffer, PCVOID *PBuffer, PULONG PSize);
+NTSTATUS FspFileNodeSeekDirInfo(PCVOID Buffer, ULONG Size,
+    UINT64 DirectoryOffset, PULONG PPosition);
 VOID FspFileNodeSetDirInfo(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size);
 BOOLEAN FspFileNodeTrySetDirInfo(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size,
     ULONG DirInfoChangeNumber);
+BOOLEAN FspFileNodeAppendDirInfo(FSP_FILE_NODE *FileNode, ULONG ChunkIndex,
+    PCVOID Buffer, ULONG Size);
 static VOID FspFileNodeInvalidateDirInfo(FSP_FILE_NODE *FileNode);
 VOID FspFileNodeNotifyChange(FSP_FILE_NODE *FileNode,
     ULONG Filter, ULONG Action);
@@ -65,6 +73,10 @@ NTSTATUS FspFileDescCreate(FSP_FILE_DESC **PFileDesc);
 VOID FspFileDescDelete(FSP_FILE_DESC *FileDesc);
 NTSTATUS FspFileDescResetDirectoryPattern(FSP_FILE_DESC *FileDesc,
     PUNICODE_STRING FileName, BOOLEAN Reset);
+static ULONG FspFileDescDirectoryPatternKind(PUNICODE_STRING DirectoryPattern);
+static BOOLEAN FspFileDescDirectoryPatternEqual(PWSTR Pattern, PWSTR Name, ULONG Count,
+    BOOLEAN CaseInsensitive);
+BOOLEAN FspFileDescDirectoryPatternMatch(FSP_FILE_DESC *FileDesc, PUNICODE_STRING FileName);
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FspFileNodeCopyList)
@@ -93,9 +105,14 @@ NTSTATUS FspFileDescResetDirectoryPattern(FSP_FILE_DESC *FileDesc,
 #pragma alloc_text(PAGE, FspFileNodeReferenceSecurity)
 #pragma alloc_text(PAGE, FspFileNodeSetSecurity)
 #pragma alloc_text(PAGE, FspFileNodeTrySetSecurity)
+// !#pragma alloc_text(PAGE, FspFileNodeCreateDirInfoChunk)
+// !#pragma alloc_text(PAGE, FspFileNodeDirInfoChunkSize)
 // !#pragma alloc_text(PAGE, FspFileNodeReferenceDirInfo)
+// !#pragma alloc_text(PAGE, FspFileNodeNextDirInfo)
+// !#pragma alloc_text(PAGE, FspFileNodeSeekDirInfo)
 // !#pragma alloc_text(PAGE, FspFileNodeSetDirInfo)
 // !#pragma alloc_text(PAGE, FspFileNodeTrySetDirInfo)
+// !#pragma alloc_text(PAGE, FspFileNodeAppendDirInfo)
 // !#pragma alloc_text(PAGE, FspFileNodeInvalidateDirInfo)
 #pragma alloc_text(PAGE, FspFileNodeNotifyChange)
 #pragma alloc_text(PAGE, FspFileNodeProcessLockIrp)
@@ -103,6 +120,9 @@ NTSTATUS FspFileDescResetDirectoryPattern(FSP_FILE_DESC *FileDesc,
 #pragma alloc_text(PAGE, FspFileDescCreate)
 #pragma alloc_text(PAGE, FspFileDescDelete)
 #pragma alloc_text(PAGE, FspFileDescResetDirectoryPattern)
+#pragma alloc_text(PAGE, FspFileDescDirectoryPatternKind)
+#pragma alloc_text(PAGE, FspFileDescDirectoryPatternEqual)
+#pragma alloc_text(PAGE, FspFileDescDirectoryPatternMatch)
 #endif
 
 #define FSP_FILE_NODE_GET_FLAGS()       \
@@ -603,7 +623,11 @@ VOID FspFileNodeClose(FSP_FILE_NODE *FileNode, PFILE_OBJECT FileObject)
     FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
 
     if (DeletedFromContextTable)
+    {
+        /* the file may have changed while it was open; forget what listings said about it */
+        FspFsvolDeviceInvalidateStatAhead(FsvolDeviceObject, &FileNode->FileName);
         FspFileNodeDereference(FileNode);
+    }
 }
 
 NTSTATUS FspFileNodeFlushAndPurgeCache(FSP_FILE_NODE *FileNode,
@@ -823,7 +847,7 @@ VOID FspFileNodeSetSecurity(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size)
 
     FspMetaCacheInvalidateItem(FsvolDeviceExtension->SecurityCache, FileNode->Security);
     FileNode->Security = 0 != Buffer ?
-        FspMetaCacheAddItem(FsvolDeviceExtension->SecurityCache, Buffer, Size) : 0;
+        FspMetaCacheAddItemShared(FsvolDeviceExtension->SecurityCache, Buffer, Size) : 0;
     FileNode->SecurityChangeNumber++;
 }
 
@@ -839,6 +863,121 @@ BOOLEAN FspFileNodeTrySetSecurity(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG
     return TRUE;
 }
 
+/*
+ * A DirInfo chunk is what we keep in the DirInfo cache for every user mode response.
+ * It consists of the FSP_FSCTL_DIR_INFO entries as received from user mode, followed
+ * by an index of the entries sorted by NextOffset and a trailer that records the size
+ * of the entries. The index allows a FileDesc that has lost its position in the cache
+ * (e.g. because of an IndexSpecified query or because the cache was refilled) to find
+ * where to resume with a binary search rather than a linear scan of the entries.
+ */
+typedef struct
+{
+    UINT64 NextOffset;
+    ULONG Position;                     /* position of the entry that follows */
+    ULONG Reserved;
+} FSP_FILE_NODE_DIR_INFO_INDEX_ENTRY;
+typedef struct
+{
+    ULONG IndexCount;
+    BOOLEAN EndOfDirectory;
+    FSP_FILE_NODE_DIR_INFO_INDEX_ENTRY Index[];
+} FSP_FILE_NODE_DIR_INFO_INDEX;
+typedef struct
+{
+    ULONG DirInfoSize;
+    ULONG Reserved;
+} FSP_FILE_NODE_DIR_INFO_TRAILER;
+static_assert(
+    sizeof(FSP_FILE_NODE_DIR_INFO_INDEX_ENTRY) <= sizeof(FSP_FSCTL_DIR_INFO) / 4 &&
+    sizeof(FSP_FILE_NODE_DIR_INFO_INDEX) + sizeof(FSP_FILE_NODE_DIR_INFO_TRAILER) <= 16,
+    "FspFsvolDeviceDirInfoCacheIndexSizeMax is too small");
+#define FspFileNodeDirInfoIndex(Buffer, Size)    ((FSP_FILE_NODE_DIR_INFO_INDEX *)((PUINT8)(Buffer) + FSP_FSCTL_DEFAULT_ALIGN_UP(Size)))
+
+static NTSTATUS FspFileNodeCreateDirInfoChunk(PCVOID Buffer, ULONG Size,
+    PVOID *PChunk, PULONG PChunkSize)
+{
+    // !PAGED_CODE();
+
+    FSP_FSCTL_DIR_INFO *DirInfo;
+    PUINT8 DirInfoBgn = (PUINT8)Buffer, DirInfoEnd = DirInfoBgn + Size;
+    FSP_FILE_NODE_DIR_INFO_INDEX *Index;
+    FSP_FILE_NODE_DIR_INFO_INDEX_ENTRY IndexEntry;
+    FSP_FILE_NODE_DIR_INFO_TRAILER *Trailer;
+    BOOLEAN EndOfDirectory = FALSE;
+    ULONG IndexCount = 0, DirInfoSize, I, J;
+    PVOID Chunk;
+    ULONG ChunkSize;
+
+    for (DirInfo = (PVOID)DirInfoBgn;
+        (PUINT8)DirInfo + sizeof(DirInfo->Size) <= DirInfoEnd;
+        DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfoSize)))
+    {
+        DirInfoSize = DirInfo->Size;
+        if (sizeof(FSP_FSCTL_DIR_INFO) > DirInfoSize)
+        {
+            EndOfDirectory = TRUE;
+            break;
+        }
+        if ((PUINT8)DirInfo + DirInfoSize > DirInfoEnd)
+            break;
+        IndexCount++;
+    }
+
+    ChunkSize = FSP_FSCTL_DEFAULT_ALIGN_UP(Size) +
+        sizeof(FSP_FILE_NODE_DIR_INFO_INDEX) + IndexCount * sizeof(FSP_FILE_NODE_DIR_INFO_INDEX_ENTRY) +
+        sizeof(FSP_FILE_NODE_DIR_INFO_TRAILER);
+    Chunk = FspAlloc(ChunkSize);
+    if (0 == Chunk)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlCopyMemory(Chunk, Buffer, Size);
+    RtlZeroMemory((PUINT8)Chunk + Size, FSP_FSCTL_DEFAULT_ALIGN_UP(Size) - Size);
+
+    Index = FspFileNodeDirInfoIndex(Chunk, Size);
+    Index->IndexCount = IndexCount;
+    Index->EndOfDirectory = EndOfDirectory;
+
+    /*
+     * File systems usually return entries in NextOffset order, so insertion sort is
+     * close to linear in practice. It is also stable, which ensures that the entry
+     * found for a repeated NextOffset is the first one, just like a linear scan.
+     */
+    DirInfo = (PVOID)DirInfoBgn;
+    for (I = 0; IndexCount > I; I++)
+    {
+        DirInfoSize = FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size);
+        IndexEntry.NextOffset = DirInfo->NextOffset;
+        IndexEntry.Position = (ULONG)((PUINT8)DirInfo + DirInfoSize - DirInfoBgn);
+        if (IndexEntry.Position > Size)
+            IndexEntry.Position = Size;
+        IndexEntry.Reserved = 0;
+        for (J = I; 0 < J && Index->Index[J - 1].NextOffset > IndexEntry.NextOffset; J--)
+            Index->Index[J] = Index->Index[J - 1];
+        Index->Index[J] = IndexEntry;
+        DirInfo = (PVOID)((PUINT8)DirInfo + DirInfoSize);
+    }
+
+    Trailer = (PVOID)((PUINT8)Chunk + ChunkSize - sizeof *Trailer);
+    Trailer->DirInfoSize = Size;
+    Trailer->Reserved = 0;
+
+    *PChunk = Chunk;
+    *PChunkSize = ChunkSize;
+
+    return STATUS_SUCCESS;
+}
+
+static ULONG FspFileNodeDirInfoChunkSize(PCVOID Chunk, ULONG ChunkSize)
+{
+    // !PAGED_CODE();
+
+    FSP_FILE_NODE_DIR_INFO_TRAILER *Trailer =
+        (PVOID)((PUINT8)Chunk + ChunkSize - sizeof *Trailer);
+
+    return Trailer->DirInfoSize;
+}
+
 BOOLEAN FspFileNodeReferenceDirInfo(FSP_FILE_NODE *FileNode, PCVOID *PBuffer, PULONG PSize)
 {
     // !PAGED_CODE();
@@ -851,8 +990,50 @@ BOOLEAN FspFileNodeReferenceDirInfo(FSP_FILE_NODE *FileNode, PCVOID *PBuffer, PU
     /* no need to acquire the DirInfoSpinLock as the FileNode is acquired */
     DirInfo = NonPaged->DirInfo;
 
-    return FspMetaCacheReferenceItemBuffer(FsvolDeviceExtension->DirInfoCache,
-        DirInfo, PBuffer, PSize);
+    if (!FspMetaCacheReferenceItemBuffer(FsvolDeviceExtension->DirInfoCache,
+        DirInfo, PBuffer, PSize))
+        return FALSE;
+
+    *PSize = FspFileNodeDirInfoChunkSize(*PBuffer, *PSize);
+    return TRUE;
+}
+
+BOOLEAN FspFileNodeNextDirInfo(PCVOID Buffer, PCVOID *PBuffer, PULONG PSize)
+{
+    // !PAGED_CODE();
+
+    if (!FspMetaCacheNextItemBuffer(Buffer, PBuffer, PSize))
+        return FALSE;
+
+    *PSize = FspFileNodeDirInfoChunkSize(*PBuffer, *PSize);
+    return TRUE;
+}
+
+NTSTATUS FspFileNodeSeekDirInfo(PCVOID Buffer, ULONG Size,
+    UINT64 DirectoryOffset, PULONG PPosition)
+{
+    // !PAGED_CODE();
+
+    FSP_FILE_NODE_DIR_INFO_INDEX *Index = FspFileNodeDirInfoIndex(Buffer, Size);
+    ULONG Lo = 0, Hi = Index->IndexCount, Mid;
+
+    /* find the first index entry with NextOffset >= DirectoryOffset */
+    while (Lo < Hi)
+    {
+        Mid = Lo + (Hi - Lo) / 2;
+        if (Index->Index[Mid].NextOffset < DirectoryOffset)
+            Lo = Mid + 1;
+        else
+            Hi = Mid;
+    }
+
+    if (Index->IndexCount > Lo && Index->Index[Lo].NextOffset == DirectoryOffset)
+    {
+        *PPosition = Index->Index[Lo].Position;
+        return STATUS_SUCCESS;
+    }
+
+    return Index->EndOfDirectory ? STATUS_NO_MORE_FILES : STATUS_NOT_FOUND;
 }
 
 VOID FspFileNodeSetDirInfo(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size)
@@ -868,9 +1049,16 @@ VOID FspFileNodeSetDirInfo(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size)
     /* no need to acquire the DirInfoSpinLock as the FileNode is acquired */
     DirInfo = NonPaged->DirInfo;
 
+    PVOID Chunk;
+    ULONG ChunkSize;
+
     FspMetaCacheInvalidateItem(FsvolDeviceExtension->DirInfoCache, DirInfo);
-    DirInfo = 0 != Buffer ?
-        FspMetaCacheAddItem(FsvolDeviceExtension->DirInfoCache, Buffer, Size) : 0;
+    DirInfo = 0;
+    if (0 != Buffer && NT_SUCCESS(FspFileNodeCreateDirInfoChunk(Buffer, Size, &Chunk, &ChunkSize)))
+    {
+        DirInfo = FspMetaCacheAddItem(FsvolDeviceExtension->DirInfoCache, Chunk, ChunkSize);
+        FspFree(Chunk);
+    }
     FileNode->DirInfoChangeNumber++;
 
     /* acquire the DirInfoSpinLock to protect against concurrent FspFileNodeInvalidateDirInfo */
@@ -891,6 +1079,33 @@ BOOLEAN FspFileNodeTrySetDirInfo(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG S
     return TRUE;
 }
 
+BOOLEAN FspFileNodeAppendDirInfo(FSP_FILE_NODE *FileNode, ULONG ChunkIndex,
+    PCVOID Buffer, ULONG Size)
+{
+    // !PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension =
+        FspFsvolDeviceExtension(FileNode->FsvolDeviceObject);
+    FSP_FILE_NODE_NONPAGED *NonPaged = FileNode->NonPaged;
+    UINT64 DirInfo;
+    PVOID Chunk;
+    ULONG ChunkSize;
+    BOOLEAN Result;
+
+    /* no need to acquire the DirInfoSpinLock as the FileNode is acquired */
+    DirInfo = NonPaged->DirInfo;
+
+    if (!NT_SUCCESS(FspFileNodeCreateDirInfoChunk(Buffer, Size, &Chunk, &ChunkSize)))
+        return FALSE;
+
+    Result = FspMetaCacheAppendItemChunk(FsvolDeviceExtension->DirInfoCache,
+        DirInfo, ChunkIndex, Chunk, ChunkSize);
+
+    FspFree(Chunk);
+
+    return Result;
+}
+
 static VOID FspFileNodeInvalidateDirInfo(FSP_FILE_NODE *FileNode)
 {
     // !PAGED_CODE();
@@ -1062,9 +1277,126 @@ NTSTATUS FspFileDescResetDirectoryPattern(FSP_FILE_DESC *FileDesc,
         }
 
         FileDesc->DirectoryPattern = DirectoryPattern;
+        FileDesc->DirectoryPatternKind = FspFileDescDirectoryPatternKind(&DirectoryPattern);
     }
 
     return STATUS_SUCCESS;
 }
 
+static ULONG FspFileDescDirectoryPatternKind(PUNICODE_STRING DirectoryPattern)
+{
+    /*
+     * Classify the pattern once, so that the common shapes can be matched
+     * without interpreting the wildcard expression for every directory entry.
+     * The DOS wildcards (<, >, ") have subtle semantics around dots; patterns
+     * that contain them (or more than one wildcard) go to FsRtlIsNameInExpression.
+     */
+
+    PAGED_CODE();
+
+    PWSTR Pattern = DirectoryPattern->Buffer;
+    ULONG Count = DirectoryPattern->Length / sizeof(WCHAR);
+    ULONG StarIndex = (ULONG)-1;
+    ULONG DotCount = 0;
+
+    if (FspFileDescDirectoryPatternMatchAll == Pattern)
+        return FspFileDescDirectoryPatternAll;
+
+    /*
+     * Win32 turns "*.ext" into "<.ext"; DOS_STAR matches up to the last dot of the
+     * name, so when ".ext" contains no other dot this is the same as "*.ext".
+     */
+    if (2 <= Count && DOS_STAR == Pattern[0] && L'.' == Pattern[1])
+    {
+        for (ULONG Index = 1; Count > Index; Index++)
+            if (L'.' == Pattern[Index])
+                DotCount++;
+        if (1 != DotCount)
+            return FspFileDescDirectoryPatternExpression;
+        StarIndex = 0;
+    }
+
+    for (ULONG Index = 0 == StarIndex ? 1 : 0; Count > Index; Index++)
+        switch (Pattern[Index])
+        {
+        case L'*':
+            if ((ULONG)-1 != StarIndex)
+                return FspFileDescDirectoryPatternExpression;
+            StarIndex = Index;
+            break;
+        case L'?':
+        case DOS_STAR:
+        case DOS_QM:
+        case DOS_DOT:
+            return FspFileDescDirectoryPatternExpression;
+        }
+
+    if ((ULONG)-1 == StarIndex)
+        return FspFileDescDirectoryPatternLiteral;
+    if (1 == Count)
+        return FspFileDescDirectoryPatternAll;
+    if (Count - 1 == StarIndex)
+        return FspFileDescDirectoryPatternPrefix;
+    if (0 == StarIndex)
+        return FspFileDescDirectoryPatternSuffix;
+    return FspFileDescDirectoryPatternExpression;
+}
+
+static BOOLEAN FspFileDescDirectoryPatternEqual(PWSTR Pattern, PWSTR Name, ULONG Count,
+    BOOLEAN CaseInsensitive)
+{
+    PAGED_CODE();
+
+    /* the pattern is already upcased when CaseInsensitive */
+    if (!CaseInsensitive)
+        return RtlEqualMemory(Pattern, Name, Count * sizeof(WCHAR));
+
+    for (ULONG Index = 0; Count > Index; Index++)
+    {
+        WCHAR P = Pattern[Index], N = Name[Index];
+        if (P == N)
+            continue;
+        /* most names are ASCII; only consult the system upcase table for the rest */
+        if (0x80 > N)
+            N = L'a' <= N && L'z' >= N ? N - (L'a' - L'A') : N;
+        else
+            N = RtlUpcaseUnicodeChar(N);
+        if (P != N)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN FspFileDescDirectoryPatternMatch(FSP_FILE_DESC *FileDesc, PUNICODE_STRING FileName)
+{
+    PAGED_CODE();
+
+    PUNICODE_STRING DirectoryPattern = &FileDesc->DirectoryPattern;
+    BOOLEAN CaseInsensitive = !FileDesc->CaseSensitive;
+    ULONG PatternCount = DirectoryPattern->Length / sizeof(WCHAR);
+    ULONG NameCount = FileName->Length / sizeof(WCHAR);
+
+    switch (FileDesc->DirectoryPatternKind)
+    {
+    case FspFileDescDirectoryPatternAll:
+        return TRUE;
+    case FspFileDescDirectoryPatternLiteral:
+        return PatternCount == NameCount &&
+            FspFileDescDirectoryPatternEqual(DirectoryPattern->Buffer, FileName->Buffer,
+                PatternCount, CaseInsensitive);
+    case FspFileDescDirectoryPatternPrefix:
+        return PatternCount - 1 <= NameCount &&
+            FspFileDescDirectoryPatternEqual(DirectoryPattern->Buffer, FileName->Buffer,
+                PatternCount - 1, CaseInsensitive);
+    case FspFileDescDirectoryPatternSuffix:
+        return PatternCount - 1 <= NameCount &&
+            FspFileDescDirectoryPatternEqual(DirectoryPattern->Buffer + 1,
+                FileName->Buffer + NameCount - (PatternCount - 1),
+                PatternCount - 1, CaseInsensitive);
+    default:
+        return FsRtlIsNameInExpression(DirectoryPattern, FileName, CaseInsensitive, 0);
+    }
+}
+
 WCHAR FspFileDescDirectoryPatternMatchAll[] = L"*";
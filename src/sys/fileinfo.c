@@ -987,6 +987,10 @@ static NTSTATUS FspFsvolSetRenameInformationSuccess(
 
     FspFileNodeRename(FileNode, &NewFileName);
 
+    /* a renamed directory may bring a whole subtree of names into (or out of) existence */
+    FspFsvolDeviceInvalidateNegativeName(FsvolDeviceObject, 0);
+    FspFsvolDeviceInvalidateStatAhead(FsvolDeviceObject, 0);
+
     /* fastfat has some really arcane rules on rename notifications; simplify! */
     FspFileNodeNotifyChange(FileNode,
         FileNode->IsDirectory ? FILE_NOTIFY_CHANGE_DIR_NAME : FILE_NOTIFY_CHANGE_FILE_NAME,
@@ -58,6 +58,10 @@ static NTSTATUS FspFsctlFileSystemControl(
             if (0 != IrpSp->FileObject->FsContext2)
                 Result = FspVolumeStop(DeviceObject, Irp, IrpSp);
             break;
+        case FSP_FSCTL_VOLUME_STATISTICS:
+            if (0 != IrpSp->FileObject->FsContext2)
+                Result = FspVolumeGetStatistics(DeviceObject, Irp, IrpSp);
+            break;
         }
         break;
     case IRP_MN_MOUNT_VOLUME:
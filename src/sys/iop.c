@@ -17,6 +17,10 @@
 
 #include <sys/driver.h>
 
+NTSTATUS FspIopInitialize(VOID);
+VOID FspIopFinalize(VOID);
+static PVOID FspIopAllocateBlock(SIZE_T Size, BOOLEAN MustSucceed, PUINT16 PSizeClass);
+static VOID FspIopFreeBlock(PVOID Block, UINT16 SizeClass);
 NTSTATUS FspIopCreateRequestFunnel(
     PIRP Irp, PUNICODE_STRING FileName, ULONG ExtraSize, FSP_IOP_REQUEST_FINI *RequestFini,
     ULONG Flags, FSP_FSCTL_TRANSACT_REQ **PRequest);
@@ -34,6 +38,10 @@ NTSTATUS FspIopDispatchPrepare(PIRP Irp, FSP_FSCTL_TRANSACT_REQ *Request);
 NTSTATUS FspIopDispatchComplete(PIRP Irp, const FSP_FSCTL_TRANSACT_RSP *Response);
 
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(INIT, FspIopInitialize)
+#pragma alloc_text(PAGE, FspIopFinalize)
+#pragma alloc_text(PAGE, FspIopAllocateBlock)
+#pragma alloc_text(PAGE, FspIopFreeBlock)
 #pragma alloc_text(PAGE, FspIopCreateRequestFunnel)
 #pragma alloc_text(PAGE, FspIopDeleteRequest)
 #pragma alloc_text(PAGE, FspIopResetRequest)
@@ -54,6 +62,121 @@ NTSTATUS FspIopDispatchComplete(PIRP Irp, const FSP_FSCTL_TRANSACT_RSP *Response
 #define REQ_HEADER_ALIGNMASK            0
 #endif
 
+/*
+ * Request and response allocator.
+ *
+ * Requests are allocated in size classes from per-processor lookaside lists. A request is
+ * at most sizeof(FSP_FSCTL_TRANSACT_REQ_HEADER) + FSP_FSCTL_TRANSACT_REQ_SIZEMAX bytes,
+ * which fits in the largest class. Each lookaside list maintains its own TotalAllocates
+ * and AllocateMisses counters, which can be examined with the !lookaside debugger
+ * extension. Size class 0 denotes a block that was allocated directly from pool.
+ */
+static const ULONG FspIopSizeClasses[] = { 256, 512, 1024, 4096 };
+#define FSP_IOP_SIZE_CLASS_COUNT        (sizeof FspIopSizeClasses / sizeof FspIopSizeClasses[0])
+static LOOKASIDE_LIST_EX *FspIopLookasideLists;
+static ULONG FspIopLookasideProcessorCount;
+
+NTSTATUS FspIopInitialize(VOID)
+{
+    ULONG ProcessorCount, Index;
+    NTSTATUS Result;
+
+    ProcessorCount = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    if (0 == ProcessorCount)
+        ProcessorCount = 1;
+
+    FspIopLookasideLists = FspAllocNonPaged(
+        ProcessorCount * FSP_IOP_SIZE_CLASS_COUNT * sizeof(LOOKASIDE_LIST_EX));
+    if (0 == FspIopLookasideLists)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    for (Index = 0; ProcessorCount * FSP_IOP_SIZE_CLASS_COUNT > Index; Index++)
+    {
+        Result = ExInitializeLookasideListEx(&FspIopLookasideLists[Index], 0, 0,
+            PagedPool, 0, FspIopSizeClasses[Index % FSP_IOP_SIZE_CLASS_COUNT],
+            FSP_ALLOC_INTERNAL_TAG, 0);
+        if (!NT_SUCCESS(Result))
+        {
+            while (0 < Index)
+                ExDeleteLookasideListEx(&FspIopLookasideLists[--Index]);
+            FspFree(FspIopLookasideLists);
+            FspIopLookasideLists = 0;
+            return Result;
+        }
+    }
+
+    FspIopLookasideProcessorCount = ProcessorCount;
+
+    return STATUS_SUCCESS;
+}
+
+VOID FspIopFinalize(VOID)
+{
+    PAGED_CODE();
+
+    if (0 == FspIopLookasideLists)
+        return;
+
+    for (ULONG Index = 0; FspIopLookasideProcessorCount * FSP_IOP_SIZE_CLASS_COUNT > Index; Index++)
+        ExDeleteLookasideListEx(&FspIopLookasideLists[Index]);
+    FspFree(FspIopLookasideLists);
+    FspIopLookasideLists = 0;
+    FspIopLookasideProcessorCount = 0;
+}
+
+static inline
+LOOKASIDE_LIST_EX *FspIopLookasideList(UINT16 SizeClass)
+{
+    /* the thread may migrate to another processor; this is fine as lookaside lists are MP-safe */
+    ULONG Processor = KeGetCurrentProcessorNumberEx(0) % FspIopLookasideProcessorCount;
+    return &FspIopLookasideLists[Processor * FSP_IOP_SIZE_CLASS_COUNT + SizeClass - 1];
+}
+
+static PVOID FspIopAllocateBlock(SIZE_T Size, BOOLEAN MustSucceed, PUINT16 PSizeClass)
+{
+    PAGED_CODE();
+
+    PVOID Block = 0;
+    UINT16 SizeClass = 0;
+
+    for (ULONG Index = 0; FSP_IOP_SIZE_CLASS_COUNT > Index; Index++)
+        if (Size <= FspIopSizeClasses[Index])
+        {
+            SizeClass = (UINT16)(Index + 1);
+            Size = FspIopSizeClasses[Index];
+            break;
+        }
+
+    if (0 != SizeClass)
+        Block = ExAllocateFromLookasideListEx(FspIopLookasideList(SizeClass));
+
+    if (0 == Block)
+    {
+        /* a pool block of exactly the class size can still be freed to the lookaside list */
+        if (MustSucceed)
+            Block = FspAllocMustSucceed(Size);
+        else
+        {
+            Block = FspAlloc(Size);
+            if (0 == Block)
+                return 0;
+        }
+    }
+
+    *PSizeClass = SizeClass;
+    return Block;
+}
+
+static VOID FspIopFreeBlock(PVOID Block, UINT16 SizeClass)
+{
+    PAGED_CODE();
+
+    if (0 != SizeClass)
+        ExFreeToLookasideListEx(FspIopLookasideList(SizeClass), Block);
+    else
+        FspFree(Block);
+}
+
 NTSTATUS FspIopCreateRequestFunnel(
     PIRP Irp, PUNICODE_STRING FileName, ULONG ExtraSize, FSP_IOP_REQUEST_FINI *RequestFini,
     ULONG Flags, FSP_FSCTL_TRANSACT_REQ **PRequest)
@@ -62,6 +185,7 @@ NTSTATUS FspIopCreateRequestFunnel(
 
     FSP_FSCTL_TRANSACT_REQ_HEADER *RequestHeader;
     FSP_FSCTL_TRANSACT_REQ *Request;
+    UINT16 SizeClass = 0;
 
     *PRequest = 0;
 
@@ -71,15 +195,23 @@ NTSTATUS FspIopCreateRequestFunnel(
     if (FSP_FSCTL_TRANSACT_REQ_SIZEMAX < sizeof *Request + ExtraSize)
         return STATUS_INVALID_PARAMETER;
 
-    if (FlagOn(Flags, FspIopRequestMustSucceed))
+    if (!FlagOn(Flags, FspIopRequestNonPaged))
+    {
+        RequestHeader = FspIopAllocateBlock(
+            sizeof *RequestHeader + sizeof *Request + ExtraSize + REQ_HEADER_ALIGNMASK,
+            FlagOn(Flags, FspIopRequestMustSucceed), &SizeClass);
+        if (0 == RequestHeader)
+            return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    else if (FlagOn(Flags, FspIopRequestMustSucceed))
         RequestHeader = FspAllocatePoolMustSucceed(
-            FlagOn(Flags, FspIopRequestNonPaged) ? NonPagedPool : PagedPool,
+            NonPagedPool,
             sizeof *RequestHeader + sizeof *Request + ExtraSize + REQ_HEADER_ALIGNMASK,
             FSP_ALLOC_INTERNAL_TAG);
     else
     {
         RequestHeader = ExAllocatePoolWithTag(
-            FlagOn(Flags, FspIopRequestNonPaged) ? NonPagedPool : PagedPool,
+            NonPagedPool,
             sizeof *RequestHeader + sizeof *Request + ExtraSize + REQ_HEADER_ALIGNMASK,
             FSP_ALLOC_INTERNAL_TAG);
         if (0 == RequestHeader)
@@ -92,6 +224,7 @@ NTSTATUS FspIopCreateRequestFunnel(
 
     RtlZeroMemory(RequestHeader, sizeof *RequestHeader + sizeof *Request + ExtraSize);
     RequestHeader->RequestFini = RequestFini;
+    RequestHeader->RequestSizeClass = SizeClass;
 
     Request = (PVOID)RequestHeader->RequestBuf;
     Request->Size = (UINT16)(sizeof *Request + ExtraSize);
@@ -125,9 +258,9 @@ VOID FspIopDeleteRequest(FSP_FSCTL_TRANSACT_REQ *Request)
         RequestHeader->RequestFini(Request, RequestHeader->Context);
 
     if (0 != RequestHeader->Response)
-        FspFree(RequestHeader->Response);
+        FspIopFreeBlock(RequestHeader->Response, RequestHeader->ResponseSizeClass);
 
-    FspFree(RequestHeader);
+    FspIopFreeBlock(RequestHeader, RequestHeader->RequestSizeClass);
 }
 
 VOID FspIopResetRequest(FSP_FSCTL_TRANSACT_REQ *Request, FSP_IOP_REQUEST_FINI *RequestFini)
@@ -274,8 +407,9 @@ BOOLEAN FspIopRetryCompleteIrp(PIRP Irp, const FSP_FSCTL_TRANSACT_RSP *Response,
     if (0 != Response && RequestHeader->Response != Response)
     {
         if (0 != RequestHeader->Response)
-            FspFree(RequestHeader->Response);
-        RequestHeader->Response = FspAllocMustSucceed(Response->Size);
+            FspIopFreeBlock(RequestHeader->Response, RequestHeader->ResponseSizeClass);
+        RequestHeader->Response = FspIopAllocateBlock(Response->Size, TRUE,
+            &RequestHeader->ResponseSizeClass);
         RtlCopyMemory(RequestHeader->Response, Response, Response->Size);
         Response = RequestHeader->Response;
     }
@@ -118,6 +118,24 @@
  * To deal with the second problem we simply call FspIoqPendingResetSynch after
  * a WaitForSingleObject call if the IRP dequeueing fails; this ensures that the
  * event is in the correst state.
+ *
+ *
+ * Pending Queue Sharding
+ *
+ * With many dispatcher threads a single pending queue lock and event serialize
+ * all IRP traffic for a volume. For this reason the pending queue is split into
+ * shards (FSP_IOQ_SHARD), each with its own lock, list, CSQ and auto-reset event.
+ * IRP's are posted to the shard of the current processor. A thread looking for
+ * IRP's waits on all shard events (its own shard's event first) and when its own
+ * shard is empty it steals from the other shards.
+ *
+ * FspVolumeTransact must not dequeue an IRP that it reposted itself during the
+ * same transaction, else it may loop. With a single FIFO queue it was enough to
+ * stop at the first reposted IRP. With shards a reposted IRP may land in any
+ * shard, so every posted IRP receives a sequence number (FspIrpPendingSequence)
+ * and FspIoqNextPendingIrp takes a boundary sequence instead: IRP's posted after
+ * the boundary are not dequeued. The Processing and Retried queues are not
+ * sharded and remain protected by the FSP_IOQ lock.
  */
 
 /*
@@ -176,58 +194,93 @@ static PIRP FspCsqRemoveNextIrp(PIO_CSQ Csq, PVOID PeekContext)
 #define FspCsqRemoveNextIrp(Q, C)       IoCsqRemoveNextIrp(Q, C)
 #endif
 
+/*
+ * Processing Dictionary
+ *
+ * IRP's in the Processing queue are also kept in a hash dictionary keyed by the IRP
+ * pointer, so that FspIoqEndProcessingIrp can find them quickly. The dictionary starts
+ * with the buckets that fit in the FSP_IOQ page and grows (or shrinks) when the number of
+ * IRP's being processed changes substantially.
+ *
+ * Resizing must not stall the spinlock holder. A new bucket array is therefore allocated
+ * outside the lock (FspIoqProcessResize) and installed with the old array kept around.
+ * Existing IRP's are then migrated a few buckets at a time by every subsequent insert and
+ * remove (FspIoqProcessMigrate); until migration finishes lookups consult both arrays.
+ * The old array is freed outside the lock on the next resize check.
+ */
+#define FSP_IOQ_PROCESS_LOAD_FACTOR     2
+#define FSP_IOQ_PROCESS_MIGRATE_COUNT   8
+#define FSP_IOQ_PROCESS_BUCKET_COUNT_MAX\
+    (FspFsctlIrpCapacityMaximum / FSP_IOQ_PROCESS_LOAD_FACTOR)
+
 #define InterruptTimeToSecFactor        10000000ULL
 #define ConvertInterruptTimeToSec(Time) ((ULONG)((Time) / InterruptTimeToSecFactor))
 #define QueryInterruptTimeInSec()       ConvertInterruptTimeToSec(KeQueryInterruptTime())
 
+#define FSP_IOQ_SHARD_COUNT_MAX         16
+
 typedef struct
 {
     PVOID IrpHint;
     ULONG ExpirationTime;
+    PULONG PBoundarySequence;
 } FSP_IOQ_PEEK_CONTEXT;
 
-static inline VOID FspIoqPendingResetSynch(FSP_IOQ *Ioq)
+static inline FSP_IOQ_SHARD *FspIoqCurrentShard(FSP_IOQ *Ioq)
+{
+    return &Ioq->Shards[KeGetCurrentProcessorNumberEx(0) % Ioq->ShardCount];
+}
+
+static inline VOID FspIoqPendingResetSynch(FSP_IOQ_SHARD *Shard)
 {
     /*
      * Examine the actual condition of the pending queue and
      * set the PendingIrpEvent accordingly.
      */
-    if (0 != Ioq->PendingIrpCount || Ioq->Stopped)
+    if (0 != Shard->PendingIrpCount || Shard->Ioq->Stopped)
         /* list is not empty or is stopped; wake up a waiter */
-        KeSetEvent(&Ioq->PendingIrpEvent, 1, FALSE);
+        KeSetEvent(&Shard->PendingIrpEvent, 1, FALSE);
     else
         /* list is empty and not stopped; future threads should go to sleep */
-        KeClearEvent(&Ioq->PendingIrpEvent);
+        KeClearEvent(&Shard->PendingIrpEvent);
 }
 
 static NTSTATUS FspIoqPendingInsertIrpEx(PIO_CSQ IoCsq, PIRP Irp, PVOID InsertContext)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
+    FSP_IOQ_SHARD *Shard = CONTAINING_RECORD(IoCsq, FSP_IOQ_SHARD, PendingIoCsq);
+    FSP_IOQ *Ioq = Shard->Ioq;
     if (Ioq->Stopped)
         return STATUS_CANCELLED;
-    if (!InsertContext && Ioq->PendingIrpCapacity <= Ioq->PendingIrpCount)
+    if ((ULONG)InterlockedIncrement(&Ioq->PendingIrpCount) > Ioq->PendingIrpCapacity &&
+        !InsertContext)
+    {
+        InterlockedDecrement(&Ioq->PendingIrpCount);
         return STATUS_INSUFFICIENT_RESOURCES;
-    Ioq->PendingIrpCount++;
-    InsertTailList(&Ioq->PendingIrpList, &Irp->Tail.Overlay.ListEntry);
-    KeSetEvent(&Ioq->PendingIrpEvent, 1, FALSE);
-        /* equivalent to FspIoqPendingResetSynch(Ioq) */
+    }
+    Shard->PendingIrpCount++;
+    FspIrpPendingSequence(Irp) = (ULONG)InterlockedIncrement(&Ioq->PendingSequence);
+    InsertTailList(&Shard->PendingIrpList, &Irp->Tail.Overlay.ListEntry);
+    KeSetEvent(&Shard->PendingIrpEvent, 1, FALSE);
+        /* equivalent to FspIoqPendingResetSynch(Shard) */
     return STATUS_SUCCESS;
 }
 
 static VOID FspIoqPendingRemoveIrp(PIO_CSQ IoCsq, PIRP Irp)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    Ioq->PendingIrpCount--;
+    FSP_IOQ_SHARD *Shard = CONTAINING_RECORD(IoCsq, FSP_IOQ_SHARD, PendingIoCsq);
+    Shard->PendingIrpCount--;
+    InterlockedDecrement(&Shard->Ioq->PendingIrpCount);
+    FspIrpDictNext(Irp) = 0;
     RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
-    FspIoqPendingResetSynch(Ioq);
+    FspIoqPendingResetSynch(Shard);
 }
 
 static PIRP FspIoqPendingPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    if (PeekContext && Ioq->Stopped)
+    FSP_IOQ_SHARD *Shard = CONTAINING_RECORD(IoCsq, FSP_IOQ_SHARD, PendingIoCsq);
+    if (PeekContext && Shard->Ioq->Stopped)
         return 0;
-    PLIST_ENTRY Head = &Ioq->PendingIrpList;
+    PLIST_ENTRY Head = &Shard->PendingIrpList;
     PLIST_ENTRY Entry = 0 == Irp ? Head->Flink : Irp->Tail.Overlay.ListEntry.Flink;
     if (Head == Entry)
         return 0;
@@ -250,7 +303,10 @@ static PIRP FspIoqPendingPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
     }
     else
     {
-        if (Irp == IrpHint)
+        /* IRP's are queued in sequence order; do not go beyond the boundary */
+        PULONG PBoundarySequence = ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->PBoundarySequence;
+        if (0 != PBoundarySequence &&
+            0 < (LONG)(FspIrpPendingSequence(Irp) - *PBoundarySequence))
             return 0;
         return Irp;
     }
@@ -259,21 +315,104 @@ static PIRP FspIoqPendingPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
 _IRQL_raises_(DISPATCH_LEVEL)
 static VOID FspIoqPendingAcquireLock(PIO_CSQ IoCsq, _At_(*PIrql, _IRQL_saves_) PKIRQL PIrql)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    KeAcquireSpinLock(&Ioq->SpinLock, PIrql);
+    FSP_IOQ_SHARD *Shard = CONTAINING_RECORD(IoCsq, FSP_IOQ_SHARD, PendingIoCsq);
+    KeAcquireSpinLock(&Shard->SpinLock, PIrql);
 }
 
 _IRQL_requires_(DISPATCH_LEVEL)
 static VOID FspIoqPendingReleaseLock(PIO_CSQ IoCsq, _IRQL_restores_ KIRQL Irql)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
+    FSP_IOQ_SHARD *Shard = CONTAINING_RECORD(IoCsq, FSP_IOQ_SHARD, PendingIoCsq);
+    KeReleaseSpinLock(&Shard->SpinLock, Irql);
 }
 
 static VOID FspIoqPendingCompleteCanceledIrp(PIO_CSQ IoCsq, PIRP Irp)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    Ioq->CompleteCanceledIrp(Irp);
+    FSP_IOQ_SHARD *Shard = CONTAINING_RECORD(IoCsq, FSP_IOQ_SHARD, PendingIoCsq);
+    Shard->Ioq->CompleteCanceledIrp(Irp);
+}
+
+static inline ULONG FspIoqProcessDesiredBucketCount(FSP_IOQ *Ioq)
+{
+    /* may be called without the lock as a hint; the answer is rechecked under the lock */
+    ULONG BucketCount = Ioq->ProcessIrpBucketCount;
+    if (0 != Ioq->ProcessIrpOldBuckets || Ioq->Stopped)
+        return 0;
+    if (Ioq->ProcessIrpCount > BucketCount * FSP_IOQ_PROCESS_LOAD_FACTOR &&
+        BucketCount < FSP_IOQ_PROCESS_BUCKET_COUNT_MAX)
+        return BucketCount * 2;
+    if (Ioq->ProcessIrpCount < BucketCount / 8 &&
+        BucketCount / 2 >= Ioq->ProcessIrpBucketCountMin)
+        return BucketCount / 2;
+    return 0;
+}
+
+static VOID FspIoqProcessMigrate(FSP_IOQ *Ioq, ULONG Count)
+{
+    /* must be called under the lock */
+    while (0 != Ioq->ProcessIrpOldBuckets && 0 < Count--)
+    {
+        PIRP Irp = Ioq->ProcessIrpOldBuckets[Ioq->ProcessIrpOldBucketIndex], NextIrp;
+        Ioq->ProcessIrpOldBuckets[Ioq->ProcessIrpOldBucketIndex] = 0;
+        for (; Irp; Irp = NextIrp)
+        {
+            ULONG Index = FspHashMixPointer(Irp) % Ioq->ProcessIrpBucketCount;
+            NextIrp = FspIrpDictNext(Irp);
+            FspIrpDictNext(Irp) = Ioq->ProcessIrpBuckets[Index];
+            Ioq->ProcessIrpBuckets[Index] = Irp;
+        }
+        if (Ioq->ProcessIrpOldBucketCount == ++Ioq->ProcessIrpOldBucketIndex)
+        {
+            ASSERT(0 == Ioq->ProcessIrpRetiredBuckets);
+            if (Ioq->ProcessIrpBucketsBuf != Ioq->ProcessIrpOldBuckets)
+                Ioq->ProcessIrpRetiredBuckets = Ioq->ProcessIrpOldBuckets;
+            Ioq->ProcessIrpOldBuckets = 0;
+            Ioq->ProcessIrpOldBucketCount = 0;
+            Ioq->ProcessIrpOldBucketIndex = 0;
+        }
+    }
+}
+
+static VOID FspIoqProcessResize(FSP_IOQ *Ioq)
+{
+    PVOID *Buckets, *RetiredBuckets;
+    ULONG BucketCount;
+    KIRQL Irql;
+
+    if (0 == Ioq->ProcessIrpRetiredBuckets && 0 == FspIoqProcessDesiredBucketCount(Ioq))
+        return;
+
+    KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
+    RetiredBuckets = Ioq->ProcessIrpRetiredBuckets;
+    Ioq->ProcessIrpRetiredBuckets = 0;
+    BucketCount = FspIoqProcessDesiredBucketCount(Ioq);
+    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
+
+    if (0 != RetiredBuckets)
+        FspFree(RetiredBuckets);
+
+    if (0 == BucketCount)
+        return;
+
+    Buckets = FspAllocNonPaged(BucketCount * sizeof Buckets[0]);
+    if (0 == Buckets)
+        return; /* not fatal; we will try again later */
+    RtlZeroMemory(Buckets, BucketCount * sizeof Buckets[0]);
+
+    KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
+    if (BucketCount == FspIoqProcessDesiredBucketCount(Ioq))
+    {
+        Ioq->ProcessIrpOldBuckets = Ioq->ProcessIrpBuckets;
+        Ioq->ProcessIrpOldBucketCount = Ioq->ProcessIrpBucketCount;
+        Ioq->ProcessIrpOldBucketIndex = 0;
+        Ioq->ProcessIrpBuckets = Buckets;
+        Ioq->ProcessIrpBucketCount = BucketCount;
+        Buckets = 0;
+    }
+    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
+
+    if (0 != Buckets)
+        FspFree(Buckets);
 }
 
 static NTSTATUS FspIoqProcessInsertIrpEx(PIO_CSQ IoCsq, PIRP Irp, PVOID InsertContext)
@@ -281,12 +420,17 @@ static NTSTATUS FspIoqProcessInsertIrpEx(PIO_CSQ IoCsq, PIRP Irp, PVOID InsertCo
     FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, ProcessIoCsq);
     if (Ioq->Stopped)
         return STATUS_CANCELLED;
+    FspIoqProcessMigrate(Ioq, FSP_IOQ_PROCESS_MIGRATE_COUNT);
     Ioq->ProcessIrpCount++;
     InsertTailList(&Ioq->ProcessIrpList, &Irp->Tail.Overlay.ListEntry);
     ULONG Index = FspHashMixPointer(Irp) % Ioq->ProcessIrpBucketCount;
 #if DBG
     for (PIRP IrpX = Ioq->ProcessIrpBuckets[Index]; IrpX; IrpX = FspIrpDictNext(IrpX))
         ASSERT(IrpX != Irp);
+    if (0 != Ioq->ProcessIrpOldBuckets)
+        for (PIRP IrpX = Ioq->ProcessIrpOldBuckets[
+            FspHashMixPointer(Irp) % Ioq->ProcessIrpOldBucketCount]; IrpX; IrpX = FspIrpDictNext(IrpX))
+            ASSERT(IrpX != Irp);
 #endif
     ASSERT(0 == FspIrpDictNext(Irp));
     FspIrpDictNext(Irp) = Ioq->ProcessIrpBuckets[Index];
@@ -294,22 +438,32 @@ static NTSTATUS FspIoqProcessInsertIrpEx(PIO_CSQ IoCsq, PIRP Irp, PVOID InsertCo
     return STATUS_SUCCESS;
 }
 
-static VOID FspIoqProcessRemoveIrp(PIO_CSQ IoCsq, PIRP Irp)
+static BOOLEAN FspIoqProcessRemoveIrpFromBucket(PVOID *Buckets, ULONG BucketCount, PIRP Irp)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, ProcessIoCsq);
-    ULONG Index = FspHashMixPointer(Irp) % Ioq->ProcessIrpBucketCount;
-    for (PIRP *PIrp = (PIRP *)&Ioq->ProcessIrpBuckets[Index];; PIrp = &FspIrpDictNext(*PIrp))
-    {
-        ASSERT(0 != *PIrp);
+    ULONG Index = FspHashMixPointer(Irp) % BucketCount;
+    for (PIRP *PIrp = (PIRP *)&Buckets[Index]; *PIrp; PIrp = &FspIrpDictNext(*PIrp))
         if (*PIrp == Irp)
         {
             *PIrp = FspIrpDictNext(Irp);
             FspIrpDictNext(Irp) = 0;
-            break;
+            return TRUE;
         }
-    }
+    return FALSE;
+}
+
+static VOID FspIoqProcessRemoveIrp(PIO_CSQ IoCsq, PIRP Irp)
+{
+    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, ProcessIoCsq);
+    BOOLEAN Removed;
+    Removed = FspIoqProcessRemoveIrpFromBucket(
+        Ioq->ProcessIrpBuckets, Ioq->ProcessIrpBucketCount, Irp);
+    if (!Removed && 0 != Ioq->ProcessIrpOldBuckets)
+        Removed = FspIoqProcessRemoveIrpFromBucket(
+            Ioq->ProcessIrpOldBuckets, Ioq->ProcessIrpOldBucketCount, Irp);
+    ASSERT(Removed);
     Ioq->ProcessIrpCount--;
     RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
+    FspIoqProcessMigrate(Ioq, FSP_IOQ_PROCESS_MIGRATE_COUNT);
 }
 
 static PIRP FspIoqProcessPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
@@ -344,6 +498,13 @@ static PIRP FspIoqProcessPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
         for (Irp = Ioq->ProcessIrpBuckets[Index]; Irp; Irp = FspIrpDictNext(Irp))
             if (Irp == IrpHint)
                 return Irp;
+        if (0 != Ioq->ProcessIrpOldBuckets)
+        {
+            Index = FspHashMixPointer(IrpHint) % Ioq->ProcessIrpOldBucketCount;
+            for (Irp = Ioq->ProcessIrpOldBuckets[Index]; Irp; Irp = FspIrpDictNext(Irp))
+                if (Irp == IrpHint)
+                    return Irp;
+        }
         return 0;
     }
 }
@@ -448,24 +609,44 @@ NTSTATUS FspIoqCreate(
     *PIoq = 0;
 
     FSP_IOQ *Ioq;
-    ULONG BucketCount = (PAGE_SIZE - sizeof *Ioq) / sizeof Ioq->ProcessIrpBuckets[0];
+    ULONG BucketCount = (PAGE_SIZE - sizeof *Ioq) / sizeof Ioq->ProcessIrpBucketsBuf[0];
+    ULONG ShardCount = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    if (0 == ShardCount)
+        ShardCount = 1;
+    else if (FSP_IOQ_SHARD_COUNT_MAX < ShardCount)
+        ShardCount = FSP_IOQ_SHARD_COUNT_MAX;
     Ioq = FspAllocNonPaged(PAGE_SIZE);
     if (0 == Ioq)
         return STATUS_INSUFFICIENT_RESOURCES;
     RtlZeroMemory(Ioq, PAGE_SIZE);
+    /* pool allocations are only 16-byte aligned; shards must not share cache lines */
+    Ioq->Shards = FspAllocNonPagedCacheAligned(ShardCount * sizeof Ioq->Shards[0]);
+    if (0 == Ioq->Shards)
+    {
+        FspFree(Ioq);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(Ioq->Shards, ShardCount * sizeof Ioq->Shards[0]);
+    Ioq->ShardCount = ShardCount;
 
     KeInitializeSpinLock(&Ioq->SpinLock);
-    KeInitializeEvent(&Ioq->PendingIrpEvent, SynchronizationEvent, FALSE);
-    InitializeListHead(&Ioq->PendingIrpList);
+    for (ULONG Index = 0; ShardCount > Index; Index++)
+    {
+        FSP_IOQ_SHARD *Shard = &Ioq->Shards[Index];
+        KeInitializeSpinLock(&Shard->SpinLock);
+        KeInitializeEvent(&Shard->PendingIrpEvent, SynchronizationEvent, FALSE);
+        InitializeListHead(&Shard->PendingIrpList);
+        IoCsqInitializeEx(&Shard->PendingIoCsq,
+            FspIoqPendingInsertIrpEx,
+            FspIoqPendingRemoveIrp,
+            FspIoqPendingPeekNextIrp,
+            FspIoqPendingAcquireLock,
+            FspIoqPendingReleaseLock,
+            FspIoqPendingCompleteCanceledIrp);
+        Shard->Ioq = Ioq;
+    }
     InitializeListHead(&Ioq->ProcessIrpList);
     InitializeListHead(&Ioq->RetriedIrpList);
-    IoCsqInitializeEx(&Ioq->PendingIoCsq,
-        FspIoqPendingInsertIrpEx,
-        FspIoqPendingRemoveIrp,
-        FspIoqPendingPeekNextIrp,
-        FspIoqPendingAcquireLock,
-        FspIoqPendingReleaseLock,
-        FspIoqPendingCompleteCanceledIrp);
     IoCsqInitializeEx(&Ioq->ProcessIoCsq,
         FspIoqProcessInsertIrpEx,
         FspIoqProcessRemoveIrp,
@@ -484,7 +665,8 @@ NTSTATUS FspIoqCreate(
         /* convert to seconds (and round up) */
     Ioq->PendingIrpCapacity = IrpCapacity;
     Ioq->CompleteCanceledIrp = CompleteCanceledIrp;
-    Ioq->ProcessIrpBucketCount = BucketCount;
+    Ioq->ProcessIrpBucketCount = Ioq->ProcessIrpBucketCountMin = BucketCount;
+    Ioq->ProcessIrpBuckets = Ioq->ProcessIrpBucketsBuf;
 
     *PIoq = Ioq;
 
@@ -494,6 +676,13 @@ NTSTATUS FspIoqCreate(
 VOID FspIoqDelete(FSP_IOQ *Ioq)
 {
     FspIoqStop(Ioq);
+    if (0 != Ioq->ProcessIrpRetiredBuckets)
+        FspFree(Ioq->ProcessIrpRetiredBuckets);
+    if (0 != Ioq->ProcessIrpOldBuckets && Ioq->ProcessIrpBucketsBuf != Ioq->ProcessIrpOldBuckets)
+        FspFree(Ioq->ProcessIrpOldBuckets);
+    if (Ioq->ProcessIrpBucketsBuf != Ioq->ProcessIrpBuckets)
+        FspFree(Ioq->ProcessIrpBuckets);
+    FspFree(Ioq->Shards);
     FspFree(Ioq);
 }
 
@@ -502,13 +691,20 @@ VOID FspIoqStop(FSP_IOQ *Ioq)
     KIRQL Irql;
     KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
     Ioq->Stopped = TRUE;
-    /* we are being stopped, permanently wake up waiters */
-    KeSetEvent(&Ioq->PendingIrpEvent, 1, FALSE);
-        /* equivalent to FspIoqPendingResetSynch(Ioq) */
     KeReleaseSpinLock(&Ioq->SpinLock, Irql);
+    for (ULONG Index = 0; Ioq->ShardCount > Index; Index++)
+    {
+        FSP_IOQ_SHARD *Shard = &Ioq->Shards[Index];
+        KeAcquireSpinLock(&Shard->SpinLock, &Irql);
+        /* we are being stopped, permanently wake up waiters */
+        KeSetEvent(&Shard->PendingIrpEvent, 1, FALSE);
+            /* equivalent to FspIoqPendingResetSynch(Shard) */
+        KeReleaseSpinLock(&Shard->SpinLock, Irql);
+    }
     PIRP Irp;
-    while (0 != (Irp = IoCsqRemoveNextIrp(&Ioq->PendingIoCsq, 0)))
-        Ioq->CompleteCanceledIrp(Irp);
+    for (ULONG Index = 0; Ioq->ShardCount > Index; Index++)
+        while (0 != (Irp = IoCsqRemoveNextIrp(&Ioq->Shards[Index].PendingIoCsq, 0)))
+            Ioq->CompleteCanceledIrp(Irp);
     while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->ProcessIoCsq, 0)))
         Ioq->CompleteCanceledIrp(Irp);
     while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->RetriedIoCsq, 0)))
@@ -530,9 +726,11 @@ VOID FspIoqRemoveExpired(FSP_IOQ *Ioq, UINT64 InterruptTime)
     FSP_IOQ_PEEK_CONTEXT PeekContext;
     PeekContext.IrpHint = 0;
     PeekContext.ExpirationTime = ConvertInterruptTimeToSec(InterruptTime);
+    PeekContext.PBoundarySequence = 0;
     PIRP Irp;
-    while (0 != (Irp = IoCsqRemoveNextIrp(&Ioq->PendingIoCsq, &PeekContext)))
-        Ioq->CompleteCanceledIrp(Irp);
+    for (ULONG Index = 0; Ioq->ShardCount > Index; Index++)
+        while (0 != (Irp = IoCsqRemoveNextIrp(&Ioq->Shards[Index].PendingIoCsq, &PeekContext)))
+            Ioq->CompleteCanceledIrp(Irp);
 #if !defined(FSP_IOQ_PROCESS_NO_CANCEL)
     while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->ProcessIoCsq, &PeekContext)))
         Ioq->CompleteCanceledIrp(Irp);
@@ -546,7 +744,7 @@ BOOLEAN FspIoqPostIrpEx(FSP_IOQ *Ioq, PIRP Irp, BOOLEAN BestEffort, NTSTATUS *PR
     NTSTATUS Result;
     FspIrpTimestamp(Irp) = BestEffort ? FspIrpTimestampInfinity :
         QueryInterruptTimeInSec() + Ioq->IrpTimeout;
-    Result = IoCsqInsertIrpEx(&Ioq->PendingIoCsq, Irp, 0, (PVOID)BestEffort);
+    Result = IoCsqInsertIrpEx(&FspIoqCurrentShard(Ioq)->PendingIoCsq, Irp, 0, (PVOID)BestEffort);
     if (NT_SUCCESS(Result))
     {
         if (0 != PResult)
@@ -561,52 +759,77 @@ BOOLEAN FspIoqPostIrpEx(FSP_IOQ *Ioq, PIRP Irp, BOOLEAN BestEffort, NTSTATUS *PR
     }
 }
 
-PIRP FspIoqNextPendingIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp, PLARGE_INTEGER Timeout,
+ULONG FspIoqPendingSequence(FSP_IOQ *Ioq)
+{
+    return (ULONG)InterlockedCompareExchange(&Ioq->PendingSequence, 0, 0);
+}
+
+static PIRP FspIoqStealPendingIrp(FSP_IOQ *Ioq, ULONG HomeIndex, FSP_IOQ_PEEK_CONTEXT *PeekContext)
+{
+    PIRP PendingIrp;
+    for (ULONG Index = 0; Ioq->ShardCount > Index; Index++)
+    {
+        FSP_IOQ_SHARD *Shard = &Ioq->Shards[(HomeIndex + Index) % Ioq->ShardCount];
+        if (0 == Shard->PendingIrpCount)
+            continue; /* unsynchronized check; an IRP that arrives now is found next time */
+        PendingIrp = IoCsqRemoveNextIrp(&Shard->PendingIoCsq, PeekContext);
+        if (0 != PendingIrp)
+            return PendingIrp;
+    }
+    return 0;
+}
+
+PIRP FspIoqNextPendingIrp(FSP_IOQ *Ioq, PULONG PBoundarySequence, PLARGE_INTEGER Timeout,
     PIRP CancellableIrp)
 {
     /* timeout of 0 normally means infinite wait; for us it means do not do any wait at all! */
     FSP_IOQ_PEEK_CONTEXT PeekContext;
+    ULONG HomeIndex = KeGetCurrentProcessorNumberEx(0) % Ioq->ShardCount;
     PIRP PendingIrp;
-    PeekContext.IrpHint = 0 != BoundaryIrp ? BoundaryIrp : (PVOID)1;
+    PeekContext.IrpHint = (PVOID)1;
     PeekContext.ExpirationTime = 0;
+    PeekContext.PBoundarySequence = PBoundarySequence;
     if (0 != Timeout)
     {
+        PVOID Objects[FSP_IOQ_SHARD_COUNT_MAX];
+        KWAIT_BLOCK WaitBlocks[FSP_IOQ_SHARD_COUNT_MAX];
+        FSP_IOQ_SHARD *Shard;
         NTSTATUS Result;
-        Result = FsRtlCancellableWaitForSingleObject(&Ioq->PendingIrpEvent, Timeout,
-            CancellableIrp);
+        /* list our home shard first, so that it is preferred when several events are signaled */
+        for (ULONG Index = 0; Ioq->ShardCount > Index; Index++)
+            Objects[Index] = &Ioq->Shards[(HomeIndex + Index) % Ioq->ShardCount].PendingIrpEvent;
+        Result = FsRtlCancellableWaitForMultipleObjects(Ioq->ShardCount, Objects, WaitAny,
+            Timeout, WaitBlocks, CancellableIrp);
         if (STATUS_TIMEOUT == Result)
             return FspIoqTimeout;
         if (STATUS_CANCELLED == Result || STATUS_THREAD_IS_TERMINATING == Result)
             return FspIoqCancelled;
-        ASSERT(STATUS_SUCCESS == Result);
-        PendingIrp = IoCsqRemoveNextIrp(&Ioq->PendingIoCsq, &PeekContext);
+        ASSERT(STATUS_WAIT_0 <= Result && Result < STATUS_WAIT_0 + Ioq->ShardCount);
+        Shard = &Ioq->Shards[(HomeIndex + Result - STATUS_WAIT_0) % Ioq->ShardCount];
+        PendingIrp = IoCsqRemoveNextIrp(&Shard->PendingIoCsq, &PeekContext);
         if (0 == PendingIrp)
         {
             /*
-             * The WaitForSingleObject call above has reset our PendingIrpEvent,
+             * The WaitForMultipleObjects call above has reset the shard's PendingIrpEvent,
              * but we did not receive an IRP. For this reason we have to reset
-             * our synchronization based on the actual condition of the pending
-             * queue.
+             * our synchronization based on the actual condition of the shard's
+             * pending queue.
              */
             KIRQL Irql;
-            KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
-            FspIoqPendingResetSynch(Ioq);
-            KeReleaseSpinLock(&Ioq->SpinLock, Irql);
+            KeAcquireSpinLock(&Shard->SpinLock, &Irql);
+            FspIoqPendingResetSynch(Shard);
+            KeReleaseSpinLock(&Shard->SpinLock, Irql);
+            PendingIrp = FspIoqStealPendingIrp(Ioq, HomeIndex, &PeekContext);
         }
     }
     else
-        PendingIrp = IoCsqRemoveNextIrp(&Ioq->PendingIoCsq, &PeekContext);
+        PendingIrp = FspIoqStealPendingIrp(Ioq, HomeIndex, &PeekContext);
     return PendingIrp;
 }
 
 ULONG FspIoqPendingIrpCount(FSP_IOQ *Ioq)
 {
-    ULONG Result;
-    KIRQL Irql;
-    KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
-    Result = Ioq->PendingIrpCount;
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
-    return Result;
+    return (ULONG)InterlockedCompareExchange(&Ioq->PendingIrpCount, 0, 0);
 }
 
 BOOLEAN FspIoqStartProcessingIrp(FSP_IOQ *Ioq, PIRP Irp)
@@ -618,6 +841,7 @@ BOOLEAN FspIoqStartProcessingIrp(FSP_IOQ *Ioq, PIRP Irp)
     if (FspIrpTimestampInfinity != FspIrpTimestamp(Irp))
         FspIrpTimestamp(Irp) = QueryInterruptTimeInSec() + Ioq->IrpTimeout;
 #endif
+    FspIoqProcessResize(Ioq);
     Result = FspCsqInsertIrpEx(&Ioq->ProcessIoCsq, Irp, 0, 0);
     return NT_SUCCESS(Result);
 }
@@ -627,9 +851,13 @@ PIRP FspIoqEndProcessingIrp(FSP_IOQ *Ioq, UINT_PTR IrpHint)
     if (0 == IrpHint)
         return 0;
     FSP_IOQ_PEEK_CONTEXT PeekContext;
+    PIRP Irp;
     PeekContext.IrpHint = (PVOID)IrpHint;
     PeekContext.ExpirationTime = 0;
-    return FspCsqRemoveNextIrp(&Ioq->ProcessIoCsq, &PeekContext);
+    PeekContext.PBoundarySequence = 0;
+    Irp = FspCsqRemoveNextIrp(&Ioq->ProcessIoCsq, &PeekContext);
+    FspIoqProcessResize(Ioq);
+    return Irp;
 }
 
 ULONG FspIoqProcessIrpCount(FSP_IOQ *Ioq)
@@ -671,6 +899,7 @@ PIRP FspIoqNextCompleteIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp)
     FSP_IOQ_PEEK_CONTEXT PeekContext;
     PeekContext.IrpHint = 0 != BoundaryIrp ? BoundaryIrp : (PVOID)1;
     PeekContext.ExpirationTime = 0;
+    PeekContext.PBoundarySequence = 0;
     return FspCsqRemoveNextIrp(&Ioq->RetriedIoCsq, &PeekContext);
 }
 
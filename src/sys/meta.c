@@ -17,19 +17,66 @@
 
 #include <sys/driver.h>
 
+/*
+ * Meta Cache
+ *
+ * The cache is split into stripes; an item lives in stripe (ItemIndex % StripeCount).
+ * Each stripe has its own lock, hash buckets, lists and share of the byte budget,
+ * so that lookups and updates from different processors rarely contend.
+ *
+ * Items are kept in two lists per stripe. ItemList is in insertion order and is used
+ * for expiration: all items have the same timeout, so the oldest item expires first.
+ * LruList is used for eviction with the CLOCK (second chance) algorithm: a hit only
+ * sets the item's Referenced flag, which allows lookups to proceed under a shared
+ * lock. When adding an item would exceed the stripe's budget, items at the head of
+ * LruList that have been referenced get their flag cleared and move to the tail;
+ * the first unreferenced item is evicted.
+ *
+ * Items added with FspMetaCacheAddItemShared are content addressed: they are also
+ * kept in a dictionary keyed by a hash of their contents, and adding identical contents
+ * returns the existing item. The stripe of such an item is derived from its content
+ * hash, so that identical contents always meet in the same stripe. Every add (shared
+ * or not) counts as a holder of the item and every FspMetaCacheInvalidateItem releases
+ * one; the item is removed from the cache when its last holder releases it. This
+ * allows many file nodes to share, say, a single copy of an inherited security
+ * descriptor. FspMetaCacheLookupItemShared and FspMetaCacheInvalidateItemShared look up
+ * and remove such items by their contents; this allows the contents to act as a key
+ * (e.g. in the negative name cache).
+ *
+ * Items added with FspMetaCacheAddItemKeyed are also content addressed, but only by a
+ * prefix (the key) of their contents; the rest of the item is a value. Adding an item
+ * replaces any prior item with the same key and FspMetaCacheReferenceItemBufferByKey
+ * returns the item for a key. FspMetaCacheInvalidateItemShared accepts such a key.
+ *
+ * An item that is not shared may be extended with FspMetaCacheAppendItemChunk. The item
+ * then consists of a chain of chunks (each up to ItemSizeMax); FspMetaCacheReferenceItemBuffer
+ * returns the first chunk and FspMetaCacheNextItemBuffer walks the rest. Chunks are only
+ * ever appended and are freed together with the item, so a reader that holds a reference
+ * to the item can walk the chain without locks. The caller names the index of the chunk
+ * it appends, so that of two racing appenders only one extends the item.
+ */
+
 typedef struct _FSP_META_CACHE_ITEM
 {
     LIST_ENTRY ListEntry;
+    LIST_ENTRY LruEntry;
     struct _FSP_META_CACHE_ITEM *DictNext;
+    struct _FSP_META_CACHE_ITEM *ContentNext;
     PVOID ItemBuffer;
     UINT64 ItemIndex;
     UINT64 ExpirationTime;
+    UINT64 ContentHash;
+    ULONG ItemSize;
+    ULONG HolderCount;
     LONG RefCount;
+    ULONG KeySize;
+    BOOLEAN Referenced;
 } FSP_META_CACHE_ITEM;
 
-typedef struct
+typedef struct _FSP_META_CACHE_ITEM_BUFFER
 {
     PVOID Item;
+    struct _FSP_META_CACHE_ITEM_BUFFER *volatile NextChunk;
     ULONG Size;
     __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) UINT8 Buffer[];
 } FSP_META_CACHE_ITEM_BUFFER;
@@ -40,17 +87,58 @@ static inline VOID FspMetaCacheDereferenceItem(FSP_META_CACHE_ITEM *Item)
     if (0 == RefCount)
     {
         /* if we ever need to add a finalizer for meta items it should go here */
-        FspFree(Item->ItemBuffer);
+        for (FSP_META_CACHE_ITEM_BUFFER *ItemBuffer = Item->ItemBuffer, *NextChunk;
+            0 != ItemBuffer; ItemBuffer = NextChunk)
+        {
+            NextChunk = ItemBuffer->NextChunk;
+            FspFree(ItemBuffer);
+        }
         FspFree(Item);
     }
 }
 
-static inline FSP_META_CACHE_ITEM *FspMetaCacheLookupIndexedItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+static inline UINT64 FspMetaCacheContentHash(PCVOID Buffer, ULONG Size)
+{
+    /* 64-bit FNV-1a */
+    UINT64 Hash = 0xcbf29ce484222325ULL;
+    for (PUINT8 P = (PVOID)Buffer, EndP = P + Size; EndP > P; P++)
+        Hash = (Hash ^ *P) * 0x100000001b3ULL;
+    return Hash;
+}
+
+static inline FSP_META_CACHE_STRIPE *FspMetaCacheStripe(FSP_META_CACHE *MetaCache,
+    UINT64 ItemIndex)
+{
+    return MetaCache->Stripes[ItemIndex % MetaCache->StripeCount];
+}
+
+static inline ULONG FspMetaCacheHashIndex(FSP_META_CACHE *MetaCache, FSP_META_CACHE_STRIPE *Stripe,
     UINT64 ItemIndex)
+{
+    return (ULONG)(ItemIndex / MetaCache->StripeCount % Stripe->ItemBucketCount);
+}
+
+static inline FSP_META_CACHE_ITEM *FspMetaCacheLookupContentItemAtDpcLevel(
+    FSP_META_CACHE_STRIPE *Stripe, UINT64 ContentHash, PCVOID Key, ULONG KeySize)
+{
+    ULONG HashIndex = (ULONG)(ContentHash % Stripe->ItemBucketCount);
+    for (FSP_META_CACHE_ITEM *ItemX = Stripe->ContentBuckets[HashIndex]; ItemX; ItemX = ItemX->ContentNext)
+    {
+        FSP_META_CACHE_ITEM_BUFFER *ItemBuffer = ItemX->ItemBuffer;
+        /* different contents may hash the same; always compare the actual bytes */
+        if (ItemX->ContentHash == ContentHash && ItemX->KeySize == KeySize &&
+            RtlEqualMemory(ItemBuffer->Buffer, Key, KeySize))
+            return ItemX;
+    }
+    return 0;
+}
+
+static inline FSP_META_CACHE_ITEM *FspMetaCacheLookupIndexedItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_STRIPE *Stripe, UINT64 ItemIndex)
 {
     FSP_META_CACHE_ITEM *Item = 0;
-    ULONG HashIndex = ItemIndex % MetaCache->ItemBucketCount;
-    for (FSP_META_CACHE_ITEM *ItemX = MetaCache->ItemBuckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
+    ULONG HashIndex = FspMetaCacheHashIndex(MetaCache, Stripe, ItemIndex);
+    for (FSP_META_CACHE_ITEM *ItemX = Stripe->ItemBuckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
         if (ItemX->ItemIndex == ItemIndex)
         {
             Item = ItemX;
@@ -59,77 +147,169 @@ static inline FSP_META_CACHE_ITEM *FspMetaCacheLookupIndexedItemAtDpcLevel(FSP_M
     return Item;
 }
 
-static inline VOID FspMetaCacheAddItemAtDpcLevel(FSP_META_CACHE *MetaCache, FSP_META_CACHE_ITEM *Item)
+static inline VOID FspMetaCacheAddItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_STRIPE *Stripe, FSP_META_CACHE_ITEM *Item)
 {
-    ULONG HashIndex = Item->ItemIndex % MetaCache->ItemBucketCount;
+    ULONG HashIndex = FspMetaCacheHashIndex(MetaCache, Stripe, Item->ItemIndex);
 #if DBG
-    for (FSP_META_CACHE_ITEM *ItemX = MetaCache->ItemBuckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
+    for (FSP_META_CACHE_ITEM *ItemX = Stripe->ItemBuckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
         ASSERT(ItemX->ItemIndex != Item->ItemIndex);
 #endif
-    Item->DictNext = MetaCache->ItemBuckets[HashIndex];
-    MetaCache->ItemBuckets[HashIndex] = Item;
-    InsertTailList(&MetaCache->ItemList, &Item->ListEntry);
-    MetaCache->ItemCount++;
+    Item->DictNext = Stripe->ItemBuckets[HashIndex];
+    Stripe->ItemBuckets[HashIndex] = Item;
+    if (0 != Item->KeySize)
+    {
+        HashIndex = (ULONG)(Item->ContentHash % Stripe->ItemBucketCount);
+        Item->ContentNext = Stripe->ContentBuckets[HashIndex];
+        Stripe->ContentBuckets[HashIndex] = Item;
+    }
+    InsertTailList(&Stripe->ItemList, &Item->ListEntry);
+    InsertTailList(&Stripe->LruList, &Item->LruEntry);
+    Stripe->ItemCount++;
+    Stripe->HolderCount += Item->HolderCount;
+    Stripe->MetaSize += Item->ItemSize;
 }
 
-static inline FSP_META_CACHE_ITEM *FspMetaCacheRemoveIndexedItemAtDpcLevel(FSP_META_CACHE *MetaCache,
-    UINT64 ItemIndex)
+static inline VOID FspMetaCacheRemoveItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_STRIPE *Stripe, FSP_META_CACHE_ITEM *Item)
 {
-    FSP_META_CACHE_ITEM *Item = 0;
-    ULONG HashIndex = ItemIndex % MetaCache->ItemBucketCount;
-    for (FSP_META_CACHE_ITEM **P = (PVOID)&MetaCache->ItemBuckets[HashIndex]; *P; P = &(*P)->DictNext)
-        if ((*P)->ItemIndex == ItemIndex)
+    ULONG HashIndex = FspMetaCacheHashIndex(MetaCache, Stripe, Item->ItemIndex);
+    for (FSP_META_CACHE_ITEM **P = (PVOID)&Stripe->ItemBuckets[HashIndex]; *P; P = &(*P)->DictNext)
+        if (*P == Item)
         {
-            Item = *P;
             *P = (*P)->DictNext;
-            RemoveEntryList(&Item->ListEntry);
-            MetaCache->ItemCount--;
             break;
         }
+    if (0 != Item->KeySize)
+    {
+        HashIndex = (ULONG)(Item->ContentHash % Stripe->ItemBucketCount);
+        for (FSP_META_CACHE_ITEM **P = (PVOID)&Stripe->ContentBuckets[HashIndex]; *P; P = &(*P)->ContentNext)
+            if (*P == Item)
+            {
+                *P = (*P)->ContentNext;
+                break;
+            }
+    }
+    RemoveEntryList(&Item->ListEntry);
+    RemoveEntryList(&Item->LruEntry);
+    Stripe->ItemCount--;
+    Stripe->HolderCount -= Item->HolderCount;
+    Stripe->MetaSize -= Item->ItemSize;
+}
+
+static inline FSP_META_CACHE_ITEM *FspMetaCacheReleaseIndexedItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_STRIPE *Stripe, UINT64 ItemIndex)
+{
+    FSP_META_CACHE_ITEM *Item = FspMetaCacheLookupIndexedItemAtDpcLevel(MetaCache, Stripe, ItemIndex);
+    if (0 == Item)
+        return 0;
+    ASSERT(0 < Item->HolderCount);
+    if (1 < Item->HolderCount)
+    {
+        /* other holders still use this item */
+        Item->HolderCount--;
+        Stripe->HolderCount--;
+        return 0;
+    }
+    FspMetaCacheRemoveItemAtDpcLevel(MetaCache, Stripe, Item);
     return Item;
 }
 
+static inline VOID FspMetaCacheRefreshItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_STRIPE *Stripe, FSP_META_CACHE_ITEM *Item)
+{
+    /* restart the item's timeout and keep ItemList in expiration order */
+    Item->ExpirationTime = FspExpirationTimeFromTimeout(MetaCache->MetaTimeout);
+    RemoveEntryList(&Item->ListEntry);
+    InsertTailList(&Stripe->ItemList, &Item->ListEntry);
+}
+
 static inline FSP_META_CACHE_ITEM *FspMetaCacheRemoveExpiredItemAtDpcLevel(FSP_META_CACHE *MetaCache,
-    UINT64 ExpirationTime)
+    FSP_META_CACHE_STRIPE *Stripe, UINT64 ExpirationTime)
 {
-    PLIST_ENTRY Head = &MetaCache->ItemList;
+    PLIST_ENTRY Head = &Stripe->ItemList;
     PLIST_ENTRY Entry = Head->Flink;
     if (Head == Entry)
         return 0;
     FSP_META_CACHE_ITEM *Item = CONTAINING_RECORD(Entry, FSP_META_CACHE_ITEM, ListEntry);
     if (!FspExpirationTimeValid2(Item->ExpirationTime, ExpirationTime))
         return 0;
-    ULONG HashIndex = Item->ItemIndex % MetaCache->ItemBucketCount;
-    for (FSP_META_CACHE_ITEM **P = (PVOID)&MetaCache->ItemBuckets[HashIndex]; *P; P = &(*P)->DictNext)
-        if (*P == Item)
-        {
-            *P = (*P)->DictNext;
+    FspMetaCacheRemoveItemAtDpcLevel(MetaCache, Stripe, Item);
+    return Item;
+}
+
+static inline FSP_META_CACHE_ITEM *FspMetaCacheRemoveLruItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_STRIPE *Stripe)
+{
+    PLIST_ENTRY Head = &Stripe->LruList;
+    PLIST_ENTRY Entry;
+    FSP_META_CACHE_ITEM *Item;
+    for (ULONG Index = 0, Count = Stripe->ItemCount; Count > Index; Index++)
+    {
+        Entry = Head->Flink;
+        if (Head == Entry)
             break;
-        }
-    RemoveEntryList(&Item->ListEntry);
-    MetaCache->ItemCount--;
+        Item = CONTAINING_RECORD(Entry, FSP_META_CACHE_ITEM, LruEntry);
+        if (!Item->Referenced)
+            break;
+        /* second chance: clear the Referenced flag and move to the tail */
+        Item->Referenced = FALSE;
+        RemoveEntryList(Entry);
+        InsertTailList(Head, Entry);
+    }
+    Entry = Head->Flink;
+    if (Head == Entry)
+        return 0;
+    Item = CONTAINING_RECORD(Entry, FSP_META_CACHE_ITEM, LruEntry);
+    FspMetaCacheRemoveItemAtDpcLevel(MetaCache, Stripe, Item);
+    Stripe->EvictionCount++;
     return Item;
 }
 
 NTSTATUS FspMetaCacheCreate(
-    ULONG MetaCapacity, ULONG ItemSizeMax, PLARGE_INTEGER MetaTimeout,
+    ULONG MetaSizeMax, ULONG ItemSizeMax, PLARGE_INTEGER MetaTimeout,
     FSP_META_CACHE **PMetaCache)
 {
     *PMetaCache = 0;
-    if (0 == MetaCapacity || 0 == ItemSizeMax || 0 == MetaTimeout->QuadPart)
+    if (0 == MetaSizeMax || 0 == ItemSizeMax || 0 == MetaTimeout->QuadPart)
         return STATUS_SUCCESS;
     FSP_META_CACHE *MetaCache;
-    ULONG BucketCount = (PAGE_SIZE - sizeof *MetaCache) / sizeof MetaCache->ItemBuckets[0];
-    MetaCache = FspAllocNonPaged(PAGE_SIZE);
+    FSP_META_CACHE_STRIPE *Stripe;
+    ULONG BucketCount = (PAGE_SIZE - sizeof *Stripe) / (2 * sizeof Stripe->ItemBuckets[0]);
+    ULONG StripeCount;
+    /* ensure that every stripe has room for a few maximum size items */
+    StripeCount = MetaSizeMax / (FspMetaCacheStripeItemsMin * ItemSizeMax);
+    if (0 == StripeCount)
+        StripeCount = 1;
+    else if (FspMetaCacheStripeCountMax < StripeCount)
+        StripeCount = FspMetaCacheStripeCountMax;
+    MetaCache = FspAllocNonPaged(sizeof *MetaCache + StripeCount * sizeof MetaCache->Stripes[0]);
     if (0 == MetaCache)
         return STATUS_INSUFFICIENT_RESOURCES;
-    RtlZeroMemory(MetaCache, PAGE_SIZE);
-    KeInitializeSpinLock(&MetaCache->SpinLock);
-    InitializeListHead(&MetaCache->ItemList);
-    MetaCache->MetaCapacity = MetaCapacity;
+    RtlZeroMemory(MetaCache, sizeof *MetaCache + StripeCount * sizeof MetaCache->Stripes[0]);
+    for (ULONG Index = 0; StripeCount > Index; Index++)
+    {
+        /* stripes must not share cache lines; do not rely on the pool aligning PAGE_SIZE requests */
+        Stripe = FspAllocNonPagedCacheAligned(PAGE_SIZE);
+        if (0 == Stripe)
+        {
+            for (ULONG Index2 = 0; Index > Index2; Index2++)
+                FspFree(MetaCache->Stripes[Index2]);
+            FspFree(MetaCache);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        RtlZeroMemory(Stripe, PAGE_SIZE);
+        InitializeListHead(&Stripe->ItemList);
+        InitializeListHead(&Stripe->LruList);
+        Stripe->MetaSizeMax = MetaSizeMax / StripeCount;
+        Stripe->ItemBucketCount = BucketCount;
+        Stripe->ContentBuckets = &Stripe->ItemBuckets[BucketCount];
+        MetaCache->Stripes[Index] = Stripe;
+    }
+    MetaCache->MetaSizeMax = MetaSizeMax;
     MetaCache->ItemSizeMax = ItemSizeMax;
     MetaCache->MetaTimeout = MetaTimeout->QuadPart;
-    MetaCache->ItemBucketCount = BucketCount;
+    MetaCache->StripeCount = StripeCount;
     *PMetaCache = MetaCache;
     return STATUS_SUCCESS;
 }
@@ -139,6 +319,8 @@ VOID FspMetaCacheDelete(FSP_META_CACHE *MetaCache)
     if (0 == MetaCache)
         return;
     FspMetaCacheInvalidateExpired(MetaCache, (UINT64)-1LL);
+    for (ULONG Index = 0; MetaCache->StripeCount > Index; Index++)
+        FspFree(MetaCache->Stripes[Index]);
     FspFree(MetaCache);
 }
 
@@ -146,16 +328,21 @@ VOID FspMetaCacheInvalidateExpired(FSP_META_CACHE *MetaCache, UINT64 ExpirationT
 {
     if (0 == MetaCache)
         return;
+    FSP_META_CACHE_STRIPE *Stripe;
     FSP_META_CACHE_ITEM *Item;
     KIRQL Irql;
-    for (;;)
+    for (ULONG Index = 0; MetaCache->StripeCount > Index; Index++)
     {
-        KeAcquireSpinLock(&MetaCache->SpinLock, &Irql);
-        Item = FspMetaCacheRemoveExpiredItemAtDpcLevel(MetaCache, ExpirationTime);
-        KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
-        if (0 == Item)
-            break;
-        FspMetaCacheDereferenceItem(Item);
+        Stripe = MetaCache->Stripes[Index];
+        for (;;)
+        {
+            Irql = ExAcquireSpinLockExclusive(&Stripe->SpinLock);
+            Item = FspMetaCacheRemoveExpiredItemAtDpcLevel(MetaCache, Stripe, ExpirationTime);
+            ExReleaseSpinLockExclusive(&Stripe->SpinLock, Irql);
+            if (0 == Item)
+                break;
+            FspMetaCacheDereferenceItem(Item);
+        }
     }
 }
 
@@ -167,18 +354,27 @@ BOOLEAN FspMetaCacheReferenceItemBuffer(FSP_META_CACHE *MetaCache, UINT64 ItemIn
         *PSize = 0;
     if (0 == MetaCache || 0 == ItemIndex)
         return FALSE;
+    FSP_META_CACHE_STRIPE *Stripe = FspMetaCacheStripe(MetaCache, ItemIndex);
     FSP_META_CACHE_ITEM *Item = 0;
     FSP_META_CACHE_ITEM_BUFFER *ItemBuffer;
     KIRQL Irql;
-    KeAcquireSpinLock(&MetaCache->SpinLock, &Irql);
-    Item = FspMetaCacheLookupIndexedItemAtDpcLevel(MetaCache, ItemIndex);
+    /*
+     * Lookups only read the stripe, so they can proceed concurrently under a shared lock.
+     * The item cannot be removed while we hold the lock, so it is safe to reference it.
+     */
+    Irql = ExAcquireSpinLockShared(&Stripe->SpinLock);
+    Item = FspMetaCacheLookupIndexedItemAtDpcLevel(MetaCache, Stripe, ItemIndex);
     if (0 == Item)
     {
-        KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
+        ExReleaseSpinLockShared(&Stripe->SpinLock, Irql);
+        InterlockedIncrement64(&Stripe->MissCount);
         return FALSE;
     }
+    if (!Item->Referenced)
+        Item->Referenced = TRUE; /* benign race; avoid dirtying the cache line when already set */
     InterlockedIncrement(&Item->RefCount);
-    KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
+    ExReleaseSpinLockShared(&Stripe->SpinLock, Irql);
+    InterlockedIncrement64(&Stripe->HitCount);
     ItemBuffer = Item->ItemBuffer;
     *PBuffer = ItemBuffer->Buffer;
     if (0 != PSize)
@@ -186,22 +382,63 @@ BOOLEAN FspMetaCacheReferenceItemBuffer(FSP_META_CACHE *MetaCache, UINT64 ItemIn
     return TRUE;
 }
 
+BOOLEAN FspMetaCacheNextItemBuffer(PCVOID Buffer, PCVOID *PBuffer, PULONG PSize)
+{
+    FSP_META_CACHE_ITEM_BUFFER *ItemBuffer = (PVOID)((PUINT8)Buffer - sizeof *ItemBuffer);
+    FSP_META_CACHE_ITEM_BUFFER *NextChunk = ItemBuffer->NextChunk;
+    *PBuffer = 0;
+    if (0 != PSize)
+        *PSize = 0;
+    if (0 == NextChunk)
+        return FALSE;
+    *PBuffer = NextChunk->Buffer;
+    if (0 != PSize)
+        *PSize = NextChunk->Size;
+    return TRUE;
+}
+
 VOID FspMetaCacheDereferenceItemBuffer(PCVOID Buffer)
 {
     FSP_META_CACHE_ITEM_BUFFER *ItemBuffer = (PVOID)((PUINT8)Buffer - sizeof *ItemBuffer);
     FspMetaCacheDereferenceItem(ItemBuffer->Item);
 }
 
-UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
+static UINT64 FspMetaCacheAddItemEx(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size,
+    ULONG KeySize, BOOLEAN Replace)
 {
-    if (0 == MetaCache)
+    if (0 == MetaCache || KeySize > Size)
         return 0;
-    FSP_META_CACHE_ITEM *Item;
+    BOOLEAN Shared = 0 != KeySize && !Replace;
+    FSP_META_CACHE_STRIPE *Stripe;
+    FSP_META_CACHE_ITEM *Item, *ReplacedItem = 0, *EvictedItem, *EvictedList = 0;
     FSP_META_CACHE_ITEM_BUFFER *ItemBuffer;
-    UINT64 ItemIndex = 0;
+    UINT64 ItemIndex = 0, ContentHash = 0;
+    ULONG StripeIndex;
     KIRQL Irql;
-    if (sizeof *ItemBuffer + Size > MetaCache->ItemSizeMax)
+    if (sizeof *ItemBuffer + Size > MetaCache->ItemSizeMax ||
+        sizeof *Item + sizeof *ItemBuffer + Size > MetaCache->MetaSizeMax / MetaCache->StripeCount)
         return 0;
+    if (0 != KeySize)
+        ContentHash = FspMetaCacheContentHash(Buffer, KeySize);
+    if (Shared)
+    {
+        Stripe = MetaCache->Stripes[ContentHash % MetaCache->StripeCount];
+        Irql = ExAcquireSpinLockExclusive(&Stripe->SpinLock);
+        Item = FspMetaCacheLookupContentItemAtDpcLevel(Stripe, ContentHash, Buffer, Size);
+        if (0 != Item)
+        {
+            /* the file system just supplied these contents; they are fresh again */
+            FspMetaCacheRefreshItemAtDpcLevel(MetaCache, Stripe, Item);
+            Item->Referenced = TRUE;
+            Item->HolderCount++;
+            Stripe->HolderCount++;
+            Stripe->DedupCount++;
+            ItemIndex = Item->ItemIndex;
+            ExReleaseSpinLockExclusive(&Stripe->SpinLock, Irql);
+            return ItemIndex;
+        }
+        ExReleaseSpinLockExclusive(&Stripe->SpinLock, Irql);
+    }
     Item = FspAllocNonPaged(sizeof *Item);
     if (0 == Item)
         return 0;
@@ -215,30 +452,254 @@ UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
     RtlZeroMemory(ItemBuffer, sizeof *ItemBuffer);
     Item->ItemBuffer = ItemBuffer;
     Item->ExpirationTime = FspExpirationTimeFromTimeout(MetaCache->MetaTimeout);
+    Item->ItemSize = sizeof *Item + sizeof *ItemBuffer + Size;
+    Item->ContentHash = ContentHash;
+    Item->HolderCount = 1;
     Item->RefCount = 1;
+    Item->KeySize = KeySize;
     ItemBuffer->Item = Item;
     ItemBuffer->Size = Size;
     RtlCopyMemory(ItemBuffer->Buffer, Buffer, Size);
-    KeAcquireSpinLock(&MetaCache->SpinLock, &Irql);
-    if (MetaCache->ItemCount >= MetaCache->MetaCapacity)
-        FspMetaCacheRemoveExpiredItemAtDpcLevel(MetaCache, (UINT64)-1LL);
-    ItemIndex = MetaCache->ItemIndex;
-    ItemIndex = (UINT64)-1LL == ItemIndex ? 1 : ItemIndex + 1;
-    MetaCache->ItemIndex = Item->ItemIndex = ItemIndex;
-    FspMetaCacheAddItemAtDpcLevel(MetaCache, Item);
-    KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
+    /* ItemIndex is (Sequence * StripeCount + StripeIndex); keyed items use their content stripe */
+    ItemIndex = (UINT64)InterlockedIncrement64(&MetaCache->ItemIndex);
+    StripeIndex = (ULONG)((0 != KeySize ? ContentHash : ItemIndex) % MetaCache->StripeCount);
+    ItemIndex = ItemIndex * MetaCache->StripeCount + StripeIndex;
+    Item->ItemIndex = ItemIndex;
+    Stripe = MetaCache->Stripes[StripeIndex];
+    Irql = ExAcquireSpinLockExclusive(&Stripe->SpinLock);
+    if (Shared)
+    {
+        /* check again; another thread may have added the same contents while we were allocating */
+        FSP_META_CACHE_ITEM *ItemX =
+            FspMetaCacheLookupContentItemAtDpcLevel(Stripe, ContentHash, Buffer, Size);
+        if (0 != ItemX)
+        {
+            FspMetaCacheRefreshItemAtDpcLevel(MetaCache, Stripe, ItemX);
+            ItemX->Referenced = TRUE;
+            ItemX->HolderCount++;
+            Stripe->HolderCount++;
+            Stripe->DedupCount++;
+            ItemIndex = ItemX->ItemIndex;
+            ExReleaseSpinLockExclusive(&Stripe->SpinLock, Irql);
+            FspMetaCacheDereferenceItem(Item);
+            return ItemIndex;
+        }
+    }
+    else if (Replace)
+    {
+        /* a newer value for the key supersedes the old one regardless of its holders */
+        ReplacedItem = FspMetaCacheLookupContentItemAtDpcLevel(Stripe, ContentHash, Buffer, KeySize);
+        if (0 != ReplacedItem)
+            FspMetaCacheRemoveItemAtDpcLevel(MetaCache, Stripe, ReplacedItem);
+    }
+    while (Stripe->MetaSize + Item->ItemSize > Stripe->MetaSizeMax &&
+        0 != (EvictedItem = FspMetaCacheRemoveLruItemAtDpcLevel(MetaCache, Stripe)))
+    {
+        /* DictNext is no longer in use; reuse it to dereference evicted items outside the lock */
+        EvictedItem->DictNext = EvictedList;
+        EvictedList = EvictedItem;
+    }
+    FspMetaCacheAddItemAtDpcLevel(MetaCache, Stripe, Item);
+    ExReleaseSpinLockExclusive(&Stripe->SpinLock, Irql);
+    if (0 != ReplacedItem)
+        FspMetaCacheDereferenceItem(ReplacedItem);
+    while (0 != EvictedList)
+    {
+        EvictedItem = EvictedList;
+        EvictedList = EvictedList->DictNext;
+        FspMetaCacheDereferenceItem(EvictedItem);
+    }
     return ItemIndex;
 }
 
+UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
+{
+    return FspMetaCacheAddItemEx(MetaCache, Buffer, Size, 0, FALSE);
+}
+
+UINT64 FspMetaCacheAddItemShared(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
+{
+    return FspMetaCacheAddItemEx(MetaCache, Buffer, Size, Size, FALSE);
+}
+
+UINT64 FspMetaCacheAddItemKeyed(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size,
+    ULONG KeySize)
+{
+    if (0 == KeySize)
+        return 0;
+    return FspMetaCacheAddItemEx(MetaCache, Buffer, Size, KeySize, TRUE);
+}
+
+BOOLEAN FspMetaCacheReferenceItemBufferByKey(FSP_META_CACHE *MetaCache, PCVOID Key, ULONG KeySize,
+    PCVOID *PBuffer, PULONG PSize)
+{
+    *PBuffer = 0;
+    if (0 != PSize)
+        *PSize = 0;
+    if (0 == MetaCache || 0 == KeySize)
+        return FALSE;
+    UINT64 ContentHash = FspMetaCacheContentHash(Key, KeySize);
+    FSP_META_CACHE_STRIPE *Stripe = MetaCache->Stripes[ContentHash % MetaCache->StripeCount];
+    FSP_META_CACHE_ITEM *Item;
+    FSP_META_CACHE_ITEM_BUFFER *ItemBuffer;
+    KIRQL Irql;
+    Irql = ExAcquireSpinLockShared(&Stripe->SpinLock);
+    Item = FspMetaCacheLookupContentItemAtDpcLevel(Stripe, ContentHash, Key, KeySize);
+    /* do not wait for the expiration timer; an expired item is a miss */
+    if (0 != Item && !FspExpirationTimeValid(Item->ExpirationTime))
+        Item = 0;
+    if (0 == Item)
+    {
+        ExReleaseSpinLockShared(&Stripe->SpinLock, Irql);
+        InterlockedIncrement64(&Stripe->MissCount);
+        return FALSE;
+    }
+    if (!Item->Referenced)
+        Item->Referenced = TRUE;
+    InterlockedIncrement(&Item->RefCount);
+    ExReleaseSpinLockShared(&Stripe->SpinLock, Irql);
+    InterlockedIncrement64(&Stripe->HitCount);
+    ItemBuffer = Item->ItemBuffer;
+    *PBuffer = ItemBuffer->Buffer;
+    if (0 != PSize)
+        *PSize = ItemBuffer->Size;
+    return TRUE;
+}
+
+BOOLEAN FspMetaCacheLookupItemShared(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
+{
+    if (0 == MetaCache)
+        return FALSE;
+    UINT64 ContentHash = FspMetaCacheContentHash(Buffer, Size);
+    FSP_META_CACHE_STRIPE *Stripe = MetaCache->Stripes[ContentHash % MetaCache->StripeCount];
+    FSP_META_CACHE_ITEM *Item;
+    KIRQL Irql;
+    Irql = ExAcquireSpinLockShared(&Stripe->SpinLock);
+    Item = FspMetaCacheLookupContentItemAtDpcLevel(Stripe, ContentHash, Buffer, Size);
+    /* do not wait for the expiration timer; an expired item is a miss */
+    if (0 != Item && !FspExpirationTimeValid(Item->ExpirationTime))
+        Item = 0;
+    if (0 != Item && !Item->Referenced)
+        Item->Referenced = TRUE;
+    ExReleaseSpinLockShared(&Stripe->SpinLock, Irql);
+    InterlockedIncrement64(0 != Item ? &Stripe->HitCount : &Stripe->MissCount);
+    return 0 != Item;
+}
+
+BOOLEAN FspMetaCacheAppendItemChunk(FSP_META_CACHE *MetaCache, UINT64 ItemIndex,
+    ULONG ChunkIndex, PCVOID Buffer, ULONG Size)
+{
+    if (0 == MetaCache || 0 == ItemIndex)
+        return FALSE;
+    FSP_META_CACHE_STRIPE *Stripe = FspMetaCacheStripe(MetaCache, ItemIndex);
+    FSP_META_CACHE_ITEM *Item, *EvictedItem, *EvictedList = 0;
+    FSP_META_CACHE_ITEM_BUFFER *ItemBuffer, *LastChunk;
+    ULONG ChunkSize, LastChunkIndex;
+    KIRQL Irql;
+    if (0 == ChunkIndex || sizeof *ItemBuffer + Size > MetaCache->ItemSizeMax)
+        return FALSE;
+    ChunkSize = sizeof *ItemBuffer + Size;
+    ItemBuffer = FspAlloc(ChunkSize);
+    if (0 == ItemBuffer)
+        return FALSE;
+    RtlZeroMemory(ItemBuffer, sizeof *ItemBuffer);
+    ItemBuffer->Size = Size;
+    RtlCopyMemory(ItemBuffer->Buffer, Buffer, Size);
+    Irql = ExAcquireSpinLockExclusive(&Stripe->SpinLock);
+    Item = FspMetaCacheLookupIndexedItemAtDpcLevel(MetaCache, Stripe, ItemIndex);
+    if (0 == Item || 0 != Item->KeySize || Item->ItemSize + ChunkSize > Stripe->MetaSizeMax)
+    {
+        ExReleaseSpinLockExclusive(&Stripe->SpinLock, Irql);
+        FspFree(ItemBuffer);
+        return FALSE;
+    }
+    /* the new chunk must be the one the caller expects; otherwise somebody else appended it */
+    for (LastChunk = Item->ItemBuffer, LastChunkIndex = 0;
+        0 != LastChunk->NextChunk;
+        LastChunk = LastChunk->NextChunk, LastChunkIndex++)
+        ;
+    if (LastChunkIndex + 1 != ChunkIndex)
+    {
+        ExReleaseSpinLockExclusive(&Stripe->SpinLock, Irql);
+        FspFree(ItemBuffer);
+        return FALSE;
+    }
+    /* take the item off the LRU list so that it cannot evict itself */
+    RemoveEntryList(&Item->LruEntry);
+    while (Stripe->MetaSize + ChunkSize > Stripe->MetaSizeMax &&
+        0 != (EvictedItem = FspMetaCacheRemoveLruItemAtDpcLevel(MetaCache, Stripe)))
+    {
+        EvictedItem->DictNext = EvictedList;
+        EvictedList = EvictedItem;
+    }
+    InsertTailList(&Stripe->LruList, &Item->LruEntry);
+    ItemBuffer->Item = Item;
+    /* publish the fully initialized chunk to lock-free readers */
+    InterlockedExchangePointer((PVOID volatile *)&LastChunk->NextChunk, ItemBuffer);
+    Item->ItemSize += ChunkSize;
+    Stripe->MetaSize += ChunkSize;
+    ExReleaseSpinLockExclusive(&Stripe->SpinLock, Irql);
+    while (0 != EvictedList)
+    {
+        EvictedItem = EvictedList;
+        EvictedList = EvictedList->DictNext;
+        FspMetaCacheDereferenceItem(EvictedItem);
+    }
+    return TRUE;
+}
+
 VOID FspMetaCacheInvalidateItem(FSP_META_CACHE *MetaCache, UINT64 ItemIndex)
 {
     if (0 == MetaCache || 0 == ItemIndex)
         return;
+    FSP_META_CACHE_STRIPE *Stripe = FspMetaCacheStripe(MetaCache, ItemIndex);
+    FSP_META_CACHE_ITEM *Item;
+    KIRQL Irql;
+    Irql = ExAcquireSpinLockExclusive(&Stripe->SpinLock);
+    Item = FspMetaCacheReleaseIndexedItemAtDpcLevel(MetaCache, Stripe, ItemIndex);
+    ExReleaseSpinLockExclusive(&Stripe->SpinLock, Irql);
+    if (0 != Item)
+        FspMetaCacheDereferenceItem(Item);
+}
+
+VOID FspMetaCacheInvalidateItemShared(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
+{
+    if (0 == MetaCache)
+        return;
+    UINT64 ContentHash = FspMetaCacheContentHash(Buffer, Size);
+    FSP_META_CACHE_STRIPE *Stripe = MetaCache->Stripes[ContentHash % MetaCache->StripeCount];
     FSP_META_CACHE_ITEM *Item;
     KIRQL Irql;
-    KeAcquireSpinLock(&MetaCache->SpinLock, &Irql);
-    Item = FspMetaCacheRemoveIndexedItemAtDpcLevel(MetaCache, ItemIndex);
-    KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
+    Irql = ExAcquireSpinLockExclusive(&Stripe->SpinLock);
+    Item = FspMetaCacheLookupContentItemAtDpcLevel(Stripe, ContentHash, Buffer, Size);
+    /* remove the item regardless of how many holders it has */
+    if (0 != Item)
+        FspMetaCacheRemoveItemAtDpcLevel(MetaCache, Stripe, Item);
+    ExReleaseSpinLockExclusive(&Stripe->SpinLock, Irql);
     if (0 != Item)
         FspMetaCacheDereferenceItem(Item);
 }
+
+VOID FspMetaCacheQueryStatistics(FSP_META_CACHE *MetaCache,
+    FSP_FSCTL_META_CACHE_STATISTICS *Statistics)
+{
+    RtlZeroMemory(Statistics, sizeof *Statistics);
+    if (0 == MetaCache)
+        return;
+    FSP_META_CACHE_STRIPE *Stripe;
+    KIRQL Irql;
+    for (ULONG Index = 0; MetaCache->StripeCount > Index; Index++)
+    {
+        Stripe = MetaCache->Stripes[Index];
+        Irql = ExAcquireSpinLockShared(&Stripe->SpinLock);
+        Statistics->HitCount += Stripe->HitCount;
+        Statistics->MissCount += Stripe->MissCount;
+        Statistics->EvictionCount += Stripe->EvictionCount;
+        Statistics->DedupCount += Stripe->DedupCount;
+        Statistics->ItemCount += Stripe->ItemCount;
+        Statistics->HolderCount += Stripe->HolderCount;
+        Statistics->Size += Stripe->MetaSize;
+        ExReleaseSpinLockShared(&Stripe->SpinLock, Irql);
+    }
+    Statistics->SizeMax = MetaCache->MetaSizeMax;
+}
@@ -43,6 +43,8 @@ NTSTATUS FspVolumeTransact(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 NTSTATUS FspVolumeStop(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
+NTSTATUS FspVolumeGetStatistics(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 NTSTATUS FspVolumeWork(
     PDEVICE_OBJECT FsvolDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 
@@ -61,6 +63,7 @@ NTSTATUS FspVolumeWork(
 #pragma alloc_text(PAGE, FspVolumeGetNameListNoLock)
 #pragma alloc_text(PAGE, FspVolumeTransact)
 #pragma alloc_text(PAGE, FspVolumeStop)
+#pragma alloc_text(PAGE, FspVolumeGetStatistics)
 #pragma alloc_text(PAGE, FspVolumeWork)
 #endif
 
@@ -102,6 +105,7 @@ static NTSTATUS FspVolumeCreateNoLock(
     NTSTATUS Result;
     PFILE_OBJECT FileObject = IrpSp->FileObject;
     FSP_FSCTL_VOLUME_PARAMS VolumeParams = { 0 };
+    USHORT VolumeParamsSize;
     USHORT PrefixLength = 0;
     GUID Guid;
     UNICODE_STRING DeviceSddl;
@@ -112,12 +116,15 @@ static NTSTATUS FspVolumeCreateNoLock(
     FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension;
     FSP_CREATE_VOLUME_REGISTER_MUP_WORK_ITEM RegisterMupWorkItem;
 
-    /* check parameters */
-    if (PREFIXW_SIZE + sizeof(FSP_FSCTL_VOLUME_PARAMS) * sizeof(WCHAR) > FileObject->FileName.Length)
+    /* check parameters; accept the original (V0) VolumeParams layout as well */
+    if (PREFIXW_SIZE + FSP_FSCTL_VOLUME_PARAMS_V0_SIZE * sizeof(WCHAR) > FileObject->FileName.Length)
         return STATUS_INVALID_PARAMETER;
+    VolumeParamsSize = (FileObject->FileName.Length - PREFIXW_SIZE) / sizeof(WCHAR);
+    if (sizeof(FSP_FSCTL_VOLUME_PARAMS) < VolumeParamsSize)
+        VolumeParamsSize = sizeof(FSP_FSCTL_VOLUME_PARAMS);
 
-    /* copy the VolumeParams */
-    for (USHORT Index = 0, Length = sizeof(FSP_FSCTL_VOLUME_PARAMS); Length > Index; Index++)
+    /* copy the VolumeParams; fields absent from a V0 layout remain 0 and receive defaults below */
+    for (USHORT Index = 0, Length = VolumeParamsSize; Length > Index; Index++)
     {
         WCHAR Value = FileObject->FileName.Buffer[PREFIXW_SIZE / sizeof(WCHAR) + Index];
         if (0xF000 != (Value & 0xFF00))
@@ -145,6 +152,12 @@ static NTSTATUS FspVolumeCreateNoLock(
     if (FspFsctlIrpCapacityMinimum > VolumeParams.IrpCapacity ||
         VolumeParams.IrpCapacity > FspFsctlIrpCapacityMaximum)
         VolumeParams.IrpCapacity = FspFsctlIrpCapacityDefault;
+    if (FspFsctlSecurityCacheSizeMinimum > VolumeParams.SecurityCacheSize ||
+        VolumeParams.SecurityCacheSize > FspFsctlSecurityCacheSizeMaximum)
+        VolumeParams.SecurityCacheSize = FspFsctlSecurityCacheSizeDefault;
+    if (FspFsctlDirInfoCacheSizeMinimum > VolumeParams.DirInfoCacheSize ||
+        VolumeParams.DirInfoCacheSize > FspFsctlDirInfoCacheSizeMaximum)
+        VolumeParams.DirInfoCacheSize = FspFsctlDirInfoCacheSizeDefault;
     if (FILE_DEVICE_NETWORK_FILE_SYSTEM == FsctlDeviceObject->DeviceType)
     {
         VolumeParams.Prefix[sizeof VolumeParams.Prefix / sizeof(WCHAR) - 1] = L'\0';
@@ -676,6 +689,7 @@ NTSTATUS FspVolumeTransact(
     FSP_FSCTL_TRANSACT_RSP *Response, *NextResponse;
     FSP_FSCTL_TRANSACT_REQ *Request, *PendingIrpRequest;
     PIRP ProcessIrp, PendingIrp, RetriedIrp, RepostedIrp;
+    ULONG PendingSequence, RepostedSequence, *PRepostedSequence;
     ULONG LoopCount;
     LARGE_INTEGER Timeout;
     PIRP TopLevelIrp = IoGetTopLevelIrp();
@@ -784,7 +798,7 @@ NTSTATUS FspVolumeTransact(
     }
 
     /* send any pending IRP's to the user-mode file system */
-    RepostedIrp = 0;
+    PRepostedSequence = 0;
     Request = OutputBuffer;
     BufferEnd = (PUINT8)OutputBuffer + OutputBufferLength;
     ASSERT(FspFsctlTransactCanProduceRequest(Request, BufferEnd));
@@ -794,15 +808,21 @@ NTSTATUS FspVolumeTransact(
         PendingIrpRequest = FspIrpRequest(PendingIrp);
 
         IoSetTopLevelIrp(PendingIrp);
+        PendingSequence = FspIoqPendingSequence(FsvolDeviceExtension->Ioq);
         Result = FspIopDispatchPrepare(PendingIrp, PendingIrpRequest);
         if (STATUS_PENDING == Result)
         {
             /*
-             * The IRP has been reposted to our Ioq. Remember the first such IRP,
-             * so that we know to break the loop if we see it again.
+             * The IRP has been reposted to our Ioq. Remember the posting sequence
+             * before the first such IRP, so that we know not to go beyond it.
+             * (The reposted IRP may be in any shard, so we cannot use the IRP
+             * itself as a boundary.)
              */
-            if (0 == RepostedIrp)
-                RepostedIrp = PendingIrp;
+            if (0 == PRepostedSequence)
+            {
+                RepostedSequence = PendingSequence;
+                PRepostedSequence = &RepostedSequence;
+            }
         }
         else if (!NT_SUCCESS(Result))
             FspIopCompleteIrp(PendingIrp, Result);
@@ -838,7 +858,7 @@ NTSTATUS FspVolumeTransact(
             break;
 
         /* get the next pending IRP, but do not go beyond the first reposted IRP! */
-        PendingIrp = FspIoqNextPendingIrp(FsvolDeviceExtension->Ioq, RepostedIrp, 0, Irp);
+        PendingIrp = FspIoqNextPendingIrp(FsvolDeviceExtension->Ioq, PRepostedSequence, 0, Irp);
         if (0 == PendingIrp)
             break;
     }
@@ -870,6 +890,34 @@ NTSTATUS FspVolumeStop(
     return STATUS_SUCCESS;
 }
 
+NTSTATUS FspVolumeGetStatistics(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp)
+{
+    PAGED_CODE();
+
+    ASSERT(IRP_MJ_FILE_SYSTEM_CONTROL == IrpSp->MajorFunction);
+    ASSERT(IRP_MN_USER_FS_REQUEST == IrpSp->MinorFunction);
+    ASSERT(FSP_FSCTL_VOLUME_STATISTICS == IrpSp->Parameters.FileSystemControl.FsControlCode);
+    ASSERT(0 != IrpSp->FileObject->FsContext2);
+
+    /* check parameters */
+    ULONG OutputBufferLength = IrpSp->Parameters.FileSystemControl.OutputBufferLength;
+    FSP_FSCTL_VOLUME_STATISTICS *Statistics = Irp->AssociatedIrp.SystemBuffer;
+    if (sizeof(FSP_FSCTL_VOLUME_STATISTICS) > OutputBufferLength)
+        return STATUS_BUFFER_TOO_SMALL;
+
+    PDEVICE_OBJECT FsvolDeviceObject = IrpSp->FileObject->FsContext2;
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+
+    FspMetaCacheQueryStatistics(FsvolDeviceExtension->SecurityCache, &Statistics->SecurityCache);
+    FspMetaCacheQueryStatistics(FsvolDeviceExtension->DirInfoCache, &Statistics->DirInfoCache);
+    FspMetaCacheQueryStatistics(FsvolDeviceExtension->NegativeNameCache, &Statistics->NegativeNameCache);
+    FspMetaCacheQueryStatistics(FsvolDeviceExtension->StatAheadCache, &Statistics->StatAheadCache);
+
+    Irp->IoStatus.Information = sizeof(FSP_FSCTL_VOLUME_STATISTICS);
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS FspVolumeWork(
     PDEVICE_OBJECT FsvolDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp)
 {
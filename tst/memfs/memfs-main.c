@@ -38,6 +38,7 @@ NTSTATUS SvcStart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
 {
     wchar_t **argp, **arge;
     ULONG DebugFlags = 0;
+    ULONG BatchSize = 0;
     ULONG Flags = MemfsDisk;
     ULONG FileInfoTimeout = INFINITE;
     ULONG MaxFileNodes = 1024;
@@ -56,6 +57,9 @@ NTSTATUS SvcStart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
         {
         case L'?':
             goto usage;
+        case L'b':
+            argtol(BatchSize);
+            break;
         case L'd':
             argtol(DebugFlags);
             break;
@@ -100,6 +104,13 @@ NTSTATUS SvcStart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
 
     FspFileSystemSetDebugLog(MemfsFileSystem(Memfs), DebugFlags);
 
+    Result = FspFileSystemSetDispatcherBatchSize(MemfsFileSystem(Memfs), BatchSize);
+    if (!NT_SUCCESS(Result))
+    {
+        fail(L"cannot set MEMFS batch size");
+        goto exit;
+    }
+
     if (0 != MountPoint && L'\0' != MountPoint[0])
     {
         Result = FspFileSystemSetMountPoint(MemfsFileSystem(Memfs),
@@ -120,8 +131,8 @@ NTSTATUS SvcStart(FSP_SERVICE *Service, ULONG argc, PWSTR *argv)
 
     MountPoint = FspFileSystemMountPoint(MemfsFileSystem(Memfs));
 
-    info(L"%s -t %ld -n %ld -s %ld%s%s%s%s%s%s",
-        L"" PROGNAME, FileInfoTimeout, MaxFileNodes, MaxFileSize,
+    info(L"%s -t %ld -n %ld -s %ld -b %ld%s%s%s%s%s%s",
+        L"" PROGNAME, FileInfoTimeout, MaxFileNodes, MaxFileSize, BatchSize,
         RootSddl ? L" -S " : L"", RootSddl ? RootSddl : L"",
         0 != VolumePrefix && L'\0' != VolumePrefix[0] ? L" -u " : L"",
             0 != VolumePrefix && L'\0' != VolumePrefix[0] ? VolumePrefix : L"",
@@ -142,6 +153,7 @@ usage:
         "\n"
         "options:\n"
         "    -d DebugFlags       [-1: enable all debug logs]\n"
+        "    -b BatchSize        [0: disable batch dispatcher]\n"
         "    -t FileInfoTimeout  [millis]\n"
         "    -n MaxFileNodes\n"
         "    -s MaxFileSize      [bytes]\n"
@@ -77,6 +77,7 @@ typedef struct _MEMFS
     MEMFS_FILE_NODE_MAP *FileNodeMap;
     ULONG MaxFileNodes;
     ULONG MaxFileSize;
+    BOOLEAN AsyncIo;
     UINT16 VolumeLabelLength;
     WCHAR VolumeLabel[32];
 } MEMFS;
@@ -504,6 +505,69 @@ static VOID Close(FSP_FILE_SYSTEM *FileSystem,
         MemfsFileNodeDelete(FileNode);
 }
 
+/*
+ * With MemfsAsyncIo Read and Write do their work synchronously, but respond to the FSD
+ * later from a thread pool thread through an asynchronous operation handle.
+ */
+typedef struct _MEMFS_ASYNC_COMPLETION
+{
+    FSP_FILE_SYSTEM_ASYNC_OPERATION *Operation;
+    NTSTATUS Status;
+    ULONG BytesTransferred;
+    BOOLEAN HasFileInfo;
+    FSP_FSCTL_FILE_INFO FileInfo;
+} MEMFS_ASYNC_COMPLETION;
+
+static VOID CALLBACK MemfsAsyncCompletion(PTP_CALLBACK_INSTANCE Instance, PVOID Context)
+{
+    MEMFS_ASYNC_COMPLETION *Completion = (MEMFS_ASYNC_COMPLETION *)Context;
+
+    if (Completion->HasFileInfo)
+        FspFileSystemCompleteAsyncWrite(Completion->Operation,
+            Completion->Status, Completion->BytesTransferred, &Completion->FileInfo);
+    else
+        FspFileSystemCompleteAsyncRead(Completion->Operation,
+            Completion->Status, Completion->BytesTransferred);
+
+    free(Completion);
+}
+
+static NTSTATUS MemfsAsyncComplete(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request, NTSTATUS Result, ULONG BytesTransferred,
+    const FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    MEMFS *Memfs = (MEMFS *)FileSystem->UserContext;
+    MEMFS_ASYNC_COMPLETION *Completion;
+
+    if (!Memfs->AsyncIo)
+        return Result;
+
+    Completion = (MEMFS_ASYNC_COMPLETION *)malloc(sizeof *Completion);
+    if (0 == Completion)
+        return Result;
+
+    if (!NT_SUCCESS(FspFileSystemBeginAsyncOperation(FileSystem, Request, &Completion->Operation)))
+    {
+        free(Completion);
+        return Result;
+    }
+
+    Completion->Status = Result;
+    Completion->BytesTransferred = BytesTransferred;
+    Completion->HasFileInfo = 0 != FileInfo;
+    if (0 != FileInfo)
+        Completion->FileInfo = *FileInfo;
+
+    if (!TrySubmitThreadpoolCallback(MemfsAsyncCompletion, Completion, 0))
+    {
+        FspFileSystemDeleteAsyncOperation(Completion->Operation);
+        free(Completion);
+        return Result;
+    }
+
+    return STATUS_PENDING;
+}
+
 static NTSTATUS Read(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_REQ *Request,
     PVOID FileNode0, PVOID Buffer, UINT64 Offset, ULONG Length,
@@ -513,7 +577,7 @@ static NTSTATUS Read(FSP_FILE_SYSTEM *FileSystem,
     UINT64 EndOffset;
 
     if (Offset >= FileNode->FileInfo.FileSize)
-        return STATUS_END_OF_FILE;
+        return MemfsAsyncComplete(FileSystem, Request, STATUS_END_OF_FILE, 0, 0);
 
     EndOffset = Offset + Length;
     if (EndOffset > FileNode->FileInfo.FileSize)
@@ -523,7 +587,7 @@ static NTSTATUS Read(FSP_FILE_SYSTEM *FileSystem,
 
     *PBytesTransferred = (ULONG)(EndOffset - Offset);
 
-    return STATUS_SUCCESS;
+    return MemfsAsyncComplete(FileSystem, Request, STATUS_SUCCESS, *PBytesTransferred, 0);
 }
 
 static NTSTATUS Write(FSP_FILE_SYSTEM *FileSystem,
@@ -553,7 +617,7 @@ static NTSTATUS Write(FSP_FILE_SYSTEM *FileSystem,
     if (ConstrainedIo)
     {
         if (Offset >= FileNode->FileInfo.FileSize)
-            return STATUS_SUCCESS;
+            return MemfsAsyncComplete(FileSystem, Request, STATUS_SUCCESS, 0, &FileNode->FileInfo);
         EndOffset = Offset + Length;
         if (EndOffset > FileNode->FileInfo.FileSize)
             EndOffset = FileNode->FileInfo.FileSize;
@@ -572,7 +636,7 @@ static NTSTATUS Write(FSP_FILE_SYSTEM *FileSystem,
     *PBytesTransferred = (ULONG)(EndOffset - Offset);
     *FileInfo = FileNode->FileInfo;
 
-    return STATUS_SUCCESS;
+    return MemfsAsyncComplete(FileSystem, Request, STATUS_SUCCESS, *PBytesTransferred, FileInfo);
 }
 
 NTSTATUS Flush(FSP_FILE_SYSTEM *FileSystem,
@@ -1024,6 +1088,17 @@ NTSTATUS MemfsCreate(
     }
 
     Memfs->FileSystem->UserContext = Memfs;
+    Memfs->AsyncIo = !!(Flags & MemfsAsyncIo);
+    if (Flags & MemfsResponseQueue)
+    {
+        Result = FspFileSystemSetResponseQueueDelay(Memfs->FileSystem, 10);
+        if (!NT_SUCCESS(Result))
+        {
+            MemfsDelete(Memfs);
+            LocalFree(RootSecurity);
+            return Result;
+        }
+    }
     Memfs->VolumeLabelLength = sizeof L"MEMFS" - sizeof(WCHAR);
     memcpy(Memfs->VolumeLabel, L"MEMFS", Memfs->VolumeLabelLength);
 
@@ -30,6 +30,8 @@ enum
 {
     MemfsDisk                           = 0x00,
     MemfsNet                            = 0x01,
+    MemfsAsyncIo                        = 0x02, /* complete Read/Write asynchronously */
+    MemfsResponseQueue                  = 0x04, /* queue responses (see FspFileSystemSetResponseQueueDelay) */
 };
 
 NTSTATUS MemfsCreate(
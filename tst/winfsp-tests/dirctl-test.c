@@ -158,6 +158,46 @@ static void querydir_dotest(ULONG Flags, PWSTR Prefix, ULONG FileInfoTimeout, UL
     Success = FindClose(Handle);
     ASSERT(Success);
 
+    static struct
+    {
+        PWSTR Pattern;
+        ULONG FileCount;
+    } PatternTests[] =
+    {
+        { L"*7", 10 },                  /* suffix */
+        { L"*.txt", 0 },                /* suffix (DOS_STAR) */
+        { L"file4*", 11 },              /* prefix */
+        { L"file42", 1 },               /* literal */
+        { L"file?7", 9 },               /* expression */
+        { L"f*e*7", 10 },               /* expression */
+    };
+    for (size_t i = 0; sizeof PatternTests / sizeof PatternTests[0] > i; i++)
+    {
+        StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir5\\%s",
+            Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs),
+            PatternTests[i].Pattern);
+        Handle = FindFirstFileW(FilePath, &FindData);
+        if (0 == PatternTests[i].FileCount)
+        {
+            ASSERT(INVALID_HANDLE_VALUE == Handle);
+            ASSERT(ERROR_FILE_NOT_FOUND == GetLastError());
+            continue;
+        }
+        ASSERT(INVALID_HANDLE_VALUE != Handle);
+
+        FileCount = 0;
+        do
+        {
+            ASSERT(0 == wcsncmp(FindData.cFileName, L"file", 4));
+            FileCount++;
+        } while (FindNextFileW(Handle, &FindData));
+        ASSERT(ERROR_NO_MORE_FILES == GetLastError());
+        ASSERT(PatternTests[i].FileCount == FileCount);
+
+        Success = FindClose(Handle);
+        ASSERT(Success);
+    }
+
     StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\DOES-NOT-EXIST",
         Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
     Handle = FindFirstFileW(FilePath, &FindData);
@@ -233,6 +273,138 @@ void querydir_expire_cache_test(void)
     }
 }
 
+static void querydir_statahead_dotest(ULONG Flags, PWSTR Prefix, ULONG FileInfoTimeout)
+{
+    void *memfs = memfs_start_ex(Flags, FileInfoTimeout);
+
+    HANDLE Handle;
+    BOOL Success;
+    WCHAR FilePath[MAX_PATH], FilePath2[MAX_PATH];
+    WIN32_FIND_DATAW FindData;
+    WIN32_FILE_ATTRIBUTE_DATA AttributeData;
+    DWORD BytesTransferred;
+    ULONG FileCount;
+    char Buffer[100];
+
+    memset(Buffer, 'A', sizeof Buffer);
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    Success = CreateDirectoryW(FilePath, 0);
+    ASSERT(Success);
+
+    for (int j = 1; 10 >= j; j++)
+    {
+        StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1\\file%d",
+            Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs), j);
+        Handle = CreateFileW(FilePath, GENERIC_ALL, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+        ASSERT(INVALID_HANDLE_VALUE != Handle);
+        Success = WriteFile(Handle, Buffer, j, &BytesTransferred, 0);
+        ASSERT(Success);
+        ASSERT((DWORD)j == BytesTransferred);
+        Success = CloseHandle(Handle);
+        ASSERT(Success);
+    }
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1\\*",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    Handle = FindFirstFileW(FilePath, &FindData);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+    FileCount = 0;
+    do
+    {
+        FileCount++;
+    } while (FindNextFileW(Handle, &FindData));
+    ASSERT(ERROR_NO_MORE_FILES == GetLastError());
+    Success = FindClose(Handle);
+    ASSERT(Success);
+    ASSERT(12 == FileCount);
+
+    /* attributes after a listing must match what the files really are */
+    for (int j = 1; 10 >= j; j++)
+    {
+        StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1\\file%d",
+            Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs), j);
+        Success = GetFileAttributesExW(FilePath, GetFileExInfoStandard, &AttributeData);
+        ASSERT(Success);
+        ASSERT(0 == (AttributeData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY));
+        ASSERT(0 == AttributeData.nFileSizeHigh);
+        ASSERT((DWORD)j == AttributeData.nFileSizeLow);
+    }
+
+    /* a file that is changed through a handle must not report its listed size */
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1\\file3",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    Handle = CreateFileW(FilePath, GENERIC_ALL, 0, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+    Success = WriteFile(Handle, Buffer, sizeof Buffer, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(sizeof Buffer == BytesTransferred);
+    Success = CloseHandle(Handle);
+    ASSERT(Success);
+    Success = GetFileAttributesExW(FilePath, GetFileExInfoStandard, &AttributeData);
+    ASSERT(Success);
+    ASSERT(sizeof Buffer == AttributeData.nFileSizeLow);
+
+    /* renamed and deleted files must not be reported under their listed names */
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1\\file4",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    StringCbPrintfW(FilePath2, sizeof FilePath2, L"%s%s\\dir1\\file4x",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    Success = MoveFileExW(FilePath, FilePath2, 0);
+    ASSERT(Success);
+    Success = GetFileAttributesExW(FilePath, GetFileExInfoStandard, &AttributeData);
+    ASSERT(!Success);
+    ASSERT(ERROR_FILE_NOT_FOUND == GetLastError());
+    Success = GetFileAttributesExW(FilePath2, GetFileExInfoStandard, &AttributeData);
+    ASSERT(Success);
+    ASSERT(4 == AttributeData.nFileSizeLow);
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1\\file5",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    Success = DeleteFileW(FilePath);
+    ASSERT(Success);
+    Success = GetFileAttributesExW(FilePath, GetFileExInfoStandard, &AttributeData);
+    ASSERT(!Success);
+    ASSERT(ERROR_FILE_NOT_FOUND == GetLastError());
+
+    for (int j = 1; 10 >= j; j++)
+    {
+        StringCbPrintfW(FilePath, sizeof FilePath, 4 == j ?
+            L"%s%s\\dir1\\file%dx" : L"%s%s\\dir1\\file%d",
+            Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs), j);
+        Success = DeleteFileW(FilePath);
+        ASSERT(Success || 5 == j);
+    }
+
+    StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\dir1",
+        Prefix ? L"" : L"\\\\?\\GLOBALROOT", Prefix ? Prefix : memfs_volumename(memfs));
+    Success = RemoveDirectoryW(FilePath);
+    ASSERT(Success);
+
+    memfs_stop(memfs);
+}
+
+void querydir_statahead_test(void)
+{
+    if (NtfsTests)
+    {
+        WCHAR DirBuf[MAX_PATH] = L"\\\\?\\";
+        GetCurrentDirectoryW(MAX_PATH - 4, DirBuf + 4);
+        querydir_statahead_dotest(-1, DirBuf, 0);
+    }
+    if (WinFspDiskTests)
+    {
+        querydir_statahead_dotest(MemfsDisk, 0, 0);
+        querydir_statahead_dotest(MemfsDisk, 0, 1000);
+    }
+    if (WinFspNetTests)
+    {
+        querydir_statahead_dotest(MemfsNet, L"\\\\memfs\\share", 0);
+        querydir_statahead_dotest(MemfsNet, L"\\\\memfs\\share", 1000);
+    }
+}
+
 static unsigned __stdcall dirnotify_dotest_thread(void *FilePath)
 {
     FspDebugLog(__FUNCTION__ ": \"%S\"\n", FilePath);
@@ -337,5 +509,6 @@ void dirctl_tests(void)
 {
     TEST(querydir_test);
     TEST(querydir_expire_cache_test);
+    TEST(querydir_statahead_test);
     TEST(dirnotify_test);
 }
@@ -0,0 +1,698 @@
+#include <winfsp/winfsp.h>
+#include <fuse/fuse.h>
+#include <tlib/testsuite.h>
+#include <strsafe.h>
+#include <string.h>
+#include "memfs.h"
+
+/*
+ * Loopback tests.
+ *
+ * These tests produce FSP_FSCTL_TRANSACT_REQ streams using the same layout as the FSD
+ * and replay them in-process against MEMFS using FspFileSystemLoopbackTransact. They
+ * exercise the request marshalling, the FspFileSystemOp* layer and the file system without
+ * any kernel transitions, which makes them useful for benchmarking user mode costs.
+ *
+ * The FUSE tests replay requests in the same way against a small in-memory FUSE file
+ * system, which allows them to observe the getattr calls of the FUSE layer.
+ */
+
+/* exported by the WinFsp DLL for testing; not declared in the public headers */
+FSP_API NTSTATUS FspFileSystemLoopbackTransact(FSP_FILE_SYSTEM *FileSystem,
+    PVOID RequestBuf, SIZE_T RequestBufSize,
+    PVOID ResponseBuf, SIZE_T *PResponseBufSize);
+FSP_FUSE_API NTSTATUS fsp_fuse_loopback_start(struct fsp_fuse_env *env,
+    struct fuse *f, FSP_FILE_SYSTEM **PFileSystem);
+
+#define LOOPBACK_BATCH                  16
+#define LOOPBACK_REQUEST_BUF_SIZE       (4 * LOOPBACK_BATCH * FSP_FSCTL_TRANSACT_REQ_SIZEMAX)
+#define LOOPBACK_RESPONSE_BUF_SIZE      (4 * LOOPBACK_BATCH * FSP_FSCTL_TRANSACT_RSP_SIZEMAX)
+#define LOOPBACK_DATA_SIZE              4096
+
+typedef struct
+{
+    FSP_FILE_SYSTEM *FileSystem;
+    HANDLE AccessToken;
+    BOOLEAN HasTraversePrivilege;
+    PUINT8 RequestBuf, ResponseBuf;
+    FSP_FSCTL_TRANSACT_REQ *Request;
+    SIZE_T ResponseBufSize;
+    ULONG TransactCount, RequestCount;
+} LOOPBACK;
+
+static void loopback_init(LOOPBACK *Loopback, FSP_FILE_SYSTEM *FileSystem)
+{
+    HANDLE ProcessToken;
+    BOOL Success;
+
+    memset(Loopback, 0, sizeof *Loopback);
+    Loopback->FileSystem = FileSystem;
+    Loopback->HasTraversePrivilege = TRUE;
+
+    /* the FSD sends an impersonation token to the file system; do the same */
+    Success = OpenProcessToken(GetCurrentProcess(), TOKEN_DUPLICATE | TOKEN_QUERY, &ProcessToken);
+    ASSERT(Success);
+    Success = DuplicateToken(ProcessToken, SecurityImpersonation, &Loopback->AccessToken);
+    ASSERT(Success);
+    CloseHandle(ProcessToken);
+
+    Loopback->RequestBuf = _aligned_malloc(LOOPBACK_REQUEST_BUF_SIZE, 16);
+    Loopback->ResponseBuf = _aligned_malloc(LOOPBACK_RESPONSE_BUF_SIZE, 16);
+    ASSERT(0 != Loopback->RequestBuf && 0 != Loopback->ResponseBuf);
+
+    Loopback->Request = (PVOID)Loopback->RequestBuf;
+}
+
+static void loopback_fini(LOOPBACK *Loopback)
+{
+    _aligned_free(Loopback->ResponseBuf);
+    _aligned_free(Loopback->RequestBuf);
+    CloseHandle(Loopback->AccessToken);
+}
+
+static FSP_FSCTL_TRANSACT_REQ *loopback_request(LOOPBACK *Loopback,
+    UINT32 Kind, UINT64 Hint, PWSTR FileName, PWSTR ExtraName)
+{
+    FSP_FSCTL_TRANSACT_REQ *Request = Loopback->Request;
+    SIZE_T FileNameSize = 0 != FileName ? (wcslen(FileName) + 1) * sizeof(WCHAR) : 0;
+    SIZE_T ExtraNameSize = 0 != ExtraName ? (wcslen(ExtraName) + 1) * sizeof(WCHAR) : 0;
+
+    ASSERT(FspFsctlTransactCanProduceRequest(Request,
+        Loopback->RequestBuf + LOOPBACK_REQUEST_BUF_SIZE));
+
+    memset(Request, 0, sizeof *Request);
+    Request->Size = (UINT16)(sizeof *Request +
+        FSP_FSCTL_DEFAULT_ALIGN_UP(FileNameSize) + ExtraNameSize);
+    Request->Kind = Kind;
+    Request->Hint = Hint;
+    if (0 != FileName)
+    {
+        memcpy(Request->Buffer, FileName, FileNameSize);
+        Request->FileName.Offset = 0;
+        Request->FileName.Size = (UINT16)FileNameSize;
+    }
+    if (0 != ExtraName)
+        memcpy(Request->Buffer + FSP_FSCTL_DEFAULT_ALIGN_UP(FileNameSize), ExtraName, ExtraNameSize);
+
+    Loopback->Request = FspFsctlTransactProduceRequest(Request, Request->Size);
+    Loopback->RequestCount++;
+
+    return Request;
+}
+
+static void loopback_create(LOOPBACK *Loopback, UINT64 Hint, PWSTR FileName,
+    UINT32 Disposition, UINT32 CreateOptions)
+{
+    FSP_FSCTL_TRANSACT_REQ *Request;
+
+    Request = loopback_request(Loopback, FspFsctlTransactCreateKind, Hint, FileName, 0);
+    Request->Req.Create.CreateOptions = (Disposition << 24) | CreateOptions;
+    Request->Req.Create.FileAttributes = FILE_ATTRIBUTE_NORMAL;
+    Request->Req.Create.AccessToken = (UINT_PTR)Loopback->AccessToken;
+    Request->Req.Create.DesiredAccess = FILE_GENERIC_READ | FILE_GENERIC_WRITE | DELETE;
+    Request->Req.Create.ShareAccess = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    Request->Req.Create.UserMode = 1;
+    Request->Req.Create.HasTraversePrivilege = Loopback->HasTraversePrivilege;
+}
+
+static void loopback_rdwr(LOOPBACK *Loopback, UINT32 Kind, UINT64 Hint,
+    UINT64 UserContext, UINT64 UserContext2, PVOID Buffer, UINT64 Offset, UINT32 Length)
+{
+    FSP_FSCTL_TRANSACT_REQ *Request;
+
+    Request = loopback_request(Loopback, Kind, Hint, 0, 0);
+    if (FspFsctlTransactReadKind == Kind)
+    {
+        Request->Req.Read.UserContext = UserContext;
+        Request->Req.Read.UserContext2 = UserContext2;
+        Request->Req.Read.Address = (UINT_PTR)Buffer;
+        Request->Req.Read.Offset = Offset;
+        Request->Req.Read.Length = Length;
+    }
+    else
+    {
+        Request->Req.Write.UserContext = UserContext;
+        Request->Req.Write.UserContext2 = UserContext2;
+        Request->Req.Write.Address = (UINT_PTR)Buffer;
+        Request->Req.Write.Offset = Offset;
+        Request->Req.Write.Length = Length;
+    }
+}
+
+static void loopback_close(LOOPBACK *Loopback, UINT64 Hint, PWSTR FileName,
+    UINT64 UserContext, UINT64 UserContext2, BOOLEAN Delete)
+{
+    FSP_FSCTL_TRANSACT_REQ *Request;
+
+    Request = loopback_request(Loopback, FspFsctlTransactCleanupKind, Hint, FileName, 0);
+    Request->Req.Cleanup.UserContext = UserContext;
+    Request->Req.Cleanup.UserContext2 = UserContext2;
+    Request->Req.Cleanup.Delete = Delete;
+
+    Request = loopback_request(Loopback, FspFsctlTransactCloseKind, Hint, 0, 0);
+    Request->Req.Close.UserContext = UserContext;
+    Request->Req.Close.UserContext2 = UserContext2;
+}
+
+static void loopback_rename(LOOPBACK *Loopback, UINT64 Hint,
+    UINT64 UserContext, UINT64 UserContext2, PWSTR FileName, PWSTR NewFileName)
+{
+    FSP_FSCTL_TRANSACT_REQ *Request;
+
+    Request = loopback_request(Loopback, FspFsctlTransactSetInformationKind, Hint,
+        FileName, NewFileName);
+    Request->Req.SetInformation.UserContext = UserContext;
+    Request->Req.SetInformation.UserContext2 = UserContext2;
+    Request->Req.SetInformation.FileInformationClass = 10/*FileRenameInformation*/;
+    Request->Req.SetInformation.Info.Rename.NewFileName.Offset =
+        FSP_FSCTL_DEFAULT_ALIGN_UP(Request->FileName.Size);
+    Request->Req.SetInformation.Info.Rename.NewFileName.Size =
+        (UINT16)((wcslen(NewFileName) + 1) * sizeof(WCHAR));
+}
+
+static void loopback_queryinfo(LOOPBACK *Loopback, UINT64 Hint,
+    UINT64 UserContext, UINT64 UserContext2)
+{
+    FSP_FSCTL_TRANSACT_REQ *Request;
+
+    Request = loopback_request(Loopback, FspFsctlTransactQueryInformationKind, Hint, 0, 0);
+    Request->Req.QueryInformation.UserContext = UserContext;
+    Request->Req.QueryInformation.UserContext2 = UserContext2;
+}
+
+static void loopback_querydir(LOOPBACK *Loopback, UINT64 Hint,
+    UINT64 UserContext, UINT64 UserContext2, PVOID Buffer, UINT64 Offset, UINT32 Length)
+{
+    FSP_FSCTL_TRANSACT_REQ *Request;
+
+    Request = loopback_request(Loopback, FspFsctlTransactQueryDirectoryKind, Hint, 0, 0);
+    Request->Req.QueryDirectory.UserContext = UserContext;
+    Request->Req.QueryDirectory.UserContext2 = UserContext2;
+    Request->Req.QueryDirectory.Address = (UINT_PTR)Buffer;
+    Request->Req.QueryDirectory.Offset = Offset;
+    Request->Req.QueryDirectory.Length = Length;
+}
+
+static FSP_FSCTL_TRANSACT_RSP *loopback_transact(LOOPBACK *Loopback)
+{
+    NTSTATUS Result;
+
+    Loopback->ResponseBufSize = LOOPBACK_RESPONSE_BUF_SIZE;
+    Result = FspFileSystemLoopbackTransact(Loopback->FileSystem,
+        Loopback->RequestBuf, (PUINT8)Loopback->Request - Loopback->RequestBuf,
+        Loopback->ResponseBuf, &Loopback->ResponseBufSize);
+    ASSERT(NT_SUCCESS(Result));
+
+    Loopback->Request = (PVOID)Loopback->RequestBuf;
+    Loopback->TransactCount++;
+
+    return (PVOID)Loopback->ResponseBuf;
+}
+
+static FSP_FSCTL_TRANSACT_RSP *loopback_next_response(LOOPBACK *Loopback,
+    FSP_FSCTL_TRANSACT_RSP *Response)
+{
+    return FspFsctlTransactConsumeResponse(Response,
+        Loopback->ResponseBuf + Loopback->ResponseBufSize);
+}
+
+static void loopback_dotest(ULONG FileCount, BOOLEAN Report)
+{
+    MEMFS *Memfs;
+    LOOPBACK Loopback;
+    NTSTATUS Result;
+    FSP_FSCTL_TRANSACT_RSP *Response, *NextResponse;
+    UINT64 UserContext[LOOPBACK_BATCH], UserContext2[LOOPBACK_BATCH];
+    UINT64 RootUserContext, RootUserContext2, Offset;
+    WCHAR FileName[64], NewFileName[64];
+    PUINT8 DataBuf, DirBuf;
+    ULONG Batch, DirEntryCount;
+    LARGE_INTEGER Frequency, Start, End;
+
+    Result = MemfsCreate(MemfsDisk, INFINITE, FileCount + 16, 1024 * 1024, 0, 0, &Memfs);
+    ASSERT(NT_SUCCESS(Result));
+    ASSERT(0 != Memfs);
+
+    loopback_init(&Loopback, MemfsFileSystem(Memfs));
+
+    DataBuf = _aligned_malloc(LOOPBACK_DATA_SIZE, 16);
+    DirBuf = _aligned_malloc(LOOPBACK_DATA_SIZE, 16);
+    ASSERT(0 != DataBuf && 0 != DirBuf);
+    memset(DataBuf, 'A', LOOPBACK_DATA_SIZE);
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+
+    /* create/write/read/rename/close files in batches */
+    for (ULONG I = 0; FileCount > I; I += LOOPBACK_BATCH)
+    {
+        Batch = FileCount - I < LOOPBACK_BATCH ? FileCount - I : LOOPBACK_BATCH;
+
+        for (ULONG J = 0; Batch > J; J++)
+        {
+            StringCbPrintfW(FileName, sizeof FileName, L"\\file%u", I + J);
+            loopback_create(&Loopback, J, FileName, FILE_CREATE, FILE_NON_DIRECTORY_FILE);
+        }
+        Response = loopback_transact(&Loopback);
+        for (ULONG J = 0; Batch > J; J++)
+        {
+            NextResponse = loopback_next_response(&Loopback, Response);
+            ASSERT(0 != NextResponse);
+            ASSERT(FspFsctlTransactCreateKind == Response->Kind);
+            ASSERT(J == Response->Hint);
+            ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+            ASSERT(FILE_CREATED == Response->IoStatus.Information);
+            UserContext[J] = Response->Rsp.Create.Opened.UserContext;
+            UserContext2[J] = Response->Rsp.Create.Opened.UserContext2;
+            Response = NextResponse;
+        }
+
+        for (ULONG J = 0; Batch > J; J++)
+            loopback_rdwr(&Loopback, FspFsctlTransactWriteKind, J,
+                UserContext[J], UserContext2[J], DataBuf, 0, LOOPBACK_DATA_SIZE);
+        for (ULONG J = 0; Batch > J; J++)
+            loopback_rdwr(&Loopback, FspFsctlTransactReadKind, J,
+                UserContext[J], UserContext2[J], DataBuf, 0, LOOPBACK_DATA_SIZE);
+        for (ULONG J = 0; Batch > J; J++)
+        {
+            StringCbPrintfW(FileName, sizeof FileName, L"\\file%u", I + J);
+            StringCbPrintfW(NewFileName, sizeof NewFileName, L"\\renamed%u", I + J);
+            loopback_rename(&Loopback, J, UserContext[J], UserContext2[J], FileName, NewFileName);
+        }
+        Response = loopback_transact(&Loopback);
+        for (ULONG J = 0; 3 * Batch > J; J++)
+        {
+            NextResponse = loopback_next_response(&Loopback, Response);
+            ASSERT(0 != NextResponse);
+            ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+            if (FspFsctlTransactWriteKind == Response->Kind ||
+                FspFsctlTransactReadKind == Response->Kind)
+                ASSERT(LOOPBACK_DATA_SIZE == Response->IoStatus.Information);
+            Response = NextResponse;
+        }
+
+        for (ULONG J = 0; Batch > J; J++)
+        {
+            StringCbPrintfW(FileName, sizeof FileName, L"\\renamed%u", I + J);
+            loopback_close(&Loopback, J, FileName, UserContext[J], UserContext2[J], FALSE);
+        }
+        Response = loopback_transact(&Loopback);
+        for (ULONG J = 0; 2 * Batch > J; J++)
+        {
+            NextResponse = loopback_next_response(&Loopback, Response);
+            ASSERT(0 != NextResponse);
+            ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+            Response = NextResponse;
+        }
+    }
+
+    /* list the root directory */
+    loopback_create(&Loopback, 0, L"\\", FILE_OPEN, FILE_DIRECTORY_FILE);
+    Response = loopback_transact(&Loopback);
+    ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+    RootUserContext = Response->Rsp.Create.Opened.UserContext;
+    RootUserContext2 = Response->Rsp.Create.Opened.UserContext2;
+
+    DirEntryCount = 0;
+    Offset = 0;
+    for (;;)
+    {
+        FSP_FSCTL_DIR_INFO *DirInfo;
+        PUINT8 DirBufEnd;
+        BOOLEAN Done = FALSE;
+
+        loopback_querydir(&Loopback, 0, RootUserContext, RootUserContext2,
+            DirBuf, Offset, LOOPBACK_DATA_SIZE);
+        Response = loopback_transact(&Loopback);
+        ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+
+        DirBufEnd = DirBuf + Response->IoStatus.Information;
+        for (DirInfo = (PVOID)DirBuf;
+            (PUINT8)DirInfo + sizeof(DirInfo->Size) <= DirBufEnd;
+            DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size)))
+        {
+            if (0 == DirInfo->Size)
+            {
+                /* end of directory marker */
+                Done = TRUE;
+                break;
+            }
+
+            DirEntryCount++;
+            Offset = DirInfo->NextOffset;
+        }
+
+        if (Done || 0 == Response->IoStatus.Information)
+            break;
+    }
+    ASSERT(FileCount <= DirEntryCount);
+
+    loopback_close(&Loopback, 0, L"\\", RootUserContext, RootUserContext2, FALSE);
+    loopback_transact(&Loopback);
+
+    QueryPerformanceCounter(&End);
+
+    if (Report)
+        tlib_printf("%lu requests in %lu transacts: %.0f requests/sec ",
+            Loopback.RequestCount, Loopback.TransactCount,
+            (double)Loopback.RequestCount * Frequency.QuadPart /
+                (End.QuadPart - Start.QuadPart + 1));
+
+    _aligned_free(DirBuf);
+    _aligned_free(DataBuf);
+
+    loopback_fini(&Loopback);
+
+    MemfsDelete(Memfs);
+}
+
+static void loopback_traverse_dotest(ULONG Depth, ULONG OpenCount, ULONG TraverseCacheTimeout,
+    BOOLEAN Report)
+{
+    MEMFS *Memfs;
+    LOOPBACK Loopback;
+    NTSTATUS Result;
+    FSP_FSCTL_TRANSACT_RSP *Response;
+    UINT64 UserContext, UserContext2;
+    WCHAR FileName[1024];
+    SIZE_T FileNameLength;
+    FSP_FILE_SYSTEM_STATISTICS Statistics;
+    LARGE_INTEGER Frequency, Start, End;
+
+    Result = MemfsCreate(MemfsDisk, INFINITE, Depth + 16, 1024 * 1024, 0, 0, &Memfs);
+    ASSERT(NT_SUCCESS(Result));
+    ASSERT(0 != Memfs);
+
+    Result = FspFileSystemSetTraverseCacheTimeout(MemfsFileSystem(Memfs), TraverseCacheTimeout);
+    ASSERT(NT_SUCCESS(Result));
+
+    loopback_init(&Loopback, MemfsFileSystem(Memfs));
+
+    /* create the directory tree while the caller still has the traverse privilege */
+    FileName[0] = L'\0';
+    for (ULONG I = 0; Depth > I; I++)
+    {
+        FileNameLength = wcslen(FileName);
+        StringCchPrintfW(FileName + FileNameLength, sizeof FileName / sizeof(WCHAR) - FileNameLength,
+            L"\\dir%u", I);
+        loopback_create(&Loopback, 0, FileName, FILE_CREATE, FILE_DIRECTORY_FILE);
+        Response = loopback_transact(&Loopback);
+        ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+        loopback_close(&Loopback, 0, FileName,
+            Response->Rsp.Create.Opened.UserContext, Response->Rsp.Create.Opened.UserContext2, FALSE);
+        loopback_transact(&Loopback);
+    }
+
+    /* every open of the deepest directory now checks all directories above it */
+    Loopback.HasTraversePrivilege = FALSE;
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+
+    for (ULONG I = 0; OpenCount > I; I++)
+    {
+        loopback_create(&Loopback, 0, FileName, FILE_OPEN, FILE_DIRECTORY_FILE);
+        Response = loopback_transact(&Loopback);
+        ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+        loopback_close(&Loopback, 0, FileName,
+            Response->Rsp.Create.Opened.UserContext, Response->Rsp.Create.Opened.UserContext2, FALSE);
+        loopback_transact(&Loopback);
+    }
+
+    QueryPerformanceCounter(&End);
+
+    FspFileSystemGetStatistics(MemfsFileSystem(Memfs), &Statistics);
+    if (0 != TraverseCacheTimeout)
+    {
+        ASSERT(Depth == Statistics.TraverseCacheMissCount);
+        ASSERT((OpenCount - 1) * Depth == Statistics.TraverseCacheHitCount);
+    }
+    else
+    {
+        ASSERT(0 == Statistics.TraverseCacheMissCount);
+        ASSERT(0 == Statistics.TraverseCacheHitCount);
+    }
+
+    /* a delete invalidates the traverse cache */
+    loopback_create(&Loopback, 0, L"\\victim", FILE_CREATE, FILE_NON_DIRECTORY_FILE);
+    Response = loopback_transact(&Loopback);
+    ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+    UserContext = Response->Rsp.Create.Opened.UserContext;
+    UserContext2 = Response->Rsp.Create.Opened.UserContext2;
+    loopback_close(&Loopback, 0, L"\\victim", UserContext, UserContext2, TRUE);
+    loopback_transact(&Loopback);
+
+    loopback_create(&Loopback, 0, FileName, FILE_OPEN, FILE_DIRECTORY_FILE);
+    Response = loopback_transact(&Loopback);
+    ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+    loopback_close(&Loopback, 0, FileName,
+        Response->Rsp.Create.Opened.UserContext, Response->Rsp.Create.Opened.UserContext2, FALSE);
+    loopback_transact(&Loopback);
+
+    FspFileSystemGetStatistics(MemfsFileSystem(Memfs), &Statistics);
+    if (0 != TraverseCacheTimeout)
+        ASSERT(2 * Depth == Statistics.TraverseCacheMissCount);
+
+    if (Report)
+        tlib_printf("depth %lu, traverse cache %s: %.0f opens/sec ",
+            Depth, 0 != TraverseCacheTimeout ? "on" : "off",
+            (double)OpenCount * Frequency.QuadPart / (End.QuadPart - Start.QuadPart + 1));
+
+    loopback_fini(&Loopback);
+
+    MemfsDelete(Memfs);
+}
+
+#define LOOPBACK_FUSE_FILE_COUNT        4
+
+static struct
+{
+    char Path[64];
+    fuse_off_t Size;
+} loopback_fuse_files[LOOPBACK_FUSE_FILE_COUNT];
+static volatile LONG loopback_fuse_getattr_count;
+
+static int loopback_fuse_find(const char *path)
+{
+    for (int I = 0; LOOPBACK_FUSE_FILE_COUNT > I; I++)
+        if (0 == strcmp(loopback_fuse_files[I].Path, path))
+            return I;
+    return -1;
+}
+
+static int loopback_fuse_getattr(const char *path, struct fuse_stat *stbuf)
+{
+    int I;
+
+    InterlockedIncrement(&loopback_fuse_getattr_count);
+
+    memset(stbuf, 0, sizeof *stbuf);
+    if (0 == strcmp("/", path))
+    {
+        stbuf->st_mode = 0040777;
+        stbuf->st_nlink = 2;
+        return 0;
+    }
+
+    I = loopback_fuse_find(path);
+    if (-1 == I)
+        return -ENOENT;
+
+    stbuf->st_ino = I + 2;
+    stbuf->st_mode = 0100777;
+    stbuf->st_nlink = 1;
+    stbuf->st_size = loopback_fuse_files[I].Size;
+    return 0;
+}
+
+static int loopback_fuse_create(const char *path, fuse_mode_t mode, struct fuse_file_info *fi)
+{
+    int I;
+
+    if (-1 != loopback_fuse_find(path))
+        return -EEXIST;
+    I = loopback_fuse_find("");
+    if (-1 == I)
+        return -ENOSPC;
+
+    StringCbCopyA(loopback_fuse_files[I].Path, sizeof loopback_fuse_files[I].Path, path);
+    loopback_fuse_files[I].Size = 0;
+    return 0;
+}
+
+static int loopback_fuse_write(const char *path, const char *buf, size_t size, fuse_off_t off,
+    struct fuse_file_info *fi)
+{
+    int I;
+
+    I = loopback_fuse_find(path);
+    if (-1 == I)
+        return -ENOENT;
+
+    if (loopback_fuse_files[I].Size < off + (fuse_off_t)size)
+        loopback_fuse_files[I].Size = off + size;
+    return (int)size;
+}
+
+static int loopback_fuse_rename(const char *oldpath, const char *newpath)
+{
+    int I;
+
+    if (-1 != loopback_fuse_find(newpath))
+        return -EEXIST;
+    I = loopback_fuse_find(oldpath);
+    if (-1 == I)
+        return -ENOENT;
+
+    StringCbCopyA(loopback_fuse_files[I].Path, sizeof loopback_fuse_files[I].Path, newpath);
+    return 0;
+}
+
+static NTSTATUS loopback_fuse_open(LOOPBACK *Loopback, PWSTR FileName, UINT32 Disposition,
+    PUINT64 PUserContext, PUINT64 PUserContext2, PUINT64 PFileSize)
+{
+    FSP_FSCTL_TRANSACT_RSP *Response;
+
+    loopback_create(Loopback, 0, FileName, Disposition, FILE_NON_DIRECTORY_FILE);
+    Response = loopback_transact(Loopback);
+    if (NT_SUCCESS(Response->IoStatus.Status))
+    {
+        *PUserContext = Response->Rsp.Create.Opened.UserContext;
+        *PUserContext2 = Response->Rsp.Create.Opened.UserContext2;
+        *PFileSize = Response->Rsp.Create.Opened.FileInfo.FileSize;
+    }
+
+    return Response->IoStatus.Status;
+}
+
+static void loopback_fuse_attr_cache_dotest(void)
+{
+    static char *argv[] = { "loopback-test", "-o", "attr_timeout=60,negative_timeout=60", 0 };
+    struct fuse_args args = FUSE_ARGS_INIT(3, argv);
+    struct fuse_operations ops;
+    struct fuse *f;
+    FSP_FILE_SYSTEM *FileSystem;
+    LOOPBACK Loopback;
+    NTSTATUS Result;
+    FSP_FSCTL_TRANSACT_RSP *Response;
+    UINT64 UserContext, UserContext2, FileSize;
+    PUINT8 DataBuf;
+    LONG GetattrCount;
+
+    memset(loopback_fuse_files, 0, sizeof loopback_fuse_files);
+
+    memset(&ops, 0, sizeof ops);
+    ops.getattr = loopback_fuse_getattr;
+    ops.create = loopback_fuse_create;
+    ops.write = loopback_fuse_write;
+    ops.rename = loopback_fuse_rename;
+
+    f = fuse_new(0, &args, &ops, sizeof ops, 0);
+    ASSERT(0 != f);
+
+    Result = fsp_fuse_loopback_start(fsp_fuse_env(), f, &FileSystem);
+    ASSERT(NT_SUCCESS(Result));
+
+    loopback_init(&Loopback, FileSystem);
+
+    DataBuf = _aligned_malloc(LOOPBACK_DATA_SIZE, 16);
+    ASSERT(0 != DataBuf);
+    memset(DataBuf, 'A', LOOPBACK_DATA_SIZE);
+
+    /* a missing file is cached as a negative entry */
+    Result = loopback_fuse_open(&Loopback, L"\\file0", FILE_OPEN,
+        &UserContext, &UserContext2, &FileSize);
+    ASSERT(STATUS_OBJECT_NAME_NOT_FOUND == Result);
+    GetattrCount = loopback_fuse_getattr_count;
+    Result = loopback_fuse_open(&Loopback, L"\\file0", FILE_OPEN,
+        &UserContext, &UserContext2, &FileSize);
+    ASSERT(STATUS_OBJECT_NAME_NOT_FOUND == Result);
+    ASSERT(GetattrCount == loopback_fuse_getattr_count);
+
+    /* create drops the negative entry */
+    Result = loopback_fuse_open(&Loopback, L"\\file0", FILE_CREATE,
+        &UserContext, &UserContext2, &FileSize);
+    ASSERT(STATUS_SUCCESS == Result);
+    ASSERT(0 == FileSize);
+
+    /* attributes are served from the cache */
+    loopback_queryinfo(&Loopback, 0, UserContext, UserContext2);
+    GetattrCount = loopback_fuse_getattr_count;
+    Response = loopback_transact(&Loopback);
+    ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+    ASSERT(0 == Response->Rsp.QueryInformation.FileInfo.FileSize);
+    ASSERT(GetattrCount == loopback_fuse_getattr_count);
+
+    /* a write does not leave stale attributes behind */
+    loopback_rdwr(&Loopback, FspFsctlTransactWriteKind, 0,
+        UserContext, UserContext2, DataBuf, 0, LOOPBACK_DATA_SIZE);
+    Response = loopback_transact(&Loopback);
+    ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+    ASSERT(LOOPBACK_DATA_SIZE == Response->IoStatus.Information);
+    loopback_queryinfo(&Loopback, 0, UserContext, UserContext2);
+    Response = loopback_transact(&Loopback);
+    ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+    ASSERT(LOOPBACK_DATA_SIZE == Response->Rsp.QueryInformation.FileInfo.FileSize);
+
+    /* a rename does not leave stale attributes behind for either name */
+    Result = loopback_fuse_open(&Loopback, L"\\file1", FILE_OPEN,
+        &UserContext, &UserContext2, &FileSize);
+    ASSERT(STATUS_OBJECT_NAME_NOT_FOUND == Result);
+    loopback_rename(&Loopback, 0, UserContext, UserContext2, L"\\file0", L"\\file1");
+    Response = loopback_transact(&Loopback);
+    ASSERT(STATUS_SUCCESS == Response->IoStatus.Status);
+    loopback_close(&Loopback, 0, L"\\file1", UserContext, UserContext2, FALSE);
+    loopback_transact(&Loopback);
+
+    Result = loopback_fuse_open(&Loopback, L"\\file0", FILE_OPEN,
+        &UserContext, &UserContext2, &FileSize);
+    ASSERT(STATUS_OBJECT_NAME_NOT_FOUND == Result);
+    Result = loopback_fuse_open(&Loopback, L"\\file1", FILE_OPEN,
+        &UserContext, &UserContext2, &FileSize);
+    ASSERT(STATUS_SUCCESS == Result);
+    ASSERT(LOOPBACK_DATA_SIZE == FileSize);
+    loopback_close(&Loopback, 0, L"\\file1", UserContext, UserContext2, FALSE);
+    loopback_transact(&Loopback);
+
+    _aligned_free(DataBuf);
+
+    loopback_fini(&Loopback);
+
+    fuse_destroy(f);
+}
+
+void loopback_test(void)
+{
+    loopback_dotest(100, FALSE);
+}
+
+void loopback_bench_test(void)
+{
+    loopback_dotest(10000, TRUE);
+}
+
+void loopback_traverse_test(void)
+{
+    loopback_traverse_dotest(12, 100, 0, FALSE);
+    loopback_traverse_dotest(12, 100, INFINITE, FALSE);
+}
+
+void loopback_traverse_bench_test(void)
+{
+    loopback_traverse_dotest(12, 10000, 0, TRUE);
+    loopback_traverse_dotest(12, 10000, INFINITE, TRUE);
+}
+
+void loopback_fuse_attr_cache_test(void)
+{
+    loopback_fuse_attr_cache_dotest();
+}
+
+void loopback_tests(void)
+{
+    TEST(loopback_test);
+    TEST_OPT(loopback_bench_test);
+    TEST(loopback_traverse_test);
+    TEST_OPT(loopback_traverse_bench_test);
+    TEST(loopback_fuse_attr_cache_test);
+}
@@ -1,6 +1,7 @@
 #include <winfsp/winfsp.h>
 #include <tlib/testsuite.h>
 #include <process.h>
+#include <strsafe.h>
 #include "memfs.h"
 
 extern int WinFspDiskTests;
@@ -15,7 +16,7 @@ void *memfs_start_ex(ULONG Flags, ULONG FileInfoTimeout)
     NTSTATUS Result;
 
     Result = MemfsCreate(Flags, FileInfoTimeout, 1024, 1024 * 1024,
-        MemfsNet == Flags ? L"\\memfs\\share" : 0, 0, &Memfs);
+        (Flags & MemfsNet) ? L"\\memfs\\share" : 0, 0, &Memfs);
     ASSERT(NT_SUCCESS(Result));
     ASSERT(0 != Memfs);
 
@@ -63,7 +64,125 @@ void memfs_test(void)
         memfs_dotest(MemfsNet);
 }
 
+struct memfs_batch_dotest_data
+{
+    PWSTR Prefix;
+    PWSTR VolumeName;
+    ULONG Index;
+};
+
+static unsigned __stdcall memfs_batch_dotest_thread(void *Data0)
+{
+    struct memfs_batch_dotest_data *Data = Data0;
+    HANDLE Handle;
+    WCHAR FilePath[MAX_PATH];
+
+    for (ULONG I = 0; 100 > I; I++)
+    {
+        StringCbPrintfW(FilePath, sizeof FilePath, L"%s%s\\file%u.%u",
+            Data->Prefix ? L"" : L"\\\\?\\GLOBALROOT", Data->Prefix ? Data->Prefix : Data->VolumeName,
+            Data->Index, I);
+
+        Handle = CreateFileW(FilePath,
+            GENERIC_ALL, 0, 0, CREATE_NEW, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, 0);
+        if (INVALID_HANDLE_VALUE == Handle)
+            return GetLastError();
+        CloseHandle(Handle);
+    }
+
+    return 0;
+}
+
+static volatile LONG memfs_batch_scaling_count;
+
+static VOID memfs_batch_scaling(FSP_FILE_SYSTEM *FileSystem, LONG ThreadCount, BOOLEAN Grow)
+{
+    InterlockedIncrement(&memfs_batch_scaling_count);
+}
+
+static void memfs_batch_dotest(ULONG Flags, PWSTR Prefix, ULONG BatchSize, ULONG ResponseQueueDelay,
+    ULONG ThreadCountMax)
+{
+    MEMFS *Memfs;
+    NTSTATUS Result;
+    struct memfs_batch_dotest_data Data[8];
+    HANDLE Threads[8];
+    DWORD ExitCode;
+    FSP_FILE_SYSTEM_STATISTICS Statistics;
+
+    Result = MemfsCreate(Flags, 1000, 1024, 1024 * 1024,
+        (Flags & MemfsNet) ? L"\\memfs\\share" : 0, 0, &Memfs);
+    ASSERT(NT_SUCCESS(Result));
+    ASSERT(0 != Memfs);
+
+    Result = FspFileSystemSetDispatcherBatchSize(MemfsFileSystem(Memfs), BatchSize);
+    ASSERT(NT_SUCCESS(Result));
+
+    Result = FspFileSystemSetResponseQueueDelay(MemfsFileSystem(Memfs), ResponseQueueDelay);
+    ASSERT(NT_SUCCESS(Result));
+
+    Result = FspFileSystemSetDispatcherThreadCountMax(MemfsFileSystem(Memfs), ThreadCountMax, 0);
+    ASSERT(NT_SUCCESS(Result));
+    FspFileSystemSetDispatcherScaling(MemfsFileSystem(Memfs), memfs_batch_scaling);
+
+    Result = MemfsStart(Memfs);
+    ASSERT(NT_SUCCESS(Result));
+
+    Result = FspFileSystemSetDispatcherBatchSize(MemfsFileSystem(Memfs), BatchSize);
+    ASSERT(STATUS_INVALID_PARAMETER == Result);
+
+    for (ULONG I = 0; sizeof Threads / sizeof Threads[0] > I; I++)
+    {
+        Data[I].Prefix = Prefix;
+        Data[I].VolumeName = MemfsFileSystem(Memfs)->VolumeName;
+        Data[I].Index = I;
+        Threads[I] = (HANDLE)_beginthreadex(0, 0, memfs_batch_dotest_thread, &Data[I], 0, 0);
+        ASSERT(0 != Threads[I]);
+    }
+
+    WaitForMultipleObjects(sizeof Threads / sizeof Threads[0], Threads, TRUE, INFINITE);
+
+    for (ULONG I = 0; sizeof Threads / sizeof Threads[0] > I; I++)
+    {
+        GetExitCodeThread(Threads[I], &ExitCode);
+        CloseHandle(Threads[I]);
+
+        ASSERT(ERROR_SUCCESS == ExitCode);
+    }
+
+    FspFileSystemGetStatistics(MemfsFileSystem(Memfs), &Statistics);
+    ASSERT(sizeof Threads / sizeof Threads[0] * 100 <=
+        Statistics.Operations[FspFsctlTransactCreateKind].Count);
+    ASSERT(0 < Statistics.TransactCount);
+
+    if (0 != ThreadCountMax)
+        ASSERT(FspFileSystemDispatcherThreadActiveCount(MemfsFileSystem(Memfs)) <=
+            MemfsFileSystem(Memfs)->DispatcherThreadCountMax);
+
+    MemfsStop(Memfs);
+    MemfsDelete(Memfs);
+}
+
+void memfs_batch_test(void)
+{
+    if (WinFspDiskTests)
+    {
+        memfs_batch_dotest(MemfsDisk, 0, 1, 0, 0);
+        memfs_batch_dotest(MemfsDisk, 0, 16, 0, 0);
+        memfs_batch_dotest(MemfsDisk, 0, 16, 10, 0);
+        memfs_batch_dotest(MemfsDisk, 0, 0, 0, 16);
+    }
+    if (WinFspNetTests)
+    {
+        memfs_batch_dotest(MemfsNet, L"\\\\memfs\\share", 1, 0, 0);
+        memfs_batch_dotest(MemfsNet, L"\\\\memfs\\share", 16, 0, 0);
+        memfs_batch_dotest(MemfsNet, L"\\\\memfs\\share", 16, 10, 0);
+        memfs_batch_dotest(MemfsNet, L"\\\\memfs\\share", 0, 0, 16);
+    }
+}
+
 void memfs_tests(void)
 {
     TEST(memfs_test);
+    TEST(memfs_batch_test);
 }
@@ -74,6 +74,54 @@ void mount_create_volume_test(void)
         mount_create_volume_dotest(L"WinFsp.Net");
 }
 
+void mount_volume_statistics_dotest(PWSTR DeviceName)
+{
+    NTSTATUS Result;
+    BOOL Success;
+    FSP_FSCTL_VOLUME_PARAMS VolumeParams = { 0 };
+    FSP_FSCTL_VOLUME_STATISTICS Statistics;
+    WCHAR VolumeName[MAX_PATH];
+    HANDLE VolumeHandle;
+
+    VolumeParams.SectorSize = 16384;
+    VolumeParams.VolumeSerialNumber = 0x12345678;
+    VolumeParams.FileInfoTimeout = 1000;
+    VolumeParams.SecurityCacheSize = 1; /* out of range; driver uses default */
+    VolumeParams.DirInfoCacheSize = FspFsctlDirInfoCacheSizeMinimum;
+    wcscpy_s(VolumeParams.Prefix, sizeof VolumeParams.Prefix / sizeof(WCHAR), L"\\winfsp-tests\\share");
+    Result = FspFsctlCreateVolume(DeviceName, &VolumeParams,
+        VolumeName, sizeof VolumeName, &VolumeHandle);
+    ASSERT(STATUS_SUCCESS == Result);
+    ASSERT(INVALID_HANDLE_VALUE != VolumeHandle);
+
+    memset(&Statistics, 0xff, sizeof Statistics);
+    Result = FspFsctlGetVolumeStatistics(VolumeHandle, &Statistics);
+    ASSERT(STATUS_SUCCESS == Result);
+    ASSERT(0 == Statistics.SecurityCache.HitCount);
+    ASSERT(0 == Statistics.SecurityCache.MissCount);
+    ASSERT(0 == Statistics.SecurityCache.EvictionCount);
+    ASSERT(0 == Statistics.SecurityCache.ItemCount);
+    ASSERT(0 == Statistics.SecurityCache.Size);
+    ASSERT(FspFsctlSecurityCacheSizeDefault == Statistics.SecurityCache.SizeMax);
+    ASSERT(0 == Statistics.DirInfoCache.ItemCount);
+    ASSERT(FspFsctlDirInfoCacheSizeMinimum == Statistics.DirInfoCache.SizeMax);
+    ASSERT(0 == Statistics.NegativeNameCache.ItemCount);
+    ASSERT(0 != Statistics.NegativeNameCache.SizeMax);
+    ASSERT(0 == Statistics.StatAheadCache.ItemCount);
+    ASSERT(0 != Statistics.StatAheadCache.SizeMax);
+
+    Success = CloseHandle(VolumeHandle);
+    ASSERT(Success);
+}
+
+void mount_volume_statistics_test(void)
+{
+    if (WinFspDiskTests)
+        mount_volume_statistics_dotest(L"WinFsp.Disk");
+    if (WinFspNetTests)
+        mount_volume_statistics_dotest(L"WinFsp.Net");
+}
+
 static unsigned __stdcall mount_volume_cancel_dotest_thread(void *FilePath)
 {
     FspDebugLog(__FUNCTION__ ": \"%S\"\n", FilePath);
@@ -261,6 +309,7 @@ void mount_tests(void)
     TEST(mount_invalid_test);
     TEST(mount_open_device_test);
     TEST(mount_create_volume_test);
+    TEST(mount_volume_statistics_test);
     TEST(mount_volume_cancel_test);
     TEST(mount_volume_transact_test);
 }
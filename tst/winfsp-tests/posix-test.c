@@ -87,7 +87,7 @@ void posix_map_sid_test(void)
     PTOKEN_PRIMARY_GROUP GroupInfo;
     DWORD InfoSize;
     PSID Sid0, Sid1;
-    UINT32 Uid;
+    UINT32 Uid, CachedUid;
 
     Success = OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &Token);
     ASSERT(Success);
@@ -135,6 +135,11 @@ void posix_map_sid_test(void)
         if (0 != map[i].Uid)
             ASSERT(Uid == map[i].Uid);
 
+        /* second mapping of the same SID is served from the SID to UID cache */
+        Result = FspPosixMapSidToUid(Sid0, &CachedUid);
+        ASSERT(NT_SUCCESS(Result));
+        ASSERT(CachedUid == Uid);
+
         Result = FspPosixMapUidToSid(Uid, &Sid1);
         ASSERT(NT_SUCCESS(Result));
 
@@ -937,6 +937,23 @@ void rdwr_mixed_test(void)
     }
 }
 
+void rdwr_async_test(void)
+{
+    /* memfs completes Read/Write through FspFileSystemBeginAsyncOperation handles */
+    if (WinFspDiskTests)
+    {
+        rdwr_dotest(MemfsDisk | MemfsAsyncIo, 0, 0, 1000, FILE_FLAG_NO_BUFFERING);
+        rdwr_dotest(MemfsDisk | MemfsAsyncIo | MemfsResponseQueue, 0, 0, 1000, FILE_FLAG_NO_BUFFERING);
+        rdwr_overlapped_dotest(MemfsDisk | MemfsAsyncIo | MemfsResponseQueue, 0, 0, 1000, FILE_FLAG_NO_BUFFERING);
+    }
+    if (WinFspNetTests)
+    {
+        rdwr_dotest(MemfsNet | MemfsAsyncIo, L"\\\\memfs\\share", L"\\\\memfs\\share", 1000, FILE_FLAG_NO_BUFFERING);
+        rdwr_dotest(MemfsNet | MemfsAsyncIo | MemfsResponseQueue, L"\\\\memfs\\share", L"\\\\memfs\\share", 1000, FILE_FLAG_NO_BUFFERING);
+        rdwr_overlapped_dotest(MemfsNet | MemfsAsyncIo | MemfsResponseQueue, L"\\\\memfs\\share", L"\\\\memfs\\share", 1000, FILE_FLAG_NO_BUFFERING);
+    }
+}
+
 void rdwr_tests(void)
 {
     TEST(rdwr_noncached_test);
@@ -947,4 +964,5 @@ void rdwr_tests(void)
     TEST(rdwr_writethru_overlapped_test);
     TEST(rdwr_mmap_test);
     TEST(rdwr_mixed_test);
+    TEST(rdwr_async_test);
 }
@@ -247,8 +247,119 @@ void setsecurity_test(void)
     }
 }
 
+static HANDLE create_securitycache_token(PWSTR IntegritySddl)
+{
+    HANDLE ProcessToken, Token;
+    PSID IntegritySid;
+    TOKEN_MANDATORY_LABEL Label;
+    BOOL Success;
+
+    /* the FSD sends an impersonation token to the file system; do the same */
+    Success = OpenProcessToken(GetCurrentProcess(), TOKEN_DUPLICATE | TOKEN_QUERY, &ProcessToken);
+    ASSERT(Success);
+    Success = DuplicateTokenEx(ProcessToken,
+        TOKEN_QUERY | TOKEN_ADJUST_DEFAULT | TOKEN_IMPERSONATE | TOKEN_DUPLICATE, 0,
+        SecurityImpersonation, TokenImpersonation, &Token);
+    ASSERT(Success);
+    CloseHandle(ProcessToken);
+
+    if (0 != IntegritySddl)
+    {
+        Success = ConvertStringSidToSidW(IntegritySddl, &IntegritySid);
+        ASSERT(Success);
+        Label.Label.Sid = IntegritySid;
+        Label.Label.Attributes = SE_GROUP_INTEGRITY;
+        Success = SetTokenInformation(Token, TokenIntegrityLevel,
+            &Label, sizeof Label + GetLengthSid(IntegritySid));
+        ASSERT(Success);
+        LocalFree(IntegritySid);
+    }
+
+    return Token;
+}
+
+static void create_securitycache_dotest(HANDLE Token, PSECURITY_DESCRIPTOR ParentDescriptor,
+    PSECURITY_DESCRIPTOR *PReferenceDescriptor)
+{
+    union
+    {
+        FSP_FSCTL_TRANSACT_REQ V;
+        UINT8 B[FSP_FSCTL_TRANSACT_REQ_SIZEMAX];
+    } RequestBuf;
+    FSP_FSCTL_TRANSACT_REQ *Request = &RequestBuf.V;
+    PSECURITY_DESCRIPTOR SecurityDescriptor, ReferenceDescriptor;
+    NTSTATUS Result;
+    BOOL Success;
+
+    Success = CreatePrivateObjectSecurity(ParentDescriptor, 0, &ReferenceDescriptor,
+        FALSE, Token, FspGetFileGenericMapping());
+    ASSERT(Success);
+
+    memset(&RequestBuf, 0, sizeof RequestBuf);
+    Request->Size = sizeof *Request;
+    Request->Kind = FspFsctlTransactCreateKind;
+    Request->Req.Create.AccessToken = (UINT_PTR)Token;
+
+    /* the first create may miss the cache; the second one must hit it */
+    for (ULONG I = 0; 2 > I; I++)
+    {
+        Result = FspCreateSecurityDescriptor(0, Request, ParentDescriptor, &SecurityDescriptor);
+        ASSERT(STATUS_SUCCESS == Result);
+        ASSERT(GetSecurityDescriptorLength(ReferenceDescriptor) ==
+            GetSecurityDescriptorLength(SecurityDescriptor));
+        ASSERT(0 == memcmp(ReferenceDescriptor, SecurityDescriptor,
+            GetSecurityDescriptorLength(ReferenceDescriptor)));
+        FspDeleteSecurityDescriptor(SecurityDescriptor,
+            FspCreateSecurityDescriptor);
+    }
+
+    *PReferenceDescriptor = ReferenceDescriptor;
+}
+
+void create_securitycache_test(void)
+{
+    /*
+     * Create two files in the same directory under tokens that differ only in their
+     * integrity level. A creator below medium integrity gets a mandatory label, so the
+     * inherited security descriptor cache must not return one token's descriptor to
+     * the other.
+     */
+    static PWSTR ParentSddl = L"O:BAG:BAD:P(A;OICI;GA;;;SY)(A;OICI;GA;;;BA)(A;OICI;GA;;;WD)";
+    static PWSTR LowIntegritySddl = L"S-1-16-4096";
+    PSECURITY_DESCRIPTOR ParentDescriptor;
+    PSECURITY_DESCRIPTOR Descriptor1, Descriptor2;
+    HANDLE Token1, Token2;
+    BOOL Success;
+
+    Success = ConvertStringSecurityDescriptorToSecurityDescriptorW(ParentSddl, SDDL_REVISION_1,
+        &ParentDescriptor, 0);
+    ASSERT(Success);
+
+    Token1 = create_securitycache_token(0);
+    Token2 = create_securitycache_token(LowIntegritySddl);
+
+    create_securitycache_dotest(Token1, ParentDescriptor, &Descriptor1);
+    create_securitycache_dotest(Token2, ParentDescriptor, &Descriptor2);
+    ASSERT(GetSecurityDescriptorLength(Descriptor1) != GetSecurityDescriptorLength(Descriptor2) ||
+        0 != memcmp(Descriptor1, Descriptor2, GetSecurityDescriptorLength(Descriptor1)));
+    DestroyPrivateObjectSecurity(&Descriptor1);
+    DestroyPrivateObjectSecurity(&Descriptor2);
+
+    /* repeat in the opposite order */
+    create_securitycache_dotest(Token2, ParentDescriptor, &Descriptor2);
+    create_securitycache_dotest(Token1, ParentDescriptor, &Descriptor1);
+    DestroyPrivateObjectSecurity(&Descriptor1);
+    DestroyPrivateObjectSecurity(&Descriptor2);
+
+    CloseHandle(Token2);
+    CloseHandle(Token1);
+
+    LocalFree(ParentDescriptor);
+}
+
 void security_tests(void)
 {
     TEST(getsecurity_test);
     TEST(setsecurity_test);
+    TEST(create_securitycache_test);
 }
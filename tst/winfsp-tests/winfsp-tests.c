@@ -13,6 +13,7 @@ int main(int argc, char *argv[])
     TESTSUITE(mount_tests);
     TESTSUITE(timeout_tests);
     TESTSUITE(memfs_tests);
+    TESTSUITE(loopback_tests);
     TESTSUITE(create_tests);
     TESTSUITE(info_tests);
     TESTSUITE(security_tests);